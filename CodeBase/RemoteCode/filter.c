@@ -0,0 +1,168 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                        Scan Quality Filter Code                        */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+
+/* ****************************************************************************** */
+/* *******************************   About  ************************************* */
+/* ****************************************************************************** */
+// This code removes beams that are not distances from every decoded scan before
+// it is journaled, streamed or mapped.
+/*	Two kinds of bad beam reach the base station otherwise, and each one costs
+	a full ray trace per particle and leaves junk in the map:
+
+	Error codes	The URG-04LX reports values below 20 instead of a distance
+			(no echo, too bright, ...).  They become FILTER_NO_RETURN,
+			which every consumer already treats as "nothing seen".
+	Mixed pixels	A beam that grazes an edge returns a range somewhere between
+			the foreground and the background.  Such a beam, like any
+			single-beam spike, differs from both of its neighbours by
+			more than the spacing of neighbouring beams allows.  Real
+			surfaces are at least two beams wide, so a beam that agrees
+			with neither neighbour is dropped.
+
+	The optional temporal median replaces each beam by the median of the same
+	beam over the last FILTER_HISTORY scans.  It removes flicker on a still
+	unit but smears when walking fast, so it is off unless asked for.
+
+	Each pass is a straight loop over the beams with no data-dependent
+	branches, so the compiler can vectorize it.
+*/
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include "prefiremapping.h"
+#include "filter.h"
+
+/* ****************************************************************************** */
+/* ****************************** Functions ************************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: filter_init()
+Purpose:  Clears a filter's history and statistics
+Input:    Filter, 1 to apply the temporal median
+**************************************************************************/
+void filter_init(struct scan_filter * filter, int median){
+	memset(filter, 0, sizeof(*filter));
+	filter->median = median;
+}
+
+/*************************************************************************
+Function: filterErrors()
+Purpose:  Maps error codes to FILTER_NO_RETURN
+Input:    Ranges, number of beams
+Returns:  Number of error codes found
+**************************************************************************/
+static uint32_t filterErrors(uint16_t * range, int count){
+	uint32_t errors = 0;
+	uint16_t r;
+	int n;
+	for(n = 0; n < count; n++){
+		r = range[n];
+		errors += (r < FILTER_ERROR_LIMIT);
+		range[n] = (r < FILTER_ERROR_LIMIT) ? FILTER_NO_RETURN : r;
+	}
+	return errors;
+}
+
+/*************************************************************************
+Function: filterIsolated()
+Purpose:  Drops beams that differ from both neighbours by more than the
+          range-dependent limit.  The first and last beam only have one
+          neighbour and are kept.
+Input:    Ranges, output ranges, number of beams
+Returns:  Number of beams dropped
+**************************************************************************/
+static uint32_t filterIsolated(const uint16_t * range, uint16_t * out, int count){
+	uint32_t dropped = 0;
+	int c, limit, left, right, drop;
+	int n;
+
+	out[0] = range[0];
+	out[count-1] = range[count-1];
+	for(n = 1; n < count-1; n++){
+		c = range[n];
+		limit = FILTER_JUMP_MIN + (c >> FILTER_JUMP_SHIFT);
+		left = abs(c - (int)range[n-1]);
+		right = abs(c - (int)range[n+1]);
+		drop = (left > limit) & (right > limit) & (c != FILTER_NO_RETURN);
+		dropped += drop;
+		out[n] = drop ? FILTER_NO_RETURN : c;
+	}
+	return dropped;
+}
+
+/*************************************************************************
+Function: filterMedian()
+Purpose:  Median of three scans, beam by beam
+Input:    Older scan, old scan, newest scan, output ranges, number of beams
+**************************************************************************/
+static void filterMedian(const uint16_t * a, const uint16_t * b, const uint16_t * c, uint16_t * out, int count){
+	uint16_t lo, hi, mid;
+	int n;
+	for(n = 0; n < count; n++){
+		lo = (a[n] < b[n]) ? a[n] : b[n];
+		hi = (a[n] < b[n]) ? b[n] : a[n];
+		mid = (hi < c[n]) ? hi : c[n];
+		out[n] = (lo > mid) ? lo : mid;
+	}
+}
+
+/*************************************************************************
+Function: filter_scan()
+Purpose:  Cleans a decoded scan in place: error codes become no-return,
+          beams that jump away from both neighbours (mixed pixels and
+          spikes) are dropped, and optionally each beam is replaced by its
+          median over the last FILTER_HISTORY scans
+Input:    Filter, scan
+**************************************************************************/
+void filter_scan(struct scan_filter * filter, struct lidar_scan * scan){
+	int count = scan->count;
+	int median;
+
+	filter->scans++;
+	filter->beams += count;
+	filter->errors += filterErrors(scan->range, count);
+	if(count > 2){
+		filter->isolated += filterIsolated(scan->range, filter->scratch, count);
+		memcpy(scan->range, filter->scratch, count*sizeof(uint16_t));
+	}
+
+	if(!filter->median)
+		return;
+	// The same beam number only means the same direction within one configuration
+	if(scan->startstep != filter->startstep || scan->endstep != filter->endstep ||
+	   scan->cluster != filter->cluster || scan->count != filter->count){
+		filter->startstep = scan->startstep;
+		filter->endstep = scan->endstep;
+		filter->cluster = scan->cluster;
+		filter->count = scan->count;
+		filter->held = 0;
+		filter->next = 0;
+	}
+	median = (filter->held == FILTER_HISTORY-1);
+	if(median)
+		filterMedian(filter->history[0], filter->history[1], scan->range, filter->scratch, count);
+	memcpy(filter->history[filter->next], scan->range, count*sizeof(uint16_t));
+	filter->next = (filter->next + 1) % (FILTER_HISTORY-1);
+	if(filter->held < FILTER_HISTORY-1)
+		filter->held++;
+	if(median)
+		memcpy(scan->range, filter->scratch, count*sizeof(uint16_t));
+}
+
+/* ****************************************************************************** */
+// End of FILTER.C
+/* ****************************************************************************** */
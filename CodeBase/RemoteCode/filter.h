@@ -0,0 +1,78 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                       Scan Quality Filter Header                       */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include <stdint.h>
+#include "hokuyo_comm.h"
+
+/* ****************************************************************************** */
+/* *****************************   Definitions  ********************************* */
+/* ****************************************************************************** */
+#define FILTER_ERROR_LIMIT 20		// URG-04LX range values below this are error codes
+#define FILTER_NO_RETURN 0		// What error codes and dropped beams become
+#define FILTER_JUMP_MIN 50		// Millimeters a beam may differ from a neighbour at any range
+#define FILTER_JUMP_SHIFT 4		// Plus range/16, as neighbouring beams spread apart with range
+#define FILTER_HISTORY 3		// Scans in the temporal median (the newest and the two before it)
+
+/*	Per-sensor filter state.  The history holds the last scans after the
+	per-scan passes, so the median never feeds on its own output.
+*/
+struct scan_filter {
+	int median;				// 1 = apply the temporal median
+	uint16_t history[FILTER_HISTORY-1][LIDAR_MAX_POINTS];
+	int held;				// Scans in the history
+	int next;				// History slot the next scan goes in
+	uint16_t startstep;			// Geometry of the scans in the history
+	uint16_t endstep;
+	uint16_t cluster;
+	uint16_t count;
+	uint16_t scratch[LIDAR_MAX_POINTS];
+
+	// Statistics
+	uint32_t scans;
+	uint64_t beams;
+	uint64_t errors;			// Error codes mapped to FILTER_NO_RETURN
+	uint64_t isolated;			// Beams dropped by the neighbour test
+};
+
+/* ****************************************************************************** */
+/* ************************ Function Declarations ******************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: filter_init()
+Purpose:  Clears a filter's history and statistics
+Input:    Filter, 1 to apply the temporal median
+**************************************************************************/
+void filter_init(struct scan_filter * filter, int median);
+
+/*************************************************************************
+Function: filter_scan()
+Purpose:  Cleans a decoded scan in place: error codes become no-return,
+          beams that jump away from both neighbours (mixed pixels and
+          spikes) are dropped, and optionally each beam is replaced by its
+          median over the last FILTER_HISTORY scans
+Input:    Filter, scan
+**************************************************************************/
+void filter_scan(struct scan_filter * filter, struct lidar_scan * scan);
+
+#endif
+/* ****************************************************************************** */
+// End of FILTER.H
+/* ****************************************************************************** */
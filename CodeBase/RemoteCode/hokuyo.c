@@ -155,6 +155,8 @@
 /* ****************************************************************************** */
 #include "prefiremapping.h"
 #include "hokuyo.h"
+#include <poll.h>
+#include <termios.h>
 
 /* ****************************************************************************** */
 /* ****************************** Variables ************************************* */
@@ -212,18 +214,19 @@ char statchar2;
  * \param name Device name to open
  * \return File Descriptor (FD) if successful, -1 if not */
 FILE * lidar_open(char * name){
-	if(DEBUGGING_MODE == 1 || LIDAR_OPEN == 1){
+	if(DEBUGGING_MODE == 1){
 		printf("***In Debugging Mode - Not Opening LIDAR***\n");
 		return NULL;
 	}
 	else{
 		FILE * stream = fopen(name, "rw+");
-		usleep(OPEN_WAIT);
-		int flushed = fflush(stream);
+		int flushed = (stream != NULL) ? fflush(stream) : EOF;
 		if(stream != NULL && flushed == 0){
-			LIDAR_OPEN = 1;
+			// No settling delay: lidar_start() waits for the sensor to answer instead
+			lidar_rawMode(fileno(stream));
+			LIDAR_OPEN++;
 			if(VERBOSE_MODE == 1)
-				printf("Opened Laser Connection\n");
+				printf("Opened Laser Connection %s\n", name);
 			return stream;
 		}
 		problem = -1;		
@@ -243,8 +246,8 @@ int lidar_close(FILE * filedescriptor){
 		return 0;
 	}
 	else{
-		if(LIDAR_OPEN == 1){
-			LIDAR_OPEN = 0;
+		if(LIDAR_OPEN > 0){
+			LIDAR_OPEN--;
 			if(VERBOSE_MODE == 1)
 				printf("Closed Laser Connection\n");
 			return fclose(filedescriptor);
@@ -267,7 +270,7 @@ void lidar_flush(FILE * filedescriptor){
 		printf("***In Debugging Mode - Not Flushing LIDAR***\n");
 	}
 	else{
-		if(LIDAR_OPEN == 1){
+		if(LIDAR_OPEN > 0){
 			flushed = fflush(filedescriptor);
 			if(VERBOSE_MODE == 1){
 				printf("Flushing LIDAR Connection, flushed %d\n",flushed);
@@ -284,7 +287,7 @@ Input:    Device name to send to, Number of scans
 **************************************************************************/
 void lidar_sendMD(FILE * filedescriptor, int scannum){
 	int commandlength = 0;	
-	char acq[16] = "000000000000000\n";
+	char acq[64] = "000000000000000\n";
 	int printlength = 0;
 	commandlength = sprintf(acq, "MD%04d%04d%02d%01d%02d\n",START_STEP, END_STEP, CLUSTER_COUNT, SCAN_INTERVAL, scannum);
 	if(DEBUGGING_MODE == 1)
@@ -306,7 +309,7 @@ Input:    Device name to send to, Number of scans
 **************************************************************************/
 void lidar_sendMS(FILE * filedescriptor, int scannum){
 	int commandlength = 0;	
-	char acq[16] = "000000000000000\n";
+	char acq[64] = "000000000000000\n";
 	int printlength = 0;
 	commandlength = sprintf(acq, "MS%04d%04d%02d%01d%02d\n",START_STEP, END_STEP, CLUSTER_COUNT, SCAN_INTERVAL, scannum);
 	if(DEBUGGING_MODE == 1)
@@ -329,7 +332,7 @@ Input:    Device name to send to
 **************************************************************************/
 void lidar_contiuousScanMD(FILE * filedescriptor){
 	int commandlength = 0;	
-	char acq[16] = "000000000000000\n";
+	char acq[64] = "000000000000000\n";
 	int printlength = 0;
 	commandlength = sprintf(acq, "MD%04d%04d%02d%01d%02d\n",START_STEP, END_STEP, CLUSTER_COUNT, SCAN_INTERVAL, 0);
 	if(DEBUGGING_MODE == 1)
@@ -352,7 +355,7 @@ Input:    Device name to send to
 **************************************************************************/
 void lidar_contiuousScanMS(FILE * filedescriptor){
 	int commandlength = 0;	
-	char acq[16] = "000000000000000\n";
+	char acq[64] = "000000000000000\n";
 	int printlength = 0;
 	commandlength = sprintf(acq, "MS%04d%04d%02d%01d%02d\n",START_STEP, END_STEP, CLUSTER_COUNT, SCAN_INTERVAL, 0);
 	if(DEBUGGING_MODE == 1)
@@ -375,7 +378,7 @@ Input:    Device name to send to
 **************************************************************************/
 void lidar_sendGD(FILE * filedescriptor){
 	int commandlength = 0;	
-	char acq[13] = "000000000000\n";
+	char acq[64] = "000000000000\n";
 	int printlength = 0;
 	commandlength = sprintf(acq, "GD%04d%04d%02d\n",START_STEP, END_STEP, CLUSTER_COUNT);
 	if(DEBUGGING_MODE == 1)
@@ -398,7 +401,7 @@ Input:    Device name to send to
 **************************************************************************/
 void lidar_sendGS(FILE * filedescriptor){
 	int commandlength = 0;	
-	char acq[13] = "000000000000\n";
+	char acq[64] = "000000000000\n";
 	int printlength = 0;
 	commandlength = sprintf(acq, "GS%04d%04d%02d\n",START_STEP, END_STEP, CLUSTER_COUNT);
 	if(DEBUGGING_MODE == 1)
@@ -420,7 +423,7 @@ Input:    Device name to send to
 **************************************************************************/
 void lidar_laserON(FILE * filedescriptor){
 	int commandlength = 0;	
-	char com[3] = "00\n";
+	char com[16] = "00\n";
 	int printlength = 0;
 	commandlength = sprintf(com, "BM\n");
 	if(DEBUGGING_MODE == 1)
@@ -442,7 +445,7 @@ Input:    Device name to send to
 **************************************************************************/
 void lidar_laserOFF(FILE * filedescriptor){
 	int commandlength = 3;	
-	char com[3] = "00\n";
+	char com[16] = "00\n";
 	int printlength = 0;
 	commandlength = sprintf(com, "QT\n");
 	if(DEBUGGING_MODE == 1)
@@ -464,7 +467,7 @@ Input:    Device name to send to
 **************************************************************************/
 void lidar_RESET(FILE * filedescriptor){
 	int commandlength = 0;	
-	char com[3] = "00\n";
+	char com[16] = "00\n";
 	int printlength = 0;
 	commandlength = sprintf(com, "RS\n");
 	if(DEBUGGING_MODE == 1)
@@ -486,7 +489,7 @@ Input:    Device name to send to
 **************************************************************************/
 void lidar_adjustON(FILE * filedescriptor){
 	int commandlength = 0;	
-	char com[4] = "000\n";
+	char com[16] = "000\n";
 	int printlength = 0;
 	commandlength = sprintf(com, "TM0\n");
 	if(DEBUGGING_MODE == 1)
@@ -508,7 +511,7 @@ Input:    Device name to send to
 **************************************************************************/
 void lidar_adjustTIME(FILE * filedescriptor){
 	int commandlength = 0;	
-	char com[4] = "000\n";
+	char com[16] = "000\n";
 	int printlength = 0;
 	commandlength = sprintf(com, "TM1\n");
 	if(DEBUGGING_MODE == 1)
@@ -530,7 +533,7 @@ Input:    Device name to send to
 **************************************************************************/
 void lidar_adjustOFF(FILE * filedescriptor){
 	int commandlength = 0;	
-	char com[4] = "000\n";
+	char com[16] = "000\n";
 	int printlength = 0;
 	commandlength = sprintf(com, "TM2\n");
 	if(DEBUGGING_MODE == 1)
@@ -552,7 +555,7 @@ Input:    Device name to send to, Bit Rate (see info above for values)
 **************************************************************************/
 void lidar_bitRate(FILE * filedescriptor, int speed){
 	int commandlength = 0;	
-	char com[9] = "00000000\n";
+	char com[16] = "00000000\n";
 	int printlength = 0;
 	if(speed != 19200 && speed != 38400 && speed != 57600 && speed != 115200 && speed != 250000 && speed != 50000 && speed != 750000){
 		problem = 11;
@@ -578,7 +581,7 @@ Input:    Device name to send to, motor speed (0 = default, 1-10, 99 = Reset to
 **************************************************************************/
 void lidar_motorSpeed(FILE * filedescriptor, int speed){
 	int commandlength = 0;	
-	char com[5] = "0000\n";
+	char com[16] = "0000\n";
 	int printlength = 0;
 	if(((speed < 0) || (speed > 10)) && (speed != 99))
 		speed = 0;
@@ -602,7 +605,7 @@ Input:    Device name to send to, sensitivity (0 = Normal, 1 = High Sensitivity)
 **************************************************************************/
 void lidar_sensitivity(FILE * filedescriptor, int sensitivity){
 	int commandlength = 0;	
-	char com[4] = "000\n";
+	char com[16] = "000\n";
 	int printlength = 0;
 	if((sensitivity != 0) && (sensitivity != 1))
 		return;
@@ -626,7 +629,7 @@ Input:    Device name to send to, malfunction to simulate
 **************************************************************************/
 void lidar_malfunctionSim(FILE * filedescriptor, int malfunction){
 	int commandlength = 0;	
-	char com[5] = "0000\n";
+	char com[16] = "0000\n";
 	int printlength = 0;
 	if((malfunction < 1) && (malfunction > 5) && (malfunction != 10))
 		return;
@@ -650,7 +653,7 @@ Input:    Device name to send to
 **************************************************************************/
 void lidar_version(FILE * filedescriptor){
 	int commandlength = 0;	
-	char com[3] = "00\n";
+	char com[16] = "00\n";
 	int printlength = 0;
 	commandlength = sprintf(com, "VV\n");
 	if(DEBUGGING_MODE == 1)
@@ -672,7 +675,7 @@ Input:    Device name to send to
 **************************************************************************/
 void lidar_specs(FILE * filedescriptor){
 	int commandlength = 0;	
-	char com[3] = "00\n";
+	char com[16] = "00\n";
 	int printlength = 0;
 	commandlength = sprintf(com, "PP\n");
 	if(DEBUGGING_MODE == 1)
@@ -694,7 +697,7 @@ Input:    Device name to send to
 **************************************************************************/
 void lidar_state(FILE * filedescriptor){
 	int commandlength = 0;	
-	char com[3] = "00\n";
+	char com[16] = "00\n";
 	int printlength = 0;
 	commandlength = sprintf(com, "II\n");
 	if(DEBUGGING_MODE == 1)
@@ -964,6 +967,267 @@ void lidar_read(FILE * filedescriptor){
 	}		
 }
 
+/*************************************************************************
+Function: lidar_rawMode()
+Purpose:  Puts the LIDAR tty into raw mode so the line discipline neither
+          echoes scan data back to the sensor nor waits for whole lines
+Input:    Device file descriptor
+**************************************************************************/
+void lidar_rawMode(int fd){
+	struct termios tio;
+	if(!isatty(fd) || tcgetattr(fd, &tio) != 0)
+		return;
+	cfmakeraw(&tio);
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	tcsetattr(fd, TCSANOW, &tio);
+}
+
+/*************************************************************************
+Function: findReply()
+Purpose:  Removes complete replies from the parser until one answers a command
+          with status '00'.  The echo is looked for at every line start, since
+          a reply can follow the tail of scan data the sensor was still sending.
+Input:    Parser, command echo (e.g. "RS"), location to copy the reply to
+          (from the echo on, NULL if not wanted), its size
+Returns:  1 if the reply was found, 0 if not (yet)
+**************************************************************************/
+static int findReply(struct lidar_parser * parser, const char * echo, char * reply, size_t size){
+	char pattern[8];
+	size_t patternlength = snprintf(pattern, sizeof(pattern), "%s\n00", echo);
+	size_t framelength;
+	size_t n, start;
+	int found;
+
+	for(n = 1; n < parser->length; n++){
+		if(parser->buffer[n] != '\n' || parser->buffer[n-1] != '\n')
+			continue;
+		framelength = n + 1;
+		found = 0;
+		for(start = 0; start + patternlength <= framelength && !found; start++){
+			if((start == 0 || parser->buffer[start-1] == '\n') && memcmp(parser->buffer + start, pattern, patternlength) == 0){
+				found = 1;
+				if(reply != NULL && size > 0)
+					snprintf(reply, size, "%.*s", (int)(framelength - start), parser->buffer + start);
+			}
+		}
+		parser->length -= framelength;
+		memmove(parser->buffer, parser->buffer + framelength, parser->length);
+		if(found)
+			return 1;
+		n = 0;
+	}
+	return 0;
+}
+
+/*************************************************************************
+Function: waitReply()
+Purpose:  Reads from the sensor until it answers a command or time runs out
+Input:    Device, parser, command echo, location to copy the reply to (NULL
+          if not wanted), its size, timeout (ms)
+Returns:  1 if the sensor answered, 0 if not
+**************************************************************************/
+static int waitReply(FILE * filedescriptor, struct lidar_parser * parser, const char * echo, char * reply, size_t size, int timeout){
+	struct pollfd pfd;
+	uint64_t deadline = pfm_time_ns() + timeout*1000000ULL;
+	uint64_t now;
+	pfd.fd = fileno(filedescriptor);
+	pfd.events = POLLIN;
+	while(!findReply(parser, echo, reply, size)){
+		now = pfm_time_ns();
+		if(now >= deadline)
+			return 0;
+		if(poll(&pfd, 1, (deadline - now + 999999) / 1000000) <= 0)
+			return 0;
+		if(lidar_parserFeed(parser, pfd.fd) <= 0)
+			return 0;
+		if(parser->length >= LIDAR_RXBUFFER)
+			parser->length = 0;		// Scan data with no reply in it
+	}
+	return 1;
+}
+
+/*************************************************************************
+Function: sendCommand()
+Purpose:  Sends a short command to a device and pushes it out of stdio
+Input:    Device, command including the LF
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+static int sendCommand(struct lidar_device * device, const char * com){
+	if(fputs(com, device->port) == EOF || fflush(device->port) != 0)
+		return -1;
+	return 0;
+}
+
+/*************************************************************************
+Function: lidar_startScan()
+Purpose:  Sends the continuous MD command for a device's own configuration
+Input:    Device
+**************************************************************************/
+void lidar_startScan(struct lidar_device * device){
+	char acq[64];
+	snprintf(acq, sizeof(acq), "MD%04d%04d%02d%01d%02d\n", device->config.startstep, device->config.endstep,
+		device->config.cluster, device->config.interval, 0);
+	if(DEBUGGING_MODE == 1){
+		printf("%s", acq);
+		return;
+	}
+	if(sendCommand(device, acq) != 0)
+		problem = 3;
+	if(VERBOSE_MODE == 1)
+		printf("LIDAR %s Continous MD Command Sent\n", device->name);
+}
+
+/*************************************************************************
+Function: lidar_syncClock()
+Purpose:  Measures the offset between the sensor's millisecond clock and the
+          host clock with the TM command.  Of LIDAR_SYNC_SAMPLES requests the
+          one with the shortest round trip is used, taking the sensor time as
+          the middle of the round trip.  The sensor must not be scanning.
+Input:    Device
+Returns:  0 if successful, -1 if the sensor did not take part
+**************************************************************************/
+int lidar_syncClock(struct lidar_device * device){
+	char reply[32];
+	uint64_t sent, received;
+	uint64_t best = UINT64_MAX;
+	uint32_t sensor;
+	int n;
+
+	if(sendCommand(device, "TM0\n") != 0 || !waitReply(device->port, &device->parser, "TM0", NULL, 0, LIDAR_REPLY_TIMEOUT))
+		return -1;
+	for(n = 0; n < LIDAR_SYNC_SAMPLES; n++){
+		sent = pfm_time_ns();
+		if(sendCommand(device, "TM1\n") != 0 || !waitReply(device->port, &device->parser, "TM1", reply, sizeof(reply), LIDAR_REPLY_TIMEOUT))
+			continue;
+		received = pfm_time_ns();
+		// TM1 LF 00 sum LF time(4) sum LF LF
+		if(strlen(reply) < 14 || checkSum(reply + 8, 4) != (uint8_t)reply[12])
+			continue;
+		fourcharDecode(reply + 8, &sensor);
+		if(received - sent < best){
+			best = received - sent;
+			device->clockoffset = (int64_t)(sent + best/2) - (int64_t)sensor*1000000;
+		}
+	}
+	sendCommand(device, "TM2\n");
+	waitReply(device->port, &device->parser, "TM2", NULL, 0, LIDAR_REPLY_TIMEOUT);
+	if(best == UINT64_MAX)
+		return -1;
+	device->clockerror = best/2;
+	device->synced = 1;
+	if(VERBOSE_MODE == 1)
+		printf("LIDAR %s Clock Synchronized to %.2f ms\n", device->name, device->clockerror / 1e6);
+	return 0;
+}
+
+/*************************************************************************
+Function: lidar_alignTime()
+Purpose:  Sets a scan's sync_time: its sensor timestamp on the host clock, or
+          the arrival time if the device's clock was not synchronized.  The
+          sensor's 24-bit clock wraps every 4.6 hours, so the wrap is chosen
+          that puts the scan closest before its arrival.
+Input:    Device, scan
+**************************************************************************/
+void lidar_alignTime(struct lidar_device * device, struct lidar_scan * scan){
+	int64_t estimate;
+	int32_t difference;
+	int64_t aligned;
+
+	scan->sync_time = scan->host_time;
+	if(!device->synced)
+		return;
+	estimate = ((int64_t)scan->host_time - device->clockoffset) / 1000000;
+	difference = (int32_t)((scan->sensor_time - (uint32_t)estimate) & 0xFFFFFF);
+	if(difference >= 0x800000)
+		difference -= 0x1000000;
+	aligned = device->clockoffset + (estimate + difference)*1000000;
+	// A scan cannot arrive before it was taken; if it seems to, the clocks drifted
+	if(aligned > 0 && (uint64_t)aligned < scan->host_time)
+		scan->sync_time = aligned;
+}
+
+/*************************************************************************
+Function: lidar_start()
+Purpose:  Brings a sensor up as soon as it is ready: discards anything left
+          in the tty, sends RS (which also stops scanning left running by an
+          earlier session) until the sensor answers, checks it with VV,
+          synchronizes its clock, then starts continuous MD scanning with the
+          device's configuration
+Input:    Device, timeout (ms) for the sensor to answer
+Returns:  0 if scanning was started, -1 if the sensor never answered
+**************************************************************************/
+int lidar_start(struct lidar_device * device, int timeout){
+	uint64_t deadline = pfm_time_ns() + timeout*1000000ULL;
+	int answered = 0;
+	if(DEBUGGING_MODE == 1){
+		lidar_startScan(device);
+		return 0;
+	}
+	tcflush(fileno(device->port), TCIOFLUSH);
+	lidar_parserDiscard(&device->parser);
+	while(!answered && pfm_time_ns() < deadline){
+		lidar_RESET(device->port);
+		fflush(device->port);
+		answered = waitReply(device->port, &device->parser, "RS", NULL, 0, LIDAR_REPLY_TIMEOUT);
+	}
+	if(answered){
+		lidar_version(device->port);
+		fflush(device->port);
+		answered = waitReply(device->port, &device->parser, "VV", NULL, 0, LIDAR_REPLY_TIMEOUT);
+	}
+	if(!answered){
+		problem = 26;
+		return -1;
+	}
+	if(lidar_syncClock(device) != 0 && VERBOSE_MODE == 1)
+		printf("LIDAR %s Clock Not Synchronized, Using Arrival Times\n", device->name);
+	lidar_parserDiscard(&device->parser);
+	lidar_startScan(device);
+	return 0;
+}
+
+/*************************************************************************
+Function: lidar_restart()
+Purpose:  First recovery step when scans stop decoding: QT, then MD again,
+          without touching the port
+Input:    Device
+Returns:  0 if the sensor answered QT, -1 if not (the port needs reopening)
+**************************************************************************/
+int lidar_restart(struct lidar_device * device){
+	int answered;
+	lidar_laserOFF(device->port);
+	fflush(device->port);
+	answered = waitReply(device->port, &device->parser, "QT", NULL, 0, LIDAR_REPLY_TIMEOUT);
+	lidar_parserDiscard(&device->parser);
+	if(!answered)
+		return -1;
+	lidar_startScan(device);
+	return 0;
+}
+
+/*************************************************************************
+Function: lidar_reopen()
+Purpose:  Last recovery step: closes the port, opens it again and restarts
+          scanning (for a USB-CDC device that dropped off and came back)
+Input:    Device (port is NULL afterwards if the reopen failed)
+Returns:  0 if scanning was started, -1 if not
+**************************************************************************/
+int lidar_reopen(struct lidar_device * device){
+	if(device->port != NULL)
+		lidar_close(device->port);
+	lidar_parserDiscard(&device->parser);
+	device->port = lidar_open(device->name);
+	if(device->port == NULL)
+		return -1;
+	if(lidar_start(device, LIDAR_REPLY_TIMEOUT) != 0){
+		// As at startup, a sensor that does not answer may still scan
+		lidar_startScan(device);
+		return -1;
+	}
+	return 0;
+}
+
 /* ****************************************************************************** */
 // End of HOKUYO.C
 /* ****************************************************************************** */
@@ -20,6 +20,54 @@
 /* ****************************************************************************** */
 #include "hokuyo_comm.h"
 
+/* ****************************************************************************** */
+/* *****************************   Definitions  ********************************* */
+/* ****************************************************************************** */
+#define LIDAR_DEVICES 2			// Scanners the driver can run at once
+#define LIDAR_HORIZONTAL 0		// Floor plan scanner, always fitted
+#define LIDAR_VERTICAL 1		// Optional wall height scanner
+#define LIDAR_SYNC_SAMPLES 8		// TM1 requests per clock synchronization
+
+/*	Scan range and rate for one sensor (the arguments of its MD command) */
+struct lidar_config {
+	int startstep;
+	int endstep;
+	int cluster;
+	int interval;
+};
+
+/*	One sensor and everything needed to keep it scanning */
+struct lidar_device {
+	char * name;				// Device name, NULL if not fitted
+	FILE * port;				// NULL if not open
+	struct lidar_config config;
+	struct lidar_parser parser;
+
+	// Clock synchronization (TM)
+	int synced;
+	int64_t clockoffset;			// Host nanoseconds at sensor time 0
+	uint64_t clockerror;			// Half the best round trip, nanoseconds
+
+	// Link recovery
+	uint64_t lastscan;			// Host time of the last scan (or recovery)
+	int badrun;				// Bad frames in a row
+	int level;				// Recovery steps taken since the last scan
+	uint32_t restarts;			// QT+MD restarts
+	uint32_t reopens;			// Port reopens
+
+	uint32_t seq;				// Scans decoded
+	uint64_t ready;				// Nanoseconds from pipeline start until the sensor answered
+	uint64_t firstscan;			// Nanoseconds from pipeline start until the first scan
+};
+
+/*	Scans of the horizontal and vertical sensor taken within LIDAR_PAIR_WINDOW
+	of each other.  A scan without a partner is sent on its own.
+*/
+struct lidar_pair {
+	struct lidar_scan scan[LIDAR_DEVICES];
+	uint8_t valid;				// Bit n is set if scan[n] holds a scan
+};
+
 /* ****************************************************************************** */
 /* ************************ Function Declarations ******************************* */
 /* ****************************************************************************** */
@@ -191,6 +239,72 @@ Input:    Device name to read from
 **************************************************************************/
 void lidar_read(FILE * filedescriptor);
 
+/*************************************************************************
+Function: lidar_rawMode()
+Purpose:  Puts the LIDAR tty into raw mode so the line discipline neither
+          echoes scan data back to the sensor nor waits for whole lines
+Input:    Device file descriptor
+**************************************************************************/
+void lidar_rawMode(int fd);
+
+/*************************************************************************
+Function: lidar_startScan()
+Purpose:  Sends the continuous MD command for a device's own configuration
+Input:    Device
+**************************************************************************/
+void lidar_startScan(struct lidar_device * device);
+
+/*************************************************************************
+Function: lidar_syncClock()
+Purpose:  Measures the offset between the sensor's millisecond clock and the
+          host clock with the TM command.  Of LIDAR_SYNC_SAMPLES requests the
+          one with the shortest round trip is used, taking the sensor time as
+          the middle of the round trip.  The sensor must not be scanning.
+Input:    Device
+Returns:  0 if successful, -1 if the sensor did not take part
+**************************************************************************/
+int lidar_syncClock(struct lidar_device * device);
+
+/*************************************************************************
+Function: lidar_alignTime()
+Purpose:  Sets a scan's sync_time: its sensor timestamp on the host clock, or
+          the arrival time if the device's clock was not synchronized.  The
+          sensor's 24-bit clock wraps every 4.6 hours, so the wrap is chosen
+          that puts the scan closest before its arrival.
+Input:    Device, scan
+**************************************************************************/
+void lidar_alignTime(struct lidar_device * device, struct lidar_scan * scan);
+
+/*************************************************************************
+Function: lidar_start()
+Purpose:  Brings a sensor up as soon as it is ready: discards anything left
+          in the tty, sends RS (which also stops scanning left running by an
+          earlier session) until the sensor answers, checks it with VV,
+          synchronizes its clock, then starts continuous MD scanning with the
+          device's configuration
+Input:    Device, timeout (ms) for the sensor to answer
+Returns:  0 if scanning was started, -1 if the sensor never answered
+**************************************************************************/
+int lidar_start(struct lidar_device * device, int timeout);
+
+/*************************************************************************
+Function: lidar_restart()
+Purpose:  First recovery step when scans stop decoding: QT, then MD again,
+          without touching the port
+Input:    Device
+Returns:  0 if the sensor answered QT, -1 if not (the port needs reopening)
+**************************************************************************/
+int lidar_restart(struct lidar_device * device);
+
+/*************************************************************************
+Function: lidar_reopen()
+Purpose:  Last recovery step: closes the port, opens it again and restarts
+          scanning (for a USB-CDC device that dropped off and came back)
+Input:    Device (port is NULL afterwards if the reopen failed)
+Returns:  0 if scanning was started, -1 if not
+**************************************************************************/
+int lidar_reopen(struct lidar_device * device);
+
 #endif
 /* ****************************************************************************** */
 // End of HOKUYO.H
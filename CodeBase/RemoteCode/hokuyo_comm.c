@@ -357,6 +357,248 @@ size_t temp;
 */
 }
 
+/*************************************************************************
+Function: decimalField()
+Purpose:  Converts a fixed-width field of ASCII digits from a command echo
+Input:    Field, number of digits, location of the value to output
+Returns:  0 if successful, -1 if a character is not a digit
+**************************************************************************/
+static int decimalField(char * input, int digits, uint16_t * output){
+	int n;
+	uint16_t value = 0;
+	for(n = 0; n < digits; n++){
+		if(input[n] < '0' || input[n] > '9')
+			return -1;
+		value = value*10 + (input[n] - '0');
+	}
+	*output = value;
+	return 0;
+}
+
+/*************************************************************************
+Function: findEcho()
+Purpose:  Finds the first line after the start of a frame that is a complete
+          MD/MS command echo (the start of a frame whose beginning was lost
+          along with the end of the previous one)
+Input:    Frame, frame length
+Returns:  Offset of the echo, 0 if there is none
+**************************************************************************/
+static size_t findEcho(char * frame, size_t length){
+	uint16_t value;
+	size_t n;
+	for(n = 1; n + 16 <= length; n++){
+		if(frame[n-1] != '\n' || frame[n] != 'M' || (frame[n+1] != 'D' && frame[n+1] != 'S'))
+			continue;
+		if(frame[n+15] == '\n' && decimalField(frame + n + 2, 4, &value) == 0 && decimalField(frame + n + 6, 4, &value) == 0 &&
+		   decimalField(frame + n + 10, 4, &value) == 0 && decimalField(frame + n + 14, 1, &value) == 0)
+			return n;
+	}
+	return 0;
+}
+
+/*************************************************************************
+Function: countGap()
+Purpose:  Counts scans the sensor sent that never decoded, from the gap in
+          its timestamps.  The shortest gap seen is taken as the scan period.
+Input:    Parser, scan just decoded
+**************************************************************************/
+static void countGap(struct lidar_parser * parser, struct lidar_scan * scan){
+	uint32_t delta;
+	if(parser->frames > 0){
+		delta = (scan->sensor_time - parser->lastsensor) & 0xFFFFFF;	// 24-bit clock
+		if(delta > 0 && (parser->period == 0 || delta < parser->period))
+			parser->period = delta;
+		if(parser->period > 0 && delta > parser->period + parser->period/2)
+			parser->lostscans += (delta + parser->period/2) / parser->period - 1;
+	}
+	parser->lastsensor = scan->sensor_time;
+}
+
+/*************************************************************************
+Function: decodeScan()
+Purpose:  Decodes one complete MD/MS frame (echo through the final LF LF),
+          verifying the sum of every line
+Input:    Frame, frame length, location of scan to output
+Returns:  LIDAR_FRAME_SCAN, LIDAR_FRAME_ECHO or LIDAR_FRAME_BAD
+**************************************************************************/
+int decodeScan(char * frame, size_t length, struct lidar_scan * scan){
+	char payload[LIDAR_MAX_POINTS*3];
+	char * line = frame;
+	char * end = frame + length;
+	char * next;
+	size_t linelength;
+	size_t datalength = 0;
+	uint32_t expected;
+	int encoding;
+	int n;
+
+	// Command echo: MD/MS + Start Step + End Step + Cluster Count + Scan Interval + Number of Scans
+	next = memchr(line, '\n', end - line);
+	if(next == NULL || next - line < 13 || line[0] != 'M' || (line[1] != 'D' && line[1] != 'S'))
+		return LIDAR_FRAME_BAD;
+	encoding = (line[1] == 'D') ? 3 : 2;
+	if(decimalField(line+2, 4, &scan->startstep) || decimalField(line+6, 4, &scan->endstep) || decimalField(line+10, 2, &scan->cluster))
+		return LIDAR_FRAME_BAD;
+	if(scan->cluster == 0)
+		scan->cluster = 1;
+	if(scan->endstep < scan->startstep)
+		return LIDAR_FRAME_BAD;
+
+	// Status + Sum.  '00' acknowledges the command, '99' precedes scan data
+	line = next + 1;
+	next = memchr(line, '\n', end - line);
+	if(next == NULL || next - line != 3 || checkSum(line, 2) != (uint8_t)line[2])
+		return LIDAR_FRAME_BAD;
+	if(line[0] == '0' && line[1] == '0')
+		return LIDAR_FRAME_ECHO;
+	if(line[0] != '9' || line[1] != '9'){
+		status = (line[0]-'0')*10 + (line[1]-'0');
+		problem = (encoding == 3) ? 20 : 21;
+		return LIDAR_FRAME_BAD;
+	}
+
+	// Timestamp + Sum
+	line = next + 1;
+	next = memchr(line, '\n', end - line);
+	if(next == NULL || next - line != 5 || checkSum(line, 4) != (uint8_t)line[4])
+		return LIDAR_FRAME_BAD;
+	fourcharDecode(line, &scan->sensor_time);
+
+	// Data blocks (up to 64 bytes + Sum each) until the empty terminating line
+	line = next + 1;
+	while(line < end && *line != '\n'){
+		next = memchr(line, '\n', end - line);
+		if(next == NULL)
+			return LIDAR_FRAME_BAD;
+		linelength = next - line;
+		if(linelength < 2 || linelength > 65 || datalength + linelength - 1 > sizeof(payload))
+			return LIDAR_FRAME_BAD;
+		if(checkSum(line, linelength - 1) != (uint8_t)line[linelength-1])
+			return LIDAR_FRAME_BAD;
+		memcpy(payload + datalength, line, linelength - 1);
+		datalength += linelength - 1;
+		line = next + 1;
+	}
+
+	expected = (scan->endstep - scan->startstep + scan->cluster) / scan->cluster;
+	if(expected > LIDAR_MAX_POINTS || datalength != expected*encoding)
+		return LIDAR_FRAME_BAD;
+	for(n = 0; n < expected; n++){
+		if(encoding == 3)
+			threecharDecode(payload + n*3, &scan->range[n]);
+		else
+			twocharDecode(payload + n*2, &scan->range[n]);
+	}
+	scan->count = expected;
+	return LIDAR_FRAME_SCAN;
+}
+
+/*************************************************************************
+Function: lidar_parserReset()
+Purpose:  Empties an incremental frame parser
+Input:    Parser
+**************************************************************************/
+void lidar_parserReset(struct lidar_parser * parser){
+	memset(parser, 0, sizeof(*parser));
+}
+
+/*************************************************************************
+Function: lidar_parserDiscard()
+Purpose:  Drops whatever is buffered, keeping the statistics
+Input:    Parser
+**************************************************************************/
+void lidar_parserDiscard(struct lidar_parser * parser){
+	parser->lostbytes += parser->length;
+	parser->length = 0;
+}
+
+/*************************************************************************
+Function: lidar_parserReceived()
+Purpose:  Accounts for bytes read into the free end of the parser's buffer
+          by someone else (such as the I/O engine)
+Input:    Parser, number of bytes
+**************************************************************************/
+void lidar_parserReceived(struct lidar_parser * parser, size_t got){
+	parser->length += got;
+	parser->rxbytes += got;
+	parser->rxtime = pfm_time_ns();
+}
+
+/*************************************************************************
+Function: lidar_parserFeed()
+Purpose:  Reads whatever bytes are available from the device into the parser
+Input:    Parser, device file descriptor (non-blocking or known readable)
+Returns:  Number of bytes read, 0 on end of file, -1 on error (errno set)
+**************************************************************************/
+int lidar_parserFeed(struct lidar_parser * parser, int fd){
+	ssize_t got;
+	if(parser->length >= LIDAR_RXBUFFER)
+		return 1;	// Full, lidar_parseFrame() must run first
+	got = read(fd, parser->buffer + parser->length, LIDAR_RXBUFFER - parser->length);
+	if(got > 0)
+		lidar_parserReceived(parser, got);
+	return (int)got;
+}
+
+/*************************************************************************
+Function: lidar_parseFrame()
+Purpose:  Removes the next complete frame from the parser and decodes it
+Input:    Parser, location of scan to output
+Returns:  LIDAR_FRAME_NONE, LIDAR_FRAME_SCAN, LIDAR_FRAME_ECHO or LIDAR_FRAME_BAD
+**************************************************************************/
+int lidar_parseFrame(struct lidar_parser * parser, struct lidar_scan * scan){
+	char * terminator = NULL;
+	size_t framelength;
+	size_t skip;
+	size_t n;
+	int result;
+
+	for(n = 1; n < parser->length; n++){
+		if(parser->buffer[n] == '\n' && parser->buffer[n-1] == '\n'){
+			terminator = parser->buffer + n;
+			break;
+		}
+	}
+	if(terminator == NULL){
+		if(parser->length >= LIDAR_RXBUFFER){
+			// Garbage with no terminator, nothing in it can be recovered
+			parser->lostbytes += parser->length;
+			parser->length = 0;
+			parser->overflows++;
+			parser->badframes++;
+			return LIDAR_FRAME_BAD;
+		}
+		return LIDAR_FRAME_NONE;
+	}
+
+	framelength = terminator - parser->buffer + 1;
+	result = decodeScan(parser->buffer, framelength, scan);
+	if(result == LIDAR_FRAME_BAD){
+		// The frame may have swallowed the tail of the previous one
+		skip = findEcho(parser->buffer, framelength);
+		if(skip > 0)
+			result = decodeScan(parser->buffer + skip, framelength - skip, scan);
+		if(result != LIDAR_FRAME_BAD){
+			parser->resyncs++;
+			parser->lostbytes += skip;
+		}
+		else
+			parser->lostbytes += framelength;
+	}
+	if(result == LIDAR_FRAME_SCAN){
+		scan->host_time = parser->rxtime;
+		scan->sync_time = parser->rxtime;	// Until the caller aligns it
+		scan->sensor = 0;
+		countGap(parser, scan);
+		parser->frames++;
+	}
+	else if(result == LIDAR_FRAME_BAD)
+		parser->badframes++;
+	parser->length -= framelength;
+	memmove(parser->buffer, terminator + 1, parser->length);
+	return result;
+}
+
 /* ****************************************************************************** */
 // End of HOKUYO_COMM.C
 /* ****************************************************************************** */
@@ -21,6 +21,56 @@
 
 
 
+/* ****************************************************************************** */
+/* *****************************   Definitions  ********************************* */
+/* ****************************************************************************** */
+#define LIDAR_MAX_POINTS 1024		// Largest step count of any supported sensor
+#define LIDAR_RXBUFFER 8192		// Receive buffer, holds several complete MD frames
+
+// Result of lidar_parseFrame()
+#define LIDAR_FRAME_NONE 0		// No complete frame buffered yet
+#define LIDAR_FRAME_SCAN 1		// Scan decoded
+#define LIDAR_FRAME_ECHO 2		// Valid reply without scan data (e.g. status '00' MD echo)
+#define LIDAR_FRAME_BAD -1		// Frame discarded (bad sum, bad length, error status)
+
+/*	One decoded MD/MS scan.  host_time is taken when the frame terminator arrives,
+	sensor_time is the 24-bit millisecond timestamp sent by the sensor and
+	sync_time is sensor_time moved onto the host clock (see lidar_alignTime()).
+*/
+struct lidar_scan {
+	uint64_t host_time;			// CLOCK_MONOTONIC nanoseconds
+	uint64_t sync_time;			// CLOCK_MONOTONIC nanoseconds the sensor took the scan
+	uint32_t sensor_time;			// Sensor milliseconds
+	uint32_t seq;				// Scan counter assigned by the reader
+	uint8_t sensor;				// Which LIDAR (LIDAR_HORIZONTAL, LIDAR_VERTICAL)
+	uint16_t startstep;
+	uint16_t endstep;
+	uint16_t cluster;
+	uint16_t count;				// Number of valid entries in range[]
+	uint16_t range[LIDAR_MAX_POINTS];	// Millimeters (values < 20 are sensor error codes)
+};
+
+/*	Incremental receive state.  Bytes are appended as they arrive and complete
+	frames (terminated by LF LF) are split off, so a reader never blocks waiting
+	for the rest of a frame.  A lost or extra byte only costs the frames it
+	touches: the next LF LF ends the damage, and a frame that does not start
+	with an echo is searched for one that starts part way in.
+*/
+struct lidar_parser {
+	char buffer[LIDAR_RXBUFFER];
+	size_t length;
+	uint64_t rxtime;			// Time of the most recent read
+	uint32_t frames;			// Frames decoded into scans
+	uint32_t badframes;			// Frames rejected
+	uint32_t overflows;			// Times the buffer filled without a terminator
+	uint64_t rxbytes;			// Bytes read from the device
+	uint32_t resyncs;			// Frames recovered from part way into damaged data
+	uint64_t lostbytes;			// Bytes discarded as damaged
+	uint32_t lostscans;			// Scans missing from the sensor's timestamps
+	uint32_t lastsensor;			// sensor_time of the last scan
+	uint32_t period;			// Shortest time seen between scans (sensor ms)
+};
+
 /* ****************************************************************************** */
 /* ************************ Function Declarations ******************************* */
 /* ****************************************************************************** */
@@ -107,6 +157,53 @@ Input:    Encoding, StartStep, EndStep, Cluster, ScanInterval, Device to Read Fr
 **************************************************************************/
 void readData(uint8_t encoding, uint32_t startstep, uint32_t endstep, uint32_t cluster, uint32_t scaninterval, FILE * filedescriptor);
 
+/*************************************************************************
+Function: lidar_parserReset()
+Purpose:  Empties an incremental frame parser
+Input:    Parser
+**************************************************************************/
+void lidar_parserReset(struct lidar_parser * parser);
+
+/*************************************************************************
+Function: lidar_parserDiscard()
+Purpose:  Drops whatever is buffered, keeping the statistics
+Input:    Parser
+**************************************************************************/
+void lidar_parserDiscard(struct lidar_parser * parser);
+
+/*************************************************************************
+Function: lidar_parserReceived()
+Purpose:  Accounts for bytes read into the free end of the parser's buffer
+          by someone else (such as the I/O engine)
+Input:    Parser, number of bytes
+**************************************************************************/
+void lidar_parserReceived(struct lidar_parser * parser, size_t got);
+
+/*************************************************************************
+Function: lidar_parserFeed()
+Purpose:  Reads whatever bytes are available from the device into the parser
+Input:    Parser, device file descriptor (non-blocking or known readable)
+Returns:  Number of bytes read, 0 on end of file, -1 on error
+**************************************************************************/
+int lidar_parserFeed(struct lidar_parser * parser, int fd);
+
+/*************************************************************************
+Function: lidar_parseFrame()
+Purpose:  Removes the next complete frame from the parser and decodes it
+Input:    Parser, location of scan to output
+Returns:  LIDAR_FRAME_NONE, LIDAR_FRAME_SCAN, LIDAR_FRAME_ECHO or LIDAR_FRAME_BAD
+**************************************************************************/
+int lidar_parseFrame(struct lidar_parser * parser, struct lidar_scan * scan);
+
+/*************************************************************************
+Function: decodeScan()
+Purpose:  Decodes one complete MD/MS frame (echo through the final LF LF),
+          verifying the sum of every line
+Input:    Frame, frame length, location of scan to output
+Returns:  LIDAR_FRAME_SCAN, LIDAR_FRAME_ECHO or LIDAR_FRAME_BAD
+**************************************************************************/
+int decodeScan(char * frame, size_t length, struct lidar_scan * scan);
+
 #endif
 /* ****************************************************************************** */
 // End of HOKUYO_COMM.H
@@ -0,0 +1,186 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                           IMU Code Header                              */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+#ifndef _IMU_H_
+#define _IMU_H_
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include <stdint.h>
+#include <stddef.h>
+
+/* ****************************************************************************** */
+/* *****************************   Definitions  ********************************* */
+/* ****************************************************************************** */
+#define IMU_RXBUFFER 1024
+#define IMU_MAX_DATA 64			// Largest data section of any CHR-6dm packet
+
+// Packet types (Host -> Sensor)
+#define IMU_SET_ACTIVE_CHANNELS 0x80
+#define IMU_SET_SILENT_MODE 0x81
+#define IMU_SET_BROADCAST_MODE 0x82
+
+// Packet types (Sensor -> Host)
+#define IMU_COMMAND_COMPLETE 0xB0
+#define IMU_COMMAND_FAILED 0xB1
+#define IMU_BAD_CHECKSUM 0xB2
+#define IMU_BAD_DATA_LENGTH 0xB3
+#define IMU_UNRECOGNIZED_PACKET 0xB4
+#define IMU_BUFFER_OVERFLOW 0xB5
+#define IMU_STATUS_REPORT 0xB6
+#define IMU_SENSOR_DATA 0xB7
+
+// Active channel bits, in the order the values appear in a SENSOR_DATA packet
+#define IMU_CH_YAW		(1 << 15)
+#define IMU_CH_PITCH		(1 << 14)
+#define IMU_CH_ROLL		(1 << 13)
+#define IMU_CH_YAW_RATE		(1 << 12)
+#define IMU_CH_PITCH_RATE	(1 << 11)
+#define IMU_CH_ROLL_RATE	(1 << 10)
+#define IMU_CH_MAG_X		(1 << 9)
+#define IMU_CH_MAG_Y		(1 << 8)
+#define IMU_CH_MAG_Z		(1 << 7)
+#define IMU_CH_GYRO_X		(1 << 6)
+#define IMU_CH_GYRO_Y		(1 << 5)
+#define IMU_CH_GYRO_Z		(1 << 4)
+#define IMU_CH_ACCEL_X		(1 << 3)
+#define IMU_CH_ACCEL_Y		(1 << 2)
+#define IMU_CH_ACCEL_Z		(1 << 1)
+#define IMU_CH_ALL		0xFFFE
+
+// Scale factors (units per LSB)
+#define IMU_SCALE_ANGLE 0.0109863		// Degrees
+#define IMU_SCALE_RATE 0.0137329		// Degrees/second
+#define IMU_SCALE_MAG 0.061035			// mGauss
+#define IMU_SCALE_GYRO 0.01812			// Degrees/second
+#define IMU_SCALE_ACCEL 0.106812		// mg
+
+#define IMU_BROADCAST_HZ 100			// Requested broadcast rate (20-300 Hz)
+
+// Result of imu_parsePacket()
+#define IMU_PACKET_NONE 0		// No complete packet buffered yet
+#define IMU_PACKET_DATA 1		// SENSOR_DATA decoded into a sample
+#define IMU_PACKET_OTHER 2		// Valid packet of another type
+#define IMU_PACKET_BAD -1		// Packet discarded (bad checksum or length)
+
+/*	One SENSOR_DATA packet converted to engineering units.  Channels that are
+	not active in the packet are left at zero; channels records which ones were.
+*/
+struct imu_sample {
+	uint64_t host_time;		// CLOCK_MONOTONIC nanoseconds
+	uint32_t seq;			// Sample counter assigned by the reader
+	uint16_t channels;		// Active channel bits
+	float yaw, pitch, roll;		// Degrees
+	float yawrate, pitchrate, rollrate;	// Degrees/second
+	float mag[3];			// mGauss
+	float gyro[3];			// Degrees/second
+	float accel[3];			// mg
+};
+
+struct imu_parser {
+	uint8_t buffer[IMU_RXBUFFER];
+	size_t length;
+	uint64_t rxtime;		// Time of the most recent read
+	uint8_t type;			// Type of the last packet removed
+	uint32_t packets;		// Packets accepted
+	uint32_t badpackets;		// Packets rejected
+	uint32_t lostbytes;		// Bytes skipped while looking for 's' 'n' 'p'
+	uint64_t rxbytes;		// Bytes read from the device
+};
+
+/* ****************************************************************************** */
+/* ************************ Function Declarations ******************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: imu_open()
+Purpose:  Opens the IMU serial port at 115200 baud in raw mode
+Input:    Device name to open
+Returns:  File descriptor if successful, -1 if not
+**************************************************************************/
+int imu_open(char * name);
+
+/*************************************************************************
+Function: imu_close()
+Purpose:  Silences and closes the IMU
+Input:    File descriptor
+Returns:  0 if successful, <0 if not
+**************************************************************************/
+int imu_close(int fd);
+
+/*************************************************************************
+Function: imu_sendPacket()
+Purpose:  Frames and sends a packet ('s' 'n' 'p' + Type + N + Data + Checksum)
+Input:    File descriptor, packet type, data, data length
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int imu_sendPacket(int fd, uint8_t type, const uint8_t * data, uint8_t length);
+
+/*************************************************************************
+Function: imu_setChannels()
+Purpose:  Selects which channels are reported in SENSOR_DATA packets
+Input:    File descriptor, channel bits
+**************************************************************************/
+void imu_setChannels(int fd, uint16_t channels);
+
+/*************************************************************************
+Function: imu_setBroadcast()
+Purpose:  Starts broadcast mode at the given rate
+Input:    File descriptor, rate in Hz (20-300)
+**************************************************************************/
+void imu_setBroadcast(int fd, int hz);
+
+/*************************************************************************
+Function: imu_setSilent()
+Purpose:  Stops broadcast mode
+Input:    File descriptor
+**************************************************************************/
+void imu_setSilent(int fd);
+
+/*************************************************************************
+Function: imu_parserReset()
+Purpose:  Empties an incremental packet parser
+Input:    Parser
+**************************************************************************/
+void imu_parserReset(struct imu_parser * parser);
+
+/*************************************************************************
+Function: imu_parserReceived()
+Purpose:  Accounts for bytes read into the free end of the parser's buffer
+          by someone else (such as the I/O engine)
+Input:    Parser, number of bytes
+**************************************************************************/
+void imu_parserReceived(struct imu_parser * parser, size_t got);
+
+/*************************************************************************
+Function: imu_parserFeed()
+Purpose:  Reads whatever bytes are available from the device into the parser
+Input:    Parser, file descriptor (known readable)
+Returns:  Number of bytes read, 0 on end of file, -1 on error (errno set)
+**************************************************************************/
+int imu_parserFeed(struct imu_parser * parser, int fd);
+
+/*************************************************************************
+Function: imu_parsePacket()
+Purpose:  Removes the next complete packet from the parser and decodes it
+Input:    Parser, location of sample to output
+Returns:  IMU_PACKET_NONE, IMU_PACKET_DATA, IMU_PACKET_OTHER or IMU_PACKET_BAD
+**************************************************************************/
+int imu_parsePacket(struct imu_parser * parser, struct imu_sample * sample);
+
+#endif
+/* ****************************************************************************** */
+// End of IMU.H
+/* ****************************************************************************** */
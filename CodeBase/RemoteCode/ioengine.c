@@ -0,0 +1,557 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                           I/O Engine Code                              */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+
+/* ****************************************************************************** */
+/* *******************************   About  ************************************* */
+/* ****************************************************************************** */
+// This code batches the serial reads and flash writes of one pipeline stage
+// into as few system calls as possible.
+/*
+	With poll() and read(), every scan costs the LIDAR stage a poll() and one
+	or more read() calls per sensor, and every journal flush costs the storage
+	stage a write() for the journal, one for the index and an fdatasync().  On
+	the BeagleBone each of those is a few microseconds of kernel entry and
+	exit that the stage spends not parsing.
+
+	With io_uring, the stage keeps a read posted on every serial port and
+	queues its writes and syncs as it goes.  ioengine_wait() then hands all of
+	it to the kernel and collects whatever has finished in a single
+	io_uring_enter().  The kernel fills the parser buffers directly, and the
+	buffers are registered once so it does not have to look up their pages
+	on every request.
+
+	io_uring is used through the raw system calls, so there is nothing extra
+	to install on the unit.  When the kernel is too old (before 5.11), the
+	headers it was built against are, or io_uring is disabled, the engine
+	falls back to poll(), read(), write() and fdatasync() behind the same
+	interface, and the -u option forces the fallback.
+*/
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include "prefiremapping.h"
+#include "ioengine.h"
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+// io_uring needs the 5.11 interface: timed waits and reads at the file position
+#if defined(IORING_ENTER_EXT_ARG) && defined(__NR_io_uring_setup)
+#define IOENGINE_URING 1
+#endif
+
+#define IOENGINE_CANCEL_TAG (~0ULL)	// Tag of the cancel requests themselves
+#define IOENGINE_CANCEL_GRACE 100	// Milliseconds a cancelled request has to show up
+
+/* ****************************************************************************** */
+/* ****************************** Functions ************************************* */
+/* ****************************************************************************** */
+
+#ifdef IOENGINE_URING
+
+/*************************************************************************
+Function: uringEnter()
+Purpose:  Submits queued requests and waits for completions
+Input:    Engine, number of completions to wait for, milliseconds to wait
+          (negative = forever)
+Returns:  Number of requests submitted, or -errno
+**************************************************************************/
+static int uringEnter(struct ioengine * io, unsigned wait, int timeout){
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned submit, flags = 0;
+	int result;
+
+	__atomic_store_n(io->sqtail, io->tail, __ATOMIC_RELEASE);
+	submit = io->tail - __atomic_load_n(io->sqhead, __ATOMIC_ACQUIRE);
+	memset(&arg, 0, sizeof(arg));
+	if(wait > 0){
+		flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+		if(timeout >= 0){
+			ts.tv_sec = timeout / 1000;
+			ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+			arg.ts = (uint64_t)(uintptr_t)&ts;
+		}
+	}
+	if(submit == 0 && wait == 0)
+		return 0;
+	io->syscalls++;
+	result = syscall(__NR_io_uring_enter, io->uring, submit, wait, flags,
+		(wait > 0) ? &arg : NULL, (wait > 0) ? sizeof(arg) : 0);
+	// Anything the kernel did not take is dropped with its link chain
+	io->linkable = NULL;
+	return (result < 0) ? -errno : result;
+}
+
+/*************************************************************************
+Function: uringReap()
+Purpose:  Collects finished requests from the completion ring
+Input:    Engine, completions output, most to collect
+Returns:  Number collected
+**************************************************************************/
+static int uringReap(struct ioengine * io, struct ioengine_completion * done, int max){
+	struct io_uring_cqe * cqes = io->cqes;
+	unsigned head = *io->cqhead;
+	unsigned tail = __atomic_load_n(io->cqtail, __ATOMIC_ACQUIRE);
+	int n = 0;
+
+	while(head != tail && n < max){
+		done[n].tag = cqes[head & io->cqmask].user_data;
+		done[n].result = cqes[head & io->cqmask].res;
+		head++;
+		n++;
+	}
+	__atomic_store_n(io->cqhead, head, __ATOMIC_RELEASE);
+	return n;
+}
+
+/*************************************************************************
+Function: uringQueue()
+Purpose:  Fills in the next submission entry
+Input:    Engine, operation, descriptor, buffer, length, tag
+Returns:  Entry, or NULL if the ring is full
+**************************************************************************/
+static struct io_uring_sqe * uringQueue(struct ioengine * io, int op, int fd, const void * buffer, size_t length, uint64_t tag){
+	struct io_uring_sqe * sqe;
+	unsigned index;
+	int b;
+
+	if(io->tail - __atomic_load_n(io->sqhead, __ATOMIC_ACQUIRE) > io->sqmask)
+		return NULL;
+	index = io->tail & io->sqmask;
+	sqe = &((struct io_uring_sqe *)io->sqes)[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->off = (uint64_t)-1;		// At (and advancing) the file position
+	sqe->addr = (uint64_t)(uintptr_t)buffer;
+	sqe->len = length;
+	sqe->user_data = tag;
+	// Registered memory saves the kernel pinning the pages for every request
+	if(io->registered && (op == IORING_OP_READ || op == IORING_OP_WRITE)){
+		for(b = 0; b < io->nbuffers; b++){
+			if((const char *)buffer >= (const char *)io->buffers[b].iov_base &&
+			   (const char *)buffer + length <= (const char *)io->buffers[b].iov_base + io->buffers[b].iov_len){
+				sqe->opcode = (op == IORING_OP_READ) ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+				sqe->buf_index = b;
+				break;
+			}
+		}
+	}
+	io->sqarray[index] = index;
+	io->tail++;
+	return sqe;
+}
+
+/*************************************************************************
+Function: uringOrdered()
+Purpose:  Queues a write or sync behind the ones already queued
+Input:    Engine, operation, descriptor, buffer, length, tag
+Returns:  0 if queued, -1 if the ring is full
+**************************************************************************/
+static int uringOrdered(struct ioengine * io, int op, int fd, const void * buffer, size_t length, uint64_t tag){
+	struct io_uring_sqe * sqe = uringQueue(io, op, fd, buffer, length, tag);
+
+	if(sqe == NULL)
+		return -1;
+	if(io->linkable != NULL)
+		((struct io_uring_sqe *)io->linkable)->flags |= IOSQE_IO_LINK;
+	io->linkable = sqe;
+	return 0;
+}
+
+#endif
+
+/*************************************************************************
+Function: ioengine_init()
+Purpose:  Sets up an io_uring, or the poll() fallback when the kernel has no
+          (or too old an) io_uring or it is not wanted
+Input:    Engine, name for messages, 1 to use the poll() fallback
+Returns:  0 if successful
+**************************************************************************/
+int ioengine_init(struct ioengine * io, const char * name, int usepoll){
+#ifdef IOENGINE_URING
+	struct io_uring_params params;
+	const unsigned needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
+		IORING_FEAT_RW_CUR_POS | IORING_FEAT_EXT_ARG;
+	char * ring;
+	int fd;
+#endif
+
+	memset(io, 0, sizeof(*io));
+	io->name = name;
+	io->uring = -1;
+	if(usepoll)
+		return 0;
+
+#ifdef IOENGINE_URING
+	memset(&params, 0, sizeof(params));
+	// Room for every request in flight plus the cancels for them
+	fd = syscall(__NR_io_uring_setup, 2*IOENGINE_DEPTH, &params);
+	if(fd < 0){
+		if(VERBOSE_MODE == 1) printf("I/O: %s uses poll(), no io_uring (%s)\n", name, strerror(errno));
+		return 0;
+	}
+	if((params.features & needed) != needed){
+		if(VERBOSE_MODE == 1) printf("I/O: %s uses poll(), io_uring is too old\n", name);
+		close(fd);
+		return 0;
+	}
+	io->ringsize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	if(io->ringsize < params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe))
+		io->ringsize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	io->sqessize = params.sq_entries * sizeof(struct io_uring_sqe);
+	io->ring = mmap(NULL, io->ringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	io->sqes = mmap(NULL, io->sqessize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if(io->ring == MAP_FAILED || io->sqes == MAP_FAILED){
+		if(VERBOSE_MODE == 1) printf("I/O: %s uses poll(), io_uring rings would not map\n", name);
+		if(io->ring != MAP_FAILED)
+			munmap(io->ring, io->ringsize);
+		if(io->sqes != MAP_FAILED)
+			munmap(io->sqes, io->sqessize);
+		io->ring = io->sqes = NULL;
+		close(fd);
+		return 0;
+	}
+	ring = io->ring;
+	io->sqhead = (unsigned *)(ring + params.sq_off.head);
+	io->sqtail = (unsigned *)(ring + params.sq_off.tail);
+	io->sqarray = (unsigned *)(ring + params.sq_off.array);
+	io->sqmask = *(unsigned *)(ring + params.sq_off.ring_mask);
+	io->cqhead = (unsigned *)(ring + params.cq_off.head);
+	io->cqtail = (unsigned *)(ring + params.cq_off.tail);
+	io->cqes = ring + params.cq_off.cqes;
+	io->cqmask = *(unsigned *)(ring + params.cq_off.ring_mask);
+	io->tail = *io->sqtail;
+	io->uring = fd;
+#endif
+	return 0;
+}
+
+/*************************************************************************
+Function: ioengine_register()
+Purpose:  Registers a long-lived buffer.  Requests on memory inside it use
+          the fixed-buffer operations.
+Input:    Engine, buffer, length
+Returns:  0 if successful, -1 if not (requests on it still work)
+**************************************************************************/
+int ioengine_register(struct ioengine * io, void * buffer, size_t length){
+	if(io->nbuffers >= IOENGINE_BUFFERS)
+		return -1;
+	io->buffers[io->nbuffers].iov_base = buffer;
+	io->buffers[io->nbuffers].iov_len = length;
+	io->nbuffers++;
+#ifdef IOENGINE_URING
+	if(io->uring < 0)
+		return 0;
+	// The kernel takes the whole table at once, so register it again with the new one
+	if(io->registered)
+		syscall(__NR_io_uring_register, io->uring, IORING_UNREGISTER_BUFFERS, NULL, 0);
+	io->registered = syscall(__NR_io_uring_register, io->uring, IORING_REGISTER_BUFFERS, io->buffers, io->nbuffers) == 0;
+	if(!io->registered){
+		if(VERBOSE_MODE == 1) printf("I/O: %s could not register buffers (%s)\n", io->name, strerror(errno));
+		return -1;
+	}
+#endif
+	return 0;
+}
+
+/*************************************************************************
+Function: fallbackQueue()
+Purpose:  Queues a request for the poll() fallback
+Input:    Engine, request type, descriptor, buffer, length, tag
+Returns:  0 if queued, -1 if the engine is full
+**************************************************************************/
+static int fallbackQueue(struct ioengine * io, int type, int fd, void * buffer, size_t length, uint64_t tag){
+	struct ioengine_request * request;
+
+	if(io->nrequests >= IOENGINE_DEPTH)
+		return -1;
+	request = &io->requests[io->nrequests++];
+	request->type = type;
+	request->fd = fd;
+	request->buffer = buffer;
+	request->length = length;
+	request->tag = tag;
+	return 0;
+}
+
+/*************************************************************************
+Function: ioengine_read()
+Purpose:  Queues a read that completes once at least one byte has arrived
+Input:    Engine, descriptor, buffer, length, tag
+Returns:  0 if queued, -1 if the engine is full
+**************************************************************************/
+int ioengine_read(struct ioengine * io, int fd, void * buffer, size_t length, uint64_t tag){
+#ifdef IOENGINE_URING
+	if(io->uring >= 0)
+		return (uringQueue(io, IORING_OP_READ, fd, buffer, length, tag) != NULL) ? 0 : -1;
+#endif
+	return fallbackQueue(io, IOENGINE_READ, fd, buffer, length, tag);
+}
+
+/*************************************************************************
+Function: ioengine_write()
+Purpose:  Queues a write at the descriptor's file position.  Writes and
+          syncs queued before one ioengine_wait() run in the order queued,
+          and one that fails or writes short cancels the ones after it.
+Input:    Engine, descriptor, buffer, length, tag
+Returns:  0 if queued, -1 if the engine is full
+**************************************************************************/
+int ioengine_write(struct ioengine * io, int fd, const void * buffer, size_t length, uint64_t tag){
+#ifdef IOENGINE_URING
+	if(io->uring >= 0)
+		return uringOrdered(io, IORING_OP_WRITE, fd, buffer, length, tag);
+#endif
+	return fallbackQueue(io, IOENGINE_WRITE, fd, (void *)buffer, length, tag);
+}
+
+/*************************************************************************
+Function: ioengine_datasync()
+Purpose:  Queues an fdatasync(), ordered after the writes queued before it
+Input:    Engine, descriptor, tag
+Returns:  0 if queued, -1 if the engine is full
+**************************************************************************/
+int ioengine_datasync(struct ioengine * io, int fd, uint64_t tag){
+#ifdef IOENGINE_URING
+	struct io_uring_sqe * sqe;
+
+	if(io->uring >= 0){
+		if(uringOrdered(io, IORING_OP_FSYNC, fd, NULL, 0, tag) < 0)
+			return -1;
+		sqe = io->linkable;
+		sqe->off = 0;
+		sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+		return 0;
+	}
+#endif
+	return fallbackQueue(io, IOENGINE_DATASYNC, fd, NULL, 0, tag);
+}
+
+/*************************************************************************
+Function: fallbackWait()
+Purpose:  ioengine_wait() for the poll() fallback.  Writes and syncs run
+          first, in order; reads finish when their descriptor is readable.
+Input:    Engine, completions output, most to collect, milliseconds to wait
+Returns:  Number of completions, 0 on timeout or signal, -1 on error
+**************************************************************************/
+static int fallbackWait(struct ioengine * io, struct ioengine_completion * done, int max, int timeout){
+	struct pollfd fds[IOENGINE_DEPTH];
+	struct ioengine_request * request;
+	int reads[IOENGINE_DEPTH];
+	int n = 0, nfds = 0, broken = 0, kept = 0;
+	int result, r;
+
+	// Writes and syncs, in the order queued
+	for(r = 0; r < io->nrequests; r++){
+		request = &io->requests[r];
+		if(request->type == IOENGINE_READ){
+			io->requests[kept++] = *request;
+			continue;
+		}
+		if(broken){
+			result = -ECANCELED;
+		}
+		else{
+			io->syscalls++;
+			if(request->type == IOENGINE_WRITE)
+				result = write(request->fd, request->buffer, request->length);
+			else
+				result = fdatasync(request->fd);
+			if(result < 0)
+				result = -errno;
+			broken = (result < 0) || (request->type == IOENGINE_WRITE && (size_t)result != request->length);
+		}
+		done[n].tag = request->tag;
+		done[n].result = result;
+		n++;
+	}
+	io->nrequests = kept;
+	if(n >= max || (n > 0 && io->nrequests == 0))
+		return n;
+
+	// Reads, once their descriptor has something (with none, just wait out the timeout)
+	for(r = 0; r < io->nrequests; r++){
+		fds[nfds].fd = io->requests[r].fd;
+		fds[nfds].events = POLLIN;
+		fds[nfds].revents = 0;
+		reads[nfds++] = r;
+	}
+	io->syscalls++;
+	result = poll(fds, nfds, (n > 0) ? 0 : timeout);
+	if(result < 0)
+		return (errno == EINTR) ? n : -1;
+	kept = 0;
+	for(r = 0; r < nfds; r++){
+		request = &io->requests[reads[r]];
+		if(fds[r].revents == 0 || n >= max){
+			io->requests[kept++] = *request;
+			continue;
+		}
+		io->syscalls++;
+		result = read(request->fd, request->buffer, request->length);
+		done[n].tag = request->tag;
+		done[n].result = (result < 0) ? -errno : result;
+		n++;
+	}
+	io->nrequests = kept;
+	return n;
+}
+
+/*************************************************************************
+Function: ioengine_wait()
+Purpose:  Submits everything queued, in one system call with io_uring, and
+          collects finished requests
+Input:    Engine, completions output, most to collect, milliseconds to wait
+          for the first one (0 = don't wait, IOENGINE_FOREVER)
+Returns:  Number of completions, 0 on timeout or signal, -1 on error
+**************************************************************************/
+int ioengine_wait(struct ioengine * io, struct ioengine_completion * done, int max, int timeout){
+	int n = 0;
+#ifdef IOENGINE_URING
+	int result;
+#endif
+
+	// Completions a cancel came across first
+	while(io->nbacklog > 0 && n < max){
+		done[n++] = io->backlog[0];
+		io->nbacklog--;
+		memmove(io->backlog, io->backlog + 1, io->nbacklog * sizeof(io->backlog[0]));
+	}
+	if(n >= max)
+		return n;
+
+	if(io->uring < 0){
+		timeout = fallbackWait(io, done + n, max - n, (n > 0) ? 0 : timeout);
+		if(timeout < 0)
+			return (n > 0) ? n : -1;
+		n += timeout;
+		io->completed += n;
+		return n;
+	}
+
+#ifdef IOENGINE_URING
+	n += uringReap(io, done + n, max - n);
+	result = uringEnter(io, (n > 0 || timeout == 0) ? 0 : 1, timeout);
+	if(result < 0 && result != -ETIME && result != -EINTR && result != -EBUSY){
+		if(VERBOSE_MODE == 1) printf("I/O: %s io_uring_enter failed (%s)\n", io->name, strerror(-result));
+		return (n > 0) ? n : -1;
+	}
+	n += uringReap(io, done + n, max - n);
+	io->completed += n;
+#endif
+	return n;
+}
+
+/*************************************************************************
+Function: ioengine_cancel()
+Purpose:  Takes back a queued or in-flight request, waiting until the
+          kernel has let go of its buffer
+Input:    Engine, tag
+Returns:  The request's result: -ECANCELED if it was cancelled, or what it
+          transferred if it finished first
+**************************************************************************/
+int ioengine_cancel(struct ioengine * io, uint64_t tag){
+	int r, n;
+#ifdef IOENGINE_URING
+	struct ioengine_completion done[2*IOENGINE_DEPTH];
+	struct io_uring_sqe * sqe;
+	int cancelled = 0, result = -ENOENT;
+	int i;
+#endif
+
+	// It may have finished already
+	for(r = 0; r < io->nbacklog; r++){
+		if(io->backlog[r].tag == tag){
+			n = io->backlog[r].result;
+			io->nbacklog--;
+			memmove(io->backlog + r, io->backlog + r + 1, (io->nbacklog - r) * sizeof(io->backlog[0]));
+			io->completed++;
+			return n;
+		}
+	}
+
+	if(io->uring < 0){
+		for(r = 0; r < io->nrequests; r++){
+			if(io->requests[r].tag == tag){
+				io->nrequests--;
+				memmove(io->requests + r, io->requests + r + 1, (io->nrequests - r) * sizeof(io->requests[0]));
+				return -ECANCELED;
+			}
+		}
+		return -ENOENT;
+	}
+
+#ifdef IOENGINE_URING
+	sqe = uringQueue(io, IORING_OP_ASYNC_CANCEL, -1, NULL, 0, IOENGINE_CANCEL_TAG);
+	if(sqe == NULL)
+		return -EBUSY;
+	sqe->off = 0;
+	sqe->addr = tag;
+	// Wait for both the cancel and the request itself.  A request the cancel
+	// missed (-ENOENT) may be just finishing, so give it a moment.
+	for(;;){
+		r = uringEnter(io, 1, cancelled ? IOENGINE_CANCEL_GRACE : IOENGINE_FOREVER);
+		if(r < 0 && r != -EINTR && r != -ETIME)
+			break;
+		n = uringReap(io, done, 2*IOENGINE_DEPTH);
+		for(i = 0; i < n; i++){
+			if(done[i].tag == IOENGINE_CANCEL_TAG){
+				cancelled = 1;
+			}
+			else if(done[i].tag == tag && result == -ENOENT){
+				result = done[i].result;
+				io->completed++;
+			}
+			else if(io->nbacklog < (int)(sizeof(io->backlog) / sizeof(io->backlog[0]))){
+				io->backlog[io->nbacklog++] = done[i];
+			}
+		}
+		if((cancelled && result != -ENOENT) || (cancelled && n == 0 && r == -ETIME))
+			break;
+	}
+	return result;
+#else
+	return -ENOENT;
+#endif
+}
+
+/*************************************************************************
+Function: ioengine_close()
+Purpose:  Releases the engine.  Cancel reads still in flight first, so no
+          buffer is written after its owner lets go of it.
+Input:    Engine
+**************************************************************************/
+void ioengine_close(struct ioengine * io){
+	if(io->uring >= 0){
+		close(io->uring);
+		munmap(io->ring, io->ringsize);
+		munmap(io->sqes, io->sqessize);
+		io->uring = -1;
+	}
+	io->nrequests = 0;
+	io->nbacklog = 0;
+}
+
+/* ****************************************************************************** */
+// End of IOENGINE.C
+/* ****************************************************************************** */
@@ -0,0 +1,170 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                          I/O Engine Header                             */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+#ifndef _IOENGINE_H_
+#define _IOENGINE_H_
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+/* ****************************************************************************** */
+/* *****************************   Definitions  ********************************* */
+/* ****************************************************************************** */
+#define IOENGINE_DEPTH 8		// Requests in flight at once
+#define IOENGINE_BUFFERS 4		// Registered buffers
+#define IOENGINE_FOREVER -1		// ioengine_wait() timeout that never expires
+
+// Request types
+#define IOENGINE_READ 1
+#define IOENGINE_WRITE 2
+#define IOENGINE_DATASYNC 3
+
+/*	A finished request */
+struct ioengine_completion {
+	uint64_t tag;			// As given when the request was queued
+	int result;			// Bytes transferred (0 for a sync), or -errno
+};
+
+/*	A request waiting in the poll() fallback */
+struct ioengine_request {
+	int type;
+	int fd;
+	void * buffer;
+	size_t length;
+	uint64_t tag;
+};
+
+/*	One stage's engine.  Not shared between threads. */
+struct ioengine {
+	const char * name;
+	int uring;			// io_uring descriptor, -1 = poll() fallback
+
+	// io_uring rings, mapped from the kernel
+	void * ring;
+	size_t ringsize;
+	void * sqes;
+	size_t sqessize;
+	unsigned * sqhead;
+	unsigned * sqtail;
+	unsigned * sqarray;
+	unsigned sqmask;
+	unsigned * cqhead;
+	unsigned * cqtail;
+	void * cqes;
+	unsigned cqmask;
+	unsigned tail;			// Next submission entry to fill
+	void * linkable;		// Newest queued write or sync, ordered before the next one
+
+	// Buffers the kernel keeps mapped, so fixed reads and writes skip the page walk
+	struct iovec buffers[IOENGINE_BUFFERS];
+	int nbuffers;
+	int registered;			// 1 if the kernel accepted them
+
+	// poll() fallback
+	struct ioengine_request requests[IOENGINE_DEPTH];
+	int nrequests;
+
+	// Completions found while cancelling, handed out by the next ioengine_wait()
+	struct ioengine_completion backlog[2*IOENGINE_DEPTH];
+	int nbacklog;
+
+	// Statistics
+	uint64_t syscalls;		// io_uring_enter(), or poll()/read()/write()/fdatasync() calls
+	uint64_t completed;		// Requests finished
+};
+
+/* ****************************************************************************** */
+/* ************************ Function Declarations ******************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: ioengine_init()
+Purpose:  Sets up an io_uring, or the poll() fallback when the kernel has no
+          (or too old an) io_uring or it is not wanted
+Input:    Engine, name for messages, 1 to use the poll() fallback
+Returns:  0 if successful
+**************************************************************************/
+int ioengine_init(struct ioengine * io, const char * name, int usepoll);
+
+/*************************************************************************
+Function: ioengine_register()
+Purpose:  Registers a long-lived buffer.  Requests on memory inside it use
+          the fixed-buffer operations.
+Input:    Engine, buffer, length
+Returns:  0 if successful, -1 if not (requests on it still work)
+**************************************************************************/
+int ioengine_register(struct ioengine * io, void * buffer, size_t length);
+
+/*************************************************************************
+Function: ioengine_read()
+Purpose:  Queues a read that completes once at least one byte has arrived
+Input:    Engine, descriptor, buffer, length, tag
+Returns:  0 if queued, -1 if the engine is full
+**************************************************************************/
+int ioengine_read(struct ioengine * io, int fd, void * buffer, size_t length, uint64_t tag);
+
+/*************************************************************************
+Function: ioengine_write()
+Purpose:  Queues a write at the descriptor's file position.  Writes and
+          syncs queued before one ioengine_wait() run in the order queued,
+          and one that fails or writes short cancels the ones after it.
+Input:    Engine, descriptor, buffer, length, tag
+Returns:  0 if queued, -1 if the engine is full
+**************************************************************************/
+int ioengine_write(struct ioengine * io, int fd, const void * buffer, size_t length, uint64_t tag);
+
+/*************************************************************************
+Function: ioengine_datasync()
+Purpose:  Queues an fdatasync(), ordered after the writes queued before it
+Input:    Engine, descriptor, tag
+Returns:  0 if queued, -1 if the engine is full
+**************************************************************************/
+int ioengine_datasync(struct ioengine * io, int fd, uint64_t tag);
+
+/*************************************************************************
+Function: ioengine_wait()
+Purpose:  Submits everything queued, in one system call with io_uring, and
+          collects finished requests
+Input:    Engine, completions output, most to collect, milliseconds to wait
+          for the first one (0 = don't wait, IOENGINE_FOREVER)
+Returns:  Number of completions, 0 on timeout or signal, -1 on error
+**************************************************************************/
+int ioengine_wait(struct ioengine * io, struct ioengine_completion * done, int max, int timeout);
+
+/*************************************************************************
+Function: ioengine_cancel()
+Purpose:  Takes back a queued or in-flight request, waiting until the
+          kernel has let go of its buffer
+Input:    Engine, tag
+Returns:  The request's result: -ECANCELED if it was cancelled, or what it
+          transferred if it finished first
+**************************************************************************/
+int ioengine_cancel(struct ioengine * io, uint64_t tag);
+
+/*************************************************************************
+Function: ioengine_close()
+Purpose:  Releases the engine.  Cancel reads still in flight first, so no
+          buffer is written after its owner lets go of it.
+Input:    Engine
+**************************************************************************/
+void ioengine_close(struct ioengine * io);
+
+#endif
+/* ****************************************************************************** */
+// End of IOENGINE.H
+/* ****************************************************************************** */
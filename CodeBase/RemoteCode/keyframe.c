@@ -0,0 +1,168 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                          Keyframe Gate Code                            */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+
+/* ****************************************************************************** */
+/* *******************************   About  ************************************* */
+/* ****************************************************************************** */
+// This code decides which scans are worth journaling and sending to the base
+// station.
+/*	While the operator stands still or walks slowly, consecutive scans repeat
+	each other, and the base station's SLAM throws them away anyway (it skips
+	readings that moved less than 5 cm or 0.03 rad).  The gate drops them at
+	capture time instead, before they cost flash, bandwidth and replay time.
+
+	A scan pair is kept when any of these holds, measured against the last
+	pair that was kept (the keyframe):
+
+	Moved		At least KEYFRAME_CHANGED percent of every KEYFRAME_STRIDE'th
+			beam moved by more than sensor noise, or gained or lost
+			its return.  About 5 cm of walking does it.
+	Turned		The IMU's yaw, pitch or roll changed by KEYFRAME_TURN
+			degrees.  A turn in place moves few beams near the axis
+			of rotation but is exactly what SLAM needs to see.
+	Heartbeat	The heartbeat period passed, so a still unit still leaves
+			a steady trickle of scans (and the base station can tell
+			it is alive).
+	Changed		A sensor appeared or scans a different range of steps.
+
+	IMU samples are always journaled; they are small and carry the motion
+	between keyframes.  The display, mapper and shared ring see every scan.
+*/
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include "prefiremapping.h"
+#include "keyframe.h"
+#include "filter.h"
+
+/* ****************************************************************************** */
+/* ****************************** Functions ************************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: keyframe_init()
+Purpose:  Clears a gate and its statistics
+Input:    Gate, heartbeat in milliseconds (0 keeps every pair)
+**************************************************************************/
+void keyframe_init(struct keyframe_gate * gate, uint32_t heartbeat){
+	memset(gate, 0, sizeof(*gate));
+	gate->heartbeat = heartbeat;
+}
+
+/*************************************************************************
+Function: angleChange()
+Purpose:  Size of the change between two angles, across the +-180 wrap
+Input:    Angles in degrees
+Returns:  Degrees, 0 to 180
+**************************************************************************/
+static float angleChange(float a, float b){
+	float d = fabsf(a - b);
+	return (d > 180.0f) ? 360.0f - d : d;
+}
+
+/*************************************************************************
+Function: changedPercent()
+Purpose:  Compares the sampled beams of a scan with the keyframe's
+Input:    Keyframe beams, scan
+Returns:  Percent of the sampled beams that changed
+**************************************************************************/
+static int changedPercent(const uint16_t * key, const struct lidar_scan * scan){
+	int changed = 0, sampled = 0;
+	int r, k, limit, returns;
+	int n;
+
+	for(n = 0; n < scan->count; n += KEYFRAME_STRIDE){
+		r = scan->range[n];
+		k = key[n / KEYFRAME_STRIDE];
+		limit = KEYFRAME_BEAM_MIN + (k >> KEYFRAME_BEAM_SHIFT);
+		// Gaining or losing a return is a change, two missing returns are not
+		returns = (r != FILTER_NO_RETURN) + (k != FILTER_NO_RETURN);
+		changed += (returns == 1) | ((returns == 2) & (abs(r - k) > limit));
+		sampled++;
+	}
+	return (sampled > 0) ? changed * 100 / sampled : 0;
+}
+
+/*************************************************************************
+Function: keyframe_check()
+Purpose:  Decides whether a (filtered) scan pair carries new information
+          and, if it does, makes it the keyframe
+Input:    Gate, scan pair, attitude at the time of the pair (NULL if none)
+Returns:  1 to keep the pair, 0 if it repeats the keyframe
+**************************************************************************/
+int keyframe_check(struct keyframe_gate * gate, const struct lidar_pair * pair, const struct imu_sample * imu){
+	const struct lidar_scan * scan;
+	uint64_t time = 0;
+	int moved = 0, changes = 0, turned = 0, heartbeat;
+	int d, n;
+
+	gate->pairs++;
+	for(d = LIDAR_DEVICES - 1; d >= 0; d--)
+		if(pair->valid & (1 << d))
+			time = pair->scan[d].host_time;
+
+	for(d = 0; d < LIDAR_DEVICES; d++){
+		if(!(pair->valid & (1 << d)))
+			continue;
+		scan = &pair->scan[d];
+		if(!(gate->held & (1 << d)) || gate->startstep[d] != scan->startstep ||
+		   gate->cluster[d] != scan->cluster || gate->count[d] != scan->count)
+			changes = 1;
+		else if(changedPercent(gate->range[d], scan) >= KEYFRAME_CHANGED)
+			moved = 1;
+	}
+	if(imu != NULL && gate->attitude)
+		turned = angleChange(imu->yaw, gate->imu.yaw) >= KEYFRAME_TURN ||
+			angleChange(imu->pitch, gate->imu.pitch) >= KEYFRAME_TURN ||
+			angleChange(imu->roll, gate->imu.roll) >= KEYFRAME_TURN;
+	heartbeat = gate->heartbeat == 0 || time >= gate->last + gate->heartbeat * 1000000ULL;
+
+	if(!(moved || changes || turned || heartbeat))
+		return 0;
+
+	// Count each kept pair once, by its most informative reason
+	gate->kept++;
+	if(changes)
+		gate->changes++;
+	else if(moved)
+		gate->moved++;
+	else if(turned)
+		gate->turned++;
+	else
+		gate->heartbeats++;
+
+	// Make it the keyframe
+	for(d = 0; d < LIDAR_DEVICES; d++){
+		if(!(pair->valid & (1 << d)))
+			continue;
+		scan = &pair->scan[d];
+		for(n = 0; n < scan->count; n += KEYFRAME_STRIDE)
+			gate->range[d][n / KEYFRAME_STRIDE] = scan->range[n];
+		gate->startstep[d] = scan->startstep;
+		gate->cluster[d] = scan->cluster;
+		gate->count[d] = scan->count;
+		gate->held |= 1 << d;
+	}
+	if(imu != NULL)
+		gate->imu = *imu;
+	gate->attitude = (imu != NULL);
+	gate->last = time;
+	return 1;
+}
+
+/* ****************************************************************************** */
+// End of KEYFRAME.C
+/* ****************************************************************************** */
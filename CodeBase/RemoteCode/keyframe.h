@@ -0,0 +1,83 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                         Keyframe Gate Header                           */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+#ifndef _KEYFRAME_H_
+#define _KEYFRAME_H_
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include <stdint.h>
+#include "hokuyo_comm.h"
+#include "hokuyo.h"
+#include "imu.h"
+
+/* ****************************************************************************** */
+/* *****************************   Definitions  ********************************* */
+/* ****************************************************************************** */
+#define KEYFRAME_STRIDE 8		// Every 8th beam is compared (~85 of a full URG-04LX scan)
+#define KEYFRAME_BEAMS (LIDAR_MAX_POINTS/KEYFRAME_STRIDE + 1)
+#define KEYFRAME_BEAM_MIN 40		// Millimeters a beam must move to count as changed, above sensor noise
+#define KEYFRAME_BEAM_SHIFT 5		// Or range/32 if that is larger, as the noise grows with range
+#define KEYFRAME_CHANGED 12		// Percent of compared beams that must change for a new keyframe
+#define KEYFRAME_TURN 2.0f		// Degrees of yaw, pitch or roll since the keyframe for a new keyframe
+
+/*	Gate state, owned by the fuser.  The keyframe is the last scan pair that
+	was kept; every new pair is compared with it, not with the pair before,
+	so slow walking still adds up to a new keyframe.
+*/
+struct keyframe_gate {
+	uint32_t heartbeat;			// Milliseconds after which a pair is kept anyway, 0 = keep every pair
+	uint64_t last;				// host_time of the keyframe
+	int held;				// Bit n is set if range[n] holds the keyframe of LIDAR n
+	uint16_t range[LIDAR_DEVICES][KEYFRAME_BEAMS];	// Every KEYFRAME_STRIDE'th beam of the keyframe
+	uint16_t startstep[LIDAR_DEVICES];	// Geometry of the keyframe scans
+	uint16_t cluster[LIDAR_DEVICES];
+	uint16_t count[LIDAR_DEVICES];
+	struct imu_sample imu;			// Attitude at the keyframe
+	int attitude;				// 1 if imu is valid
+
+	// Statistics
+	uint32_t pairs;				// Pairs checked
+	uint32_t kept;				// Pairs kept, for each of the reasons below
+	uint32_t moved;				// Enough beams changed
+	uint32_t turned;			// The IMU turned far enough
+	uint32_t heartbeats;			// The heartbeat came due
+	uint32_t changes;			// A sensor appeared or changed its geometry
+};
+
+/* ****************************************************************************** */
+/* ************************ Function Declarations ******************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: keyframe_init()
+Purpose:  Clears a gate and its statistics
+Input:    Gate, heartbeat in milliseconds (0 keeps every pair)
+**************************************************************************/
+void keyframe_init(struct keyframe_gate * gate, uint32_t heartbeat);
+
+/*************************************************************************
+Function: keyframe_check()
+Purpose:  Decides whether a (filtered) scan pair carries new information
+          and, if it does, makes it the keyframe
+Input:    Gate, scan pair, attitude at the time of the pair (NULL if none)
+Returns:  1 to keep the pair, 0 if it repeats the keyframe
+**************************************************************************/
+int keyframe_check(struct keyframe_gate * gate, const struct lidar_pair * pair, const struct imu_sample * imu);
+
+#endif
+/* ****************************************************************************** */
+// End of KEYFRAME.H
+/* ****************************************************************************** */
@@ -0,0 +1,257 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                              LCD Code                                  */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+
+/* ****************************************************************************** */
+/* *******************************   About  ************************************* */
+/* ****************************************************************************** */
+// This code contains the 4D Systems uLCD-32PT serial (SGC) display commands
+
+/* ****************************************************************************** */
+/* ********************   Configuration Definitions  **************************** */
+/* ****************************************************************************** */
+/*	(Information obtained from 4D Systems "PICASO-SGC Command Set")
+
+	Every command is a 1-byte command symbol followed by binary parameters.
+	Coordinates and colours are 2 bytes each, MSB first (the 320 pixel axis does
+	not fit in one byte).  The display answers every command with ACK (06H) once
+	it has been executed, or NAK (15H) if it could not be.
+
+	U (55H)		Autobaud, must be the first byte after power up
+	E (45H)		Clear screen
+	B (42H)		Background colour
+	p (70H)		Pen size: 0 = solid, 1 = wire frame
+	P (50H)		Put pixel: x, y, colour
+	L (4CH)		Line: x1, y1, x2, y2, colour
+	r (72H)		Rectangle: x1, y1, x2, y2, colour
+	s (73H)		Text string: column, row, font, colour, characters, 00H
+*/
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include "prefiremapping.h"
+#include "lcd.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+
+/* ****************************************************************************** */
+/* ****************************** Functions ************************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: lcd_open()
+Purpose:  Opens the display serial port and sends the autobaud command
+Input:    Display, device name to open
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int lcd_open(struct lcd * display, char * name){
+	struct termios tio;
+	uint8_t autobaud = 'U';
+	memset(display, 0, sizeof(*display));
+	display->fd = -1;
+	if(DEBUGGING_MODE == 1){
+		printf("***In Debugging Mode - Not Opening LCD***\n");
+		return -1;
+	}
+	display->fd = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if(display->fd < 0){
+		problem = 50;
+		return -1;
+	}
+	if(isatty(display->fd) && tcgetattr(display->fd, &tio) == 0){
+		cfmakeraw(&tio);
+		cfsetispeed(&tio, B115200);
+		cfsetospeed(&tio, B115200);
+		tio.c_cc[VMIN] = 1;
+		tio.c_cc[VTIME] = 0;
+		tcsetattr(display->fd, TCSANOW, &tio);
+		tcflush(display->fd, TCIOFLUSH);
+	}
+	if(lcd_command(display, &autobaud, 1) != 0){
+		problem = 50;
+		close(display->fd);
+		display->fd = -1;
+		return -1;
+	}
+	if(VERBOSE_MODE == 1)
+		printf("Opened LCD Connection\n");
+	return 0;
+}
+
+/*************************************************************************
+Function: lcd_close()
+Purpose:  Closes the display serial port
+Input:    Display
+Returns:  0 if successful, <0 if not
+**************************************************************************/
+int lcd_close(struct lcd * display){
+	int result;
+	if(display->fd < 0){
+		problem = -4;
+		return -1;
+	}
+	result = close(display->fd);
+	display->fd = -1;
+	if(VERBOSE_MODE == 1)
+		printf("Closed LCD Connection\n");
+	return result;
+}
+
+/*************************************************************************
+Function: lcd_command()
+Purpose:  Sends a raw SGC command and waits for the ACK/NAK reply
+Input:    Display, command bytes, command length
+Returns:  0 if acknowledged, -1 if not
+**************************************************************************/
+int lcd_command(struct lcd * display, const uint8_t * command, int length){
+	struct pollfd pfd;
+	uint8_t reply = 0;
+	if(DEBUGGING_MODE == 1 || display->fd < 0)
+		return -1;
+	if(write(display->fd, command, length) != length){
+		problem = 51;
+		return -1;
+	}
+	display->bytes += length;
+	pfd.fd = display->fd;
+	pfd.events = POLLIN;
+	if(poll(&pfd, 1, LCD_ACK_TIMEOUT) <= 0 || read(display->fd, &reply, 1) != 1){
+		display->timeouts++;
+		problem = 52;
+		return -1;
+	}
+	if(reply != LCD_ACK){
+		display->naks++;
+		problem = 52;
+		return -1;
+	}
+	display->commands++;
+	return 0;
+}
+
+/*************************************************************************
+Function: lcd_put16()
+Purpose:  Stores a 16-bit parameter MSB first
+Input:    Destination, value
+**************************************************************************/
+static void lcd_put16(uint8_t * destination, int value){
+	destination[0] = (value >> 8) & 0xFF;
+	destination[1] = value & 0xFF;
+}
+
+/*************************************************************************
+Function: lcd_clear()
+Purpose:  Sends an E command to clear the screen to the background colour
+Input:    Display
+**************************************************************************/
+int lcd_clear(struct lcd * display){
+	uint8_t command = 'E';
+	return lcd_command(display, &command, 1);
+}
+
+/*************************************************************************
+Function: lcd_background()
+Purpose:  Sends a B command to set the background colour
+Input:    Display, RGB565 colour
+**************************************************************************/
+int lcd_background(struct lcd * display, uint16_t colour){
+	uint8_t command[3];
+	command[0] = 'B';
+	lcd_put16(command+1, colour);
+	return lcd_command(display, command, 3);
+}
+
+/*************************************************************************
+Function: lcd_penSize()
+Purpose:  Sends a p command to select solid (0) or wire frame (1) shapes
+Input:    Display, pen size
+**************************************************************************/
+int lcd_penSize(struct lcd * display, int pen){
+	uint8_t command[2];
+	command[0] = 'p';
+	command[1] = pen ? 1 : 0;
+	return lcd_command(display, command, 2);
+}
+
+/*************************************************************************
+Function: lcd_pixel()
+Purpose:  Sends a P command to draw one pixel
+Input:    Display, x, y, RGB565 colour
+**************************************************************************/
+int lcd_pixel(struct lcd * display, int x, int y, uint16_t colour){
+	uint8_t command[7];
+	command[0] = 'P';
+	lcd_put16(command+1, x);
+	lcd_put16(command+3, y);
+	lcd_put16(command+5, colour);
+	return lcd_command(display, command, 7);
+}
+
+/*************************************************************************
+Function: lcd_line()
+Purpose:  Sends an L command to draw a line
+Input:    Display, start x/y, end x/y, RGB565 colour
+**************************************************************************/
+int lcd_line(struct lcd * display, int x1, int y1, int x2, int y2, uint16_t colour){
+	uint8_t command[11];
+	command[0] = 'L';
+	lcd_put16(command+1, x1);
+	lcd_put16(command+3, y1);
+	lcd_put16(command+5, x2);
+	lcd_put16(command+7, y2);
+	lcd_put16(command+9, colour);
+	return lcd_command(display, command, 11);
+}
+
+/*************************************************************************
+Function: lcd_rectangle()
+Purpose:  Sends an r command to draw a rectangle (filled if pen size is 0)
+Input:    Display, top left x/y, bottom right x/y, RGB565 colour
+**************************************************************************/
+int lcd_rectangle(struct lcd * display, int x1, int y1, int x2, int y2, uint16_t colour){
+	uint8_t command[11];
+	command[0] = 'r';
+	lcd_put16(command+1, x1);
+	lcd_put16(command+3, y1);
+	lcd_put16(command+5, x2);
+	lcd_put16(command+7, y2);
+	lcd_put16(command+9, colour);
+	return lcd_command(display, command, 11);
+}
+
+/*************************************************************************
+Function: lcd_string()
+Purpose:  Sends an s command to print text at a character position
+Input:    Display, column, row, font (0-3), RGB565 colour, text
+**************************************************************************/
+int lcd_string(struct lcd * display, int column, int row, int font, uint16_t colour, const char * text){
+	uint8_t command[6 + 256 + 1];
+	size_t length = strlen(text);
+	if(length > 256)
+		length = 256;
+	command[0] = 's';
+	command[1] = column;
+	command[2] = row;
+	command[3] = font;
+	lcd_put16(command+4, colour);
+	memcpy(command+6, text, length);
+	command[6+length] = 0x00;
+	return lcd_command(display, command, 7 + length);
+}
+
+/* ****************************************************************************** */
+// End of LCD.C
+/* ****************************************************************************** */
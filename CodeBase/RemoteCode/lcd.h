@@ -0,0 +1,130 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                           LCD Code Header                              */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+#ifndef _LCD_H_
+#define _LCD_H_
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include <stdint.h>
+
+/* ****************************************************************************** */
+/* *****************************   Definitions  ********************************* */
+/* ****************************************************************************** */
+#define LCD_WIDTH 240
+#define LCD_HEIGHT 320
+#define LCD_BAUD 115200
+#define LCD_ACK 0x06
+#define LCD_NAK 0x15
+#define LCD_ACK_TIMEOUT 500			// Milliseconds to wait for ACK/NAK
+
+// RGB565 colours
+#define LCD_RGB(r,g,b) ((uint16_t)((((r) & 0xF8) << 8) | (((g) & 0xFC) << 3) | ((b) >> 3)))
+#define LCD_BLACK 0x0000
+#define LCD_WHITE 0xFFFF
+#define LCD_RED 0xF800
+#define LCD_GREEN 0x07E0
+#define LCD_BLUE 0x001F
+#define LCD_GREY 0x8410
+
+struct lcd {
+	int fd;
+	uint32_t commands;			// Commands acknowledged
+	uint32_t naks;				// Commands rejected
+	uint32_t timeouts;			// Commands with no reply
+	uint64_t bytes;				// Bytes sent to the display
+};
+
+/* ****************************************************************************** */
+/* ************************ Function Declarations ******************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: lcd_open()
+Purpose:  Opens the display serial port and sends the autobaud command
+Input:    Display, device name to open
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int lcd_open(struct lcd * display, char * name);
+
+/*************************************************************************
+Function: lcd_close()
+Purpose:  Closes the display serial port
+Input:    Display
+Returns:  0 if successful, <0 if not
+**************************************************************************/
+int lcd_close(struct lcd * display);
+
+/*************************************************************************
+Function: lcd_command()
+Purpose:  Sends a raw SGC command and waits for the ACK/NAK reply
+Input:    Display, command bytes, command length
+Returns:  0 if acknowledged, -1 if not
+**************************************************************************/
+int lcd_command(struct lcd * display, const uint8_t * command, int length);
+
+/*************************************************************************
+Function: lcd_clear()
+Purpose:  Sends an E command to clear the screen to the background colour
+Input:    Display
+**************************************************************************/
+int lcd_clear(struct lcd * display);
+
+/*************************************************************************
+Function: lcd_background()
+Purpose:  Sends a B command to set the background colour
+Input:    Display, RGB565 colour
+**************************************************************************/
+int lcd_background(struct lcd * display, uint16_t colour);
+
+/*************************************************************************
+Function: lcd_penSize()
+Purpose:  Sends a p command to select solid (0) or wire frame (1) shapes
+Input:    Display, pen size
+**************************************************************************/
+int lcd_penSize(struct lcd * display, int pen);
+
+/*************************************************************************
+Function: lcd_pixel()
+Purpose:  Sends a P command to draw one pixel
+Input:    Display, x, y, RGB565 colour
+**************************************************************************/
+int lcd_pixel(struct lcd * display, int x, int y, uint16_t colour);
+
+/*************************************************************************
+Function: lcd_line()
+Purpose:  Sends an L command to draw a line
+Input:    Display, start x/y, end x/y, RGB565 colour
+**************************************************************************/
+int lcd_line(struct lcd * display, int x1, int y1, int x2, int y2, uint16_t colour);
+
+/*************************************************************************
+Function: lcd_rectangle()
+Purpose:  Sends an r command to draw a rectangle (filled if pen size is 0)
+Input:    Display, top left x/y, bottom right x/y, RGB565 colour
+**************************************************************************/
+int lcd_rectangle(struct lcd * display, int x1, int y1, int x2, int y2, uint16_t colour);
+
+/*************************************************************************
+Function: lcd_string()
+Purpose:  Sends an s command to print text at a character position
+Input:    Display, column, row, font (0-3), RGB565 colour, text
+**************************************************************************/
+int lcd_string(struct lcd * display, int column, int row, int font, uint16_t colour, const char * text);
+
+#endif
+/* ****************************************************************************** */
+// End of LCD.H
+/* ****************************************************************************** */
@@ -0,0 +1,364 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                            Live Map Code                               */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+
+/* ****************************************************************************** */
+/* *******************************   About  ************************************* */
+/* ****************************************************************************** */
+// This code keeps a small occupancy grid of the area around the operator so the
+// handheld can show coverage while scanning.  It is a preview only; the base
+// station still builds the real map from the journal.
+/*
+	Each scan is matched against the grid by brute-force correlation over a
+	small window of x, y and heading around the predicted pose (last pose plus
+	the IMU's change in yaw).  The score of a candidate is the sum of the
+	positive log-odds of the cells its beam endpoints land in.
+
+	Cost control:
+	- Beam directions are looked up in a table built once per scan
+	  configuration, and candidate headings are combined with the predicted
+	  heading by angle addition from a rotation table, so no trig runs per
+	  candidate pose.
+	- All arithmetic is float32 or integer.
+	- The heading candidates are searched from the prediction outwards and the
+	  clock is checked before each one.  When the budget runs out the best
+	  pose so far is used (or the scan is skipped if too little was searched),
+	  and free-space ray tracing is dropped if there is no time left for it.
+	- The grid rolls (shifts by whole cells) to stay centered on the operator,
+	  so its size is fixed regardless of how far they walk.
+*/
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include "prefiremapping.h"
+#include "livemap.h"
+#include "filter.h"
+
+/* ****************************************************************************** */
+/* ****************************** Functions ************************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: livemap_init()
+Purpose:  Clears the grid and places the pose at its center
+Input:    Map
+**************************************************************************/
+void livemap_init(struct livemap * map){
+	int k;
+	float angle;
+	memset(map, 0, sizeof(*map));
+	map->originx = -LIVEMAP_SIZE/2;
+	map->originy = -LIVEMAP_SIZE/2;
+	for(k = 0; k < LIVEMAP_ANGLES; k++){
+		angle = (k - LIVEMAP_SEARCH_ANGLES) * LIVEMAP_ANGLE_STEP;
+		map->rotcos[k] = cosf(angle);
+		map->rotsin[k] = sinf(angle);
+	}
+	polar_init(&map->beams);
+}
+
+/*************************************************************************
+Function: roll()
+Purpose:  Shifts the grid so the pose is near its center again.  Cells that
+          scroll in are unknown.
+Input:    Map
+**************************************************************************/
+static void roll(struct livemap * map){
+	int posex = (int)floorf(map->pose.x / LIVEMAP_RESOLUTION) - map->originx;
+	int posey = (int)floorf(map->pose.y / LIVEMAP_RESOLUTION) - map->originy;
+	int dx = posex - LIVEMAP_SIZE/2;
+	int dy = posey - LIVEMAP_SIZE/2;
+	int row;
+
+	if(abs(dx) <= LIVEMAP_RECENTER && abs(dy) <= LIVEMAP_RECENTER)
+		return;
+	if(abs(dx) >= LIVEMAP_SIZE || abs(dy) >= LIVEMAP_SIZE){
+		memset(map->cell, 0, sizeof(map->cell));
+	}
+	else{
+		if(dy > 0){
+			memmove(map->cell[0], map->cell[dy], (LIVEMAP_SIZE - dy) * LIVEMAP_SIZE);
+			memset(map->cell[LIVEMAP_SIZE - dy], 0, dy * LIVEMAP_SIZE);
+		}
+		else if(dy < 0){
+			memmove(map->cell[-dy], map->cell[0], (LIVEMAP_SIZE + dy) * LIVEMAP_SIZE);
+			memset(map->cell[0], 0, -dy * LIVEMAP_SIZE);
+		}
+		for(row = 0; row < LIVEMAP_SIZE && dx != 0; row++){
+			if(dx > 0){
+				memmove(map->cell[row], map->cell[row] + dx, LIVEMAP_SIZE - dx);
+				memset(map->cell[row] + LIVEMAP_SIZE - dx, 0, dx);
+			}
+			else{
+				memmove(map->cell[row] - dx, map->cell[row], LIVEMAP_SIZE + dx);
+				memset(map->cell[row], 0, -dx);
+			}
+		}
+	}
+	map->originx += dx;
+	map->originy += dy;
+	map->rolls++;
+}
+
+/*************************************************************************
+Function: projectPoints()
+Purpose:  Places the beam endpoints in grid cells for one candidate pose.
+          Points too close to the edge for the search window are marked -1.
+Input:    Map, candidate x/y (mm), candidate heading cosine/sine
+**************************************************************************/
+static void projectPoints(struct livemap * map, float x, float y, float c, float s){
+	const int low = LIVEMAP_SEARCH_CELLS;
+	const int high = LIVEMAP_SIZE - LIVEMAP_SEARCH_CELLS;
+	const float inverse = 1.0f / LIVEMAP_RESOLUTION;
+	float wx, wy;
+	int cx, cy;
+	int n;
+	for(n = 0; n < map->points; n++){
+		wx = x + c*map->localx[n] - s*map->localy[n];
+		wy = y + s*map->localx[n] + c*map->localy[n];
+		cx = (int)floorf(wx * inverse) - map->originx;
+		cy = (int)floorf(wy * inverse) - map->originy;
+		if(cx < low || cx >= high || cy < low || cy >= high)
+			cx = -1;
+		map->cellx[n] = cx;
+		map->celly[n] = cy;
+	}
+}
+
+/*************************************************************************
+Function: scoreWindow()
+Purpose:  Scores every x/y offset in the search window for the projected
+          points and returns the best one (ties go to the smaller offset)
+Input:    Map, locations of best offset and score to output
+**************************************************************************/
+static void scoreWindow(struct livemap * map, int * bestdx, int * bestdy, int32_t * bestscore){
+	const int width = 2*LIVEMAP_SEARCH_CELLS + 1;
+	int32_t score[2*LIVEMAP_SEARCH_CELLS + 1][2*LIVEMAP_SEARCH_CELLS + 1];
+	const int8_t * row;
+	int8_t value;
+	int dx, dy;
+	int distance, bestdistance;
+	int n;
+
+	memset(score, 0, sizeof(score));
+	for(n = 0; n < map->points; n++){
+		if(map->cellx[n] < 0)
+			continue;
+		for(dy = 0; dy < width; dy++){
+			row = map->cell[map->celly[n] + dy - LIVEMAP_SEARCH_CELLS] + map->cellx[n] - LIVEMAP_SEARCH_CELLS;
+			for(dx = 0; dx < width; dx++){
+				value = row[dx];
+				if(value > 0)
+					score[dy][dx] += value;
+			}
+		}
+	}
+
+	*bestscore = -1;
+	bestdistance = 0;
+	for(dy = 0; dy < width; dy++){
+		for(dx = 0; dx < width; dx++){
+			distance = abs(dx - LIVEMAP_SEARCH_CELLS) + abs(dy - LIVEMAP_SEARCH_CELLS);
+			if(score[dy][dx] > *bestscore || (score[dy][dx] == *bestscore && distance < bestdistance)){
+				*bestscore = score[dy][dx];
+				*bestdx = dx - LIVEMAP_SEARCH_CELLS;
+				*bestdy = dy - LIVEMAP_SEARCH_CELLS;
+				bestdistance = distance;
+			}
+		}
+	}
+}
+
+/*************************************************************************
+Function: insertScan()
+Purpose:  Marks beam endpoints as occupied and, if traceFree is set, the
+          cells between the pose and each endpoint as free
+Input:    Map, trace free space flag
+**************************************************************************/
+static void insertScan(struct livemap * map, int traceFree){
+	int originx = (int)floorf(map->pose.x / LIVEMAP_RESOLUTION) - map->originx;
+	int originy = (int)floorf(map->pose.y / LIVEMAP_RESOLUTION) - map->originy;
+	int x, y, x1, y1;
+	int dx, dy, sx, sy, error, e2;
+	int value;
+	int n;
+
+	projectPoints(map, map->pose.x, map->pose.y, cosf(map->pose.theta), sinf(map->pose.theta));
+	for(n = 0; n < map->points; n++){
+		x1 = map->cellx[n];
+		y1 = map->celly[n];
+		if(x1 < 0)
+			continue;
+		if(traceFree){
+			// Bresenham from the pose to the cell before the endpoint
+			x = originx;
+			y = originy;
+			dx = abs(x1 - x);
+			dy = -abs(y1 - y);
+			sx = (x < x1) ? 1 : -1;
+			sy = (y < y1) ? 1 : -1;
+			error = dx + dy;
+			while(x != x1 || y != y1){
+				if(x >= 0 && x < LIVEMAP_SIZE && y >= 0 && y < LIVEMAP_SIZE){
+					value = map->cell[y][x] - LIVEMAP_FREE;
+					map->cell[y][x] = (value < LIVEMAP_MIN) ? LIVEMAP_MIN : value;
+				}
+				e2 = 2*error;
+				if(e2 >= dy){
+					error += dy;
+					x += sx;
+				}
+				if(e2 <= dx){
+					error += dx;
+					y += sy;
+				}
+			}
+		}
+		value = map->cell[y1][x1] + LIVEMAP_HIT;
+		map->cell[y1][x1] = (value > LIVEMAP_MAX) ? LIVEMAP_MAX : value;
+	}
+}
+
+/*************************************************************************
+Function: livemap_addScan()
+Purpose:  Matches a scan against the grid around the predicted pose and, if
+          the match was made in time, inserts it.  Stops searching when the
+          budget runs out and keeps the best pose found so far.
+Input:    Map, scan, IMU sample taken with the scan (NULL if none), budget
+          in nanoseconds
+Returns:  LIVEMAP_FIRST, LIVEMAP_MATCHED, LIVEMAP_TRUNCATED or LIVEMAP_SKIPPED
+**************************************************************************/
+int livemap_addScan(struct livemap * map, const struct lidar_scan * scan, const struct imu_sample * imu, uint64_t budget){
+	uint64_t start = pfm_time_ns();
+	uint64_t deadline = start + budget;
+	float theta = map->pose.theta;
+	float basecos, basesin, c, s;
+	float delta;
+	int32_t score, bestscore = -1;
+	int dx, dy, bestdx = 0, bestdy = 0, bestk = LIVEMAP_SEARCH_ANGLES;
+	int searched = 0;
+	int result;
+	int i, k;
+
+	polar_prepare(&map->beams, scan);
+	map->points = polar_points(&map->beams, scan->range, scan->count, LIVEMAP_DECIMATE, FILTER_ERROR_LIMIT, LIVEMAP_MAX_RANGE,
+		map->localx, map->localy);
+	map->scans++;
+
+	// Predict the heading from the IMU (yaw is clockwise, the map is counterclockwise)
+	if(imu != NULL && (imu->channels & IMU_CH_YAW)){
+		if(map->haveyaw){
+			delta = -(imu->yaw - map->lastyaw) * (float)(M_PI/180);
+			if(delta > M_PI)
+				delta -= 2*M_PI;
+			else if(delta < -M_PI)
+				delta += 2*M_PI;
+			theta += delta;
+		}
+		map->lastyaw = imu->yaw;
+		map->haveyaw = 1;
+	}
+
+	if(!map->started){
+		map->pose.theta = theta;
+		insertScan(map, 1);
+		map->started = 1;
+		result = LIVEMAP_FIRST;
+	}
+	else{
+		// Headings from the prediction outwards: 0, +1, -1, +2, -2, ...
+		basecos = cosf(theta);
+		basesin = sinf(theta);
+		result = LIVEMAP_MATCHED;
+		for(i = 0; i < LIVEMAP_ANGLES; i++){
+			if(pfm_time_ns() > deadline){
+				result = (searched < LIVEMAP_MIN_ANGLES) ? LIVEMAP_SKIPPED : LIVEMAP_TRUNCATED;
+				break;
+			}
+			k = LIVEMAP_SEARCH_ANGLES + ((i & 1) ? (i+1)/2 : -(i/2));
+			c = basecos*map->rotcos[k] - basesin*map->rotsin[k];
+			s = basesin*map->rotcos[k] + basecos*map->rotsin[k];
+			projectPoints(map, map->pose.x, map->pose.y, c, s);
+			scoreWindow(map, &dx, &dy, &score);
+			if(score > bestscore){
+				bestscore = score;
+				bestdx = dx;
+				bestdy = dy;
+				bestk = k;
+			}
+			searched++;
+		}
+		// A skipped scan still keeps the predicted heading, since lastyaw has
+		// already moved on to this scan's yaw
+		if(result != LIVEMAP_SKIPPED)
+			theta += (bestk - LIVEMAP_SEARCH_ANGLES) * LIVEMAP_ANGLE_STEP;
+		if(theta > M_PI)
+			theta -= 2*M_PI;
+		else if(theta < -M_PI)
+			theta += 2*M_PI;
+		map->pose.theta = theta;
+		if(result != LIVEMAP_SKIPPED){
+			map->pose.x += bestdx * LIVEMAP_RESOLUTION;
+			map->pose.y += bestdy * LIVEMAP_RESOLUTION;
+			roll(map);
+			insertScan(map, pfm_time_ns() < deadline);
+		}
+	}
+
+	if(result == LIVEMAP_MATCHED || result == LIVEMAP_FIRST)
+		map->matched++;
+	else if(result == LIVEMAP_TRUNCATED)
+		map->truncated++;
+	else
+		map->skipped++;
+	map->lasttime = pfm_time_ns() - start;
+	if(map->lasttime > map->maxtime)
+		map->maxtime = map->lasttime;
+	return result;
+}
+
+/*************************************************************************
+Function: livemap_view()
+Purpose:  Downsamples the grid for the display
+Input:    Map, location of view to output
+**************************************************************************/
+void livemap_view(const struct livemap * map, struct livemap_view * view){
+	int vx, vy, x, y;
+	int wall, free;
+	int8_t value;
+	for(vy = 0; vy < LIVEMAP_VIEW_SIZE; vy++){
+		for(vx = 0; vx < LIVEMAP_VIEW_SIZE; vx++){
+			wall = 0;
+			free = 0;
+			for(y = vy*LIVEMAP_VIEW_SCALE; y < (vy+1)*LIVEMAP_VIEW_SCALE; y++){
+				for(x = vx*LIVEMAP_VIEW_SCALE; x < (vx+1)*LIVEMAP_VIEW_SCALE; x++){
+					value = map->cell[y][x];
+					if(value > LIVEMAP_OCCUPIED)
+						wall = 1;
+					else if(value < 0)
+						free = 1;
+				}
+			}
+			view->cell[vy][vx] = wall ? LIVEMAP_VIEW_WALL : (free ? LIVEMAP_VIEW_FREE : LIVEMAP_VIEW_UNKNOWN);
+		}
+	}
+	view->posex = ((int)floorf(map->pose.x / LIVEMAP_RESOLUTION) - map->originx) / LIVEMAP_VIEW_SCALE;
+	view->posey = ((int)floorf(map->pose.y / LIVEMAP_RESOLUTION) - map->originy) / LIVEMAP_VIEW_SCALE;
+	view->theta = map->pose.theta;
+}
+
+/* ****************************************************************************** */
+// End of LIVEMAP.C
+/* ****************************************************************************** */
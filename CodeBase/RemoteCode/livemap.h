@@ -0,0 +1,148 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                         Live Map Code Header                           */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+#ifndef _LIVEMAP_H_
+#define _LIVEMAP_H_
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include <stdint.h>
+#include "hokuyo_comm.h"
+#include "imu.h"
+#include "polar.h"
+
+/* ****************************************************************************** */
+/* *****************************   Definitions  ********************************* */
+/* ****************************************************************************** */
+// Grid
+#define LIVEMAP_SIZE 256			// Cells per side (must be a power of two)
+#define LIVEMAP_RESOLUTION 50.0f		// Millimeters per cell (12.8 m square)
+#define LIVEMAP_RECENTER 48			// Cells the pose may leave the center before the grid rolls
+#define LIVEMAP_HIT 24				// Log-odds added to a cell a beam ends in
+#define LIVEMAP_FREE 4				// Log-odds removed from a cell a beam passes through
+#define LIVEMAP_MAX 100				// Log-odds clamp
+#define LIVEMAP_MIN -60
+#define LIVEMAP_OCCUPIED 30			// Log-odds above which a cell is drawn as a wall
+
+// Scan use
+#define LIVEMAP_DECIMATE 2			// Use every Nth beam
+#define LIVEMAP_MAX_BEAMS (LIDAR_MAX_POINTS/LIVEMAP_DECIMATE)
+#define LIVEMAP_MAX_RANGE 5600			// Millimeters, URG-04LX specified range
+
+// Correlative search window around the predicted pose
+#define LIVEMAP_SEARCH_CELLS 4			// +/- cells in x and y
+#define LIVEMAP_SEARCH_ANGLES 8			// +/- angle steps
+#define LIVEMAP_ANGLE_STEP 0.00872665f		// 0.5 degrees in radians
+#define LIVEMAP_ANGLES (2*LIVEMAP_SEARCH_ANGLES + 1)
+#define LIVEMAP_MIN_ANGLES 3			// Angles that must be searched before a match is trusted
+
+#define LIVEMAP_BUDGET_NS 30000000ULL		// Hard per-scan budget (30 ms on the Cortex-A8)
+
+// View for the display
+#define LIVEMAP_VIEW_SIZE 64			// Cells per side of the coarse view
+#define LIVEMAP_VIEW_SCALE (LIVEMAP_SIZE/LIVEMAP_VIEW_SIZE)
+#define LIVEMAP_VIEW_UNKNOWN 0
+#define LIVEMAP_VIEW_FREE 1
+#define LIVEMAP_VIEW_WALL 2
+
+// Result of livemap_addScan()
+#define LIVEMAP_FIRST 0				// First scan, inserted without matching
+#define LIVEMAP_MATCHED 1			// Full search finished within budget
+#define LIVEMAP_TRUNCATED 2			// Search cut short by the budget, best match used
+#define LIVEMAP_SKIPPED 3			// Budget gone before a usable match, scan not inserted
+
+struct livemap_pose {
+	float x;				// Millimeters, map frame
+	float y;
+	float theta;				// Radians, counterclockwise
+};
+
+struct livemap {
+	int8_t cell[LIVEMAP_SIZE][LIVEMAP_SIZE];	// [y][x] log-odds
+	int originx;				// World cell of cell[0][0]
+	int originy;
+	struct livemap_pose pose;
+	int started;
+
+	// Beam direction table, rebuilt when the scan configuration changes
+	struct polar_table beams;
+
+	// Search rotation table (offsets from the predicted heading)
+	float rotcos[LIVEMAP_ANGLES];
+	float rotsin[LIVEMAP_ANGLES];
+
+	// Work space
+	float localx[LIVEMAP_MAX_BEAMS];
+	float localy[LIVEMAP_MAX_BEAMS];
+	int32_t cellx[LIVEMAP_MAX_BEAMS];
+	int32_t celly[LIVEMAP_MAX_BEAMS];
+	int points;
+
+	// IMU heading prior
+	float lastyaw;
+	int haveyaw;
+
+	// Statistics
+	uint32_t scans;
+	uint32_t matched;
+	uint32_t truncated;
+	uint32_t skipped;
+	uint32_t rolls;
+	uint64_t lasttime;			// Nanoseconds spent on the last scan
+	uint64_t maxtime;
+};
+
+/*	Coarse copy of the grid for the display, centered on the grid */
+struct livemap_view {
+	uint8_t cell[LIVEMAP_VIEW_SIZE][LIVEMAP_VIEW_SIZE];	// LIVEMAP_VIEW_* codes, [y][x]
+	int posex;				// Pose in view cells
+	int posey;
+	float theta;
+	uint32_t seq;				// Scan the view was made after
+};
+
+/* ****************************************************************************** */
+/* ************************ Function Declarations ******************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: livemap_init()
+Purpose:  Clears the grid and places the pose at its center
+Input:    Map
+**************************************************************************/
+void livemap_init(struct livemap * map);
+
+/*************************************************************************
+Function: livemap_addScan()
+Purpose:  Matches a scan against the grid around the predicted pose and, if
+          the match was made in time, inserts it.  Stops searching when the
+          budget runs out and keeps the best pose found so far.
+Input:    Map, scan, IMU sample taken with the scan (NULL if none), budget
+          in nanoseconds
+Returns:  LIVEMAP_FIRST, LIVEMAP_MATCHED, LIVEMAP_TRUNCATED or LIVEMAP_SKIPPED
+**************************************************************************/
+int livemap_addScan(struct livemap * map, const struct lidar_scan * scan, const struct imu_sample * imu, uint64_t budget);
+
+/*************************************************************************
+Function: livemap_view()
+Purpose:  Downsamples the grid for the display
+Input:    Map, location of view to output
+**************************************************************************/
+void livemap_view(const struct livemap * map, struct livemap_view * view);
+
+#endif
+/* ****************************************************************************** */
+// End of LIVEMAP.H
+/* ****************************************************************************** */
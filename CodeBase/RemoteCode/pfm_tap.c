@@ -0,0 +1,162 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                         Scan Ring Tap Program                          */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+
+/* ****************************************************************************** */
+/* *******************************   About  ************************************* */
+/* ****************************************************************************** */
+// This program reads scans out of the acquisition daemon's shared memory ring
+// (see shmring.c) in a separate process.  It prints each scan, or records them
+// to a journal of its own, and can be started, killed and restarted at any
+// time without the daemon noticing.  When the daemon restarts, the tap
+// attaches to the new ring.
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include "prefiremapping.h"
+#include "pipeline.h"
+#include <signal.h>
+#include <poll.h>
+
+/* ****************************************************************************** */
+/* *****************************   Definitions  ********************************* */
+/* ****************************************************************************** */
+#define TAP_WAIT 500			// Milliseconds between attach attempts and shutdown checks
+
+/* ****************************************************************************** */
+/* ********************   Configuration Definitions  **************************** */
+/* ****************************************************************************** */
+
+char * ringname = SCAN_RING;			// Shared Memory Scan Ring Name
+char * journalname = NULL;			// Journal to Record to (optional)
+long limit = 0;					// Scans to Read, 0 = until stopped
+int quiet = 0;					// Print Only the Summary
+
+volatile sig_atomic_t shutdown_requested = 0;	// Set by SIGINT/SIGTERM
+
+/*************************************************************************
+Function: requestShutdown()
+Purpose:  Signal handler, asks the main loop to stop
+Input:    Signal number
+**************************************************************************/
+static void requestShutdown(int signum){
+	shutdown_requested = 1;
+}
+
+/*************************************************************************
+Function: usage()
+Purpose:  Prints the command line options
+Input:    Program name
+**************************************************************************/
+static void usage(char * name){
+	printf("Usage: %s [-t ring] [-o journal] [-c count] [-q]\n", name);
+	printf("  -t  Shared memory ring to read (default %s)\n", SCAN_RING);
+	printf("  -o  Record the scans to a journal\n");
+	printf("  -c  Stop after this many scans\n");
+	printf("  -q  Print only the summary\n");
+}
+
+/* ****************************************************************************** */
+/* **************************** Main Program ************************************ */
+/* ****************************************************************************** */
+int main(int argc,char **argv){
+	struct sigaction action;
+	struct shmring_reader reader;
+	struct storage store;
+	struct pfm_frame copy;
+	const struct pfm_frame * frame;
+	uint64_t received = 0, lost = 0, torn = 0;
+	int attached = 0, attaches = 0;
+	int option;
+	int result;
+
+	problem = 0;
+	while((option = getopt(argc, argv, "t:o:c:qh")) != -1){
+		switch(option){
+			case 't': ringname = optarg; break;
+			case 'o': journalname = optarg; break;
+			case 'c': limit = atol(optarg); break;
+			case 'q': quiet = 1; break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = requestShutdown;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	store.fd = -1;
+	if(journalname != NULL && storage_open(&store, journalname) != 0){
+		printf("Problem Opening Journal %s\n", journalname);
+		return 1;
+	}
+
+	while(!shutdown_requested && (limit == 0 || received < limit)){
+		if(!attached){
+			if(shmring_attach(&reader, ringname, sizeof(struct pfm_frame)) != 0){
+				poll(NULL, 0, TAP_WAIT);
+				continue;
+			}
+			attached = 1;
+			attaches++;
+			if(!quiet)
+				printf("Attached to %s (writer %u)\n", ringname, reader.ring.header->writerpid);
+		}
+		result = shmring_wait(&reader, TAP_WAIT);
+		while(result == SHMRING_ITEM && (result = shmring_peek(&reader, (const void **)&frame)) == SHMRING_ITEM){
+			// Recording needs a stable copy; printing reads the slot in place
+			if(store.fd >= 0)
+				copy = *frame;
+			else if(!quiet)
+				printf("scan %6u sensor %u  %4u beams  t %.3f s%s\n", frame->scan.seq, frame->scan.sensor,
+					frame->scan.count, frame->scan.sync_time / 1e9, frame->attitude ? "  attitude" : "");
+			if(!shmring_done(&reader)){
+				torn++;
+				continue;
+			}
+			if(store.fd >= 0){
+				storage_writeScan(&store, &copy.scan);
+				if(!quiet)
+					printf("scan %6u sensor %u  %4u beams recorded\n", copy.scan.seq, copy.scan.sensor, copy.scan.count);
+			}
+			received++;
+			if(limit != 0 && received >= limit)
+				break;
+		}
+		if(result == SHMRING_CLOSED){
+			lost += reader.lost;
+			shmring_detach(&reader);
+			attached = 0;
+			if(!quiet)
+				printf("Writer Stopped, Waiting for %s\n", ringname);
+		}
+	}
+	if(attached){
+		lost += reader.lost;
+		shmring_detach(&reader);
+	}
+	if(store.fd >= 0)
+		storage_close(&store);
+	printf("%llu scans, %llu lost (%llu overwritten while being read), %d attaches\n", (unsigned long long)received,
+		(unsigned long long)lost, (unsigned long long)torn, attaches);
+	return 0;
+}
+/* ****************************************************************************** */
+// End of PFM_TAP.C
+/* ****************************************************************************** */
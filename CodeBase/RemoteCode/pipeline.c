@@ -0,0 +1,1134 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                       Acquisition Pipeline Code                        */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+
+/* ****************************************************************************** */
+/* *******************************   About  ************************************* */
+/* ****************************************************************************** */
+// This code runs the acquisition daemon: one thread per concern, connected by
+// bounded queues.
+/*
+	LIDAR reader --[scans: drop newest]--\
+	                                      fuser --[records: block]--> storage writer
+	IMU reader ----[imu: drop newest]----/      |-[frames: keep latest]--> LCD renderer
+	                                             \-[mapframes: keep latest]--> mapper
+	                                                   mapper --[views: keep latest]--> LCD renderer
+	storage writer --[outgoing: drop newest]--> stream (TCP to the base station)
+	fuser --[shared memory ring: overwrite oldest]--> other processes (see shmring.c)
+
+	The sensor readers never wait on anything but their device.  When the fuser
+	falls behind, the scan/IMU queues fill and the readers drop (and count) new
+	items instead of stalling the serial ports.  The journal queue blocks, so a
+	slow flash write holds up only the fuser, which the dropping queues isolate
+	from the sensors.  The LCD only ever draws the newest frame, and the mapper
+	only ever matches the newest scan, so when it runs over its time budget it
+	skips scans rather than falling further behind.  The stream drops freely
+	too: anything it misses is read back from the journal.
+*/
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include "prefiremapping.h"
+#include "pipeline.h"
+#include <poll.h>
+#include <sys/socket.h>
+
+/* ****************************************************************************** */
+/* ****************************** Functions ************************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: stage_account()
+Purpose:  Adds one processed item to a stage's statistics
+Input:    Stage, time processing of the item started
+**************************************************************************/
+static void stage_account(struct pfm_stage * stage, uint64_t start){
+	uint64_t elapsed = pfm_time_ns() - start;
+	__atomic_add_fetch(&stage->items, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&stage->busy, elapsed, __ATOMIC_RELAXED);
+	if(elapsed > stage->maxbusy)
+		__atomic_store_n(&stage->maxbusy, elapsed, __ATOMIC_RELAXED);
+}
+
+/*************************************************************************
+Function: sendPair()
+Purpose:  Queues the pending scans for the fuser and empties the pair
+Input:    Pipeline, pair
+**************************************************************************/
+static void sendPair(struct pfm_pipeline * pfm, struct lidar_pair * pair){
+	if(pair->valid == 0)
+		return;
+	queue_push(&pfm->scans, pair, 0);
+	if(pair->valid == (1 << LIDAR_DEVICES) - 1)
+		pfm->pairs++;
+	else
+		pfm->singles++;
+	pair->valid = 0;
+}
+
+/*************************************************************************
+Function: pairScan()
+Purpose:  Adds a scan to the pending pair.  The pair is sent as soon as every
+          fitted sensor has a scan in it; a scan whose partner was taken more
+          than LIDAR_PAIR_WINDOW apart is sent on its own.
+Input:    Pipeline, pending pair, scan
+**************************************************************************/
+static void pairScan(struct pfm_pipeline * pfm, struct lidar_pair * pair, struct lidar_scan * scan){
+	uint8_t fitted = 0;
+	uint8_t bit = 1 << scan->sensor;
+	int d;
+
+	for(d = 0; d < LIDAR_DEVICES; d++){
+		if(pfm->lidar[d].name == NULL)
+			continue;
+		fitted |= 1 << d;
+		// A pending scan from too long before this one will not be paired now
+		if(d != scan->sensor && (pair->valid & (1 << d)) &&
+		   llabs((int64_t)(pair->scan[d].sync_time - scan->sync_time)) > LIDAR_PAIR_WINDOW*1000000LL)
+			sendPair(pfm, pair);
+	}
+	if(pair->valid & bit)
+		sendPair(pfm, pair);		// This sensor's previous scan never found a partner
+	pair->scan[scan->sensor] = *scan;
+	pair->valid |= bit;
+	if((pair->valid & fitted) == fitted)
+		sendPair(pfm, pair);
+}
+
+/*************************************************************************
+Function: recoverLidar()
+Purpose:  Escalates when a sensor's scans stop decoding: QT+MD first, then
+          reopening the port (retried every LIDAR_STALL_TIMEOUT until it works)
+Input:    Pipeline, device
+**************************************************************************/
+static void recoverLidar(struct pfm_pipeline * pfm, struct lidar_device * device){
+	device->level++;
+	if(device->port != NULL && device->level == 1 && lidar_restart(device) == 0){
+		device->restarts++;
+		if(VERBOSE_MODE == 1)
+			printf("LIDAR %s Scans Stalled, Restarted Scanning\n", device->name);
+	}
+	else{
+		device->reopens++;
+		if(VERBOSE_MODE == 1)
+			printf("LIDAR %s Not Answering, Reopening\n", device->name);
+		if(lidar_reopen(device) == 0 && device->ready == 0)
+			device->ready = pfm_time_ns() - pfm->started;
+	}
+	device->badrun = 0;
+	device->lastscan = pfm_time_ns();
+}
+
+/*************************************************************************
+Function: disarmLidar()
+Purpose:  Takes back the read posted on a sensor's port, keeping whatever it
+          received, before anything else reads from or reopens the port
+Input:    Pipeline, sensor, posted reads
+**************************************************************************/
+static void disarmLidar(struct pfm_pipeline * pfm, int d, int * armed){
+	int got;
+
+	if(!armed[d])
+		return;
+	got = ioengine_cancel(&pfm->lidario, d);
+	if(got > 0)
+		lidar_parserReceived(&pfm->lidar[d].parser, got);
+	armed[d] = 0;
+}
+
+/*************************************************************************
+Function: lidar_stage()
+Purpose:  LIDAR reader thread for every fitted sensor.  Starts continuous MD
+          scanning on each as soon as it answers, then waits on all of their
+          ports at once, timestamps every scan on the common clock and queues
+          horizontal/vertical pairs for the fuser.  When a sensor's scans stop
+          decoding it is recovered without disturbing the other.
+Input:    Pipeline
+**************************************************************************/
+static void * lidar_stage(void * arg){
+	struct pfm_pipeline * pfm = arg;
+	struct pfm_stage * stage = &pfm->stage[STAGE_LIDAR];
+	struct lidar_device * device;
+	struct lidar_pair pending;
+	struct lidar_scan scan;
+	struct ioengine_completion done[IOENGINE_DEPTH];
+	int armed[LIDAR_DEVICES];
+	uint64_t rxbytes;
+	uint64_t now;
+	int count, n, d;
+	int result;
+
+	if(pfm->realtime)
+		rt_prefaultStack();
+	pending.valid = 0;
+	for(d = 0; d < LIDAR_DEVICES; d++){
+		device = &pfm->lidar[d];
+		if(device->port == NULL)
+			continue;
+		lidar_parserReset(&device->parser);
+		if(lidar_start(device, LIDAR_START_TIMEOUT) == 0)
+			device->ready = pfm_time_ns() - pfm->started;
+		else{
+			if(VERBOSE_MODE == 1)
+				printf("LIDAR %s Did Not Answer, Starting Scans Anyway\n", device->name);
+			lidar_startScan(device);
+		}
+	}
+	for(d = 0; d < LIDAR_DEVICES; d++){
+		pfm->lidar[d].lastscan = pfm_time_ns();
+		if(pfm->lidar[d].name != NULL)
+			ioengine_register(&pfm->lidario, pfm->lidar[d].parser.buffer, LIDAR_RXBUFFER);
+		armed[d] = 0;
+	}
+
+	while(pfm->running){
+		// Keep a read posted on every port, straight into the free end of its parser
+		for(d = 0; d < LIDAR_DEVICES; d++){
+			device = &pfm->lidar[d];
+			if(device->port == NULL || armed[d] || device->parser.length >= LIDAR_RXBUFFER)
+				continue;
+			armed[d] = ioengine_read(&pfm->lidario, fileno(device->port), device->parser.buffer + device->parser.length,
+				LIDAR_RXBUFFER - device->parser.length, d) == 0;
+		}
+		count = ioengine_wait(&pfm->lidario, done, IOENGINE_DEPTH, pending.valid ? LIDAR_PAIR_WINDOW : PIPE_POLL_MS);
+
+		for(n = 0; n < count; n++){
+			d = (int)done[n].tag;
+			device = &pfm->lidar[d];
+			armed[d] = 0;
+			if(done[n].result <= 0){
+				device->badrun = LIDAR_BAD_LIMIT;	// Unplugged or hung up, recover now
+				continue;
+			}
+			lidar_parserReceived(&device->parser, done[n].result);
+			while((result = lidar_parseFrame(&device->parser, &scan)) != LIDAR_FRAME_NONE){
+				if(result == LIDAR_FRAME_BAD)
+					device->badrun++;
+				if(result != LIDAR_FRAME_SCAN)
+					continue;
+				scan.sensor = d;
+				scan.seq = device->seq++;
+				lidar_alignTime(device, &scan);
+				device->badrun = 0;
+				device->level = 0;
+				device->lastscan = scan.host_time;
+				if(device->firstscan == 0){
+					device->firstscan = scan.host_time - pfm->started;
+					if(device->ready == 0)
+						device->ready = device->firstscan;	// It never answered, but it is scanning
+					if(VERBOSE_MODE == 1)
+						printf("First LIDAR %s Scan %.0f ms After Startup\n", device->name, device->firstscan / 1e6);
+				}
+				pairScan(pfm, &pending, &scan);
+				stage_account(stage, scan.host_time);
+			}
+		}
+
+		// Don't hold a scan back longer than its partner could take to arrive
+		now = pfm_time_ns();
+		for(d = 0; d < LIDAR_DEVICES; d++)
+			if((pending.valid & (1 << d)) && now - pending.scan[d].host_time > LIDAR_PAIR_WINDOW*1000000ULL)
+				sendPair(pfm, &pending);
+
+		rxbytes = 0;
+		for(d = 0; d < LIDAR_DEVICES; d++){
+			device = &pfm->lidar[d];
+			rxbytes += device->parser.rxbytes;
+			if(device->name == NULL)
+				continue;
+			if(device->port == NULL || device->badrun >= LIDAR_BAD_LIMIT || now - device->lastscan > LIDAR_STALL_TIMEOUT*1000000ULL){
+				disarmLidar(pfm, d, armed);
+				recoverLidar(pfm, device);
+			}
+		}
+		__atomic_store_n(&stage->bytes, rxbytes, __ATOMIC_RELAXED);
+	}
+	sendPair(pfm, &pending);
+
+	for(d = 0; d < LIDAR_DEVICES; d++){
+		device = &pfm->lidar[d];
+		disarmLidar(pfm, d, armed);
+		if(device->port != NULL)
+			lidar_laserOFF(device->port);
+		if(device->name != NULL && VERBOSE_MODE == 1)
+			printf("LIDAR %s Stopped: %u frames, %u bad, %u overflows, %u resyncs\n", device->name,
+				device->parser.frames, device->parser.badframes, device->parser.overflows, device->parser.resyncs);
+	}
+	return NULL;
+}
+
+/*************************************************************************
+Function: imu_stage()
+Purpose:  IMU reader thread.  Starts broadcast mode and queues every decoded
+          sample for the fuser.
+Input:    Pipeline
+**************************************************************************/
+static void * imu_stage(void * arg){
+	struct pfm_pipeline * pfm = arg;
+	struct pfm_stage * stage = &pfm->stage[STAGE_IMU];
+	struct imu_parser parser;
+	struct imu_sample sample;
+	struct ioengine_completion done[IOENGINE_DEPTH];
+	uint32_t seq = 0;
+	int armed = 0;
+	int result;
+
+	if(pfm->realtime)
+		rt_prefaultStack();
+	imu_parserReset(&parser);
+	imu_setChannels(pfm->imufd, IMU_CH_ALL);
+	imu_setBroadcast(pfm->imufd, IMU_BROADCAST_HZ);
+	ioengine_register(&pfm->imuio, parser.buffer, IMU_RXBUFFER);
+	while(pfm->running){
+		// A full buffer must be parsed before anything more can be read
+		if(parser.length < IMU_RXBUFFER){
+			if(!armed)
+				armed = ioengine_read(&pfm->imuio, pfm->imufd, parser.buffer + parser.length,
+					IMU_RXBUFFER - parser.length, 0) == 0;
+			if(ioengine_wait(&pfm->imuio, done, IOENGINE_DEPTH, PIPE_POLL_MS) <= 0)
+				continue;
+			armed = 0;
+			if(done[0].result <= 0)
+				continue;
+			imu_parserReceived(&parser, done[0].result);
+		}
+		__atomic_store_n(&stage->bytes, parser.rxbytes, __ATOMIC_RELAXED);
+		while((result = imu_parsePacket(&parser, &sample)) != IMU_PACKET_NONE){
+			if(result != IMU_PACKET_DATA)
+				continue;
+			sample.seq = seq++;
+			queue_push(&pfm->imu, &sample, 0);
+			stage_account(stage, sample.host_time);
+		}
+	}
+	if(armed)
+		ioengine_cancel(&pfm->imuio, 0);
+	if(VERBOSE_MODE == 1)
+		printf("IMU Stage Stopped: %u packets, %u bad, %u bytes lost\n", parser.packets, parser.badpackets, parser.lostbytes);
+	return NULL;
+}
+
+/*************************************************************************
+Function: fuser_stage()
+Purpose:  Fuser thread.  Filters bad beams out of each scan, attaches the
+          latest attitude to it, forwards scans that pass the keyframe gate
+          and all IMU samples to the journal, and horizontal scans to the
+          display and mapper.
+Input:    Pipeline
+**************************************************************************/
+static void * fuser_stage(void * arg){
+	struct pfm_pipeline * pfm = arg;
+	struct pfm_stage * stage = &pfm->stage[STAGE_FUSER];
+	struct queue * inputs[2];
+	struct imu_sample latest;
+	struct imu_sample * sample;
+	struct lidar_pair * pair;
+	struct lidar_scan * scan;
+	struct pfm_record * record;
+	struct pfm_frame * frame;
+	struct pfm_frame shared;
+	int havelatest = 0;
+	int attitude, keep;
+	uint64_t start;
+	int d;
+
+	inputs[0] = &pfm->scans;
+	inputs[1] = &pfm->imu;
+	memset(&latest, 0, sizeof(latest));
+	for(;;){
+		if(queue_poll(inputs, 2, PIPE_POLL_MS) == 0){
+			if(!pfm->running)
+				break;
+			continue;
+		}
+
+		// IMU first, so each scan sees every sample that arrived before it
+		while((sample = queue_peek(&pfm->imu)) != NULL){
+			start = pfm_time_ns();
+			latest = *sample;
+			havelatest = 1;
+			record = queue_reserve(&pfm->records, PIPE_STORE_WAIT_MS);
+			if(record != NULL){
+				record->type = PFJ_IMU;
+				record->data.imu = *sample;
+				queue_commit(&pfm->records);
+			}
+			queue_release(&pfm->imu);
+			stage_account(stage, start);
+		}
+
+		while((pair = queue_peek(&pfm->scans)) != NULL){
+			start = pfm_time_ns();
+			attitude = 0;
+			for(d = 0; d < LIDAR_DEVICES; d++){
+				if(!(pair->valid & (1 << d)))
+					continue;
+				filter_scan(&pfm->filter[d], &pair->scan[d]);
+				attitude |= havelatest && latest.host_time + PIPE_IMU_MAX_AGE >= pair->scan[d].host_time;
+			}
+			// Only pairs with something new go to the journal (and so the base station)
+			keep = keyframe_check(&pfm->keyframes, pair, attitude ? &latest : NULL);
+			for(d = 0; d < LIDAR_DEVICES; d++){
+				if(!(pair->valid & (1 << d)))
+					continue;
+				if(pfm->ring.header != NULL){
+					shared.scan = pair->scan[d];
+					shared.imu = latest;
+					shared.attitude = havelatest && latest.host_time + PIPE_IMU_MAX_AGE >= pair->scan[d].host_time;
+					shmring_publish(&pfm->ring, &shared);
+				}
+				record = keep ? queue_reserve(&pfm->records, PIPE_STORE_WAIT_MS) : NULL;
+				if(record != NULL){
+					record->type = PFJ_SCAN;
+					record->data.scan = pair->scan[d];
+					queue_commit(&pfm->records);
+				}
+			}
+			if(!(pair->valid & (1 << LIDAR_HORIZONTAL))){
+				queue_release(&pfm->scans);
+				stage_account(stage, start);
+				continue;
+			}
+			scan = &pair->scan[LIDAR_HORIZONTAL];
+			frame = (pfm->display.fd >= 0) ? queue_reserve(&pfm->frames, 0) : NULL;
+			if(frame != NULL){
+				frame->scan = *scan;
+				frame->imu = latest;
+				frame->attitude = havelatest && latest.host_time + PIPE_IMU_MAX_AGE >= scan->host_time;
+				queue_commit(&pfm->frames);
+			}
+			frame = (pfm->map != NULL) ? queue_reserve(&pfm->mapframes, 0) : NULL;
+			if(frame != NULL){
+				frame->scan = *scan;
+				frame->imu = latest;
+				frame->attitude = havelatest && latest.host_time + PIPE_IMU_MAX_AGE >= scan->host_time;
+				queue_commit(&pfm->mapframes);
+			}
+			queue_release(&pfm->scans);
+			stage_account(stage, start);
+		}
+	}
+	return NULL;
+}
+
+/*************************************************************************
+Function: storage_stage()
+Purpose:  Storage writer thread.  Appends records to the journal and syncs it
+          every STORAGE_SYNC_INTERVAL.  Keeps draining the queue when no
+          journal is open so the fuser is never held up.
+Input:    Pipeline
+**************************************************************************/
+static void * storage_stage(void * arg){
+	struct pfm_pipeline * pfm = arg;
+	struct pfm_stage * stage = &pfm->stage[STAGE_STORAGE];
+	struct pfm_record * record;
+	struct stream_record * wire;
+	uint64_t start;
+	int result;
+
+	for(;;){
+		if(queue_wait(&pfm->records, PIPE_POLL_MS) == 0 && pfm->records.stopping)
+			break;
+		while((record = queue_peek(&pfm->records)) != NULL){
+			start = pfm_time_ns();
+			if(record->type == PFJ_SCAN)
+				result = storage_writeScan(&pfm->store, &record->data.scan);
+			else
+				result = storage_writeImu(&pfm->store, &record->data.imu);
+			queue_release(&pfm->records);
+			// Hand the encoded record to the stream, numbered by its place in the journal
+			if(result == 0 && pfm->stream.listenfd >= 0 && (wire = queue_reserve(&pfm->outgoing, 0)) != NULL){
+				wire->seq = pfm->store.records - 1;
+				wire->length = pfm->store.used - pfm->store.last;
+				memcpy(wire->bytes, pfm->store.buffer + pfm->store.last, wire->length);
+				queue_commit(&pfm->outgoing);
+			}
+			stage_account(stage, start);
+		}
+		if(pfm->store.fd >= 0 && pfm_time_ns() - pfm->store.lastsync > STORAGE_SYNC_INTERVAL*1000000ULL)
+			storage_sync(&pfm->store);
+	}
+	// Make the tail of the journal readable for the stream's final replay
+	if(pfm->store.fd >= 0)
+		storage_sync(&pfm->store);
+	return NULL;
+}
+
+/*************************************************************************
+Function: stream_stage()
+Purpose:  Stream thread.  Serves one base station connection: sends live
+          records while the client keeps up and fills any gap from the
+          journal.  After capture stops it finishes the replay (for at most
+          PIPE_STREAM_DRAIN seconds) and tells the client the stream ended.
+Input:    Pipeline
+**************************************************************************/
+static void * stream_stage(void * arg){
+	struct pfm_pipeline * pfm = arg;
+	struct pfm_stage * stage = &pfm->stage[STAGE_STREAM];
+	struct stream * s = &pfm->stream;
+	struct stream_record * record;
+	struct pollfd pfd[3];
+	uint64_t start;
+	uint64_t stopped = 0;
+	uint64_t value;
+	uint32_t available;
+	ssize_t got;
+	int progress = 0;
+	int count, n;
+
+	for(;;){
+		count = 0;
+		pfd[count].fd = s->listenfd;
+		pfd[count++].events = POLLIN;
+		if(s->clientfd >= 0){
+			pfd[count].fd = s->clientfd;
+			pfd[count++].events = POLLIN;
+		}
+		if(queue_count(&pfm->outgoing) == 0){
+			pfd[count].fd = pfm->outgoing.datafd;
+			pfd[count++].events = POLLIN;
+		}
+		if(poll(pfd, count, progress ? 0 : PIPE_POLL_MS) > 0){
+			for(n = count-1; n >= 0; n--){
+				if(!(pfd[n].revents & (POLLIN | POLLHUP | POLLERR)))
+					continue;
+				if(pfd[n].fd == pfm->outgoing.datafd)
+					got = read(pfd[n].fd, &value, sizeof(value));
+				else if(pfd[n].fd == s->clientfd){
+					if(stream_receive(s) != 0)
+						stream_drop(s);
+				}
+				else if(pfd[n].fd == s->listenfd)
+					stream_accept(s);
+			}
+		}
+		progress = 0;
+		start = pfm_time_ns();
+
+		// Live records, for as long as they continue where the client is
+		while((record = queue_peek(&pfm->outgoing)) != NULL){
+			if(s->clientfd < 0 || !s->hello || record->seq < s->nextseq){
+				queue_release(&pfm->outgoing);
+				continue;
+			}
+			if(record->seq > s->nextseq || s->credits == 0)
+				break;
+			n = stream_send(s, record->seq, record->bytes, record->length);
+			queue_release(&pfm->outgoing);
+			if(n != 0)
+				break;
+			stage_account(stage, start);
+			start = pfm_time_ns();
+		}
+
+		// Anything older than the live records comes from the journal
+		if(stream_ready(s)){
+			available = __atomic_load_n(&pfm->store.flushed, __ATOMIC_ACQUIRE);
+			record = queue_peek(&pfm->outgoing);
+			if(record != NULL && record->seq < available)
+				available = record->seq;
+			n = stream_replay(s, available);
+			if(n > 0){
+				__atomic_add_fetch(&stage->items, n - 1, __ATOMIC_RELAXED);
+				stage_account(stage, start);
+				progress = 1;
+			}
+		}
+
+		if(s->clientfd >= 0 && s->hello && pfm_time_ns() - s->lastsend > STREAM_IDLE_INTERVAL*1000000ULL)
+			stream_notify(s, PFS_IDLE);
+
+		if(pfm->outgoing.stopping && queue_count(&pfm->outgoing) == 0){
+			if(stopped == 0)
+				stopped = pfm_time_ns();
+			if(s->clientfd >= 0 && s->hello && s->nextseq >= __atomic_load_n(&pfm->store.flushed, __ATOMIC_ACQUIRE)){
+				stream_notify(s, PFS_END);
+				break;
+			}
+			if(s->clientfd < 0 || pfm_time_ns() - stopped > PIPE_STREAM_DRAIN*1000000000ULL)
+				break;
+		}
+	}
+	(void)got;
+	if(VERBOSE_MODE == 1)
+		printf("Stream Stage Stopped: %u connections, %llu live, %llu replayed\n", s->connects,
+			(unsigned long long)s->live, (unsigned long long)s->replayed);
+	stream_close(s);
+	return NULL;
+}
+
+/*************************************************************************
+Function: mapper_stage()
+Purpose:  Live mapper thread.  Matches the newest scan into the preview map
+          within LIVEMAP_BUDGET_NS and hands a coarse view to the LCD.
+Input:    Pipeline
+**************************************************************************/
+static void * mapper_stage(void * arg){
+	struct pfm_pipeline * pfm = arg;
+	struct pfm_stage * stage = &pfm->stage[STAGE_MAPPER];
+	struct pfm_frame * frame;
+	struct livemap_view * view;
+	uint64_t start;
+	uint32_t seq;
+
+	for(;;){
+		if(queue_wait(&pfm->mapframes, PIPE_POLL_MS) == 0){
+			if(pfm->mapframes.stopping)
+				break;
+			continue;
+		}
+		frame = queue_peek(&pfm->mapframes);
+		if(frame == NULL)
+			continue;
+		start = pfm_time_ns();
+		seq = frame->scan.seq;
+		livemap_addScan(pfm->map, &frame->scan, frame->attitude ? &frame->imu : NULL, LIVEMAP_BUDGET_NS);
+		queue_release(&pfm->mapframes);
+		view = (pfm->display.fd >= 0) ? queue_reserve(&pfm->views, 0) : NULL;
+		if(view != NULL){
+			livemap_view(pfm->map, view);
+			view->seq = seq;
+			queue_commit(&pfm->views);
+		}
+		stage_account(stage, start);
+	}
+	return NULL;
+}
+
+/*************************************************************************
+Function: drawView()
+Purpose:  Draws the coarse live map, the newest scan placed at the map pose
+          and the operator's heading into the back buffer
+Input:    Renderer, view, frame (NULL if none), beam x and y in the sensor
+          frame
+**************************************************************************/
+static void drawView(struct render * r, struct livemap_view * view, struct pfm_frame * frame, const float * beamx, const float * beamy){
+	const int size = LCD_WIDTH / LIVEMAP_VIEW_SIZE;		// Pixels per view cell
+	const int left = (LCD_WIDTH - size*LIVEMAP_VIEW_SIZE) / 2;
+	const float scale = size / (LIVEMAP_VIEW_SCALE * LIVEMAP_RESOLUTION);	// Pixels per millimeter
+	const float c = cosf(view->theta);
+	const float s = sinf(view->theta);
+	int centerx, centery;
+	int x, y, n;
+
+	render_fill(r, 0, RENDER_TOP, LCD_WIDTH-1, LCD_HEIGHT-1, LCD_BLACK);
+	for(y = 0; y < LIVEMAP_VIEW_SIZE; y++){
+		for(x = 0; x < LIVEMAP_VIEW_SIZE; x++){
+			if(view->cell[y][x] == LIVEMAP_VIEW_UNKNOWN)
+				continue;
+			// Map y grows upwards, screen y grows downwards
+			render_fill(r, left + x*size, RENDER_TOP + (LIVEMAP_VIEW_SIZE-1-y)*size,
+				left + x*size + size-1, RENDER_TOP + (LIVEMAP_VIEW_SIZE-1-y)*size + size-1,
+				(view->cell[y][x] == LIVEMAP_VIEW_WALL) ? LCD_WHITE : PIPE_FREE_COLOUR);
+		}
+	}
+	centerx = left + view->posex*size + size/2;
+	centery = RENDER_TOP + (LIVEMAP_VIEW_SIZE-1-view->posey)*size + size/2;
+	if(frame != NULL){
+		for(n = 0; n < frame->scan.count; n += 2){
+			if(frame->scan.range[n] < FILTER_ERROR_LIMIT)
+				continue;
+			render_pixel(r, centerx + (int)((c*beamx[n] - s*beamy[n])*scale), centery - (int)((s*beamx[n] + c*beamy[n])*scale), LCD_GREEN);
+		}
+	}
+	render_line(r, centerx, centery, centerx + (int)(8*c), centery - (int)(8*s), LCD_RED);
+}
+
+/*************************************************************************
+Function: drawScan()
+Purpose:  Draws a top-down view of a scan (forward is up) into the back buffer
+Input:    Renderer, frame, beam x and y in the sensor frame
+**************************************************************************/
+static void drawScan(struct render * r, struct pfm_frame * frame, const float * beamx, const float * beamy){
+	int centerx = LCD_WIDTH/2;
+	int centery = LCD_HEIGHT/2 + 40;
+	float scale = (LCD_WIDTH/2) / 4000.0;	// Pixels per millimeter, 4 m to the edge
+	int n;
+
+	render_fill(r, 0, RENDER_TOP, LCD_WIDTH-1, LCD_HEIGHT-1, LCD_BLACK);
+	// Sensor x is forward (screen up), sensor y is left (screen left)
+	for(n = 0; n < frame->scan.count; n += 2){
+		if(frame->scan.range[n] < FILTER_ERROR_LIMIT)
+			continue;
+		render_pixel(r, centerx - (int)(beamy[n]*scale), centery - (int)(beamx[n]*scale), LCD_GREEN);
+	}
+	render_pixel(r, centerx, centery, LCD_RED);
+}
+
+/*************************************************************************
+Function: lcd_budget()
+Purpose:  Works out how many bytes per second the display may use: what the
+          USB hub has left once the sensors (plus a margin) are served,
+          capped at the display's own link rate
+Input:    Pipeline, seconds since the last call, location of the sensor byte
+          counts at the last call (updated)
+Returns:  Bytes per second
+**************************************************************************/
+static uint32_t lcd_budget(struct pfm_pipeline * pfm, double seconds, uint64_t * lastbytes){
+	uint64_t bytes = __atomic_load_n(&pfm->stage[STAGE_LIDAR].bytes, __ATOMIC_RELAXED) +
+			 __atomic_load_n(&pfm->stage[STAGE_IMU].bytes, __ATOMIC_RELAXED);
+	double sensors = (bytes - *lastbytes) / seconds;
+	double left = PIPE_SERIAL_BUDGET - sensors * PIPE_SENSOR_MARGIN / 100;
+
+	*lastbytes = bytes;
+	if(left > RENDER_LINK_RATE)
+		left = RENDER_LINK_RATE;
+	if(left < RENDER_MIN_RATE)
+		left = RENDER_MIN_RATE;
+	return (uint32_t)left;
+}
+
+/*************************************************************************
+Function: lcd_stage()
+Purpose:  LCD renderer thread.  Draws the newest frame into the shadow
+          framebuffer at most every PIPE_LCD_PERIOD and sends the tiles that
+          changed, within the serial budget the sensors leave.
+Input:    Pipeline
+**************************************************************************/
+static void * lcd_stage(void * arg){
+	struct pfm_pipeline * pfm = arg;
+	struct pfm_stage * stage = &pfm->stage[STAGE_LCD];
+	struct render * r = pfm->render;
+	struct queue * inputs[2];
+	struct pfm_frame * frame;
+	struct livemap_view * view;
+	struct polar_table beams;
+	float beamx[LIDAR_MAX_POINTS];
+	float beamy[LIDAR_MAX_POINTS];
+	char text[RENDER_TEXT_COLUMNS+1];
+	uint64_t start;
+	uint64_t lastdraw = 0;
+	uint64_t lastbudget;
+	uint64_t sensorbytes = 0;
+	uint64_t elapsed;
+	int stopping;
+
+	inputs[0] = &pfm->frames;
+	inputs[1] = &pfm->views;
+	polar_init(&beams);
+	if(render_init(r, &pfm->display, LCD_BLACK, RENDER_MIN_RATE) != 0 && VERBOSE_MODE == 1)
+		printf("LCD Did Not Acknowledge Clear\n");
+	lastbudget = pfm_time_ns();
+	for(;;){
+		stopping = pfm->frames.stopping;
+		if(pfm_time_ns() - lastbudget >= 1000000000ULL){
+			render_setRate(r, lcd_budget(pfm, (pfm_time_ns() - lastbudget) / 1e9, &sensorbytes));
+			lastbudget = pfm_time_ns();
+		}
+		if(queue_poll(inputs, 2, PIPE_POLL_MS) == 0){
+			if(stopping)
+				break;
+			render_flush(r, &pfm->display);		// Finish tiles deferred for lack of budget
+			continue;
+		}
+		elapsed = (pfm_time_ns() - lastdraw) / 1000000;
+		if(elapsed < PIPE_LCD_PERIOD && !stopping){
+			poll(NULL, 0, PIPE_LCD_PERIOD - elapsed);
+			continue;
+		}
+		start = pfm_time_ns();
+		// The map view supersedes the raw scan when the mapper is running
+		view = queue_peek(&pfm->views);
+		frame = queue_peek(&pfm->frames);
+		if(frame != NULL){
+			polar_prepare(&beams, &frame->scan);
+			polar_convert(&beams, frame->scan.range, frame->scan.count, beamx, beamy);
+		}
+		if(view != NULL){
+			drawView(r, view, frame, beamx, beamy);
+			snprintf(text, sizeof(text), "Map %u", view->seq);
+			render_text(r, &pfm->display, 0, LCD_WHITE, text);
+		}
+		else if(frame != NULL){
+			drawScan(r, frame, beamx, beamy);
+			snprintf(text, sizeof(text), "Scan %u", frame->scan.seq);
+			render_text(r, &pfm->display, 0, LCD_WHITE, text);
+		}
+		if(frame != NULL && frame->attitude){
+			snprintf(text, sizeof(text), "Y%4.0f P%4.0f R%4.0f", frame->imu.yaw, frame->imu.pitch, frame->imu.roll);
+			render_text(r, &pfm->display, 1, LCD_WHITE, text);
+		}
+		if(view != NULL)
+			queue_release(&pfm->views);
+		if(frame != NULL)
+			queue_release(&pfm->frames);
+		render_flush(r, &pfm->display);
+		lastdraw = pfm_time_ns();
+		stage_account(stage, start);
+		if(stopping)
+			break;
+	}
+	return NULL;
+}
+
+/*************************************************************************
+Function: stage_start()
+Purpose:  Starts one stage thread
+Input:    Pipeline, stage number, stage name, thread function
+**************************************************************************/
+static void stage_start(struct pfm_pipeline * pfm, int number, const char * name, void * (*function)(void *)){
+	struct pfm_stage * stage = &pfm->stage[number];
+	pthread_attr_t attr;
+
+	stage->name = name;
+	// Locked memory covers each whole stack, so keep them small
+	pthread_attr_init(&attr);
+	if(pfm->realtime)
+		pthread_attr_setstacksize(&attr, RT_STACK_SIZE);
+	if(pthread_create(&stage->thread, &attr, function, pfm) == 0)
+		stage->started = 1;
+	else if(VERBOSE_MODE == 1)
+		printf("Unable to Start %s Stage\n", name);
+	pthread_attr_destroy(&attr);
+	if(stage->started && pfm->realtime && stage->priority > 0){
+		stage->fifo = (rt_setThread(stage->thread, stage->priority, stage->cpu) == 0);
+		if(!stage->fifo && VERBOSE_MODE == 1)
+			printf("Unable to Run %s Stage Under SCHED_FIFO\n", name);
+	}
+}
+
+/*************************************************************************
+Function: prefaultQueue()
+Purpose:  Faults in every slot of a queue
+Input:    Queue
+Returns:  Bytes touched
+**************************************************************************/
+static size_t prefaultQueue(struct queue * q){
+	return rt_prefault(q->slots, (size_t)q->capacity * q->elemsize);
+}
+
+/*************************************************************************
+Function: pipeline_start()
+Purpose:  Opens the devices, creates the queues and starts one thread per
+          stage.  A device that fails to open disables its stage only.
+Input:    Pipeline with the device names filled in
+Returns:  0 if successful, -1 if the queues could not be created
+**************************************************************************/
+int pipeline_start(struct pfm_pipeline * pfm){
+	int lidars;
+	int n;
+	for(n = 0; n < STAGE_COUNT; n++)
+		memset(&pfm->stage[n], 0, sizeof(pfm->stage[n]));
+	pfm->stage[STAGE_LIDAR].name = "lidar";
+	pfm->stage[STAGE_IMU].name = "imu";
+	pfm->stage[STAGE_FUSER].name = "fuser";
+	pfm->stage[STAGE_STORAGE].name = "storage";
+	pfm->stage[STAGE_LCD].name = "lcd";
+	pfm->stage[STAGE_MAPPER].name = "mapper";
+	pfm->stage[STAGE_STREAM].name = "stream";
+	pfm->stage[STAGE_LIDAR].priority = RT_LIDAR_PRIORITY;
+	pfm->stage[STAGE_LIDAR].cpu = RT_LIDAR_CPU;
+	pfm->stage[STAGE_IMU].priority = RT_IMU_PRIORITY;
+	pfm->stage[STAGE_IMU].cpu = RT_IMU_CPU;
+	pfm->memlocked = 0;
+	pfm->prefaulted = 0;
+	pfm->started = pfm_time_ns();
+	pfm->lastreport = pfm->started;
+
+	if(queue_init(&pfm->scans, "scans", sizeof(struct lidar_pair), PIPE_SCAN_DEPTH, QUEUE_DROP_NEWEST) != 0 ||
+	   queue_init(&pfm->imu, "imu", sizeof(struct imu_sample), PIPE_IMU_DEPTH, QUEUE_DROP_NEWEST) != 0 ||
+	   queue_init(&pfm->records, "records", sizeof(struct pfm_record), PIPE_STORE_DEPTH, QUEUE_BLOCK) != 0 ||
+	   queue_init(&pfm->frames, "frames", sizeof(struct pfm_frame), PIPE_LCD_DEPTH, QUEUE_KEEP_LATEST) != 0 ||
+	   queue_init(&pfm->mapframes, "mapframe", sizeof(struct pfm_frame), PIPE_MAP_DEPTH, QUEUE_KEEP_LATEST) != 0 ||
+	   queue_init(&pfm->views, "views", sizeof(struct livemap_view), PIPE_VIEW_DEPTH, QUEUE_KEEP_LATEST) != 0 ||
+	   queue_init(&pfm->outgoing, "outgoing", sizeof(struct stream_record), PIPE_STREAM_DEPTH, QUEUE_DROP_NEWEST) != 0)
+		return -1;
+
+	pfm->map = malloc(sizeof(struct livemap));
+	if(pfm->map != NULL)
+		livemap_init(pfm->map);
+	else if(VERBOSE_MODE == 1)
+		printf("Unable to Allocate Live Map, Mapper Stage Disabled\n");
+
+	keyframe_init(&pfm->keyframes, pfm->heartbeat);
+	ioengine_init(&pfm->lidario, "LIDAR", pfm->usepoll);
+	ioengine_init(&pfm->imuio, "IMU", pfm->usepoll);
+	ioengine_init(&pfm->storeio, "Journal", pfm->usepoll);
+	lidars = 0;
+	for(n = 0; n < LIDAR_DEVICES; n++){
+		filter_init(&pfm->filter[n], pfm->median);
+		pfm->lidar[n].port = (pfm->lidar[n].name != NULL) ? lidar_open(pfm->lidar[n].name) : NULL;
+		if(pfm->lidar[n].port != NULL)
+			lidars++;
+		else if(pfm->lidar[n].name != NULL && VERBOSE_MODE == 1)
+			printf("Problem Opening LIDAR %s\n", pfm->lidar[n].name);
+	}
+	if(lidars == 0 && VERBOSE_MODE == 1)
+		printf("No LIDAR Open, LIDAR Stage Disabled\n");
+	pfm->imufd = imu_open(pfm->imuname);
+	if(pfm->imufd < 0 && VERBOSE_MODE == 1)
+		printf("Problem Opening IMU, IMU Stage Disabled\n");
+	if(lcd_open(&pfm->display, pfm->lcdname) != 0 && VERBOSE_MODE == 1)
+		printf("Problem Opening LCD, LCD Stage Disabled\n");
+	pfm->render = NULL;
+	if(pfm->display.fd >= 0){
+		pfm->render = malloc(sizeof(struct render));
+		if(pfm->render == NULL){
+			if(VERBOSE_MODE == 1)
+				printf("Unable to Allocate Framebuffers, LCD Stage Disabled\n");
+			lcd_close(&pfm->display);
+		}
+	}
+	if(storage_open(&pfm->store, pfm->journalname) != 0 && VERBOSE_MODE == 1)
+		printf("Problem Opening Journal %s, Data Will Not Be Saved\n", pfm->journalname);
+	if(pfm->store.fd >= 0){
+		ioengine_register(&pfm->storeio, pfm->store.buffer, STORAGE_BUFFER);
+		ioengine_register(&pfm->storeio, pfm->store.index, sizeof(pfm->store.index));
+		pfm->store.io = &pfm->storeio;
+	}
+	// The stream replays from the journal, so it needs one
+	pfm->stream.listenfd = -1;
+	pfm->stream.clientfd = -1;
+	pfm->stream.journal.fd = -1;
+	pfm->stream.journal.session.fd = -1;
+	if(pfm->streamport > 0 && pfm->store.fd >= 0 && stream_listen(&pfm->stream, pfm->streamport, pfm->journalname) != 0 && VERBOSE_MODE == 1)
+		printf("Problem Opening Stream Port %d, Stream Stage Disabled\n", pfm->streamport);
+
+	pfm->ring.header = NULL;
+	if(pfm->ringname != NULL && shmring_create(&pfm->ring, pfm->ringname, sizeof(struct pfm_frame), SHMRING_SLOTS) != 0 && VERBOSE_MODE == 1)
+		printf("Problem Creating Shared Scan Ring %s, Scans Will Not Be Shared\n", pfm->ringname);
+
+	// Everything the readers and their consumers touch is resident before the first read
+	if(pfm->realtime){
+		pfm->memlocked = (rt_lockMemory() == 0);
+		pfm->prefaulted += prefaultQueue(&pfm->scans);
+		pfm->prefaulted += prefaultQueue(&pfm->imu);
+		pfm->prefaulted += prefaultQueue(&pfm->records);
+		pfm->prefaulted += prefaultQueue(&pfm->frames);
+		pfm->prefaulted += prefaultQueue(&pfm->mapframes);
+		pfm->prefaulted += prefaultQueue(&pfm->views);
+		pfm->prefaulted += prefaultQueue(&pfm->outgoing);
+		if(pfm->store.fd >= 0)
+			pfm->prefaulted += rt_prefault(pfm->store.buffer, STORAGE_BUFFER);
+		pfm->prefaulted += rt_prefault(pfm->map, (pfm->map != NULL) ? sizeof(struct livemap) : 0);
+		pfm->prefaulted += rt_prefault(pfm->render, (pfm->render != NULL) ? sizeof(struct render) : 0);
+		pfm->prefaulted += rt_prefault(pfm->ring.header, (pfm->ring.header != NULL) ? pfm->ring.size : 0);
+		if(rt_jitterStart(&pfm->jitter, RT_PROBE_PRIORITY, RT_PROBE_CPU) != 0 && VERBOSE_MODE == 1)
+			printf("Unable to Start Jitter Probe\n");
+	}
+
+	pfm->running = 1;
+	if(pfm->stream.listenfd >= 0)
+		stage_start(pfm, STAGE_STREAM, "stream", stream_stage);
+	stage_start(pfm, STAGE_STORAGE, "storage", storage_stage);
+	stage_start(pfm, STAGE_FUSER, "fuser", fuser_stage);
+	if(pfm->display.fd >= 0)
+		stage_start(pfm, STAGE_LCD, "lcd", lcd_stage);
+	if(pfm->map != NULL)
+		stage_start(pfm, STAGE_MAPPER, "mapper", mapper_stage);
+	if(pfm->imufd >= 0)
+		stage_start(pfm, STAGE_IMU, "imu", imu_stage);
+	if(lidars > 0)
+		stage_start(pfm, STAGE_LIDAR, "lidar", lidar_stage);
+	return 0;
+}
+
+/*************************************************************************
+Function: queue_report()
+Purpose:  Prints one line of queue statistics
+Input:    Queue, output stream
+**************************************************************************/
+static void queue_report(struct queue * q, FILE * out){
+	fprintf(out, "  %-8s %4u/%-4u %6u %10llu %8llu %8llu\n", q->name, queue_count(q), q->capacity, q->highwater,
+		(unsigned long long)q->pushed, (unsigned long long)q->dropped, (unsigned long long)q->skipped);
+}
+
+/*************************************************************************
+Function: jitter_report()
+Purpose:  Prints the wake-up latency of the jitter probe and its histogram
+Input:    Probe, output stream
+**************************************************************************/
+static void jitter_report(struct rt_jitter * jitter, FILE * out){
+	uint64_t samples = __atomic_load_n(&jitter->samples, __ATOMIC_RELAXED);
+	uint64_t total = __atomic_load_n(&jitter->total, __ATOMIC_RELAXED);
+	uint64_t recent = __atomic_exchange_n(&jitter->recentmax, 0, __ATOMIC_RELAXED);
+	int n;
+
+	fprintf(out, "  jitter   %llu wake-ups%s, avg %.1f us, max %.1f us (%.1f us since last report)\n",
+		(unsigned long long)samples, jitter->fifo ? "" : " (not SCHED_FIFO)",
+		samples > 0 ? total / 1e3 / samples : 0.0, jitter->max / 1e3, recent / 1e3);
+	fprintf(out, "          ");
+	for(n = 0; n < RT_JITTER_BUCKETS; n++){
+		if(n < RT_JITTER_BUCKETS - 1)
+			fprintf(out, " <%llu:", (unsigned long long)(rt_jitterBound(n) / 1000));
+		else
+			fprintf(out, " more:");
+		fprintf(out, "%llu", (unsigned long long)__atomic_load_n(&jitter->histogram[n], __ATOMIC_RELAXED));
+	}
+	fprintf(out, " us\n");
+}
+
+/*************************************************************************
+Function: pipeline_report()
+Purpose:  Prints processing time per stage and occupancy per queue
+Input:    Pipeline, output stream
+**************************************************************************/
+void pipeline_report(struct pfm_pipeline * pfm, FILE * out){
+	struct ioengine * engines[3] = {&pfm->lidario, &pfm->imuio, &pfm->storeio};
+	struct pfm_stage * stage;
+	struct lidar_device * device;
+	uint64_t now = pfm_time_ns();
+	double seconds = (now - pfm->lastreport) / 1e9;
+	uint64_t items, busy;
+	int n;
+
+	if(seconds <= 0)
+		seconds = 1;
+	fprintf(out, "---- Pipeline at %.1f s ----\n", (now - pfm->started) / 1e9);
+	fprintf(out, "  %-8s %10s %8s %8s %8s %6s\n", "stage", "items", "rate/s", "avg ms", "max ms", "load");
+	for(n = 0; n < STAGE_COUNT; n++){
+		stage = &pfm->stage[n];
+		if(!stage->started)
+			continue;
+		items = __atomic_load_n(&stage->items, __ATOMIC_RELAXED);
+		busy = __atomic_load_n(&stage->busy, __ATOMIC_RELAXED);
+		fprintf(out, "  %-8s %10llu %8.1f %8.3f %8.3f %5.1f%%\n", stage->name, (unsigned long long)items,
+			(items - stage->lastitems) / seconds,
+			(items > stage->lastitems) ? (busy - stage->lastbusy) / 1e6 / (items - stage->lastitems) : 0.0,
+			stage->maxbusy / 1e6,
+			(busy - stage->lastbusy) / 1e7 / seconds);
+		stage->lastitems = items;
+		stage->lastbusy = busy;
+	}
+	fprintf(out, "  %-8s %9s %6s %10s %8s %8s\n", "queue", "depth", "high", "pushed", "dropped", "skipped");
+	queue_report(&pfm->scans, out);
+	queue_report(&pfm->imu, out);
+	queue_report(&pfm->records, out);
+	queue_report(&pfm->frames, out);
+	queue_report(&pfm->mapframes, out);
+	queue_report(&pfm->views, out);
+	queue_report(&pfm->outgoing, out);
+	for(n = 0; n < LIDAR_DEVICES && pfm->stage[STAGE_LIDAR].started; n++){
+		device = &pfm->lidar[n];
+		if(device->name == NULL)
+			continue;
+		if(device->firstscan > 0)
+			fprintf(out, "  lidar%d   ready after %.0f ms, first scan after %.0f ms, clock %s %.2f ms\n", n,
+				device->ready / 1e6, device->firstscan / 1e6, device->synced ? "synchronized to" : "not synchronized,", device->clockerror / 1e6);
+		else
+			fprintf(out, "  lidar%d   %s, no scans yet\n", n, (device->ready > 0) ? "scanning" : "waiting for the sensor");
+		fprintf(out, "  link%d    %u resyncs, %llu bytes lost, %u scans lost, %u restarts, %u reopens\n", n,
+			device->parser.resyncs, (unsigned long long)device->parser.lostbytes, device->parser.lostscans,
+			device->restarts, device->reopens);
+	}
+	for(n = 0; n < LIDAR_DEVICES && pfm->stage[STAGE_LIDAR].started; n++)
+		if(pfm->filter[n].scans > 0)
+			fprintf(out, "  filter%d  %u scans, %llu beams, %llu error codes, %llu isolated dropped, median %s\n", n,
+				pfm->filter[n].scans, (unsigned long long)pfm->filter[n].beams, (unsigned long long)pfm->filter[n].errors,
+				(unsigned long long)pfm->filter[n].isolated, pfm->filter[n].median ? "on" : "off");
+	if(pfm->keyframes.pairs > 0 && pfm->keyframes.heartbeat > 0)
+		fprintf(out, "  keyframe %u of %u pairs journaled (%u moved, %u turned, %u heartbeat, %u new sensor), heartbeat %u ms\n",
+			pfm->keyframes.kept, pfm->keyframes.pairs, pfm->keyframes.moved, pfm->keyframes.turned,
+			pfm->keyframes.heartbeats, pfm->keyframes.changes, pfm->keyframes.heartbeat);
+	if(pfm->realtime)
+		fprintf(out, "  rt       lidar %s, imu %s, memory %s, %.1f kB prefaulted\n",
+			pfm->stage[STAGE_LIDAR].fifo ? "SCHED_FIFO" : "normal", pfm->stage[STAGE_IMU].fifo ? "SCHED_FIFO" : "normal",
+			pfm->memlocked ? "locked" : "not locked", pfm->prefaulted / 1024.0);
+	if(pfm->jitter.started)
+		jitter_report(&pfm->jitter, out);
+	if(pfm->lidar[LIDAR_VERTICAL].name != NULL && pfm->stage[STAGE_LIDAR].started)
+		fprintf(out, "  pairs    %u paired, %u single\n", pfm->pairs, pfm->singles);
+	if(pfm->map != NULL)
+		fprintf(out, "  livemap  %u scans, %u matched, %u truncated, %u skipped, last %.1f ms, max %.1f ms\n",
+			pfm->map->scans, pfm->map->matched, pfm->map->truncated, pfm->map->skipped,
+			pfm->map->lasttime / 1e6, pfm->map->maxtime / 1e6);
+	if(pfm->render != NULL)
+		fprintf(out, "  display  %u flushes, %u tiles, %u deferred, %u commands, %llu bytes, budget %u B/s\n",
+			pfm->render->flushes, pfm->render->tiles, pfm->render->deferred, pfm->render->commands,
+			(unsigned long long)pfm->render->bytes, pfm->render->rate);
+	if(pfm->stage[STAGE_STREAM].started)
+		fprintf(out, "  stream   %u connections, %s, next record %u, %llu live, %llu replayed, %llu bytes\n",
+			pfm->stream.connects, (pfm->stream.clientfd >= 0) ? "connected" : "waiting", pfm->stream.nextseq,
+			(unsigned long long)pfm->stream.live, (unsigned long long)pfm->stream.replayed,
+			(unsigned long long)pfm->stream.bytes);
+	if(pfm->ring.header != NULL || pfm->ring.published > 0)
+		fprintf(out, "  shared   %s, %llu scans published, %u reader wake-ups\n", pfm->ring.name,
+			(unsigned long long)pfm->ring.published, pfm->ring.wakes);
+	if(pfm->store.fd >= 0)
+		fprintf(out, "  journal  %u records, %llu bytes, slowest sync %.1f ms\n", pfm->store.records,
+			(unsigned long long)pfm->store.bytes, pfm->store.maxsync / 1e6);
+	fprintf(out, "  io       ");
+	for(n = 0; n < 3; n++)
+		fprintf(out, "%s%s %llu requests in %llu calls (%s)", (n > 0) ? ", " : "", engines[n]->name,
+			(unsigned long long)engines[n]->completed, (unsigned long long)engines[n]->syscalls,
+			(engines[n]->uring >= 0) ? "io_uring" : "poll");
+	fprintf(out, "\n");
+	pfm->lastreport = now;
+}
+
+/*************************************************************************
+Function: pipeline_stop()
+Purpose:  Stops the stages upstream first so every accepted item reaches
+          the journal, then closes the devices
+Input:    Pipeline
+**************************************************************************/
+void pipeline_stop(struct pfm_pipeline * pfm){
+	int n;
+	pfm->running = 0;
+	rt_jitterStop(&pfm->jitter);
+	if(pfm->stage[STAGE_LIDAR].started)
+		pthread_join(pfm->stage[STAGE_LIDAR].thread, NULL);
+	if(pfm->stage[STAGE_IMU].started)
+		pthread_join(pfm->stage[STAGE_IMU].thread, NULL);
+	queue_stop(&pfm->scans);
+	queue_stop(&pfm->imu);
+	if(pfm->stage[STAGE_FUSER].started)
+		pthread_join(pfm->stage[STAGE_FUSER].thread, NULL);
+	shmring_destroy(&pfm->ring);
+	queue_stop(&pfm->records);
+	queue_stop(&pfm->mapframes);
+	if(pfm->stage[STAGE_STORAGE].started)
+		pthread_join(pfm->stage[STAGE_STORAGE].thread, NULL);
+	queue_stop(&pfm->outgoing);
+	if(pfm->stage[STAGE_STREAM].started)
+		pthread_join(pfm->stage[STAGE_STREAM].thread, NULL);
+	if(pfm->stage[STAGE_MAPPER].started)
+		pthread_join(pfm->stage[STAGE_MAPPER].thread, NULL);
+	queue_stop(&pfm->frames);
+	queue_stop(&pfm->views);
+	if(pfm->stage[STAGE_LCD].started)
+		pthread_join(pfm->stage[STAGE_LCD].thread, NULL);
+
+	for(n = 0; n < LIDAR_DEVICES; n++)
+		if(pfm->lidar[n].port != NULL)
+			lidar_close(pfm->lidar[n].port);
+	if(pfm->imufd >= 0)
+		imu_close(pfm->imufd);
+	if(pfm->display.fd >= 0)
+		lcd_close(&pfm->display);
+	if(pfm->store.fd >= 0)
+		storage_close(&pfm->store);
+	if(VERBOSE_MODE == 1)
+		pipeline_report(pfm, stdout);
+	ioengine_close(&pfm->lidario);
+	ioengine_close(&pfm->imuio);
+	ioengine_close(&pfm->storeio);
+
+	queue_free(&pfm->scans);
+	queue_free(&pfm->imu);
+	queue_free(&pfm->records);
+	queue_free(&pfm->frames);
+	queue_free(&pfm->mapframes);
+	queue_free(&pfm->views);
+	queue_free(&pfm->outgoing);
+	free(pfm->map);
+	pfm->map = NULL;
+	free(pfm->render);
+	pfm->render = NULL;
+}
+
+/* ****************************************************************************** */
+// End of PIPELINE.C
+/* ****************************************************************************** */
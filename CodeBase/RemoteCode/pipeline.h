@@ -0,0 +1,194 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                      Acquisition Pipeline Header                       */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include <pthread.h>
+#include "queue.h"
+#include "hokuyo_comm.h"
+#include "hokuyo.h"
+#include "imu.h"
+#include "lcd.h"
+#include "storage.h"
+#include "livemap.h"
+#include "render.h"
+#include "stream.h"
+#include "rt.h"
+#include "filter.h"
+#include "keyframe.h"
+#include "ioengine.h"
+#include "polar.h"
+#include "shmring.h"
+
+/* ****************************************************************************** */
+/* *****************************   Definitions  ********************************* */
+/* ****************************************************************************** */
+// Queue depths (rounded up to a power of two)
+#define PIPE_SCAN_DEPTH 16		// LIDAR -> fuser, ~1.6 s of scan pairs at 10 Hz
+#define PIPE_IMU_DEPTH 128		// IMU -> fuser, ~1.3 s of samples at 100 Hz
+#define PIPE_STORE_DEPTH 64		// Fuser -> storage
+#define PIPE_LCD_DEPTH 4		// Fuser -> LCD
+#define PIPE_MAP_DEPTH 4		// Fuser -> mapper
+#define PIPE_VIEW_DEPTH 2		// Mapper -> LCD
+#define PIPE_STREAM_DEPTH 64		// Storage -> stream
+
+#define PIPE_POLL_MS 100		// Longest a stage sleeps before re-checking for shutdown
+#define PIPE_STORE_WAIT_MS 1000		// Longest the fuser waits on a full storage queue
+#define PIPE_IMU_MAX_AGE 50000000ULL	// Nanoseconds an IMU sample may lead a scan and still be attached
+#define PIPE_LCD_PERIOD (1000/RENDER_MAX_FPS)	// Milliseconds between display updates
+#define PIPE_SERIAL_BUDGET 40000	// Bytes per second all serial devices on the USB hub may carry together
+#define PIPE_SENSOR_MARGIN 150		// Percent of the measured LIDAR + IMU rate kept free for them
+#define PIPE_FREE_COLOUR LCD_RGB(40,40,40)	// Explored floor on the preview
+#define PIPE_REPORT_INTERVAL 5		// Seconds between stage reports
+#define PIPE_STREAM_DRAIN 5		// Seconds the stream may keep replaying to a connected client after capture stops
+
+// Stages
+#define STAGE_LIDAR 0
+#define STAGE_IMU 1
+#define STAGE_FUSER 2
+#define STAGE_STORAGE 3
+#define STAGE_LCD 4
+#define STAGE_MAPPER 5
+#define STAGE_STREAM 6
+#define STAGE_COUNT 7
+
+/*	Scan with the attitude the IMU reported closest before it */
+struct pfm_frame {
+	struct lidar_scan scan;
+	struct imu_sample imu;
+	int attitude;			// 1 if imu holds a sample no older than PIPE_IMU_MAX_AGE
+};
+
+/*	Element of the storage queue */
+struct pfm_record {
+	uint16_t type;			// PFJ_SCAN or PFJ_IMU
+	union {
+		struct lidar_scan scan;
+		struct imu_sample imu;
+	} data;
+};
+
+/*	Per-stage accounting, written by the stage and read by the reporter */
+struct pfm_stage {
+	const char * name;
+	pthread_t thread;
+	int started;
+	uint64_t items;			// Items processed
+	uint64_t busy;			// Nanoseconds spent processing
+	uint64_t maxbusy;		// Slowest single item
+	uint64_t bytes;			// Bytes read from the device (reader stages)
+	uint64_t lastitems;		// Snapshot at the previous report
+	uint64_t lastbusy;
+	int priority;			// SCHED_FIFO priority, 0 = normal scheduling
+	int cpu;			// CPU to pin a SCHED_FIFO stage to, -1 = any
+	int fifo;			// 1 if SCHED_FIFO was applied
+};
+
+struct pfm_pipeline {
+	// Configuration
+	char * imuname;
+	char * lcdname;
+	char * journalname;
+	int streamport;			// TCP port for the base station, 0 = no streaming
+	char * ringname;		// Shared memory scan ring for other processes, NULL = none
+	int realtime;			// 1 = run the readers under the real-time profile (see rt.c)
+	int median;			// 1 = median-filter each beam over the last few scans
+	uint32_t heartbeat;		// Milliseconds between scans journaled while nothing changes, 0 = journal every scan
+	int usepoll;			// 1 = poll() and read()/write() instead of io_uring (see ioengine.c)
+
+	// Devices
+	struct lidar_device lidar[LIDAR_DEVICES];	// Names and configuration filled in by the caller
+	int imufd;
+	struct lcd display;
+	struct storage store;
+	struct stream stream;
+	struct shmring ring;		// Written by the fuser stage (header NULL if not shared)
+
+	// I/O engines, one per stage that does device or flash I/O
+	struct ioengine lidario;
+	struct ioengine imuio;
+	struct ioengine storeio;
+
+	// Queues
+	struct queue scans;		// LIDAR -> fuser, scan pairs (QUEUE_DROP_NEWEST)
+	struct queue imu;		// IMU -> fuser (QUEUE_DROP_NEWEST)
+	struct queue records;		// Fuser -> storage (QUEUE_BLOCK)
+	struct queue frames;		// Fuser -> LCD (QUEUE_KEEP_LATEST)
+	struct queue mapframes;		// Fuser -> mapper (QUEUE_KEEP_LATEST)
+	struct queue views;		// Mapper -> LCD (QUEUE_KEEP_LATEST)
+	struct queue outgoing;		// Storage -> stream (QUEUE_DROP_NEWEST, gaps are replayed from the journal)
+
+	// Scan pairing statistics, written by the LIDAR stage
+	uint32_t pairs;			// Horizontal and vertical scans sent together
+	uint32_t singles;		// Scans sent without a partner
+
+	// Scan quality filters, one per LIDAR, owned by the fuser stage
+	struct scan_filter filter[LIDAR_DEVICES];
+
+	// Decides which scan pairs are journaled, owned by the fuser stage
+	struct keyframe_gate keyframes;
+
+	// Live preview map, owned by the mapper stage
+	struct livemap * map;
+
+	// Display framebuffers, owned by the LCD stage
+	struct render * render;
+
+	// Real-time profile
+	int memlocked;			// 1 if mlockall() succeeded
+	size_t prefaulted;		// Bytes of queues and scratch faulted in before the start
+	struct rt_jitter jitter;	// Wake-up latency at the LIDAR reader's priority
+
+	struct pfm_stage stage[STAGE_COUNT];
+	volatile int running;
+	uint64_t started;
+	uint64_t lastreport;
+};
+
+/* ****************************************************************************** */
+/* ************************ Function Declarations ******************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: pipeline_start()
+Purpose:  Opens the devices, creates the queues and starts one thread per
+          stage.  A device that fails to open disables its stage only.
+Input:    Pipeline with the device names filled in
+Returns:  0 if successful, -1 if the queues could not be created
+**************************************************************************/
+int pipeline_start(struct pfm_pipeline * pfm);
+
+/*************************************************************************
+Function: pipeline_report()
+Purpose:  Prints processing time per stage and occupancy per queue
+Input:    Pipeline, output stream
+**************************************************************************/
+void pipeline_report(struct pfm_pipeline * pfm, FILE * out);
+
+/*************************************************************************
+Function: pipeline_stop()
+Purpose:  Stops the stages upstream first so every accepted item reaches
+          the journal, then closes the devices
+Input:    Pipeline
+**************************************************************************/
+void pipeline_stop(struct pfm_pipeline * pfm);
+
+#endif
+/* ****************************************************************************** */
+// End of PIPELINE.H
+/* ****************************************************************************** */
@@ -0,0 +1,145 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                         Beam Geometry Code                             */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+
+/* ****************************************************************************** */
+/* *******************************   About  ************************************* */
+/* ****************************************************************************** */
+// This code turns LIDAR ranges into angles and x/y points for every consumer
+// (the live map, the display, exporters).
+/*	The URG-04LX steps are 360/1024 degrees apart, so the direction of beam n
+	depends only on the start step and cluster count the scan was taken with.
+	Each consumer keeps a polar_table, which is built once per configuration
+	and afterwards a conversion is one multiply per coordinate: no sinf() or
+	cosf() per beam.
+
+	polar_convert() works four beams at a time with GCC vector extensions,
+	which become NEON on the BeagleBone's Cortex-A8 (with -mfpu=neon) and SSE
+	on a PC, and falls back to plain C elsewhere and for the last few beams.
+*/
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include "prefiremapping.h"
+#include "polar.h"
+
+#if defined(__GNUC__) && defined(__has_builtin)
+#if __has_builtin(__builtin_convertvector)
+#define POLAR_VECTOR 4				// Beams per vector
+typedef float polar_floats __attribute__((vector_size(POLAR_VECTOR*sizeof(float))));
+typedef uint16_t polar_ranges __attribute__((vector_size(POLAR_VECTOR*sizeof(uint16_t))));
+#endif
+#endif
+
+/* ****************************************************************************** */
+/* ****************************** Functions ************************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: polar_init()
+Purpose:  Marks a table as not built
+Input:    Table
+**************************************************************************/
+void polar_init(struct polar_table * table){
+	table->count = 0;
+}
+
+/*************************************************************************
+Function: polar_prepare()
+Purpose:  Builds the table for a scan's (start step, end step, cluster)
+          configuration, unless it was already built for it
+Input:    Table, scan
+Returns:  1 if the table was rebuilt, 0 if it was already current
+**************************************************************************/
+int polar_prepare(struct polar_table * table, const struct lidar_scan * scan){
+	float step;
+	int count = scan->count;
+	int n;
+
+	if(table->count != 0 && table->count == scan->count && table->startstep == scan->startstep &&
+	   table->endstep == scan->endstep && table->cluster == scan->cluster)
+		return 0;
+	if(count > LIDAR_MAX_POINTS)
+		count = LIDAR_MAX_POINTS;
+	for(n = 0; n < count; n++){
+		// A clustered reading covers several steps, use the middle one
+		step = scan->startstep + n*scan->cluster + (scan->cluster - 1) * 0.5f;
+		table->angle[n] = (step - LIDAR_FRONT_STEP) * (float)(2*M_PI / LIDAR_STEPS_PER_REV);
+		table->cosine[n] = cosf(table->angle[n]);
+		table->sine[n] = sinf(table->angle[n]);
+	}
+	table->startstep = scan->startstep;
+	table->endstep = scan->endstep;
+	table->cluster = scan->cluster;
+	table->count = count;
+	return 1;
+}
+
+/*************************************************************************
+Function: polar_convert()
+Purpose:  Converts every beam to x/y millimeters in the sensor frame.  Output
+          n belongs to beam n; beams with no return come out at 0,0.
+          Nothing is allocated.
+Input:    Prepared table, ranges, number of beams, x output, y output
+          (each at least count floats)
+**************************************************************************/
+void polar_convert(const struct polar_table * table, const uint16_t * range, int count, float * x, float * y){
+	int n = 0;
+#ifdef POLAR_VECTOR
+	polar_ranges raw;
+	polar_floats r, vx, vy;
+
+	// The tables are aligned, the caller's buffers need not be
+	for(; n + POLAR_VECTOR <= count; n += POLAR_VECTOR){
+		memcpy(&raw, range + n, sizeof(raw));
+		r = __builtin_convertvector(raw, polar_floats);
+		vx = r * *(const polar_floats *)(table->cosine + n);
+		vy = r * *(const polar_floats *)(table->sine + n);
+		memcpy(x + n, &vx, sizeof(vx));
+		memcpy(y + n, &vy, sizeof(vy));
+	}
+#endif
+	for(; n < count; n++){
+		x[n] = range[n] * table->cosine[n];
+		y[n] = range[n] * table->sine[n];
+	}
+}
+
+/*************************************************************************
+Function: polar_points()
+Purpose:  Converts every stride'th beam whose range lies in [minrange,
+          maxrange] and packs the results together
+Input:    Prepared table, ranges, number of beams, stride, minimum range,
+          maximum range, x output, y output (each at least count/stride + 1
+          floats)
+Returns:  Number of points written
+**************************************************************************/
+int polar_points(const struct polar_table * table, const uint16_t * range, int count, int stride,
+	uint16_t minrange, uint16_t maxrange, float * x, float * y){
+	int points = 0;
+	int n;
+	for(n = 0; n < count; n += stride){
+		if(range[n] < minrange || range[n] > maxrange)
+			continue;
+		x[points] = range[n] * table->cosine[n];
+		y[points] = range[n] * table->sine[n];
+		points++;
+	}
+	return points;
+}
+
+/* ****************************************************************************** */
+// End of POLAR.C
+/* ****************************************************************************** */
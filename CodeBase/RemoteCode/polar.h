@@ -0,0 +1,91 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                        Beam Geometry Header                            */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+#ifndef _POLAR_H_
+#define _POLAR_H_
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include <stdint.h>
+#include "hokuyo_comm.h"
+
+/* ****************************************************************************** */
+/* *****************************   Definitions  ********************************* */
+/* ****************************************************************************** */
+#define LIDAR_FRONT_STEP 384			// Step pointing straight ahead
+#define LIDAR_STEPS_PER_REV 1024		// 0.3515625 degrees per step
+#define POLAR_ALIGN 16				// Table alignment, one SIMD register
+
+/*	Direction of every beam of one scan configuration, in the sensor frame:
+	angle 0 is straight ahead and angles grow counterclockwise, so a beam
+	ends at x = range*cosine (forward), y = range*sine (left).  A clustered
+	reading points at the middle of the steps it covers.
+*/
+struct polar_table {
+	float angle[LIDAR_MAX_POINTS] __attribute__((aligned(POLAR_ALIGN)));	// Radians
+	float cosine[LIDAR_MAX_POINTS] __attribute__((aligned(POLAR_ALIGN)));
+	float sine[LIDAR_MAX_POINTS] __attribute__((aligned(POLAR_ALIGN)));
+	uint16_t startstep;			// Configuration the table was built for
+	uint16_t endstep;
+	uint16_t cluster;
+	uint16_t count;				// 0 = not built yet
+};
+
+/* ****************************************************************************** */
+/* ************************ Function Declarations ******************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: polar_init()
+Purpose:  Marks a table as not built
+Input:    Table
+**************************************************************************/
+void polar_init(struct polar_table * table);
+
+/*************************************************************************
+Function: polar_prepare()
+Purpose:  Builds the table for a scan's (start step, end step, cluster)
+          configuration, unless it was already built for it
+Input:    Table, scan
+Returns:  1 if the table was rebuilt, 0 if it was already current
+**************************************************************************/
+int polar_prepare(struct polar_table * table, const struct lidar_scan * scan);
+
+/*************************************************************************
+Function: polar_convert()
+Purpose:  Converts every beam to x/y millimeters in the sensor frame.  Output
+          n belongs to beam n; beams with no return come out at 0,0.
+          Nothing is allocated.
+Input:    Prepared table, ranges, number of beams, x output, y output
+          (each at least count floats)
+**************************************************************************/
+void polar_convert(const struct polar_table * table, const uint16_t * range, int count, float * x, float * y);
+
+/*************************************************************************
+Function: polar_points()
+Purpose:  Converts every stride'th beam whose range lies in [minrange,
+          maxrange] and packs the results together
+Input:    Prepared table, ranges, number of beams, stride, minimum range,
+          maximum range, x output, y output (each at least count/stride + 1
+          floats)
+Returns:  Number of points written
+**************************************************************************/
+int polar_points(const struct polar_table * table, const uint16_t * range, int count, int stride,
+	uint16_t minrange, uint16_t maxrange, float * x, float * y);
+
+#endif
+/* ****************************************************************************** */
+// End of POLAR.H
+/* ****************************************************************************** */
@@ -16,15 +16,13 @@
 /* ****************************************************************************** */
 /* *******************************   About  ************************************* */
 /* ****************************************************************************** */
-// This is the main program code for the Pre-Fire Mapping System.
+// This is the main program code for the Pre-Fire Mapping System.  It starts the
+// acquisition pipeline (see pipeline.c) and runs until SIGINT/SIGTERM.
 
 
 /* ****************************************************************************** */
 /* ******************************   TO DO  ************************************** */
 /* ****************************************************************************** */
-// Connect to LIDAR
-// Configure LIDAR settings
-// Obtain data from LIDAR
 // Process Data
 // Apply SLAM algorithm
 // Close Connection with LIDAR
@@ -37,32 +35,95 @@
 /* ****************************** Includes ************************************** */
 /* ****************************************************************************** */
 #include "prefiremapping.h"
+#include "pipeline.h"
+#include <signal.h>
 
 
 /* ****************************************************************************** */
 /* ********************   Configuration Definitions  **************************** */
 /* ****************************************************************************** */
 
-char * lidarname = "/dev/ttyACM0";		// LIDAR Connection Name
-FILE * fd;					// LIDAR File Descriptor (I/O Stream)
+char * lidarname = LIDAR_DEVICE;		// LIDAR Connection Name
+char * verticalname = NULL;			// Vertical LIDAR Connection Name (optional)
+char * imuname = IMU_DEVICE;			// IMU Connection Name
+char * lcdname = LCD_DEVICE;			// LCD Connection Name
+char * journalname = JOURNAL_FILE;		// Journal on the Flash Drive
+int streamport = STREAM_PORT;			// Base Station Stream Port
+char * ringname = SCAN_RING;			// Shared Memory Scan Ring Name
+int realtime = 1;				// Real-Time Scheduling Profile for the Readers
+int median = 0;					// Temporal Median Filter on the Scans
+int heartbeat = KEYFRAME_HEARTBEAT;		// Keyframe Heartbeat (ms), 0 = Journal Every Scan
+int usepoll = 0;				// poll()/read()/write() Instead of io_uring
 int status;					// LIDAR File Descriptor Status
 
-char teststr[8] = "0000000\n";
+struct pfm_pipeline pfm;			// Acquisition Pipeline
+volatile sig_atomic_t shutdown_requested = 0;	// Set by SIGINT/SIGTERM
+
+/*************************************************************************
+Function: requestShutdown()
+Purpose:  Signal handler, asks the main loop to stop the pipeline
+Input:    Signal number
+**************************************************************************/
+static void requestShutdown(int signum){
+	shutdown_requested = 1;
+}
+
+/*************************************************************************
+Function: usage()
+Purpose:  Prints the command line options
+Input:    Program name
+**************************************************************************/
+static void usage(char * name){
+	printf("Usage: %s [-l lidar] [-v lidar] [-i imu] [-d lcd] [-o journal] [-s port] [-t ring] [-n] [-m] [-k ms] [-u]\n", name);
+	printf("  -l  LIDAR device (default %s)\n", LIDAR_DEVICE);
+	printf("  -v  Vertical LIDAR device for wall heights (default none)\n");
+	printf("  -i  IMU device (default %s)\n", IMU_DEVICE);
+	printf("  -d  LCD device (default %s)\n", LCD_DEVICE);
+	printf("  -o  Journal file (default %s)\n", JOURNAL_FILE);
+	printf("  -s  TCP port to stream to the base station on, 0 = off (default %d)\n", STREAM_PORT);
+	printf("  -t  Shared memory ring other processes read scans from, - = off (default %s)\n", SCAN_RING);
+	printf("  -n  No real-time scheduling or memory locking for the sensor readers\n");
+	printf("  -m  Median-filter each beam over the last %d scans (best when standing still)\n", FILTER_HISTORY);
+	printf("  -k  Journal a scan at least every this many ms when nothing changes, 0 = every scan (default %d)\n", KEYFRAME_HEARTBEAT);
+	printf("  -u  Use poll() and read()/write() for the sensors and journal instead of io_uring\n");
+}
 
 /* ****************************************************************************** */
 /* **************************** Main Program ************************************ */
 /* ****************************************************************************** */
 int main(int argc,char **argv){
-	
+	struct sigaction action;
+	int option;
+
 	/*** SCAN PROPERTIES ***/
 	problem = 0;				// Startup with No Problem
-	fd = NULL;
 	START_STEP = 10;
 	END_STEP = 750;
 	CLUSTER_COUNT = 1;
 	SCAN_INTERVAL = 1;
 	/***********************/
-	
+
+	/***  COMMAND LINE   ***/
+	while((option = getopt(argc, argv, "l:v:i:d:o:s:t:nmk:uh")) != -1){
+		switch(option){
+			case 'l': lidarname = optarg; break;
+			case 'v': verticalname = optarg; break;
+			case 'i': imuname = optarg; break;
+			case 'd': lcdname = optarg; break;
+			case 'o': journalname = optarg; break;
+			case 's': streamport = atoi(optarg); break;
+			case 't': ringname = (strcmp(optarg, "-") == 0) ? NULL : optarg; break;
+			case 'n': realtime = 0; break;
+			case 'm': median = 1; break;
+			case 'k': heartbeat = atoi(optarg); break;
+			case 'u': usepoll = 1; break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	/***********************/
+
 	/***  DEBUGGING MODE ***/
 	if(DEBUGGING_MODE == 1)
 		printf("-------IN DEBUGGING MODE - NOT CONNECTED TO LIDAR-------\n\n\n");
@@ -72,33 +133,56 @@ int main(int argc,char **argv){
 	if(VERBOSE_MODE == 1)
 		printf("-------IN VERBOSE MODE - OUTPUTTING DATA TO TERMINAL-------\n\n\n");
 	/***********************/
-	
-	
-	/***    Open LIDAR   ***/
-	if(DEBUGGING_MODE == 0)
-		fd = lidar_open(lidarname);
-	if(fd == NULL && DEBUGGING_MODE == 0){
-		// Problem opening LIDAR
-		problem = -1;
-		if(VERBOSE_MODE == 1)	
-			printf("Problem Opening LIDAR\n");
-	}
 
-	
+	/***     SIGNALS     ***/
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = requestShutdown;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+	/***********************/
 
-	usleep(1000000);
-	lidar_sendMD(fd,1);
-	lidar_read(fd);
+	/***  Start Pipeline ***/
+	memset(&pfm, 0, sizeof(pfm));
+	pfm.lidar[LIDAR_HORIZONTAL].name = lidarname;
+	pfm.lidar[LIDAR_HORIZONTAL].config.startstep = START_STEP;
+	pfm.lidar[LIDAR_HORIZONTAL].config.endstep = END_STEP;
+	pfm.lidar[LIDAR_HORIZONTAL].config.cluster = CLUSTER_COUNT;
+	pfm.lidar[LIDAR_HORIZONTAL].config.interval = SCAN_INTERVAL;
+	pfm.lidar[LIDAR_VERTICAL].name = verticalname;
+	pfm.lidar[LIDAR_VERTICAL].config.startstep = VERTICAL_START_STEP;
+	pfm.lidar[LIDAR_VERTICAL].config.endstep = VERTICAL_END_STEP;
+	pfm.lidar[LIDAR_VERTICAL].config.cluster = CLUSTER_COUNT;
+	pfm.lidar[LIDAR_VERTICAL].config.interval = SCAN_INTERVAL;
+	pfm.imuname = imuname;
+	pfm.lcdname = lcdname;
+	pfm.journalname = journalname;
+	pfm.streamport = streamport;
+	pfm.ringname = ringname;
+	pfm.realtime = realtime;
+	pfm.median = median;
+	pfm.heartbeat = (heartbeat > 0) ? heartbeat : 0;
+	pfm.usepoll = usepoll;
+	if(pipeline_start(&pfm) != 0){
+		if(VERBOSE_MODE == 1)
+			printf("Problem Starting Pipeline\n");
+		return 1;
+	}
+	/***********************/
 
-	usleep(2000000);
-	//Laser OFF
-	//lidar_laserOFF(fd);
-	//lidar_read(fd);
+	// Everything from here on is driven by the stage threads; the main
+	// thread only reports until it is asked to stop.
+	while(!shutdown_requested){
+		sleep(PIPE_REPORT_INTERVAL);
+		if(!shutdown_requested && VERBOSE_MODE == 1)
+			pipeline_report(&pfm, stdout);
+	}
 
-	// Close LIDAR
-	status = lidar_close(fd);
+	// Stop Pipeline (turns the laser off and closes every device)
+	pipeline_stop(&pfm);
 
-	return 0;
+	return problem == 0 ? 0 : 2;
 }
 /* ****************************************************************************** */
 // End of PREFIREMAPPING.C
@@ -26,6 +26,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 #include "hokuyo_comm.h"
 #include "hokuyo.h"
 
@@ -38,6 +39,9 @@
 
 int problem;						// Problem is occurring.  Value indicates problem
 		// 0 = No Problem
+		// -5 = Problem Closing Journal (Not open)
+		// -4 = Problem Closing LCD Communication (Not open)
+		// -3 = Problem Closing IMU Communication (Not open)
 		// -2 = Problem Closing LIDAR Communication (Already closed)
 		// -1 = Problem with Opening LIDAR Communication		
 		// 01 = Problem with LIDAR MD command
@@ -74,6 +78,16 @@ int problem;						// Problem is occurring.  Value indicates problem
 		// 32 = Problem with received VV Command
 		// 33 = Problem with received PP Command
 		// 34 = Problem with received II Command
+		// 40 = Problem Opening IMU Communication
+		// 41 = Problem Sending IMU Command
+		// 42 = Problem with received IMU Packet (Checksum or Length)
+		// 50 = Problem Opening LCD Communication
+		// 51 = Problem Sending LCD Command
+		// 52 = LCD Command not Acknowledged
+		// 60 = Problem Opening Journal
+		// 61 = Problem Writing Journal
+		// 70 = Problem Opening Stream Socket
+		// 80 = Problem Creating Shared Scan Ring
 
 int status;						// LIDAR Status
 		// GD/GS STATUS
@@ -114,16 +128,44 @@ int status;						// LIDAR Status
 
 
 // LIDAR
-#define OPEN_WAIT 1000000
+#define LIDAR_REPLY_TIMEOUT 250		// Milliseconds to wait for a command echo before asking again
+#define LIDAR_START_TIMEOUT 5000	// Milliseconds the sensor has to answer after power up
+#define LIDAR_STALL_TIMEOUT 500		// Milliseconds without a scan before recovering the link
+#define LIDAR_BAD_LIMIT 3		// Bad frames in a row before recovering the link
+#define LIDAR_PAIR_WINDOW 50		// Milliseconds apart a horizontal and vertical scan may be taken and still be paired
+#define VERTICAL_START_STEP 44		// Vertical LIDAR scans its full 240 degrees, floor to ceiling
+#define VERTICAL_END_STEP 725
 int START_STEP;
 int END_STEP;
 int CLUSTER_COUNT;
 int SCAN_INTERVAL;
-int LIDAR_OPEN;
+int LIDAR_OPEN;					// Number of LIDARs open
 uint32_t lidar_time;
 uint16_t data[740];
 #define REMBLOCK 36
 
+// DEVICES
+#define LIDAR_DEVICE "/dev/ttyACM0"
+#define IMU_DEVICE "/dev/ttyUSB0"
+#define LCD_DEVICE "/dev/ttyUSB1"
+#define JOURNAL_FILE "/media/flash/scan.pfj"
+#define SCAN_RING "/pfm-scans"			// Shared memory object other processes read scans from
+#define KEYFRAME_HEARTBEAT 1000			// Milliseconds between scans journaled while standing still
+
+/* ****************************************************************************** */
+/* ************************** Inline Functions ********************************** */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: pfm_time_ns()
+Purpose:  Monotonic clock used to timestamp every scan and IMU sample
+Returns:  CLOCK_MONOTONIC time in nanoseconds
+**************************************************************************/
+static inline uint64_t pfm_time_ns(void){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec*1000000000ULL + now.tv_nsec;
+}
 
 #endif
 /* ****************************************************************************** */
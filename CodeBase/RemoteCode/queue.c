@@ -0,0 +1,296 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                          Bounded Queue Code                            */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+
+/* ****************************************************************************** */
+/* *******************************   About  ************************************* */
+/* ****************************************************************************** */
+// This code contains the bounded lock-free queues that connect the stages of the
+// acquisition pipeline.
+/*	Every queue has exactly one producer thread and one consumer thread.  The
+	producer owns head and the consumer owns tail; each side publishes its index
+	with a release store and reads the other side's index with an acquire load,
+	so a slot is never read before it is written or reused before it is read.
+
+	Full-queue policies:
+		QUEUE_BLOCK		The producer sleeps on the space doorbell.  Used where
+					losing data is worse than stalling the producer (the
+					journal), and only downstream of a dropping queue so
+					the stall can never reach a sensor read.
+		QUEUE_DROP_NEWEST	The item being pushed is discarded and counted.  Used
+					directly behind the sensor readers.
+		QUEUE_KEEP_LATEST	As DROP_NEWEST, and the consumer additionally skips
+					everything but the newest item.  Used for the display,
+					which only ever wants the most recent frame.
+*/
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include "prefiremapping.h"
+#include "queue.h"
+#include <poll.h>
+#include <sys/eventfd.h>
+
+/* ****************************************************************************** */
+/* ****************************** Functions ************************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: queue_ring()
+Purpose:  Rings a doorbell (eventfd), waking a thread sleeping on it
+Input:    Doorbell file descriptor
+**************************************************************************/
+static void queue_ring(int fd){
+	uint64_t one = 1;
+	ssize_t written = write(fd, &one, sizeof(one));
+	(void)written;		// EAGAIN only means the counter is already non-zero
+}
+
+/*************************************************************************
+Function: queue_sleep()
+Purpose:  Waits on a doorbell and clears it
+Input:    Doorbell file descriptor, timeout in milliseconds
+Returns:  1 if the doorbell rang, 0 on timeout
+**************************************************************************/
+static int queue_sleep(int fd, int timeout){
+	struct pollfd pfd;
+	uint64_t value;
+	ssize_t got;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	if(poll(&pfd, 1, timeout) <= 0)
+		return 0;
+	got = read(fd, &value, sizeof(value));
+	(void)got;
+	return 1;
+}
+
+/*************************************************************************
+Function: queue_init()
+Purpose:  Allocates a queue of capacity slots (rounded up to a power of two)
+Input:    Queue, name for reports, slot size, capacity, full-queue policy
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int queue_init(struct queue * q, const char * name, size_t elemsize, uint32_t capacity, int policy){
+	uint32_t size = 1;
+	memset(q, 0, sizeof(*q));
+	while(size < capacity)
+		size <<= 1;
+	q->name = name;
+	q->elemsize = elemsize;
+	q->capacity = size;
+	q->mask = size - 1;
+	q->policy = policy;
+	q->slots = calloc(size, elemsize);
+	q->datafd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	q->spacefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(q->slots == NULL || q->datafd < 0 || q->spacefd < 0){
+		if(VERBOSE_MODE == 1)
+			printf("Unable to Create Queue %s\n", name);
+		queue_free(q);
+		return -1;
+	}
+	return 0;
+}
+
+/*************************************************************************
+Function: queue_free()
+Purpose:  Releases the slots and doorbells of a queue
+Input:    Queue
+**************************************************************************/
+void queue_free(struct queue * q){
+	if(q->datafd >= 0)
+		close(q->datafd);
+	if(q->spacefd >= 0)
+		close(q->spacefd);
+	free(q->slots);
+	q->slots = NULL;
+	q->datafd = -1;
+	q->spacefd = -1;
+}
+
+/*************************************************************************
+Function: queue_stop()
+Purpose:  Wakes both sides of a queue and makes further waits return at once
+Input:    Queue
+**************************************************************************/
+void queue_stop(struct queue * q){
+	__atomic_store_n(&q->stopping, 1, __ATOMIC_RELEASE);
+	queue_ring(q->datafd);
+	queue_ring(q->spacefd);
+}
+
+/*************************************************************************
+Function: queue_count()
+Purpose:  Current occupancy of the queue
+Input:    Queue
+Returns:  Number of items waiting
+**************************************************************************/
+uint32_t queue_count(struct queue * q){
+	uint32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	return head - tail;
+}
+
+/*************************************************************************
+Function: queue_reserve()
+Purpose:  Producer: returns the next free slot to fill in place.  Applies the
+          queue's full policy (waits for QUEUE_BLOCK, else counts a drop)
+Input:    Queue, milliseconds to wait for room (QUEUE_BLOCK only)
+Returns:  Pointer to the slot, NULL if the item must be dropped
+**************************************************************************/
+void * queue_reserve(struct queue * q, int timeout){
+	uint32_t head = q->head;
+	uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	while(head - tail >= q->capacity){
+		if(q->policy != QUEUE_BLOCK || q->stopping || !queue_sleep(q->spacefd, timeout)){
+			q->dropped++;
+			return NULL;
+		}
+		tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	}
+	return q->slots + (size_t)(head & q->mask) * q->elemsize;
+}
+
+/*************************************************************************
+Function: queue_commit()
+Purpose:  Producer: publishes the slot returned by queue_reserve()
+Input:    Queue
+**************************************************************************/
+void queue_commit(struct queue * q){
+	uint32_t head = q->head + 1;
+	uint32_t depth = head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	__atomic_store_n(&q->head, head, __ATOMIC_RELEASE);
+	q->pushed++;
+	if(depth > q->highwater)
+		q->highwater = depth;
+	queue_ring(q->datafd);
+}
+
+/*************************************************************************
+Function: queue_push()
+Purpose:  Producer: copies an item into the queue (reserve + commit)
+Input:    Queue, item, milliseconds to wait for room (QUEUE_BLOCK only)
+Returns:  0 if queued, 1 if dropped
+**************************************************************************/
+int queue_push(struct queue * q, const void * item, int timeout){
+	void * slot = queue_reserve(q, timeout);
+	if(slot == NULL)
+		return 1;
+	memcpy(slot, item, q->elemsize);
+	queue_commit(q);
+	return 0;
+}
+
+/*************************************************************************
+Function: queue_peek()
+Purpose:  Consumer: returns the oldest item (newest for QUEUE_KEEP_LATEST)
+          without removing it
+Input:    Queue
+Returns:  Pointer to the item, NULL if the queue is empty
+**************************************************************************/
+void * queue_peek(struct queue * q){
+	uint32_t tail = q->tail;
+	uint32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	if(head == tail)
+		return NULL;
+	if(q->policy == QUEUE_KEEP_LATEST && head - tail > 1){
+		q->skipped += head - tail - 1;
+		tail = head - 1;
+		__atomic_store_n(&q->tail, tail, __ATOMIC_RELEASE);
+	}
+	return q->slots + (size_t)(tail & q->mask) * q->elemsize;
+}
+
+/*************************************************************************
+Function: queue_release()
+Purpose:  Consumer: frees the item returned by queue_peek()
+Input:    Queue
+**************************************************************************/
+void queue_release(struct queue * q){
+	__atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+	q->popped++;
+	if(q->policy == QUEUE_BLOCK)
+		queue_ring(q->spacefd);
+}
+
+/*************************************************************************
+Function: queue_pop()
+Purpose:  Consumer: copies out and removes the next item (peek + release)
+Input:    Queue, location of item to output
+Returns:  1 if an item was copied, 0 if the queue is empty
+**************************************************************************/
+int queue_pop(struct queue * q, void * item){
+	void * slot = queue_peek(q);
+	if(slot == NULL)
+		return 0;
+	memcpy(item, slot, q->elemsize);
+	queue_release(q);
+	return 1;
+}
+
+/*************************************************************************
+Function: queue_wait()
+Purpose:  Consumer: sleeps until the queue has an item, it is stopped, or
+          the timeout expires
+Input:    Queue, timeout in milliseconds (-1 = forever)
+Returns:  Number of items waiting
+**************************************************************************/
+uint32_t queue_wait(struct queue * q, int timeout){
+	uint32_t count = queue_count(q);
+	while(count == 0 && !q->stopping){
+		if(!queue_sleep(q->datafd, timeout))
+			break;
+		count = queue_count(q);
+	}
+	return count;
+}
+
+/*************************************************************************
+Function: queue_poll()
+Purpose:  Consumer of several queues: sleeps until any of them has an item,
+          one is stopped, or the timeout expires
+Input:    Array of queues, number of queues, timeout in milliseconds
+Returns:  Total number of items waiting
+**************************************************************************/
+uint32_t queue_poll(struct queue ** queues, int count, int timeout){
+	struct pollfd pfd[QUEUE_POLL_MAX];
+	uint64_t value;
+	uint32_t total = 0;
+	int stopping = 0;
+	int n;
+	ssize_t got;
+	if(count > QUEUE_POLL_MAX)
+		count = QUEUE_POLL_MAX;
+	for(n = 0; n < count; n++){
+		total += queue_count(queues[n]);
+		stopping |= queues[n]->stopping;
+		pfd[n].fd = queues[n]->datafd;
+		pfd[n].events = POLLIN;
+	}
+	if(total > 0 || stopping || poll(pfd, count, timeout) <= 0)
+		return total;
+	for(n = 0; n < count; n++){
+		if(pfd[n].revents & POLLIN)
+			got = read(pfd[n].fd, &value, sizeof(value));
+		total += queue_count(queues[n]);
+	}
+	(void)got;
+	return total;
+}
+
+/* ****************************************************************************** */
+// End of QUEUE.C
+/* ****************************************************************************** */
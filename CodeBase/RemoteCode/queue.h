@@ -0,0 +1,167 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                       Bounded Queue Code Header                        */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+#ifndef _QUEUE_H_
+#define _QUEUE_H_
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include <stdint.h>
+#include <stddef.h>
+
+/* ****************************************************************************** */
+/* *****************************   Definitions  ********************************* */
+/* ****************************************************************************** */
+// What the producer does when the queue is full
+#define QUEUE_BLOCK		0	// Producer waits for the consumer (back-pressure)
+#define QUEUE_DROP_NEWEST	1	// New item is discarded and counted as a drop
+#define QUEUE_KEEP_LATEST	2	// Like DROP_NEWEST, but the consumer skips to the newest item
+
+#define QUEUE_CACHELINE 64
+#define QUEUE_POLL_MAX 8			// Most queues one queue_poll() can wait on
+
+/*	Single-producer / single-consumer ring of fixed-size slots.  head is only
+	written by the producer and tail only by the consumer, so neither side takes
+	a lock.  Each side has an eventfd doorbell so a stage can sleep in poll()
+	until its input has data (or, for QUEUE_BLOCK, until its output has room).
+*/
+struct queue {
+	// Producer side
+	volatile uint32_t head __attribute__((aligned(QUEUE_CACHELINE)));
+	uint64_t pushed;
+	uint64_t dropped;
+	uint32_t highwater;
+
+	// Consumer side
+	volatile uint32_t tail __attribute__((aligned(QUEUE_CACHELINE)));
+	uint64_t popped;
+	uint64_t skipped;
+
+	// Shared, read-only after queue_init()
+	const char * name __attribute__((aligned(QUEUE_CACHELINE)));
+	unsigned char * slots;
+	size_t elemsize;
+	uint32_t capacity;
+	uint32_t mask;
+	int policy;
+	int datafd;			// Signalled when an item is committed
+	int spacefd;			// Signalled when a slot is released
+	volatile int stopping;
+};
+
+/* ****************************************************************************** */
+/* ************************ Function Declarations ******************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: queue_init()
+Purpose:  Allocates a queue of capacity slots (rounded up to a power of two)
+Input:    Queue, name for reports, slot size, capacity, full-queue policy
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int queue_init(struct queue * q, const char * name, size_t elemsize, uint32_t capacity, int policy);
+
+/*************************************************************************
+Function: queue_free()
+Purpose:  Releases the slots and doorbells of a queue
+Input:    Queue
+**************************************************************************/
+void queue_free(struct queue * q);
+
+/*************************************************************************
+Function: queue_stop()
+Purpose:  Wakes both sides of a queue and makes further waits return at once
+Input:    Queue
+**************************************************************************/
+void queue_stop(struct queue * q);
+
+/*************************************************************************
+Function: queue_reserve()
+Purpose:  Producer: returns the next free slot to fill in place.  Applies the
+          queue's full policy (waits for QUEUE_BLOCK, else counts a drop)
+Input:    Queue, milliseconds to wait for room (QUEUE_BLOCK only)
+Returns:  Pointer to the slot, NULL if the item must be dropped
+**************************************************************************/
+void * queue_reserve(struct queue * q, int timeout);
+
+/*************************************************************************
+Function: queue_commit()
+Purpose:  Producer: publishes the slot returned by queue_reserve()
+Input:    Queue
+**************************************************************************/
+void queue_commit(struct queue * q);
+
+/*************************************************************************
+Function: queue_push()
+Purpose:  Producer: copies an item into the queue (reserve + commit)
+Input:    Queue, item, milliseconds to wait for room (QUEUE_BLOCK only)
+Returns:  0 if queued, 1 if dropped
+**************************************************************************/
+int queue_push(struct queue * q, const void * item, int timeout);
+
+/*************************************************************************
+Function: queue_peek()
+Purpose:  Consumer: returns the oldest item (newest for QUEUE_KEEP_LATEST)
+          without removing it
+Input:    Queue
+Returns:  Pointer to the item, NULL if the queue is empty
+**************************************************************************/
+void * queue_peek(struct queue * q);
+
+/*************************************************************************
+Function: queue_release()
+Purpose:  Consumer: frees the item returned by queue_peek()
+Input:    Queue
+**************************************************************************/
+void queue_release(struct queue * q);
+
+/*************************************************************************
+Function: queue_pop()
+Purpose:  Consumer: copies out and removes the next item (peek + release)
+Input:    Queue, location of item to output
+Returns:  1 if an item was copied, 0 if the queue is empty
+**************************************************************************/
+int queue_pop(struct queue * q, void * item);
+
+/*************************************************************************
+Function: queue_wait()
+Purpose:  Consumer: sleeps until the queue has an item, it is stopped, or
+          the timeout expires
+Input:    Queue, timeout in milliseconds (-1 = forever)
+Returns:  Number of items waiting
+**************************************************************************/
+uint32_t queue_wait(struct queue * q, int timeout);
+
+/*************************************************************************
+Function: queue_count()
+Purpose:  Current occupancy of the queue
+Input:    Queue
+Returns:  Number of items waiting
+**************************************************************************/
+uint32_t queue_count(struct queue * q);
+
+/*************************************************************************
+Function: queue_poll()
+Purpose:  Consumer of several queues: sleeps until any of them has an item,
+          one is stopped, or the timeout expires
+Input:    Array of queues, number of queues, timeout in milliseconds
+Returns:  Total number of items waiting
+**************************************************************************/
+uint32_t queue_poll(struct queue ** queues, int count, int timeout);
+
+#endif
+/* ****************************************************************************** */
+// End of QUEUE.H
+/* ****************************************************************************** */
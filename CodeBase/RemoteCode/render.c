@@ -0,0 +1,321 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                         Display Renderer Code                          */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+
+/* ****************************************************************************** */
+/* *******************************   About  ************************************* */
+/* ****************************************************************************** */
+// This code draws into a shadow framebuffer and sends only what changed.
+/*
+	The display is on a 115200 baud serial link, so redrawing the whole screen
+	(153600 bytes of pixels) is out of the question.  Instead the renderer keeps
+	two RGB565 buffers: back, which the caller draws the next frame into, and
+	front, a copy of what the display currently shows.  On a flush the screen
+	is compared 16x16 tile by tile and each changed tile is encoded as:
+
+		one filled rectangle (11 bytes)		if the whole tile is one colour
+		otherwise, per changed row, runs of equal colour that contain at least
+		one changed pixel, as a line (11 bytes) or a single pixel (7 bytes)
+
+	The bytes sent are limited by a token bucket whose rate the caller sets
+	from whatever serial budget the sensors leave, and by RENDER_MAX_FPS.  A
+	tile is only copied into front once all of its commands were acknowledged,
+	so a failed command is simply retried on the next flush.
+*/
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include "prefiremapping.h"
+#include "render.h"
+
+/* ****************************************************************************** */
+/* ****************************** Functions ************************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: burst()
+Purpose:  Most bytes the token bucket may hold: one second of the rate, but
+          never less than the worst case tile, or a tile that busy could
+          never be sent at a low rate and would hold up every later one
+Input:    Renderer
+Returns:  Bucket capacity in bytes
+**************************************************************************/
+static double burst(struct render * r){
+	if(r->rate < RENDER_MAX_TILE_BYTES)
+		return RENDER_MAX_TILE_BYTES;
+	return r->rate;
+}
+
+/*************************************************************************
+Function: render_init()
+Purpose:  Clears the display and both framebuffers to a colour
+Input:    Renderer, display, background colour, initial byte rate
+Returns:  0 if successful, -1 if the display did not respond
+**************************************************************************/
+int render_init(struct render * r, struct lcd * display, uint16_t colour, uint32_t rate){
+	int x, y;
+	memset(r, 0, sizeof(*r));
+	for(y = 0; y < LCD_HEIGHT; y++){
+		for(x = 0; x < LCD_WIDTH; x++){
+			r->back[y][x] = colour;
+			r->front[y][x] = colour;
+		}
+	}
+	r->rate = rate;
+	r->tokens = rate;
+	r->lastfill = pfm_time_ns();
+	if(lcd_background(display, colour) != 0 || lcd_clear(display) != 0 || lcd_penSize(display, 0) != 0)
+		return -1;
+	return 0;
+}
+
+/*************************************************************************
+Function: render_setRate()
+Purpose:  Changes the number of serial bytes per second the renderer may use
+Input:    Renderer, bytes per second
+**************************************************************************/
+void render_setRate(struct render * r, uint32_t rate){
+	if(rate < RENDER_MIN_RATE)
+		rate = RENDER_MIN_RATE;
+	r->rate = rate;
+	if(r->tokens > burst(r))
+		r->tokens = burst(r);
+}
+
+/*************************************************************************
+Function: render_fill()
+Purpose:  Fills a rectangle of the back buffer (clipped to the screen)
+Input:    Renderer, top left x/y, bottom right x/y (inclusive), colour
+**************************************************************************/
+void render_fill(struct render * r, int x1, int y1, int x2, int y2, uint16_t colour){
+	int x, y;
+	if(x1 < 0) x1 = 0;
+	if(y1 < 0) y1 = 0;
+	if(x2 >= LCD_WIDTH) x2 = LCD_WIDTH - 1;
+	if(y2 >= LCD_HEIGHT) y2 = LCD_HEIGHT - 1;
+	for(y = y1; y <= y2; y++)
+		for(x = x1; x <= x2; x++)
+			r->back[y][x] = colour;
+}
+
+/*************************************************************************
+Function: render_pixel()
+Purpose:  Sets one back buffer pixel (ignored if off screen)
+Input:    Renderer, x, y, colour
+**************************************************************************/
+void render_pixel(struct render * r, int x, int y, uint16_t colour){
+	if(x >= 0 && x < LCD_WIDTH && y >= 0 && y < LCD_HEIGHT)
+		r->back[y][x] = colour;
+}
+
+/*************************************************************************
+Function: render_line()
+Purpose:  Draws a line into the back buffer
+Input:    Renderer, start x/y, end x/y, colour
+**************************************************************************/
+void render_line(struct render * r, int x1, int y1, int x2, int y2, uint16_t colour){
+	int dx = abs(x2 - x1);
+	int dy = -abs(y2 - y1);
+	int sx = (x1 < x2) ? 1 : -1;
+	int sy = (y1 < y2) ? 1 : -1;
+	int error = dx + dy;
+	int e2;
+	for(;;){
+		render_pixel(r, x1, y1, colour);
+		if(x1 == x2 && y1 == y2)
+			break;
+		e2 = 2*error;
+		if(e2 >= dy){
+			error += dy;
+			x1 += sx;
+		}
+		if(e2 <= dx){
+			error += dx;
+			y1 += sy;
+		}
+	}
+}
+
+/*************************************************************************
+Function: putCommand()
+Purpose:  Encodes an r (rectangle), L (line) or P (pixel) command
+Input:    Command, symbol, coordinates (x2/y2 unused for P), colour
+**************************************************************************/
+static void putCommand(struct render_command * command, uint8_t symbol, int x1, int y1, int x2, int y2, uint16_t colour){
+	uint8_t * b = command->bytes;
+	b[0] = symbol;
+	b[1] = x1 >> 8;	b[2] = x1 & 0xFF;
+	b[3] = y1 >> 8;	b[4] = y1 & 0xFF;
+	if(symbol == 'P'){
+		b[5] = colour >> 8;	b[6] = colour & 0xFF;
+		command->length = 7;
+		return;
+	}
+	b[5] = x2 >> 8;	b[6] = x2 & 0xFF;
+	b[7] = y2 >> 8;	b[8] = y2 & 0xFF;
+	b[9] = colour >> 8;	b[10] = colour & 0xFF;
+	command->length = 11;
+}
+
+/*************************************************************************
+Function: encodeTile()
+Purpose:  Encodes the changes in one tile
+Input:    Renderer, tile x/y, location of total byte count to output
+Returns:  Number of commands (0 if the tile is unchanged)
+**************************************************************************/
+static int encodeTile(struct render * r, int tx, int ty, int * bytes){
+	const int x0 = tx*RENDER_TILE;
+	const int y0 = ty*RENDER_TILE;
+	uint16_t colour = r->back[y0][x0];
+	int changed = 0;
+	int uniform = 1;
+	int count = 0;
+	int x, y, end, runchanged;
+
+	*bytes = 0;
+	for(y = y0; y < y0 + RENDER_TILE; y++){
+		if(memcmp(&r->back[y][x0], &r->front[y][x0], RENDER_TILE*2) != 0)
+			changed = 1;
+		for(x = x0; x < x0 + RENDER_TILE && uniform; x++)
+			if(r->back[y][x] != colour)
+				uniform = 0;
+	}
+	if(!changed)
+		return 0;
+	if(uniform){
+		putCommand(&r->command[0], 'r', x0, y0, x0 + RENDER_TILE - 1, y0 + RENDER_TILE - 1, colour);
+		*bytes = r->command[0].length;
+		return 1;
+	}
+
+	for(y = y0; y < y0 + RENDER_TILE; y++){
+		if(memcmp(&r->back[y][x0], &r->front[y][x0], RENDER_TILE*2) == 0)
+			continue;
+		x = x0;
+		while(x < x0 + RENDER_TILE){
+			colour = r->back[y][x];
+			runchanged = 0;
+			for(end = x; end < x0 + RENDER_TILE && r->back[y][end] == colour; end++)
+				runchanged |= (r->front[y][end] != colour);
+			if(runchanged){
+				if(end - x == 1)
+					putCommand(&r->command[count], 'P', x, y, 0, 0, colour);
+				else
+					putCommand(&r->command[count], 'L', x, y, end - 1, y, colour);
+				*bytes += r->command[count].length;
+				count++;
+			}
+			x = end;
+		}
+	}
+	return count;
+}
+
+/*************************************************************************
+Function: render_text()
+Purpose:  Replaces a line of status text if it changed and the budget allows.
+          Text is drawn straight to the display, not through the framebuffer.
+Input:    Renderer, display, row (0 to RENDER_TEXT_ROWS-1), colour, text
+Returns:  Number of bytes sent, -1 if the budget did not allow it
+**************************************************************************/
+int render_text(struct render * r, struct lcd * display, int row, uint16_t colour, const char * text){
+	struct render_command * clear = &r->command[0];
+	char line[RENDER_TEXT_COLUMNS+1];
+	int bytes;
+
+	if(row < 0 || row >= RENDER_TEXT_ROWS)
+		return -1;
+	snprintf(line, sizeof(line), "%s", text);
+	if(strcmp(line, r->text[row]) == 0)
+		return 0;
+	putCommand(clear, 'r', 0, row*RENDER_TEXT_HEIGHT, LCD_WIDTH-1, (row+1)*RENDER_TEXT_HEIGHT - 1, r->back[row*RENDER_TEXT_HEIGHT][0]);
+	bytes = clear->length + 7 + strlen(line);
+	if(bytes > r->tokens)
+		return -1;
+	r->tokens -= bytes;
+	r->bytes += bytes;
+	r->commands += 2;
+	if(lcd_command(display, clear->bytes, clear->length) != 0 || lcd_string(display, 0, row, 0, colour, line) != 0)
+		return bytes;		// Cache left alone, so it is redrawn next time
+	strcpy(r->text[row], line);
+	return bytes;
+}
+
+/*************************************************************************
+Function: render_flush()
+Purpose:  Sends the tiles that differ between the back buffer and the display
+          as run-length encoded rectangle/line/pixel commands, as far as the
+          byte budget and frame rate allow.  Tiles that do not fit are left
+          dirty and sent first next time.
+Input:    Renderer, display
+Returns:  Number of bytes sent, -1 if called sooner than the frame rate allows
+**************************************************************************/
+int render_flush(struct render * r, struct lcd * display){
+	const int total = RENDER_TILES_X * RENDER_TILES_Y;
+	uint64_t now = pfm_time_ns();
+	int sent = 0;
+	int bytes;
+	int commands;
+	int tile, tx, ty, n, i, y;
+	int ok;
+
+	if(now - r->lastflush < 1000000000ULL / RENDER_MAX_FPS)
+		return -1;
+	r->tokens += (now - r->lastfill) * 1e-9 * r->rate;
+	if(r->tokens > burst(r))
+		r->tokens = burst(r);
+	r->lastfill = now;
+	r->lastflush = now;
+	r->flushes++;
+
+	for(i = 0; i < total; i++){
+		tile = (r->nexttile + i) % total;
+		tx = tile % RENDER_TILES_X;
+		ty = tile / RENDER_TILES_X;
+		commands = encodeTile(r, tx, ty, &bytes);
+		if(commands == 0)
+			continue;
+		if(bytes > r->tokens){
+			// Out of budget: count what is left and start here next time
+			for(n = i; n < total; n++){
+				tile = (r->nexttile + n) % total;
+				if(encodeTile(r, tile % RENDER_TILES_X, tile / RENDER_TILES_X, &bytes) > 0)
+					r->deferred++;
+			}
+			r->nexttile = (r->nexttile + i) % total;
+			return sent;
+		}
+		ok = 1;
+		for(n = 0; n < commands && ok; n++){
+			if(lcd_command(display, r->command[n].bytes, r->command[n].length) != 0)
+				ok = 0;
+			r->commands++;
+		}
+		r->tokens -= bytes;
+		sent += bytes;
+		r->bytes += bytes;
+		if(ok){
+			for(y = ty*RENDER_TILE; y < (ty+1)*RENDER_TILE; y++)
+				memcpy(&r->front[y][tx*RENDER_TILE], &r->back[y][tx*RENDER_TILE], RENDER_TILE*2);
+			r->tiles++;
+		}
+	}
+	r->nexttile = 0;
+	return sent;
+}
+
+/* ****************************************************************************** */
+// End of RENDER.C
+/* ****************************************************************************** */
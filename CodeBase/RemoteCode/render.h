@@ -0,0 +1,130 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                      Display Renderer Code Header                      */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+#ifndef _RENDER_H_
+#define _RENDER_H_
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include <stdint.h>
+#include "lcd.h"
+
+/* ****************************************************************************** */
+/* *****************************   Definitions  ********************************* */
+/* ****************************************************************************** */
+#define RENDER_TILE 16				// Tile edge in pixels
+#define RENDER_TILES_X (LCD_WIDTH/RENDER_TILE)
+#define RENDER_TILES_Y (LCD_HEIGHT/RENDER_TILE)
+#define RENDER_MAX_FPS 5			// Upper limit on flushes per second
+#define RENDER_LINK_RATE (LCD_BAUD/10)		// Bytes per second the display's 8N1 link can carry
+#define RENDER_MIN_RATE 500			// Bytes per second the display always gets
+#define RENDER_MAX_COMMANDS (RENDER_TILE*RENDER_TILE)	// Worst case commands for one tile
+#define RENDER_COMMAND_BYTES 11			// Longest command the encoder emits
+#define RENDER_MAX_TILE_BYTES (RENDER_MAX_COMMANDS*RENDER_COMMAND_BYTES)	// Worst case bytes for one tile
+#define RENDER_TEXT_ROWS 4			// Rows of font 0 text above the framebuffer area
+#define RENDER_TEXT_HEIGHT 8			// Pixels per text row
+#define RENDER_TEXT_COLUMNS 40
+#define RENDER_TOP (RENDER_TEXT_ROWS*RENDER_TEXT_HEIGHT)	// First framebuffer row the caller should draw in
+
+struct render_command {
+	uint8_t length;
+	uint8_t bytes[RENDER_COMMAND_BYTES];
+};
+
+struct render {
+	uint16_t back[LCD_HEIGHT][LCD_WIDTH];	// Frame being drawn
+	uint16_t front[LCD_HEIGHT][LCD_WIDTH];	// What the display is showing
+	struct render_command command[RENDER_MAX_COMMANDS];
+	char text[RENDER_TEXT_ROWS][RENDER_TEXT_COLUMNS+1];	// Text the display is showing
+
+	// Serial budget (token bucket in bytes)
+	uint32_t rate;				// Bytes per second
+	double tokens;
+	uint64_t lastfill;
+	uint64_t lastflush;
+	int nexttile;				// Where the next flush starts, so deferred tiles go first
+
+	// Statistics
+	uint32_t flushes;
+	uint32_t tiles;				// Tiles sent
+	uint32_t deferred;			// Tiles postponed for lack of budget
+	uint32_t commands;
+	uint64_t bytes;
+};
+
+/* ****************************************************************************** */
+/* ************************ Function Declarations ******************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: render_init()
+Purpose:  Clears the display and both framebuffers to a colour
+Input:    Renderer, display, background colour, initial byte rate
+Returns:  0 if successful, -1 if the display did not respond
+**************************************************************************/
+int render_init(struct render * r, struct lcd * display, uint16_t colour, uint32_t rate);
+
+/*************************************************************************
+Function: render_setRate()
+Purpose:  Changes the number of serial bytes per second the renderer may use
+Input:    Renderer, bytes per second
+**************************************************************************/
+void render_setRate(struct render * r, uint32_t rate);
+
+/*************************************************************************
+Function: render_fill()
+Purpose:  Fills a rectangle of the back buffer (clipped to the screen)
+Input:    Renderer, top left x/y, bottom right x/y (inclusive), colour
+**************************************************************************/
+void render_fill(struct render * r, int x1, int y1, int x2, int y2, uint16_t colour);
+
+/*************************************************************************
+Function: render_pixel()
+Purpose:  Sets one back buffer pixel (ignored if off screen)
+Input:    Renderer, x, y, colour
+**************************************************************************/
+void render_pixel(struct render * r, int x, int y, uint16_t colour);
+
+/*************************************************************************
+Function: render_line()
+Purpose:  Draws a line into the back buffer
+Input:    Renderer, start x/y, end x/y, colour
+**************************************************************************/
+void render_line(struct render * r, int x1, int y1, int x2, int y2, uint16_t colour);
+
+/*************************************************************************
+Function: render_text()
+Purpose:  Replaces a line of status text if it changed and the budget allows.
+          Text is drawn straight to the display, not through the framebuffer.
+Input:    Renderer, display, row (0 to RENDER_TEXT_ROWS-1), colour, text
+Returns:  Number of bytes sent, -1 if the budget did not allow it
+**************************************************************************/
+int render_text(struct render * r, struct lcd * display, int row, uint16_t colour, const char * text);
+
+/*************************************************************************
+Function: render_flush()
+Purpose:  Sends the tiles that differ between the back buffer and the display
+          as run-length encoded rectangle/line/pixel commands, as far as the
+          byte budget and frame rate allow.  Tiles that do not fit are left
+          dirty and sent first next time.
+Input:    Renderer, display
+Returns:  Number of bytes sent, -1 if called sooner than the frame rate allows
+**************************************************************************/
+int render_flush(struct render * r, struct lcd * display);
+
+#endif
+/* ****************************************************************************** */
+// End of RENDER.H
+/* ****************************************************************************** */
@@ -0,0 +1,215 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                      Real-Time Scheduling Code                         */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+
+/* ****************************************************************************** */
+/* *******************************   About  ************************************* */
+/* ****************************************************************************** */
+// This code contains the real-time scheduling profile of the sensor readers.
+/*	Under storage and LCD load the LIDAR reader could be preempted long enough
+	for the tty buffer to overflow.  The readers therefore run under SCHED_FIFO
+	above every other stage, pinned to a CPU, with all memory locked and the
+	queues and scratch buffers faulted in before the first read, so the only
+	thing a reader ever waits on is its device.
+
+	The jitter probe wakes just below the readers' priority, on their CPU, on
+	an absolute RT_PROBE_PERIOD grid and records how late each wake-up was.
+	That bounds the latency a reader sees between its data arriving and it
+	running, plus the time the readers themselves take to run.
+
+	Everything here degrades gracefully: without the privileges for
+	SCHED_FIFO or mlockall() the pipeline runs as before and the report says
+	which parts of the profile are in force.
+*/
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#define _GNU_SOURCE			// pthread_setaffinity_np()
+#include "prefiremapping.h"
+#include "rt.h"
+#include <sched.h>
+#include <sys/mman.h>
+
+/* ****************************************************************************** */
+/* ****************************** Functions ************************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: rt_lockMemory()
+Purpose:  Locks every current and future page of the process into RAM so a
+          reader never waits on a page fault
+Returns:  0 if successful, -1 if not (usually missing privileges)
+**************************************************************************/
+int rt_lockMemory(void){
+	if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0){
+		if(VERBOSE_MODE == 1)
+			printf("Unable to Lock Memory, Readers May Page Fault\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*************************************************************************
+Function: rt_prefault()
+Purpose:  Touches every page of a buffer so it is backed by RAM before the
+          pipeline starts
+Input:    Buffer, size in bytes
+Returns:  Bytes touched
+**************************************************************************/
+size_t rt_prefault(void * buffer, size_t size){
+	volatile unsigned char * bytes = buffer;
+	long page = sysconf(_SC_PAGESIZE);
+	size_t n;
+
+	if(buffer == NULL || size == 0)
+		return 0;
+	if(page <= 0)
+		page = 4096;
+	// A write fault, so copy-on-write zero pages are replaced by real ones
+	for(n = 0; n < size; n += page)
+		bytes[n] = bytes[n];
+	bytes[size - 1] = bytes[size - 1];
+	return size;
+}
+
+/*************************************************************************
+Function: rt_prefaultStack()
+Purpose:  Touches RT_STACK_PREFAULT bytes of the calling thread's stack
+**************************************************************************/
+void rt_prefaultStack(void){
+	volatile unsigned char stack[RT_STACK_PREFAULT];
+	size_t n;
+	for(n = 0; n < sizeof(stack); n += 512)
+		stack[n] = 0;
+}
+
+/*************************************************************************
+Function: rt_setThread()
+Purpose:  Pins a thread to a CPU and runs it under SCHED_FIFO
+Input:    Thread, priority, CPU (-1 = leave the affinity alone)
+Returns:  0 if SCHED_FIFO was applied, -1 if not
+**************************************************************************/
+int rt_setThread(pthread_t thread, int priority, int cpu){
+	struct sched_param param;
+	cpu_set_t cpus;
+
+	// A CPU the board does not have (single core BeagleBone) just means "any"
+	if(cpu >= 0 && cpu < sysconf(_SC_NPROCESSORS_ONLN)){
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		if(pthread_setaffinity_np(thread, sizeof(cpus), &cpus) != 0 && VERBOSE_MODE == 1)
+			printf("Unable to Pin Thread to CPU %d\n", cpu);
+	}
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
+	if(pthread_setschedparam(thread, SCHED_FIFO, &param) != 0)
+		return -1;
+	return 0;
+}
+
+/*************************************************************************
+Function: rt_jitterBound()
+Purpose:  Upper bound of a histogram bucket
+Input:    Bucket number
+Returns:  Latency in nanoseconds below which samples fall in the bucket
+          (UINT64_MAX for the last)
+**************************************************************************/
+uint64_t rt_jitterBound(int bucket){
+	static const uint64_t bounds[RT_JITTER_BUCKETS] = {
+		10000ULL, 20000ULL, 50000ULL, 100000ULL, 200000ULL, 500000ULL, 1000000ULL, UINT64_MAX
+	};
+	return bounds[bucket];
+}
+
+/*************************************************************************
+Function: jitterProbe()
+Purpose:  Probe thread.  Sleeps to each point of an absolute RT_PROBE_PERIOD
+          grid and records how late it woke.
+Input:    Probe
+**************************************************************************/
+static void * jitterProbe(void * arg){
+	struct rt_jitter * jitter = arg;
+	struct timespec next;
+	uint64_t target, late;
+	int bucket;
+
+	rt_prefaultStack();
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while(jitter->running){
+		next.tv_nsec += RT_PROBE_PERIOD;
+		while(next.tv_nsec >= 1000000000L){
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
+		if(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) != 0)
+			continue;
+		target = (uint64_t)next.tv_sec*1000000000ULL + next.tv_nsec;
+		late = pfm_time_ns() - target;
+		for(bucket = 0; late >= rt_jitterBound(bucket); bucket++);
+		__atomic_add_fetch(&jitter->histogram[bucket], 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&jitter->samples, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&jitter->total, late, __ATOMIC_RELAXED);
+		if(late > jitter->max)
+			__atomic_store_n(&jitter->max, late, __ATOMIC_RELAXED);
+		if(late > __atomic_load_n(&jitter->recentmax, __ATOMIC_RELAXED))
+			__atomic_store_n(&jitter->recentmax, late, __ATOMIC_RELAXED);
+		// After a long stall, measure from now rather than replaying every missed period
+		if(late > 10*RT_PROBE_PERIOD)
+			clock_gettime(CLOCK_MONOTONIC, &next);
+	}
+	return NULL;
+}
+
+/*************************************************************************
+Function: rt_jitterStart()
+Purpose:  Starts the wake-up jitter probe
+Input:    Probe, priority, CPU
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int rt_jitterStart(struct rt_jitter * jitter, int priority, int cpu){
+	pthread_attr_t attr;
+	int result;
+
+	memset(jitter, 0, sizeof(*jitter));
+	jitter->running = 1;
+	// Locked memory covers the whole stack, so keep it as small as a stage's
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, RT_STACK_SIZE);
+	result = pthread_create(&jitter->thread, &attr, jitterProbe, jitter);
+	pthread_attr_destroy(&attr);
+	if(result != 0){
+		jitter->running = 0;
+		return -1;
+	}
+	jitter->started = 1;
+	jitter->fifo = (rt_setThread(jitter->thread, priority, cpu) == 0);
+	return 0;
+}
+
+/*************************************************************************
+Function: rt_jitterStop()
+Purpose:  Stops the wake-up jitter probe
+Input:    Probe
+**************************************************************************/
+void rt_jitterStop(struct rt_jitter * jitter){
+	if(!jitter->started || !jitter->running)
+		return;
+	jitter->running = 0;
+	pthread_join(jitter->thread, NULL);
+}
+
+/* ****************************************************************************** */
+// End of RT.C
+/* ****************************************************************************** */
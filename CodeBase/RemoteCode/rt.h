@@ -0,0 +1,122 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                     Real-Time Scheduling Header                        */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+#ifndef _RT_H_
+#define _RT_H_
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* ****************************************************************************** */
+/* *****************************   Definitions  ********************************* */
+/* ****************************************************************************** */
+// Scheduling profile of the sensor readers (SCHED_FIFO, 1-99, higher runs first)
+#define RT_LIDAR_PRIORITY 80		// LIDAR reader, the sensor with the smallest tty margin
+#define RT_IMU_PRIORITY 70		// IMU reader
+#define RT_LIDAR_CPU 0			// CPU the LIDAR reader is pinned to, -1 = any
+#define RT_IMU_CPU 0			// CPU the IMU reader is pinned to, -1 = any
+
+#define RT_STACK_SIZE (256*1024)	// Stack of every stage thread (all of it is locked)
+#define RT_STACK_PREFAULT (64*1024)	// Stack a real-time thread touches before it starts work
+
+// Wake-up jitter probe, runs on the readers' CPU just below them, so it never delays
+// their wake-ups; what it measures includes the time they take to run
+#define RT_PROBE_PRIORITY (RT_IMU_PRIORITY - 1)
+#define RT_PROBE_CPU RT_LIDAR_CPU
+#define RT_PROBE_PERIOD 1000000ULL	// Nanoseconds between probe wake-ups
+#define RT_JITTER_BUCKETS 8		// Histogram buckets, see rt_jitterBound()
+
+/*	Wake-up latency seen by a SCHED_FIFO thread: how late clock_nanosleep()
+	returns after the absolute time it was asked to wake at.  Written by the
+	probe thread, read by the reporter.
+*/
+struct rt_jitter {
+	pthread_t thread;
+	int started;
+	volatile int running;
+	int fifo;			// 1 if the probe itself got SCHED_FIFO
+	uint64_t samples;
+	uint64_t total;			// Sum of latencies in nanoseconds
+	uint64_t max;			// Worst latency since start
+	uint64_t recentmax;		// Worst latency since the last report
+	uint64_t histogram[RT_JITTER_BUCKETS];
+};
+
+/* ****************************************************************************** */
+/* ************************ Function Declarations ******************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: rt_lockMemory()
+Purpose:  Locks every current and future page of the process into RAM so a
+          reader never waits on a page fault
+Returns:  0 if successful, -1 if not (usually missing privileges)
+**************************************************************************/
+int rt_lockMemory(void);
+
+/*************************************************************************
+Function: rt_prefault()
+Purpose:  Touches every page of a buffer so it is backed by RAM before the
+          pipeline starts
+Input:    Buffer, size in bytes
+Returns:  Bytes touched
+**************************************************************************/
+size_t rt_prefault(void * buffer, size_t size);
+
+/*************************************************************************
+Function: rt_prefaultStack()
+Purpose:  Touches RT_STACK_PREFAULT bytes of the calling thread's stack
+**************************************************************************/
+void rt_prefaultStack(void);
+
+/*************************************************************************
+Function: rt_setThread()
+Purpose:  Pins a thread to a CPU and runs it under SCHED_FIFO
+Input:    Thread, priority, CPU (-1 = leave the affinity alone)
+Returns:  0 if SCHED_FIFO was applied, -1 if not
+**************************************************************************/
+int rt_setThread(pthread_t thread, int priority, int cpu);
+
+/*************************************************************************
+Function: rt_jitterStart()
+Purpose:  Starts the wake-up jitter probe
+Input:    Probe, priority, CPU
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int rt_jitterStart(struct rt_jitter * jitter, int priority, int cpu);
+
+/*************************************************************************
+Function: rt_jitterStop()
+Purpose:  Stops the wake-up jitter probe
+Input:    Probe
+**************************************************************************/
+void rt_jitterStop(struct rt_jitter * jitter);
+
+/*************************************************************************
+Function: rt_jitterBound()
+Purpose:  Upper bound of a histogram bucket
+Input:    Bucket number
+Returns:  Latency in nanoseconds below which samples fall in the bucket
+          (UINT64_MAX for the last)
+**************************************************************************/
+uint64_t rt_jitterBound(int bucket);
+
+#endif
+/* ****************************************************************************** */
+// End of RT.H
+/* ****************************************************************************** */
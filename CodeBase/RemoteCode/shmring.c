@@ -0,0 +1,340 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                      Shared Memory Scan Ring Code                      */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+
+/* ****************************************************************************** */
+/* *******************************   About  ************************************* */
+/* ****************************************************************************** */
+// This code hands decoded scans to other processes through shared memory.
+// See shmring.h for the layout.
+/*
+	Consumers such as a UI, a separate storage writer or a debug recorder can
+	run as their own processes, so a crash in one of them never takes down
+	capture.  They read the scans straight out of the mapping: no copies, no
+	sockets.
+
+	The ring is a POSIX shared memory object rather than an anonymous memfd
+	so that a consumer started (or restarted) at any time can find it by name.
+	The writer reads nothing back from the mapping except the armed flag,
+	which a reader sets just before it sleeps and the writer clears each time
+	it wakes them.  So a reader that is slow, stuck, scribbling on the header
+	or killed half way through an item (or in its sleep) cannot hold up
+	acquisition: the writer's only extra cost is one futex wake per item while
+	readers sleep, and a dead reader's flag costs one more wake at most.
+*/
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include "prefiremapping.h"
+#include "shmring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// The header must fit in front of slot 0
+typedef char shmring_header_fits[(sizeof(struct shmring_header) <= SHMRING_HEADER) ? 1 : -1];
+
+/* ****************************************************************************** */
+/* ****************************** Functions ************************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: slotAt()
+Purpose:  Finds the slot an item lives in
+Input:    Ring, sequence number
+Returns:  Slot
+**************************************************************************/
+static struct shmring_slot * slotAt(struct shmring * ring, uint64_t seq){
+	return (struct shmring_slot *)(ring->slots + (size_t)(seq & ring->mask) * ring->stride);
+}
+
+/*************************************************************************
+Function: shmring_create()
+Purpose:  Creates (replacing any stale one) and maps the shared ring
+Input:    Ring, object name ("/pfm-scans"), payload bytes per slot, number of
+          slots (a power of two)
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int shmring_create(struct shmring * ring, const char * name, size_t slotsize, uint32_t slots){
+	struct shmring_header * header;
+	struct timespec now;
+	uint32_t stride = (SHMRING_SLOT_HEADER + slotsize + SHMRING_LINE - 1) & ~(SHMRING_LINE - 1);
+
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+	ring->name = name;
+	if(slots == 0 || (slots & (slots - 1)) != 0){
+		problem = 80;
+		return -1;
+	}
+	// A ring left behind by a crashed run is replaced; its readers see it closed
+	shm_unlink(name);
+	ring->fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	ring->size = SHMRING_HEADER + (size_t)slots * stride;
+	if(ring->fd < 0 || ftruncate(ring->fd, ring->size) != 0){
+		problem = 80;
+		if(ring->fd >= 0){
+			close(ring->fd);
+			shm_unlink(name);
+		}
+		ring->fd = -1;
+		return -1;
+	}
+	header = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+	if(header == MAP_FAILED){
+		problem = 80;
+		close(ring->fd);
+		shm_unlink(name);
+		ring->fd = -1;
+		return -1;
+	}
+	// ftruncate() zeroed every slot, so no slot matches any item yet
+	ring->header = header;
+	ring->slots = (unsigned char *)header + SHMRING_HEADER;
+	ring->mask = slots - 1;
+	ring->slotsize = slotsize;
+	ring->stride = stride;
+	header->version = SHMRING_VERSION;
+	header->headersize = SHMRING_HEADER;
+	header->slotsize = slotsize;
+	header->stride = stride;
+	header->slots = slots;
+	header->writerpid = getpid();
+	clock_gettime(CLOCK_REALTIME, &now);
+	header->created = (uint64_t)now.tv_sec*1000000000ULL + now.tv_nsec;
+	// The magic goes last, a reader attaching meanwhile sees no ring yet
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(header->magic, SHMRING_MAGIC, 4);
+	if(VERBOSE_MODE == 1)
+		printf("Sharing Scans Through %s\n", name);
+	return 0;
+}
+
+/*************************************************************************
+Function: futexWake()
+Purpose:  Wakes every process sleeping on the ring's futex word
+Input:    Ring
+**************************************************************************/
+static void futexWake(struct shmring * ring){
+	syscall(SYS_futex, &ring->header->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	ring->wakes++;
+}
+
+/*************************************************************************
+Function: shmring_publish()
+Purpose:  Writer: copies an item into the next slot and wakes sleeping
+          readers.  Never waits.
+Input:    Ring, item (slotsize bytes)
+**************************************************************************/
+void shmring_publish(struct shmring * ring, const void * item){
+	struct shmring_header * header = ring->header;
+	uint64_t seq = ring->head;
+	struct shmring_slot * slot = slotAt(ring, seq);
+
+	// Odd while writing, so a reader of the previous item in this slot sees it change
+	__atomic_store_n(&slot->seq, 2*seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy((unsigned char *)slot + SHMRING_SLOT_HEADER, item, ring->slotsize);
+	__atomic_store_n(&slot->seq, 2*seq + 2, __ATOMIC_RELEASE);
+	ring->head = seq + 1;
+	__atomic_store_n(&header->head, ring->head, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&header->futex, 1, __ATOMIC_SEQ_CST);
+	// Readers arm again before every sleep, so one that died asleep is only woken once
+	if(__atomic_exchange_n(&header->armed, 0, __ATOMIC_SEQ_CST) != 0)
+		futexWake(ring);
+	ring->published++;
+}
+
+/*************************************************************************
+Function: shmring_destroy()
+Purpose:  Writer: marks the ring closed, wakes every reader and removes it
+Input:    Ring
+**************************************************************************/
+void shmring_destroy(struct shmring * ring){
+	if(ring->header == NULL)
+		return;
+	// Unlinked first, so a reader that sees it closed cannot attach to it again
+	shm_unlink(ring->name);
+	__atomic_store_n(&ring->header->closed, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&ring->header->futex, 1, __ATOMIC_SEQ_CST);
+	futexWake(ring);
+	munmap(ring->header, ring->size);
+	close(ring->fd);
+	ring->header = NULL;
+	ring->fd = -1;
+}
+
+/*************************************************************************
+Function: shmring_attach()
+Purpose:  Reader: maps an existing ring and starts at the next item the
+          writer publishes
+Input:    Reader, object name, expected payload bytes per slot
+Returns:  0 if successful, -1 if there is no usable (open) ring
+**************************************************************************/
+int shmring_attach(struct shmring_reader * reader, const char * name, size_t slotsize){
+	struct shmring * ring = &reader->ring;
+	struct shmring_header * header;
+	struct stat info;
+
+	memset(reader, 0, sizeof(*reader));
+	ring->name = name;
+	ring->fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+	if(ring->fd < 0)
+		return -1;
+	if(fstat(ring->fd, &info) != 0 || info.st_size < SHMRING_HEADER){
+		close(ring->fd);
+		ring->fd = -1;
+		return -1;
+	}
+	ring->size = info.st_size;
+	// Read-write only because a reader arms the writer's wake-up in the header
+	header = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+	if(header == MAP_FAILED){
+		close(ring->fd);
+		ring->fd = -1;
+		return -1;
+	}
+	ring->header = header;
+	if(memcmp(header->magic, SHMRING_MAGIC, 4) != 0 || header->version != SHMRING_VERSION ||
+	   header->slotsize != slotsize || header->slots == 0 || header->closed ||
+	   header->headersize + (size_t)header->slots * header->stride > ring->size){
+		shmring_detach(reader);
+		return -1;
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	ring->slots = (unsigned char *)header + header->headersize;
+	ring->mask = header->slots - 1;
+	ring->slotsize = header->slotsize;
+	ring->stride = header->stride;
+	reader->cursor = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+	return 0;
+}
+
+/*************************************************************************
+Function: writerGone()
+Purpose:  Checks whether the ring was closed or its writer died
+Input:    Ring
+Returns:  1 if no more items will come
+**************************************************************************/
+static int writerGone(struct shmring * ring){
+	if(__atomic_load_n(&ring->header->closed, __ATOMIC_ACQUIRE))
+		return 1;
+	return kill(ring->header->writerpid, 0) != 0 && errno == ESRCH;
+}
+
+/*************************************************************************
+Function: shmring_peek()
+Purpose:  Reader: returns the next item in place, without copying it.  The
+          item must be checked with shmring_done() before its contents are
+          trusted.
+Input:    Reader, location of item pointer to output
+Returns:  SHMRING_ITEM, SHMRING_NONE or SHMRING_CLOSED
+**************************************************************************/
+int shmring_peek(struct shmring_reader * reader, const void ** item){
+	struct shmring * ring = &reader->ring;
+	struct shmring_slot * slot;
+	uint64_t head, seq;
+
+	for(;;){
+		head = __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+		if(reader->cursor == head)
+			return __atomic_load_n(&ring->header->closed, __ATOMIC_ACQUIRE) ? SHMRING_CLOSED : SHMRING_NONE;
+		// More than a ring behind: the oldest items are gone
+		if(head - reader->cursor > ring->mask + 1){
+			reader->lost += head - (ring->mask + 1) - reader->cursor;
+			reader->cursor = head - (ring->mask + 1);
+		}
+		slot = slotAt(ring, reader->cursor);
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if(seq == 2*reader->cursor + 2)
+			break;
+		// Already being overwritten by a newer item
+		reader->lost++;
+		reader->cursor++;
+	}
+	reader->check = seq;
+	*item = (const unsigned char *)slot + SHMRING_SLOT_HEADER;
+	return SHMRING_ITEM;
+}
+
+/*************************************************************************
+Function: shmring_done()
+Purpose:  Reader: finishes with the item from shmring_peek() and moves on
+Input:    Reader
+Returns:  1 if the item was intact the whole time, 0 if the writer
+          overwrote it (it is counted as lost)
+**************************************************************************/
+int shmring_done(struct shmring_reader * reader){
+	struct shmring_slot * slot = slotAt(&reader->ring, reader->cursor);
+	int intact;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	intact = (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == reader->check);
+	if(!intact)
+		reader->lost++;
+	reader->cursor++;
+	return intact;
+}
+
+/*************************************************************************
+Function: shmring_wait()
+Purpose:  Reader: sleeps until an item is ready, the writer stops or the
+          timeout expires
+Input:    Reader, timeout in milliseconds
+Returns:  SHMRING_ITEM, SHMRING_NONE or SHMRING_CLOSED
+**************************************************************************/
+int shmring_wait(struct shmring_reader * reader, int timeout){
+	struct shmring_header * header = reader->ring.header;
+	struct timespec wait;
+	uint32_t futex;
+
+	// Load the futex word before checking, so a publish in between makes the wait return at once
+	futex = __atomic_load_n(&header->futex, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&header->head, __ATOMIC_ACQUIRE) != reader->cursor)
+		return SHMRING_ITEM;
+	if(writerGone(&reader->ring))
+		return SHMRING_CLOSED;
+	wait.tv_sec = timeout / 1000;
+	wait.tv_nsec = (timeout % 1000) * 1000000L;
+	// Armed after loading the futex word, so a publish that clears it before the wait also changes the word
+	__atomic_store_n(&header->armed, 1, __ATOMIC_SEQ_CST);
+	syscall(SYS_futex, &header->futex, FUTEX_WAIT, futex, &wait, NULL, 0);
+	if(__atomic_load_n(&header->head, __ATOMIC_ACQUIRE) != reader->cursor)
+		return SHMRING_ITEM;
+	return writerGone(&reader->ring) ? SHMRING_CLOSED : SHMRING_NONE;
+}
+
+/*************************************************************************
+Function: shmring_detach()
+Purpose:  Reader: unmaps the ring
+Input:    Reader
+**************************************************************************/
+void shmring_detach(struct shmring_reader * reader){
+	struct shmring * ring = &reader->ring;
+	if(ring->header != NULL)
+		munmap(ring->header, ring->size);
+	if(ring->fd >= 0)
+		close(ring->fd);
+	ring->header = NULL;
+	ring->fd = -1;
+}
+
+/* ****************************************************************************** */
+// End of SHMRING.C
+/* ****************************************************************************** */
@@ -0,0 +1,196 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                     Shared Memory Scan Ring Header                     */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+#ifndef _SHMRING_H_
+#define _SHMRING_H_
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include <stdint.h>
+#include <stddef.h>
+
+/* ****************************************************************************** */
+/* *****************************   Definitions  ********************************* */
+/* ****************************************************************************** */
+/*	Shared scan ring (POSIX shared memory object, e.g. /dev/shm/pfm-scans),
+	native byte order, readers must be built from the same headers:
+
+	Header (SHMRING_HEADER bytes)
+		magic[4]	"PFR1"
+		version		uint16
+		headersize	uint16	offset of slot 0
+		slotsize	uint32	payload bytes per slot (sizeof(struct pfm_frame))
+		stride		uint32	bytes from one slot to the next
+		slots		uint32	number of slots, a power of two
+		writerpid	uint32	process that owns the ring
+		created		uint64	CLOCK_REALTIME nanoseconds the ring was created
+		closed		uint32	set when the writer stops
+		armed		uint32	set by a reader about to sleep on futex,
+					cleared by the writer when it wakes them
+		futex		uint32	(own cache line) bumped after every publish
+		head		uint64	(own cache line) sequence number of the next item,
+					a copy of the writer's own
+
+	Slots, slot n at headersize + n*stride
+		seq		uint64	seqlock: 2*s+1 while item s is being written,
+					2*s+2 once it is complete
+		reserved	uint64
+		payload		slotsize bytes
+
+	Item s lives in slot s & (slots-1).  The one writer never waits for a
+	reader: each reader keeps its own cursor in its own memory, and a reader
+	that falls more than a ring behind loses the oldest items (and counts
+	them).  A reader uses the payload in place and then checks that the slot's
+	seq did not change, which tells it the writer did not overwrite the item
+	meanwhile.  Apart from the armed flag, the writer only ever writes to the
+	ring: its position and the slot geometry are kept in its own memory, so a
+	reader that scribbles on the header cannot misdirect it.
+*/
+#define SHMRING_MAGIC "PFR1"
+#define SHMRING_VERSION 2
+#define SHMRING_HEADER 256
+#define SHMRING_SLOT_HEADER 16
+#define SHMRING_SLOTS 64		// ~3 s of scans from both LIDARs at 10 Hz
+#define SHMRING_LINE 64			// Cache line, slots are padded to it
+
+// shmring_peek() / shmring_wait() results
+#define SHMRING_NONE 0			// Nothing new
+#define SHMRING_ITEM 1			// An item is ready
+#define SHMRING_CLOSED -1		// The writer stopped or died, attach again
+
+struct shmring_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t headersize;
+	uint32_t slotsize;
+	uint32_t stride;
+	uint32_t slots;
+	uint32_t writerpid;
+	uint64_t created;
+	volatile uint32_t closed;
+	volatile uint32_t armed;
+	volatile uint32_t futex __attribute__((aligned(SHMRING_LINE)));
+	volatile uint64_t head __attribute__((aligned(SHMRING_LINE)));
+};
+
+struct shmring_slot {
+	volatile uint64_t seq;
+	uint64_t reserved;
+	// payload follows
+};
+
+/*	One side's mapping of a ring */
+struct shmring {
+	const char * name;
+	int fd;
+	size_t size;
+	struct shmring_header * header;
+	unsigned char * slots;
+	uint32_t mask;
+	uint32_t slotsize;		// Copies of the header's, which readers could overwrite
+	uint32_t stride;
+
+	// Writer's position, published to header->head
+	uint64_t head;
+
+	// Writer statistics
+	uint64_t published;
+	uint32_t wakes;			// futex wake calls made (only after a reader armed)
+};
+
+/*	A reader's private position */
+struct shmring_reader {
+	struct shmring ring;
+	uint64_t cursor;		// Sequence number of the next item to read
+	uint64_t check;			// seq of the item handed out by shmring_peek()
+	uint64_t lost;			// Items overwritten before this reader got to them
+};
+
+/* ****************************************************************************** */
+/* ************************ Function Declarations ******************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: shmring_create()
+Purpose:  Creates (replacing any stale one) and maps the shared ring
+Input:    Ring, object name ("/pfm-scans"), payload bytes per slot, number of
+          slots (a power of two)
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int shmring_create(struct shmring * ring, const char * name, size_t slotsize, uint32_t slots);
+
+/*************************************************************************
+Function: shmring_publish()
+Purpose:  Writer: copies an item into the next slot and wakes sleeping
+          readers.  Never waits.
+Input:    Ring, item (slotsize bytes)
+**************************************************************************/
+void shmring_publish(struct shmring * ring, const void * item);
+
+/*************************************************************************
+Function: shmring_destroy()
+Purpose:  Writer: marks the ring closed, wakes every reader and removes it
+Input:    Ring
+**************************************************************************/
+void shmring_destroy(struct shmring * ring);
+
+/*************************************************************************
+Function: shmring_attach()
+Purpose:  Reader: maps an existing ring and starts at the next item the
+          writer publishes
+Input:    Reader, object name, expected payload bytes per slot
+Returns:  0 if successful, -1 if there is no usable (open) ring
+**************************************************************************/
+int shmring_attach(struct shmring_reader * reader, const char * name, size_t slotsize);
+
+/*************************************************************************
+Function: shmring_peek()
+Purpose:  Reader: returns the next item in place, without copying it.  The
+          item must be checked with shmring_done() before its contents are
+          trusted.
+Input:    Reader, location of item pointer to output
+Returns:  SHMRING_ITEM, SHMRING_NONE or SHMRING_CLOSED
+**************************************************************************/
+int shmring_peek(struct shmring_reader * reader, const void ** item);
+
+/*************************************************************************
+Function: shmring_done()
+Purpose:  Reader: finishes with the item from shmring_peek() and moves on
+Input:    Reader
+Returns:  1 if the item was intact the whole time, 0 if the writer
+          overwrote it (it is counted as lost)
+**************************************************************************/
+int shmring_done(struct shmring_reader * reader);
+
+/*************************************************************************
+Function: shmring_wait()
+Purpose:  Reader: sleeps until an item is ready, the writer stops or the
+          timeout expires
+Input:    Reader, timeout in milliseconds
+Returns:  SHMRING_ITEM, SHMRING_NONE or SHMRING_CLOSED
+**************************************************************************/
+int shmring_wait(struct shmring_reader * reader, int timeout);
+
+/*************************************************************************
+Function: shmring_detach()
+Purpose:  Reader: unmaps the ring
+Input:    Reader
+**************************************************************************/
+void shmring_detach(struct shmring_reader * reader);
+
+#endif
+/* ****************************************************************************** */
+// End of SHMRING.H
+/* ****************************************************************************** */
@@ -0,0 +1,556 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                            Storage Code                                */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+
+/* ****************************************************************************** */
+/* *******************************   About  ************************************* */
+/* ****************************************************************************** */
+// This code writes the scan/IMU journal (.pfj) and its session index (.idx) to
+// the flash drive and reads them back.  See storage.h for the file layouts.
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include "prefiremapping.h"
+#include "storage.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/* ****************************************************************************** */
+/* ****************************** Functions ************************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: storage_open()
+Purpose:  Creates a journal file and writes its header
+Input:    Storage, path of the journal
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int storage_open(struct storage * store, const char * path){
+	struct pfj_header header;
+	struct pfx_header indexheader;
+	struct timespec now;
+	char name[256];
+	memset(store, 0, sizeof(*store));
+	store->indexfd = -1;
+	store->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	store->buffer = malloc(STORAGE_BUFFER);
+	if(store->fd < 0 || store->buffer == NULL){
+		problem = 60;
+		if(store->fd >= 0)
+			close(store->fd);
+		free(store->buffer);
+		store->fd = -1;
+		store->buffer = NULL;
+		return -1;
+	}
+	clock_gettime(CLOCK_REALTIME, &now);
+	memcpy(header.magic, PFJ_MAGIC, 4);
+	header.version = PFJ_VERSION;
+	header.headersize = sizeof(header);
+	header.created = (uint64_t)now.tv_sec*1000000000ULL + now.tv_nsec;
+	memcpy(store->buffer, &header, sizeof(header));
+	store->used = sizeof(header);
+	store->lastsync = pfm_time_ns();
+	if(VERBOSE_MODE == 1)
+		printf("Opened Journal %s\n", path);
+
+	// The index is a convenience for readers; the journal is recorded without it
+	index_name(path, name, sizeof(name));
+	store->indexfd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	memcpy(indexheader.magic, PFX_MAGIC, 4);
+	indexheader.version = PFX_VERSION;
+	indexheader.headersize = sizeof(indexheader);
+	indexheader.created = header.created;
+	if(store->indexfd >= 0 && write(store->indexfd, &indexheader, sizeof(indexheader)) != sizeof(indexheader)){
+		close(store->indexfd);
+		store->indexfd = -1;
+	}
+	if(store->indexfd < 0 && VERBOSE_MODE == 1)
+		printf("Problem Creating Index %s, Journal Will Not Be Indexed\n", name);
+	return 0;
+}
+
+/*************************************************************************
+Function: writeAll()
+Purpose:  Writes the rest of a buffer, however many write() calls it takes
+Input:    Descriptor, buffer, length, bytes of it already written
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+static int writeAll(int fd, const void * buffer, size_t length, size_t done){
+	ssize_t written;
+	while(done < length){
+		written = write(fd, (const char *)buffer + done, length - done);
+		if(written <= 0)
+			return -1;
+		done += written;
+	}
+	return 0;
+}
+
+/*************************************************************************
+Function: flushJournal()
+Purpose:  Hands buffered records and index entries to the kernel and, if
+          asked, forces the journal onto the flash drive.  With an I/O
+          engine, the journal write, the index write and the sync go to the
+          kernel together, in that order; whatever it leaves unfinished
+          is finished here.
+Input:    Storage, 1 to fdatasync() the journal
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+static int flushJournal(struct storage * store, int sync){
+	struct ioengine_completion done[IOENGINE_DEPTH];
+	size_t indexbytes = (store->indexfd >= 0) ? store->indexused*sizeof(struct pfx_entry) : 0;
+	int result[3] = {0, 0, -ECANCELED};	// Journal bytes, index bytes, sync
+	int expected = 0;
+	int n, i;
+
+	if(store->io != NULL){
+		if(store->used > 0 && ioengine_write(store->io, store->fd, store->buffer, store->used, 0) == 0)
+			expected++;
+		// Index entries only ever point at journal data that has been written
+		if(indexbytes > 0 && ioengine_write(store->io, store->indexfd, store->index, indexbytes, 1) == 0)
+			expected++;
+		if(sync && ioengine_datasync(store->io, store->fd, 2) == 0)
+			expected++;
+		while(expected > 0){
+			n = ioengine_wait(store->io, done, IOENGINE_DEPTH, IOENGINE_FOREVER);
+			if(n < 0){
+				problem = 61;
+				store->used = 0;
+				return -1;
+			}
+			for(i = 0; i < n; i++){
+				if(done[i].tag < 3){
+					result[done[i].tag] = done[i].result;
+					expected--;
+				}
+			}
+		}
+	}
+
+	// A write cut short, or cancelled because the one before it was, carries on here
+	if(result[0] < 0 || writeAll(store->fd, store->buffer, store->used, result[0]) != 0){
+		problem = 61;
+		store->used = 0;
+		return -1;
+	}
+	store->bytes += store->used;
+	store->used = 0;
+	__atomic_store_n(&store->flushed, store->records, __ATOMIC_RELEASE);
+
+	if(indexbytes > 0 && ((result[1] < 0 && result[1] != -ECANCELED) ||
+	   writeAll(store->indexfd, store->index, indexbytes, (result[1] > 0) ? result[1] : 0) != 0)){
+		close(store->indexfd);
+		store->indexfd = -1;
+	}
+	store->indexused = 0;
+
+	if(sync && result[2] == -ECANCELED)
+		result[2] = (fdatasync(store->fd) == 0) ? 0 : -errno;
+	if(sync && result[2] < 0){
+		problem = 61;
+		return -1;
+	}
+	return 0;
+}
+
+/*************************************************************************
+Function: storage_flush()
+Purpose:  Hands buffered records to the kernel
+Input:    Storage
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int storage_flush(struct storage * store){
+	return flushJournal(store, 0);
+}
+
+/*************************************************************************
+Function: storage_write()
+Purpose:  Appends one record to the journal buffer, writing the buffer out
+          when it is full
+Input:    Storage, record type, sequence number, timestamp, payload, length
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int storage_write(struct storage * store, uint16_t type, uint32_t seq, uint64_t timestamp, const void * payload, uint32_t length){
+	struct pfj_record record;
+	if(store->fd < 0 || sizeof(record) + length > STORAGE_BUFFER)
+		return -1;
+	if(store->used + sizeof(record) + length > STORAGE_BUFFER && storage_flush(store) != 0)
+		return -1;
+	record.sync = PFJ_SYNC;
+	record.type = type;
+	record.reserved = 0;
+	record.length = length;
+	record.seq = seq;
+	record.timestamp = timestamp;
+	store->last = store->used;
+	memcpy(store->buffer + store->used, &record, sizeof(record));
+	memcpy(store->buffer + store->used + sizeof(record), payload, length);
+	store->used += sizeof(record) + length;
+	store->records++;
+	return 0;
+}
+
+/*************************************************************************
+Function: storage_writeScan()
+Purpose:  Appends a LIDAR scan record (PFJ_VSCAN for the vertical LIDAR)
+          and indexes horizontal scans
+Input:    Storage, scan
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int storage_writeScan(struct storage * store, const struct lidar_scan * scan){
+	unsigned char payload[sizeof(struct pfj_scan) + LIDAR_MAX_POINTS*2];
+	struct pfj_scan header;
+	header.sensor_time = scan->sensor_time;
+	header.startstep = scan->startstep;
+	header.endstep = scan->endstep;
+	header.cluster = scan->cluster;
+	header.count = scan->count;
+	memcpy(payload, &header, sizeof(header));
+	struct pfx_entry * entry;
+	memcpy(payload + sizeof(header), scan->range, scan->count*2);
+	if(scan->sensor != 0)
+		return storage_write(store, PFJ_VSCAN, scan->seq, scan->sync_time, payload, sizeof(header) + scan->count*2);
+	if(storage_write(store, PFJ_SCAN, scan->seq, scan->sync_time, payload, sizeof(header) + scan->count*2) != 0)
+		return -1;
+	if(store->indexfd < 0)
+		return 0;
+	entry = &store->index[store->indexused++];
+	entry->timestamp = scan->sync_time;
+	entry->offset = store->bytes + store->last;
+	entry->record = store->records - 1;
+	entry->scan = scan->seq;
+	memcpy(entry->attitude, store->attitude, sizeof(entry->attitude));
+	store->scans++;
+	if(store->indexused == STORAGE_INDEX_ENTRIES)
+		return storage_flush(store);
+	return 0;
+}
+
+/*************************************************************************
+Function: storage_writeImu()
+Purpose:  Appends an IMU sample record
+Input:    Storage, sample
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int storage_writeImu(struct storage * store, const struct imu_sample * sample){
+	struct pfj_imu payload;
+	payload.channels = sample->channels;
+	payload.reserved = 0;
+	payload.angle[0] = sample->yaw;
+	payload.angle[1] = sample->pitch;
+	payload.angle[2] = sample->roll;
+	payload.rate[0] = sample->yawrate;
+	payload.rate[1] = sample->pitchrate;
+	payload.rate[2] = sample->rollrate;
+	memcpy(payload.mag, sample->mag, sizeof(payload.mag));
+	memcpy(payload.gyro, sample->gyro, sizeof(payload.gyro));
+	memcpy(payload.accel, sample->accel, sizeof(payload.accel));
+	if(sample->channels & IMU_CH_YAW){
+		store->attitude[0] = sample->yaw;
+		store->attitude[1] = sample->pitch;
+		store->attitude[2] = sample->roll;
+	}
+	return storage_write(store, PFJ_IMU, sample->seq, sample->host_time, &payload, sizeof(payload));
+}
+
+/*************************************************************************
+Function: storage_sync()
+Purpose:  Flushes and forces the journal onto the flash drive
+Input:    Storage
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int storage_sync(struct storage * store){
+	uint64_t start;
+	uint64_t elapsed;
+	if(store->fd < 0)
+		return -1;
+	start = pfm_time_ns();
+	if(flushJournal(store, 1) != 0)
+		return -1;
+	store->lastsync = pfm_time_ns();
+	elapsed = store->lastsync - start;
+	if(elapsed > store->maxsync)
+		store->maxsync = elapsed;
+	store->syncs++;
+	return 0;
+}
+
+/*************************************************************************
+Function: storage_close()
+Purpose:  Syncs and closes the journal
+Input:    Storage
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int storage_close(struct storage * store){
+	int result;
+	if(store->fd < 0){
+		problem = -5;
+		return -1;
+	}
+	result = storage_sync(store);
+	if(close(store->fd) != 0)
+		result = -1;
+	store->fd = -1;
+	if(store->indexfd >= 0)
+		close(store->indexfd);
+	store->indexfd = -1;
+	free(store->buffer);
+	store->buffer = NULL;
+	if(VERBOSE_MODE == 1)
+		printf("Closed Journal, %u records, %llu bytes\n", store->records, (unsigned long long)store->bytes);
+	return result;
+}
+
+/*************************************************************************
+Function: index_name()
+Purpose:  Derives the index file name from the journal name (.pfj -> .idx,
+          otherwise .idx is appended)
+Input:    Journal name, location of index name to output, its size
+**************************************************************************/
+void index_name(const char * journalname, char * name, size_t size){
+	size_t length = strlen(journalname);
+	if(length > 4 && strcmp(journalname + length - 4, ".pfj") == 0)
+		snprintf(name, size, "%.*s.idx", (int)(length - 4), journalname);
+	else
+		snprintf(name, size, "%s.idx", journalname);
+}
+
+/*************************************************************************
+Function: index_refresh()
+Purpose:  Recounts the complete entries of an index that may still be growing
+Input:    Index
+**************************************************************************/
+static void index_refresh(struct session_index * index){
+	struct stat info;
+	if(fstat(index->fd, &info) == 0 && info.st_size >= index->headersize)
+		index->count = (info.st_size - index->headersize) / sizeof(struct pfx_entry);
+}
+
+/*************************************************************************
+Function: index_open()
+Purpose:  Opens a session index and counts its complete entries
+Input:    Index, journal name (the index name is derived from it)
+Returns:  0 if successful, -1 if there is no usable index
+**************************************************************************/
+int index_open(struct session_index * index, const char * journalname){
+	struct pfx_header header;
+	char name[256];
+	memset(index, 0, sizeof(*index));
+	index_name(journalname, name, sizeof(name));
+	index->fd = open(name, O_RDONLY | O_CLOEXEC);
+	if(index->fd < 0)
+		return -1;
+	if(pread(index->fd, &header, sizeof(header), 0) != sizeof(header) ||
+	   memcmp(header.magic, PFX_MAGIC, 4) != 0 || header.headersize < sizeof(header)){
+		close(index->fd);
+		index->fd = -1;
+		return -1;
+	}
+	index->headersize = header.headersize;
+	index->created = header.created;
+	index_refresh(index);
+	return 0;
+}
+
+/*************************************************************************
+Function: index_entry()
+Purpose:  Reads entry n (scan n of the session)
+Input:    Index, entry number, location of entry to output
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int index_entry(struct session_index * index, uint32_t n, struct pfx_entry * entry){
+	if(n >= index->count)
+		return -1;
+	if(pread(index->fd, entry, sizeof(*entry), index->headersize + (uint64_t)n*sizeof(*entry)) != sizeof(*entry))
+		return -1;
+	return 0;
+}
+
+/*************************************************************************
+Function: index_findTime()
+Purpose:  Binary search for the first scan at or after a time
+Input:    Index, CLOCK_MONOTONIC nanoseconds
+Returns:  Entry number (count if every scan is earlier)
+**************************************************************************/
+uint32_t index_findTime(struct session_index * index, uint64_t timestamp){
+	struct pfx_entry entry;
+	uint32_t low = 0;
+	uint32_t high;
+	uint32_t middle;
+	index_refresh(index);
+	high = index->count;
+	while(low < high){
+		middle = low + (high - low)/2;
+		if(index_entry(index, middle, &entry) != 0 || entry.timestamp >= timestamp)
+			high = middle;
+		else
+			low = middle + 1;
+	}
+	return low;
+}
+
+/*************************************************************************
+Function: index_findRecord()
+Purpose:  Binary search for the last scan at or before a journal record
+Input:    Index, record index
+Returns:  Entry number, -1 if the record comes before the first scan
+**************************************************************************/
+int64_t index_findRecord(struct session_index * index, uint32_t record){
+	struct pfx_entry entry;
+	uint32_t low = 0;
+	uint32_t high;
+	uint32_t middle;
+	index_refresh(index);
+	high = index->count;
+	while(low < high){
+		middle = low + (high - low)/2;
+		if(index_entry(index, middle, &entry) != 0 || entry.record > record)
+			high = middle;
+		else
+			low = middle + 1;
+	}
+	return (int64_t)low - 1;
+}
+
+/*************************************************************************
+Function: index_close()
+Purpose:  Closes a session index
+Input:    Index
+**************************************************************************/
+void index_close(struct session_index * index){
+	if(index->fd >= 0)
+		close(index->fd);
+	index->fd = -1;
+}
+
+/*************************************************************************
+Function: journal_open()
+Purpose:  Opens a journal for reading and checks its header
+Input:    Reader, path of the journal
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int journal_open(struct journal * reader, const char * path){
+	struct pfj_header header;
+	memset(reader, 0, sizeof(*reader));
+	reader->session.fd = -1;
+	reader->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(reader->fd < 0)
+		return -1;
+	if(pread(reader->fd, &header, sizeof(header), 0) != sizeof(header) ||
+	   memcmp(header.magic, PFJ_MAGIC, 4) != 0 || header.headersize < sizeof(header)){
+		close(reader->fd);
+		reader->fd = -1;
+		return -1;
+	}
+	reader->created = header.created;
+	reader->offset = header.headersize;
+	// Only trust an index written for this journal
+	if(index_open(&reader->session, path) == 0 && reader->session.created != header.created)
+		index_close(&reader->session);
+	return 0;
+}
+
+/*************************************************************************
+Function: journal_read()
+Purpose:  Reads the next complete record.  Damaged data is skipped up to the
+          next sync word.
+Input:    Reader, location of record header to output, location of payload
+          to output, size of the payload buffer
+Returns:  1 if a record was read, 0 at the (current) end of the journal,
+          -1 on a read error
+**************************************************************************/
+int journal_read(struct journal * reader, struct pfj_record * record, void * payload, size_t size){
+	ssize_t got;
+	for(;;){
+		got = pread(reader->fd, record, sizeof(*record), reader->offset);
+		if(got < 0)
+			return -1;
+		if(got < (ssize_t)sizeof(*record))
+			return 0;
+		if(record->sync != PFJ_SYNC || record->length > size){
+			// Damaged, step forward one byte at a time until the next sync word
+			reader->offset++;
+			reader->resyncs++;
+			continue;
+		}
+		got = pread(reader->fd, payload, record->length, reader->offset + sizeof(*record));
+		if(got < 0)
+			return -1;
+		if(got < (ssize_t)record->length)
+			return 0;		// Still being written
+		reader->offset += sizeof(*record) + record->length;
+		reader->index++;
+		return 1;
+	}
+}
+
+/*************************************************************************
+Function: journal_seek()
+Purpose:  Positions the reader at a record index, rewinding if needed
+Input:    Reader, record index
+Returns:  0 if successful, -1 if the journal ends before that record
+**************************************************************************/
+int journal_seek(struct journal * reader, uint32_t index){
+	struct pfj_record record;
+	unsigned char payload[sizeof(struct pfj_scan) + LIDAR_MAX_POINTS*2];
+	struct pfj_header header;
+	struct pfx_entry entry;
+	int64_t n;
+	if(reader->session.fd >= 0 && index != reader->index){
+		n = index_findRecord(&reader->session, index);
+		if(n >= 0 && index_entry(&reader->session, n, &entry) == 0 &&
+		   (index < reader->index || entry.record > reader->index))
+			journal_seekEntry(reader, &entry);
+	}
+	if(index < reader->index){
+		if(pread(reader->fd, &header, sizeof(header), 0) != sizeof(header))
+			return -1;
+		reader->offset = header.headersize;
+		reader->index = 0;
+	}
+	while(reader->index < index)
+		if(journal_read(reader, &record, payload, sizeof(payload)) != 1)
+			return -1;
+	return 0;
+}
+
+/*************************************************************************
+Function: journal_seekEntry()
+Purpose:  Positions the reader at the scan an index entry describes
+Input:    Reader, index entry
+**************************************************************************/
+void journal_seekEntry(struct journal * reader, const struct pfx_entry * entry){
+	reader->offset = entry->offset;
+	reader->index = entry->record;
+}
+
+/*************************************************************************
+Function: journal_close()
+Purpose:  Closes a journal reader
+Input:    Reader
+**************************************************************************/
+void journal_close(struct journal * reader){
+	if(reader->fd >= 0)
+		close(reader->fd);
+	reader->fd = -1;
+	index_close(&reader->session);
+}
+
+/* ****************************************************************************** */
+// End of STORAGE.C
+/* ****************************************************************************** */
@@ -0,0 +1,332 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                         Storage Code Header                            */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+#ifndef _STORAGE_H_
+#define _STORAGE_H_
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include <stdint.h>
+#include <stddef.h>
+#include "hokuyo_comm.h"
+#include "imu.h"
+#include "ioengine.h"
+
+/* ****************************************************************************** */
+/* *****************************   Definitions  ********************************* */
+/* ****************************************************************************** */
+/*	Pre-Fire Journal (.pfj) layout, all fields little-endian:
+
+	File header (16 bytes)
+		magic[4]	"PFJ1"
+		version		uint16
+		headersize	uint16	(size of this header, for later growth)
+		created		uint64	CLOCK_REALTIME nanoseconds when the file was opened
+
+	Records, back to back
+		sync		uint32	PFJ_SYNC, lets a reader find the next record after damage
+		type		uint16	PFJ_SCAN, PFJ_IMU, PFJ_VSCAN
+		reserved	uint16
+		length		uint32	payload bytes following the record header
+		seq		uint32	sensor sequence number
+		timestamp	uint64	CLOCK_MONOTONIC nanoseconds (for scans, when the sensor
+				took the scan if its clock is synchronized)
+		payload		length bytes (struct pfj_scan + ranges, or struct pfj_imu)
+
+	PFJ_SCAN records hold the horizontal LIDAR, PFJ_VSCAN the optional
+	vertical one; a reader that does not know PFJ_VSCAN can skip it.
+*/
+/*	Session index (.idx, next to the journal), all fields little-endian:
+
+	File header (16 bytes)
+		magic[4]	"PFX1"
+		version		uint16
+		headersize	uint16
+		created		uint64	same value as the journal's header
+
+	Entries, one per horizontal scan, fixed size so entry n is at headersize + n*sizeof(entry)
+		timestamp	uint64	CLOCK_MONOTONIC nanoseconds of the scan
+		offset		uint64	journal file offset of the scan's record
+		record		uint32	journal record index of the scan
+		scan		uint32	scan sequence number
+		attitude	float[3] yaw, pitch, roll of the last IMU sample before the scan,
+				so a reader starting here has the state it would have built up
+
+	Scan n is one read away and a time window is a binary search away.  The
+	index is written only after the journal data it points at, so it never
+	points past the end of the journal; a missing or short index can be
+	rebuilt from the journal.
+*/
+#define PFJ_MAGIC "PFJ1"
+#define PFJ_VERSION 1
+#define PFJ_SYNC 0x7E4A4650		// "PFJ~"
+#define PFJ_SCAN 1
+#define PFJ_IMU 2
+#define PFJ_VSCAN 3
+#define PFX_MAGIC "PFX1"
+#define PFX_VERSION 1
+
+#define STORAGE_BUFFER (64*1024)	// Bytes collected before each write()
+#define STORAGE_SYNC_INTERVAL 1000	// Milliseconds between fdatasync() calls
+#define STORAGE_INDEX_ENTRIES 256	// Index entries collected before each write()
+
+struct pfj_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t headersize;
+	uint64_t created;
+} __attribute__((packed));
+
+struct pfj_record {
+	uint32_t sync;
+	uint16_t type;
+	uint16_t reserved;
+	uint32_t length;
+	uint32_t seq;
+	uint64_t timestamp;
+} __attribute__((packed));
+
+struct pfj_scan {
+	uint32_t sensor_time;
+	uint16_t startstep;
+	uint16_t endstep;
+	uint16_t cluster;
+	uint16_t count;
+	// uint16_t range[count] follows
+} __attribute__((packed));
+
+struct pfj_imu {
+	uint16_t channels;
+	uint16_t reserved;
+	float angle[3];			// Yaw, pitch, roll
+	float rate[3];			// Yaw, pitch, roll rates
+	float mag[3];
+	float gyro[3];
+	float accel[3];
+} __attribute__((packed));
+
+struct pfx_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t headersize;
+	uint64_t created;
+} __attribute__((packed));
+
+struct pfx_entry {
+	uint64_t timestamp;
+	uint64_t offset;
+	uint32_t record;
+	uint32_t scan;
+	float attitude[3];
+} __attribute__((packed));
+
+struct storage {
+	int fd;
+	int indexfd;
+	unsigned char * buffer;
+	size_t used;
+	uint64_t bytes;			// Bytes handed to the kernel
+	uint32_t records;
+	uint32_t syncs;
+	uint64_t lastsync;
+	uint64_t maxsync;		// Slowest flush and fdatasync() in nanoseconds
+	size_t last;			// Buffer offset of the newest record
+	uint32_t flushed;		// Records handed to the kernel (readable by journal_read())
+	struct ioengine * io;		// Engine for the writes and syncs, NULL = write() and fdatasync()
+
+	// Session index
+	struct pfx_entry index[STORAGE_INDEX_ENTRIES];
+	uint32_t indexused;
+	uint32_t scans;			// Entries written so far
+	float attitude[3];		// Latest IMU angles, copied into each entry
+};
+
+/*	Reader for a session index */
+struct session_index {
+	int fd;
+	uint16_t headersize;
+	uint64_t created;
+	uint32_t count;			// Complete entries when opened
+};
+
+/*	Sequential reader for a journal, which may still be growing.  Records are
+	numbered from 0 in file order; that index is what the stream sends as its
+	sequence number.
+*/
+struct journal {
+	int fd;
+	uint64_t created;
+	uint64_t offset;		// File offset of the next record
+	uint32_t index;			// Index of the next record
+	uint32_t resyncs;		// Damaged stretches skipped
+	struct session_index session;	// Used by journal_seek() if the session has one (fd >= 0)
+};
+
+/* ****************************************************************************** */
+/* ************************ Function Declarations ******************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: storage_open()
+Purpose:  Creates a journal file and writes its header
+Input:    Storage, path of the journal
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int storage_open(struct storage * store, const char * path);
+
+/*************************************************************************
+Function: storage_write()
+Purpose:  Appends one record to the journal buffer, writing the buffer out
+          when it is full
+Input:    Storage, record type, sequence number, timestamp, payload, length
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int storage_write(struct storage * store, uint16_t type, uint32_t seq, uint64_t timestamp, const void * payload, uint32_t length);
+
+/*************************************************************************
+Function: storage_writeScan()
+Purpose:  Appends a LIDAR scan record (PFJ_VSCAN for the vertical LIDAR)
+          and indexes horizontal scans
+Input:    Storage, scan
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int storage_writeScan(struct storage * store, const struct lidar_scan * scan);
+
+/*************************************************************************
+Function: storage_writeImu()
+Purpose:  Appends an IMU sample record
+Input:    Storage, sample
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int storage_writeImu(struct storage * store, const struct imu_sample * sample);
+
+/*************************************************************************
+Function: storage_flush()
+Purpose:  Hands buffered records to the kernel
+Input:    Storage
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int storage_flush(struct storage * store);
+
+/*************************************************************************
+Function: storage_sync()
+Purpose:  Flushes and forces the journal onto the flash drive
+Input:    Storage
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int storage_sync(struct storage * store);
+
+/*************************************************************************
+Function: storage_close()
+Purpose:  Syncs and closes the journal
+Input:    Storage
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int storage_close(struct storage * store);
+
+/*************************************************************************
+Function: index_name()
+Purpose:  Derives the index file name from the journal name (.pfj -> .idx,
+          otherwise .idx is appended)
+Input:    Journal name, location of index name to output, its size
+**************************************************************************/
+void index_name(const char * journalname, char * name, size_t size);
+
+/*************************************************************************
+Function: index_open()
+Purpose:  Opens a session index and counts its complete entries
+Input:    Index, journal name (the index name is derived from it)
+Returns:  0 if successful, -1 if there is no usable index
+**************************************************************************/
+int index_open(struct session_index * index, const char * journalname);
+
+/*************************************************************************
+Function: index_entry()
+Purpose:  Reads entry n (scan n of the session)
+Input:    Index, entry number, location of entry to output
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int index_entry(struct session_index * index, uint32_t n, struct pfx_entry * entry);
+
+/*************************************************************************
+Function: index_findTime()
+Purpose:  Binary search for the first scan at or after a time
+Input:    Index, CLOCK_MONOTONIC nanoseconds
+Returns:  Entry number (count if every scan is earlier)
+**************************************************************************/
+uint32_t index_findTime(struct session_index * index, uint64_t timestamp);
+
+/*************************************************************************
+Function: index_findRecord()
+Purpose:  Binary search for the last scan at or before a journal record
+Input:    Index, record index
+Returns:  Entry number, -1 if the record comes before the first scan
+**************************************************************************/
+int64_t index_findRecord(struct session_index * index, uint32_t record);
+
+/*************************************************************************
+Function: index_close()
+Purpose:  Closes a session index
+Input:    Index
+**************************************************************************/
+void index_close(struct session_index * index);
+
+/*************************************************************************
+Function: journal_open()
+Purpose:  Opens a journal for reading and checks its header
+Input:    Reader, path of the journal
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int journal_open(struct journal * reader, const char * path);
+
+/*************************************************************************
+Function: journal_read()
+Purpose:  Reads the next complete record.  Damaged data is skipped up to the
+          next sync word.
+Input:    Reader, location of record header to output, location of payload
+          to output, size of the payload buffer
+Returns:  1 if a record was read, 0 at the (current) end of the journal,
+          -1 on a read error
+**************************************************************************/
+int journal_read(struct journal * reader, struct pfj_record * record, void * payload, size_t size);
+
+/*************************************************************************
+Function: journal_seek()
+Purpose:  Positions the reader at a record index.  Jumps to the nearest
+          indexed scan before it when the session has an index, otherwise
+          rewinds if needed and reads forward.
+Input:    Reader, record index
+Returns:  0 if successful, -1 if the journal ends before that record
+**************************************************************************/
+int journal_seek(struct journal * reader, uint32_t index);
+
+/*************************************************************************
+Function: journal_seekEntry()
+Purpose:  Positions the reader at the scan an index entry describes
+Input:    Reader, index entry
+**************************************************************************/
+void journal_seekEntry(struct journal * reader, const struct pfx_entry * entry);
+
+/*************************************************************************
+Function: journal_close()
+Purpose:  Closes a journal reader
+Input:    Reader
+**************************************************************************/
+void journal_close(struct journal * reader);
+
+#endif
+/* ****************************************************************************** */
+// End of STORAGE.H
+/* ****************************************************************************** */
@@ -0,0 +1,285 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                           Live Stream Code                             */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+
+/* ****************************************************************************** */
+/* *******************************   About  ************************************* */
+/* ****************************************************************************** */
+// This code streams journal records to the base station while capture runs.
+// See stream.h for the protocol.
+/*
+	Live records come from the storage stage right after they are appended to
+	the journal.  When the client has fallen behind (no credits, a dropped
+	queue item, or a reconnect asking for an older record) the gap is read
+	back from the journal instead, so the base station always receives every
+	record exactly once and in order.
+*/
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include "prefiremapping.h"
+#include "stream.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/* ****************************************************************************** */
+/* ****************************** Functions ************************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: stream_listen()
+Purpose:  Opens the listening socket
+Input:    Stream, TCP port, journal to replay from
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int stream_listen(struct stream * s, int port, const char * journalname){
+	struct sockaddr_in address;
+	int one = 1;
+
+	memset(s, 0, sizeof(*s));
+	s->clientfd = -1;
+	s->journal.fd = -1;
+	s->journal.session.fd = -1;
+	s->journalname = journalname;
+	s->listenfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(s->listenfd < 0){
+		problem = 70;
+		return -1;
+	}
+	setsockopt(s->listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	if(bind(s->listenfd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(s->listenfd, 1) != 0){
+		problem = 70;
+		close(s->listenfd);
+		s->listenfd = -1;
+		return -1;
+	}
+	if(VERBOSE_MODE == 1)
+		printf("Streaming on TCP Port %d\n", port);
+	return 0;
+}
+
+/*************************************************************************
+Function: stream_accept()
+Purpose:  Accepts a connection, replacing any current client
+Input:    Stream
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int stream_accept(struct stream * s){
+	struct timeval timeout;
+	int fd = accept(s->listenfd, NULL, NULL);
+	int one = 1;
+	if(fd < 0)
+		return -1;
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	if(s->clientfd >= 0)
+		stream_drop(s);		// The newest connection wins, the old one is most likely dead
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	timeout.tv_sec = STREAM_SEND_TIMEOUT / 1000;
+	timeout.tv_usec = (STREAM_SEND_TIMEOUT % 1000) * 1000;
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	s->clientfd = fd;
+	s->hello = 0;
+	s->credits = 0;
+	s->rxlength = 0;
+	s->lastsend = pfm_time_ns();
+	s->connects++;
+	if(VERBOSE_MODE == 1)
+		printf("Stream Client Connected\n");
+	return 0;
+}
+
+/*************************************************************************
+Function: stream_receive()
+Purpose:  Reads and handles HELLO/CREDIT messages from the client
+Input:    Stream
+Returns:  0 if successful, -1 if the client disconnected or misbehaved
+**************************************************************************/
+int stream_receive(struct stream * s){
+	struct pfs_header header;
+	struct pfs_hello hello;
+	struct pfs_credit credit;
+	ssize_t got;
+	size_t size;
+
+	got = recv(s->clientfd, s->rx + s->rxlength, sizeof(s->rx) - s->rxlength, MSG_DONTWAIT);
+	if(got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR))
+		return -1;
+	if(got > 0)
+		s->rxlength += got;
+	while(s->rxlength >= sizeof(header)){
+		memcpy(&header, s->rx, sizeof(header));
+		if(header.sync != PFS_SYNC || header.length > sizeof(s->rx) - sizeof(header))
+			return -1;
+		size = sizeof(header) + header.length;
+		if(s->rxlength < size)
+			break;
+		if(header.type == PFS_HELLO && header.length == sizeof(hello)){
+			memcpy(&hello, s->rx + sizeof(header), sizeof(hello));
+			s->hello = 1;
+			s->nextseq = hello.resume;
+			s->credits = hello.credits;
+		}
+		else if(header.type == PFS_CREDIT && header.length == sizeof(credit)){
+			memcpy(&credit, s->rx + sizeof(header), sizeof(credit));
+			s->credits += credit.credits;
+		}
+		if(s->credits > STREAM_MAX_CREDITS)
+			s->credits = STREAM_MAX_CREDITS;
+		memmove(s->rx, s->rx + size, s->rxlength - size);
+		s->rxlength -= size;
+	}
+	return 0;
+}
+
+/*************************************************************************
+Function: stream_ready()
+Purpose:  Checks whether a record may be sent now
+Input:    Stream
+Returns:  1 if a client is connected, said hello and holds a credit
+**************************************************************************/
+int stream_ready(struct stream * s){
+	return s->clientfd >= 0 && s->hello && s->credits > 0;
+}
+
+/*************************************************************************
+Function: sendMessage()
+Purpose:  Sends a header and payload as one message
+Input:    Stream, type, sequence number, payload, length
+Returns:  0 if successful, -1 if the client was dropped
+**************************************************************************/
+static int sendMessage(struct stream * s, uint16_t type, uint32_t seq, const void * payload, uint32_t length){
+	unsigned char message[sizeof(struct pfs_header) + STREAM_RECORD_MAX];
+	struct pfs_header header;
+	size_t done = 0;
+	size_t size = sizeof(header) + length;
+	ssize_t sent;
+
+	header.sync = PFS_SYNC;
+	header.type = type;
+	header.reserved = 0;
+	header.length = length;
+	header.seq = seq;
+	memcpy(message, &header, sizeof(header));
+	if(length > 0)
+		memcpy(message + sizeof(header), payload, length);
+	while(done < size){
+		sent = send(s->clientfd, message + done, size - done, MSG_NOSIGNAL);
+		if(sent <= 0){
+			if(sent < 0 && errno == EINTR)
+				continue;
+			stream_drop(s);
+			return -1;
+		}
+		done += sent;
+	}
+	s->bytes += size;
+	s->lastsend = pfm_time_ns();
+	return 0;
+}
+
+/*************************************************************************
+Function: stream_send()
+Purpose:  Sends one encoded journal record and takes a credit
+Input:    Stream, record index, record bytes, length
+Returns:  0 if successful, -1 if the client was dropped
+**************************************************************************/
+int stream_send(struct stream * s, uint32_t seq, const void * bytes, uint32_t length){
+	if(sendMessage(s, PFS_RECORD, seq, bytes, length) != 0)
+		return -1;
+	s->nextseq = seq + 1;
+	s->credits--;
+	s->live++;
+	return 0;
+}
+
+/*************************************************************************
+Function: stream_replay()
+Purpose:  Sends records the client is missing from the journal, as far as
+          the credits allow
+Input:    Stream, index of the first record not yet readable from the journal
+Returns:  Number of records sent, -1 if the client was dropped
+**************************************************************************/
+int stream_replay(struct stream * s, uint32_t available){
+	unsigned char record[STREAM_RECORD_MAX];
+	struct pfj_record header;
+	int count = 0;
+
+	if(s->journal.fd < 0 && journal_open(&s->journal, s->journalname) != 0)
+		return 0;
+	if(s->nextseq < available && s->journal.index != s->nextseq && journal_seek(&s->journal, s->nextseq) != 0)
+		return 0;
+	while(stream_ready(s) && s->nextseq < available){
+		if(journal_read(&s->journal, &header, record + sizeof(header), sizeof(record) - sizeof(header)) != 1)
+			break;
+		memcpy(record, &header, sizeof(header));
+		if(sendMessage(s, PFS_RECORD, s->nextseq, record, sizeof(header) + header.length) != 0)
+			return -1;
+		s->nextseq++;
+		s->credits--;
+		s->replayed++;
+		count++;
+	}
+	return count;
+}
+
+/*************************************************************************
+Function: stream_notify()
+Purpose:  Sends a PFS_IDLE or PFS_END message
+Input:    Stream, message type
+Returns:  0 if successful, -1 if the client was dropped
+**************************************************************************/
+int stream_notify(struct stream * s, uint16_t type){
+	return sendMessage(s, type, s->nextseq, NULL, 0);
+}
+
+/*************************************************************************
+Function: stream_drop()
+Purpose:  Closes the client connection
+Input:    Stream
+**************************************************************************/
+void stream_drop(struct stream * s){
+	if(s->clientfd < 0)
+		return;
+	close(s->clientfd);
+	s->clientfd = -1;
+	s->hello = 0;
+	s->credits = 0;
+	if(VERBOSE_MODE == 1)
+		printf("Stream Client Disconnected at Record %u\n", s->nextseq);
+}
+
+/*************************************************************************
+Function: stream_close()
+Purpose:  Closes the client, the listening socket and the replay reader
+Input:    Stream
+**************************************************************************/
+void stream_close(struct stream * s){
+	stream_drop(s);
+	if(s->listenfd >= 0)
+		close(s->listenfd);
+	s->listenfd = -1;
+	journal_close(&s->journal);
+}
+
+/* ****************************************************************************** */
+// End of STREAM.C
+/* ****************************************************************************** */
@@ -0,0 +1,185 @@
+/* ********************************************************************** */
+/*                      Pre-Fire Mapping System                           */
+/*                        Live Stream Code Header                         */
+/*                            Remote Unit                                 */
+/*                                                                        */
+/* Authors : William Etter (MSE '11)                                      */
+/*                                                                        */
+/*                      University of Pennsylvania                        */
+/* mLab - Real-Time Embedded Systems Laboratory                           */
+/* Date : March 23, 2011                                                  */
+/* Version : 1.0                                                          */
+/* Hardware : Hoyuko Laser RangeFinder, BeagleBone, CHRobotics IMU        */
+/* Copyright William Etter 2011 (Etterw@seas.upenn.edu)                   */
+/* ********************************************************************** */
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+/* ****************************************************************************** */
+/* ****************************** Includes ************************************** */
+/* ****************************************************************************** */
+#include <stdint.h>
+#include "storage.h"
+
+/* ****************************************************************************** */
+/* *****************************   Definitions  ********************************* */
+/* ****************************************************************************** */
+/*	Pre-Fire Stream (PFS) over TCP, all fields little-endian.  The handheld
+	listens; the base station connects.  Every message starts with:
+
+		sync		uint32	PFS_SYNC
+		type		uint16	PFS_*
+		reserved	uint16
+		length		uint32	payload bytes following the header
+		seq		uint32	record index in the journal (PFS_RECORD, PFS_IDLE, PFS_END)
+
+	Base station -> handheld
+		PFS_HELLO	resume uint32 (first record wanted), credits uint32
+		PFS_CREDIT	credits uint32 (more records the base station can take)
+
+	Handheld -> base station
+		PFS_RECORD	one journal record (struct pfj_record + payload), verbatim
+		PFS_IDLE	nothing to send; seq is the next record
+		PFS_END		capture stopped and every record has been sent
+
+	The handheld sends a record only while it holds a credit.  Records are
+	numbered by their position in the journal, so after a disconnect the base
+	station says where it got to and the handheld replays the gap from flash.
+*/
+#define PFS_SYNC 0x7E534650		// "PFS~"
+#define PFS_HELLO 1
+#define PFS_CREDIT 2
+#define PFS_RECORD 3
+#define PFS_IDLE 4
+#define PFS_END 5
+
+#define STREAM_PORT 7070
+#define STREAM_RECORD_MAX (sizeof(struct pfj_record) + sizeof(struct pfj_scan) + LIDAR_MAX_POINTS*2)
+#define STREAM_IDLE_INTERVAL 1000	// Milliseconds between PFS_IDLE messages on a quiet link
+#define STREAM_SEND_TIMEOUT 2000	// Milliseconds a send may block before the client is dropped
+#define STREAM_MAX_CREDITS 1024		// Most credits a client may hold
+
+struct pfs_header {
+	uint32_t sync;
+	uint16_t type;
+	uint16_t reserved;
+	uint32_t length;
+	uint32_t seq;
+} __attribute__((packed));
+
+struct pfs_hello {
+	uint32_t resume;
+	uint32_t credits;
+} __attribute__((packed));
+
+struct pfs_credit {
+	uint32_t credits;
+} __attribute__((packed));
+
+/*	Encoded journal record on its way from the storage stage to the stream */
+struct stream_record {
+	uint32_t seq;
+	uint32_t length;
+	unsigned char bytes[STREAM_RECORD_MAX];
+};
+
+struct stream {
+	int listenfd;
+	int clientfd;
+	const char * journalname;
+	struct journal journal;		// Replay reader, opened on first use
+
+	// Client state
+	int hello;			// 1 once the client said where to resume
+	uint32_t nextseq;		// Next record the client wants
+	uint32_t credits;
+	unsigned char rx[64];
+	size_t rxlength;
+	uint64_t lastsend;
+
+	// Statistics
+	uint32_t connects;
+	uint64_t live;			// Records sent straight from the storage stage
+	uint64_t replayed;		// Records sent from the journal
+	uint64_t bytes;
+};
+
+/* ****************************************************************************** */
+/* ************************ Function Declarations ******************************* */
+/* ****************************************************************************** */
+
+/*************************************************************************
+Function: stream_listen()
+Purpose:  Opens the listening socket
+Input:    Stream, TCP port, journal to replay from
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int stream_listen(struct stream * s, int port, const char * journalname);
+
+/*************************************************************************
+Function: stream_accept()
+Purpose:  Accepts a connection, replacing any current client
+Input:    Stream
+Returns:  0 if successful, -1 if not
+**************************************************************************/
+int stream_accept(struct stream * s);
+
+/*************************************************************************
+Function: stream_receive()
+Purpose:  Reads and handles HELLO/CREDIT messages from the client
+Input:    Stream
+Returns:  0 if successful, -1 if the client disconnected or misbehaved
+**************************************************************************/
+int stream_receive(struct stream * s);
+
+/*************************************************************************
+Function: stream_ready()
+Purpose:  Checks whether a record may be sent now
+Input:    Stream
+Returns:  1 if a client is connected, said hello and holds a credit
+**************************************************************************/
+int stream_ready(struct stream * s);
+
+/*************************************************************************
+Function: stream_send()
+Purpose:  Sends one encoded journal record and takes a credit
+Input:    Stream, record index, record bytes, length
+Returns:  0 if successful, -1 if the client was dropped
+**************************************************************************/
+int stream_send(struct stream * s, uint32_t seq, const void * bytes, uint32_t length);
+
+/*************************************************************************
+Function: stream_replay()
+Purpose:  Sends records the client is missing from the journal, as far as
+          the credits allow
+Input:    Stream, index of the first record not yet readable from the journal
+Returns:  Number of records sent, -1 if the client was dropped
+**************************************************************************/
+int stream_replay(struct stream * s, uint32_t available);
+
+/*************************************************************************
+Function: stream_notify()
+Purpose:  Sends a PFS_IDLE or PFS_END message
+Input:    Stream, message type
+Returns:  0 if successful, -1 if the client was dropped
+**************************************************************************/
+int stream_notify(struct stream * s, uint16_t type);
+
+/*************************************************************************
+Function: stream_drop()
+Purpose:  Closes the client connection
+Input:    Stream
+**************************************************************************/
+void stream_drop(struct stream * s);
+
+/*************************************************************************
+Function: stream_close()
+Purpose:  Closes the client, the listening socket and the replay reader
+Input:    Stream
+**************************************************************************/
+void stream_close(struct stream * s);
+
+#endif
+/* ****************************************************************************** */
+// End of STREAM.H
+/* ****************************************************************************** */
@@ -21,8 +21,11 @@
 
 #include "basic.h"
 
-// The number of sensor readings for this robot (typically 181 for a laser range finder)
-#define SENSE_NUMBER 180
+// The most sensor readings a scan can have (as many as a log record keeps, see logfile.h), and the
+// number this robot's scans have. SENSE_NUMBER is 180 unless the log being played back says otherwise
+// (see beams.h).
+#define SENSE_MAX 1024
+extern int SENSE_NUMBER;
 // Turn radius of the robot in map squares.Since the "robot" is actually the sensor origin for the
 // purposes of this program, the turn radius is the displacement of the sensor from the robot's center
 // of rotation (assuming holonomic turns)
@@ -35,7 +38,7 @@ struct TSense_struct{
   double theta, distance;
 };
 typedef struct TSense_struct TSenseSample;
-typedef TSenseSample TSense[SENSE_NUMBER+1];
+typedef TSenseSample TSense[SENSE_MAX+1];
 
 // This is the structure for storing odometry data from the robot. The same conditions apply as above.
 struct odo_struct{
@@ -0,0 +1,1066 @@
+//
+// bag.c
+//
+// Playback of ROS bags. See bag.h.
+//
+// A replay thread does the work: it takes the chunks in order of their start times from the
+// decompression threads, converts the messages on the topics we use into pending readings, and
+// writes the pending readings out in time order. A pending reading is only written once no chunk
+// still to come could hold an earlier one (its start time is later), so a bag whose chunks overlap
+// in time still comes out in order.
+//
+// Decompression needs libbz2; lz4 frames (which is what ROS writes) are decoded here.
+//
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <math.h>
+#include <bzlib.h>
+
+#include "laser.h"
+#include "logfile.h"
+#include "bag.h"
+
+// What a connection's messages are used for
+#define BAG_UNUSED 0
+#define BAG_SCAN 1
+#define BAG_ODOMETRY 2
+#define BAG_IMU 3
+
+#define BAG_SLOTS (BAG_THREADS*BAG_AHEAD)
+
+struct TBagChunk_struct {
+  uint64_t pos;
+  uint64_t start, end;
+};
+typedef struct TBagChunk_struct TBagChunk;
+
+// A message converted and waiting to be written
+struct TBagReading_struct {
+  uint64_t time;
+  // The order it was read in, which breaks ties between readings at the same time
+  uint64_t order;
+  int kind;
+  double x, y, theta;
+  // A scan's readings (allocated with it), where the first looks and the angle between them
+  int count;
+  double start, step;
+  float *range;
+};
+typedef struct TBagReading_struct TBagReading;
+
+struct TBag_struct {
+  int fd;
+  // What each connection (by its number) is used for
+  int *kinds;
+  uint32_t connections;
+  // The chunks to read, in order of their start times, and the window of time to replay
+  TBagChunk *chunks;
+  int chunkCount;
+  uint64_t start, end;
+
+  // The decompression threads. Chunk i goes in slot i % BAG_SLOTS once it is ready; the threads
+  // stay no more than BAG_AHEAD chunks each ahead of the chunks taken.
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  pthread_t thread[BAG_THREADS];
+  int threads, next, taken, stop;
+  struct {
+    char *data;
+    size_t size;
+    int ready;
+  } slot[BAG_SLOTS];
+
+  // The readings waiting to be written, as a heap on time
+  TBagReading **heap;
+  int heapCount, heapSize;
+  uint64_t order;
+
+  // The pipe, until the log is started on it with the first scan, the log being written, and the
+  // geometry of its scans (the first scan's)
+  FILE *pipe;
+  TLogWriter *log;
+  TLogRecord record;
+  int count;
+  double angle, step;
+  // The latest pose. Without an odometry topic it has no position, only the IMU's heading.
+  int pose, position, havePose;
+  double x, y, theta;
+  uint32_t scans;
+};
+typedef struct TBag_struct TBag;
+
+
+//
+// IsBag
+//
+int IsBag(const char *name)
+{
+  size_t length = strlen(name);
+
+  return ((length > 4) && (strcmp(name + length - 4, ".bag") == 0));
+}
+
+
+//
+// Field
+//
+// Finds a field of a record header. Returns its value, or NULL if the header does not have it.
+//
+static const char *Field(const char *header, uint32_t length, const char *name, uint32_t *size)
+{
+  const char *end = header + length;
+  size_t nameLength = strlen(name);
+  uint32_t fieldLength;
+
+  while (end - header >= 4) {
+    memcpy(&fieldLength, header, 4);
+    header += 4;
+    if (fieldLength > (size_t) (end - header))
+      return NULL;
+    if ((fieldLength > nameLength) && (header[nameLength] == '=') && (!memcmp(header, name, nameLength))) {
+      *size = fieldLength - nameLength - 1;
+      return header + nameLength + 1;
+    }
+    header += fieldLength;
+  }
+  return NULL;
+}
+
+
+//
+// FieldValue
+//
+// Copies a fixed size field of a record header. Returns -1 if the header does not have it.
+//
+static int FieldValue(const char *header, uint32_t length, const char *name, void *value, uint32_t size)
+{
+  const char *field;
+  uint32_t fieldSize;
+
+  field = Field(header, length, name, &fieldSize);
+  if ((field == NULL) || (fieldSize != size))
+    return -1;
+  memcpy(value, field, size);
+  return 0;
+}
+
+
+//
+// Op
+//
+// The type of a record, or -1.
+//
+static int Op(const char *header, uint32_t length)
+{
+  uint8_t op;
+
+  return (FieldValue(header, length, "op", &op, 1) == 0) ? op : -1;
+}
+
+
+//
+// FieldTime
+//
+// A time field (seconds and nanoseconds) in nanoseconds. Returns -1 if the header does not have it.
+//
+static int FieldTime(const char *header, uint32_t length, const char *name, uint64_t *time)
+{
+  uint32_t value[2];
+
+  if (FieldValue(header, length, name, value, sizeof(value)) != 0)
+    return -1;
+  *time = value[0]*1000000000ULL + value[1];
+  return 0;
+}
+
+
+//
+// NextRecord
+//
+// Finds the next record in memory. Returns 0 at the end, or if the rest is damaged.
+//
+static int NextRecord(const char *&p, const char *end, const char *&header, uint32_t &headerLength,
+		      const char *&data, uint32_t &dataLength)
+{
+  if (end - p < 4)
+    return 0;
+  memcpy(&headerLength, p, 4);
+  if (headerLength > (size_t) (end - p - 4))
+    return 0;
+  header = p + 4;
+  p = header + headerLength;
+  if (end - p < 4)
+    return 0;
+  memcpy(&dataLength, p, 4);
+  if (dataLength > (size_t) (end - p - 4))
+    return 0;
+  data = p + 4;
+  p = data + dataLength;
+  return 1;
+}
+
+
+//
+// ReadBlock
+//
+// Reads a length and that many bytes from the file. Returns them (to be freed), or NULL.
+//
+static char *ReadBlock(int fd, uint64_t pos, uint32_t *length)
+{
+  char *block;
+
+  if ((pread(fd, length, 4, pos) != 4) || (*length > BAG_MAX_RECORD))
+    return NULL;
+  block = (char *) malloc(*length + 1);
+  if ((block != NULL) && (pread(fd, block, *length, pos + 4) != (ssize_t) *length)) {
+    free(block);
+    return NULL;
+  }
+  return block;
+}
+
+
+//
+// Lz4Block
+//
+// Decodes an LZ4 block onto the end of the output. Matches can reach back into earlier blocks,
+// which is what a frame of linked blocks needs. Returns the new length of the output, or -1.
+//
+static long Lz4Block(const unsigned char *in, size_t length, unsigned char *out, size_t done, size_t size)
+{
+  const unsigned char *end = in + length;
+  size_t literals, match, offset;
+  unsigned int token, byte;
+
+  while (in < end) {
+    token = *(in++);
+    literals = token >> 4;
+    if (literals == 15)
+      do {
+	if (in >= end)
+	  return -1;
+	byte = *(in++);
+	literals += byte;
+      } while (byte == 255);
+    if (((size_t) (end - in) < literals) || (size - done < literals))
+      return -1;
+    memcpy(out + done, in, literals);
+    in += literals;
+    done += literals;
+    // The last sequence is only literals
+    if (in == end)
+      break;
+
+    if (end - in < 2)
+      return -1;
+    offset = in[0] | (in[1] << 8);
+    in += 2;
+    if ((offset == 0) || (offset > done))
+      return -1;
+    match = (token & 15) + 4;
+    if ((token & 15) == 15)
+      do {
+	if (in >= end)
+	  return -1;
+	byte = *(in++);
+	match += byte;
+      } while (byte == 255);
+    if (size - done < match)
+      return -1;
+    // Byte by byte, since a match can overlap what it is copying
+    for (; match > 0; match--, done++)
+      out[done] = out[done - offset];
+  }
+  return done;
+}
+
+
+//
+// Lz4Frame
+//
+// Decodes LZ4 frames into exactly size bytes. The checksums are not checked. Returns -1 on failure.
+//
+static int Lz4Frame(const unsigned char *in, size_t length, unsigned char *out, size_t size)
+{
+  const unsigned char *end = in + length;
+  uint32_t magic, block, skip;
+  size_t headerLength;
+  long done = 0;
+  int flags;
+
+  while (end - in >= 4) {
+    memcpy(&magic, in, 4);
+    in += 4;
+    // Skippable frames
+    if ((magic & 0xFFFFFFF0) == 0x184D2A50) {
+      if (end - in < 4)
+	return -1;
+      memcpy(&skip, in, 4);
+      if (skip > (size_t) (end - in - 4))
+	return -1;
+      in += 4 + skip;
+      continue;
+    }
+    if ((magic != 0x184D2204) || (end - in < 3))
+      return -1;
+    flags = in[0];
+    // A version 1 frame without a dictionary; FLG, BD, the content size if there is one, and the
+    // header checksum
+    if (((flags >> 6) != 1) || (flags & 0x01))
+      return -1;
+    headerLength = (flags & 0x08) ? 11 : 3;
+    if ((size_t) (end - in) < headerLength)
+      return -1;
+    in += headerLength;
+
+    for (;;) {
+      if (end - in < 4)
+	return -1;
+      memcpy(&block, in, 4);
+      in += 4;
+      if (block == 0)
+	break;
+      length = block & 0x7FFFFFFF;
+      if ((size_t) (end - in) < length)
+	return -1;
+      if (block & 0x80000000) {
+	if (size - done < length)
+	  return -1;
+	memcpy(out + done, in, length);
+	done += length;
+      }
+      else if ((done = Lz4Block(in, length, out, done, size)) < 0)
+	return -1;
+      in += length;
+      // Block checksum
+      if (flags & 0x10)
+	in += 4;
+    }
+    // Content checksum
+    if (flags & 0x04)
+      in += 4;
+    if (in > end)
+      return -1;
+  }
+  return ((size_t) done == size) ? 0 : -1;
+}
+
+
+//
+// ReadChunk
+//
+// Reads and decompresses a chunk. Returns its records (to be freed), or NULL if it is damaged.
+//
+static char *ReadChunk(TBag *bag, TBagChunk *chunk, size_t *size)
+{
+  char *header, *data, *records = NULL;
+  const char *compression;
+  uint32_t headerLength, dataLength, compressionLength, recordsLength;
+  unsigned int length;
+
+  header = ReadBlock(bag->fd, chunk->pos, &headerLength);
+  if (header == NULL)
+    return NULL;
+  compression = Field(header, headerLength, "compression", &compressionLength);
+  if ((Op(header, headerLength) != BAG_CHUNK) || (compression == NULL) ||
+      (FieldValue(header, headerLength, "size", &recordsLength, 4) != 0) || (recordsLength > BAG_MAX_RECORD)) {
+    free(header);
+    return NULL;
+  }
+  data = ReadBlock(bag->fd, chunk->pos + 4 + headerLength, &dataLength);
+  if (data == NULL) {
+    free(header);
+    return NULL;
+  }
+
+  if ((compressionLength == 4) && (!strncmp(compression, "none", 4))) {
+    records = data;
+    data = NULL;
+    recordsLength = dataLength;
+  }
+  else {
+    records = (char *) malloc(recordsLength + 1);
+    length = recordsLength;
+    if ((records != NULL) && (compressionLength == 3) && (!strncmp(compression, "bz2", 3))) {
+      if ((BZ2_bzBuffToBuffDecompress(records, &length, data, dataLength, 0, 0) != BZ_OK) || (length != recordsLength)) {
+	free(records);
+	records = NULL;
+      }
+    }
+    else if ((records != NULL) && (compressionLength == 3) && (!strncmp(compression, "lz4", 3))) {
+      if (Lz4Frame((const unsigned char *) data, dataLength, (unsigned char *) records, recordsLength) != 0) {
+	free(records);
+	records = NULL;
+      }
+    }
+    else {
+      fprintf(stderr, "Unknown compression %.*s in bag\n", (int) compressionLength, compression);
+      free(records);
+      records = NULL;
+    }
+  }
+  free(header);
+  free(data);
+  *size = recordsLength;
+  return records;
+}
+
+
+//
+// Decompress
+//
+// A decompression thread. Takes the next chunk to read, as long as it is not too far ahead.
+//
+static void *Decompress(void *arg)
+{
+  TBag *bag = (TBag *) arg;
+  char *records;
+  size_t size = 0;
+  int i;
+
+  for (;;) {
+    pthread_mutex_lock(&bag->lock);
+    while ((!bag->stop) && (bag->next < bag->chunkCount) && (bag->next >= bag->taken + bag->threads*BAG_AHEAD))
+      pthread_cond_wait(&bag->changed, &bag->lock);
+    if ((bag->stop) || (bag->next >= bag->chunkCount)) {
+      pthread_mutex_unlock(&bag->lock);
+      return NULL;
+    }
+    i = bag->next++;
+    pthread_mutex_unlock(&bag->lock);
+
+    records = ReadChunk(bag, &bag->chunks[i], &size);
+
+    pthread_mutex_lock(&bag->lock);
+    bag->slot[i % BAG_SLOTS].data = records;
+    bag->slot[i % BAG_SLOTS].size = size;
+    bag->slot[i % BAG_SLOTS].ready = 1;
+    pthread_cond_broadcast(&bag->changed);
+    pthread_mutex_unlock(&bag->lock);
+  }
+}
+
+
+//
+// TakeChunk
+//
+// Waits for chunk i to be decompressed and takes it. Chunks are taken in order.
+//
+static char *TakeChunk(TBag *bag, int i, size_t *size)
+{
+  char *records;
+
+  pthread_mutex_lock(&bag->lock);
+  while (!bag->slot[i % BAG_SLOTS].ready)
+    pthread_cond_wait(&bag->changed, &bag->lock);
+  records = bag->slot[i % BAG_SLOTS].data;
+  *size = bag->slot[i % BAG_SLOTS].size;
+  bag->slot[i % BAG_SLOTS].data = NULL;
+  bag->slot[i % BAG_SLOTS].ready = 0;
+  bag->taken++;
+  pthread_cond_broadcast(&bag->changed);
+  pthread_mutex_unlock(&bag->lock);
+  return records;
+}
+
+
+//
+// Earlier
+//
+static inline int Earlier(TBagReading *a, TBagReading *b)
+{
+  return (a->time < b->time) || ((a->time == b->time) && (a->order < b->order));
+}
+
+
+//
+// Push
+//
+// Adds a reading to the heap.
+//
+static int Push(TBag *bag, TBagReading *reading)
+{
+  TBagReading **heap, *swap;
+  int i;
+
+  if (bag->heapCount == bag->heapSize) {
+    heap = (TBagReading **) realloc(bag->heap, (bag->heapSize*2 + 64) * sizeof(TBagReading *));
+    if (heap == NULL)
+      return -1;
+    bag->heap = heap;
+    bag->heapSize = bag->heapSize*2 + 64;
+  }
+  reading->order = bag->order++;
+  i = bag->heapCount++;
+  bag->heap[i] = reading;
+  while ((i > 0) && (Earlier(bag->heap[i], bag->heap[(i-1)/2]))) {
+    swap = bag->heap[i];
+    bag->heap[i] = bag->heap[(i-1)/2];
+    bag->heap[(i-1)/2] = swap;
+    i = (i-1)/2;
+  }
+  return 0;
+}
+
+
+//
+// Pop
+//
+// Takes the earliest reading from the heap.
+//
+static TBagReading *Pop(TBag *bag)
+{
+  TBagReading *top = bag->heap[0], *swap;
+  int i = 0, child;
+
+  bag->heap[0] = bag->heap[--bag->heapCount];
+  for (;;) {
+    child = 2*i + 1;
+    if (child >= bag->heapCount)
+      break;
+    if ((child + 1 < bag->heapCount) && (Earlier(bag->heap[child+1], bag->heap[child])))
+      child++;
+    if (!Earlier(bag->heap[child], bag->heap[i]))
+      break;
+    swap = bag->heap[i];
+    bag->heap[i] = bag->heap[child];
+    bag->heap[child] = swap;
+    i = child;
+  }
+  return top;
+}
+
+
+//
+// Get
+//
+// Copies the next size bytes of a message. Returns -1 if the message is too short.
+//
+static int Get(const char *&p, const char *end, void *value, size_t size)
+{
+  if ((size_t) (end - p) < size)
+    return -1;
+  memcpy(value, p, size);
+  p += size;
+  return 0;
+}
+
+
+//
+// SkipHeader
+//
+// Steps over a std_msgs/Header (seq, stamp and frame_id), or another string if stamp is FALSE.
+//
+static int SkipHeader(const char *&p, const char *end, int stamp)
+{
+  uint32_t length;
+
+  if (stamp) {
+    if (end - p < 12)
+      return -1;
+    p += 12;
+  }
+  if ((Get(p, end, &length, 4) != 0) || (length > (size_t) (end - p)))
+    return -1;
+  p += length;
+  return 0;
+}
+
+
+//
+// Yaw
+//
+// The heading of a quaternion (x, y, z, w).
+//
+static double Yaw(double *q)
+{
+  return atan2(2.0*(q[3]*q[2] + q[0]*q[1]), 1.0 - 2.0*(q[1]*q[1] + q[2]*q[2]));
+}
+
+
+//
+// Convert
+//
+// Converts a message into a reading. Returns NULL if it cannot be read or has nothing we use.
+//
+static TBagReading *Convert(int kind, uint64_t time, const char *p, const char *end)
+{
+  TBagReading *reading;
+  float limits[7], range;
+  double pose[7], orientation[4], covariance;
+  uint32_t count = 0, stride;
+  int i;
+
+  // angle_min, angle_max, angle_increment, time_increment, scan_time, range_min, range_max, then the
+  // ranges. A laser with more readings than a log record keeps has every stride'th one kept.
+  if ((kind == BAG_SCAN) &&
+      ((SkipHeader(p, end, TRUE) != 0) || (Get(p, end, limits, sizeof(limits)) != 0) || (Get(p, end, &count, 4) != 0) ||
+       ((size_t) (end - p)/sizeof(float) < count) || (count == 0) || (limits[2] == 0.0)))
+    return NULL;
+  stride = (count + LOG_MAX_READINGS - 1) / LOG_MAX_READINGS;
+  if (stride > 1)
+    count = (count + stride - 1) / stride;
+
+  reading = (TBagReading *) malloc(sizeof(TBagReading) + count*sizeof(float));
+  if (reading == NULL)
+    return NULL;
+  reading->kind = kind;
+  reading->time = time;
+  reading->range = (float *) (reading + 1);
+
+  switch (kind) {
+  case BAG_SCAN:
+    reading->count = count;
+    reading->start = limits[0];
+    reading->step = limits[2] * stride;
+    // Anything outside the laser's range (or not a number) is max range
+    for (i = 0; i < (int) count; i++) {
+      memcpy(&range, p + i*stride*sizeof(float), sizeof(float));
+      if ((range >= limits[5]) && (range <= limits[6]))
+	reading->range[i] = range;
+      else
+	reading->range[i] = MAX_SENSE_RANGE / MAP_SCALE;
+    }
+    return reading;
+
+  case BAG_ODOMETRY:
+    // The header, child_frame_id, then the pose's position and orientation
+    if ((SkipHeader(p, end, TRUE) != 0) || (SkipHeader(p, end, FALSE) != 0) || (Get(p, end, pose, sizeof(pose)) != 0))
+      break;
+    reading->x = pose[0];
+    reading->y = pose[1];
+    reading->theta = Yaw(pose + 3);
+    return reading;
+
+  case BAG_IMU:
+    // The header, the orientation and its covariance, which starts with -1 if there is no orientation
+    if ((SkipHeader(p, end, TRUE) != 0) || (Get(p, end, orientation, sizeof(orientation)) != 0) ||
+	(Get(p, end, &covariance, sizeof(covariance)) != 0) || (covariance == -1.0))
+      break;
+    reading->theta = Yaw(orientation);
+    return reading;
+  }
+
+  free(reading);
+  return NULL;
+}
+
+
+//
+// ReadChunkRecords
+//
+// Converts the messages of a chunk that are on the topics we use, and adds them to the heap.
+//
+static void ReadChunkRecords(TBag *bag, const char *p, const char *end)
+{
+  const char *header, *data;
+  uint32_t headerLength, dataLength, connection;
+  uint64_t time;
+  TBagReading *reading;
+
+  while (NextRecord(p, end, header, headerLength, data, dataLength)) {
+    if ((Op(header, headerLength) != BAG_MESSAGE) ||
+	(FieldValue(header, headerLength, "conn", &connection, 4) != 0) || (connection >= bag->connections) ||
+	(bag->kinds[connection] == BAG_UNUSED) || (FieldTime(header, headerLength, "time", &time) != 0))
+      continue;
+    reading = Convert(bag->kinds[connection], time, data, data + dataLength);
+    if ((reading != NULL) && (Push(bag, reading) != 0))
+      free(reading);
+  }
+}
+
+
+//
+// WriteReading
+//
+// Keeps track of the pose, and writes each scan in the window with the pose before it. The log
+// keeps the laser's own readings, as many as the first scan has and where they look; a scan with
+// different ones is resampled to them. Returns -1 if the log can no longer be written (SLAM has
+// stopped reading it).
+//
+static int WriteReading(TBag *bag, TBagReading *reading)
+{
+  int i, n;
+
+  if (reading->kind == BAG_ODOMETRY) {
+    bag->x = reading->x;
+    bag->y = reading->y;
+    bag->theta = reading->theta;
+    bag->havePose = TRUE;
+    return 0;
+  }
+  if (reading->kind == BAG_IMU) {
+    bag->theta = reading->theta;
+    bag->havePose = TRUE;
+    return 0;
+  }
+
+  // Scans before the window, or before there is a pose to go with them, are left out
+  if ((reading->time < bag->start) || ((bag->pose) && (!bag->havePose)))
+    return 0;
+  if (bag->log == NULL) {
+    bag->log = LogWriteTo(bag->pipe, DPB, reading->count, reading->start, reading->step,
+			  bag->position ? 0 : DPB_HEADING_ONLY);
+    bag->pipe = NULL;
+    if (bag->log == NULL)
+      return -1;
+    bag->count = reading->count;
+    bag->angle = reading->start;
+    bag->step = reading->step;
+  }
+  bag->record.type = LOG_ODOMETRY;
+  bag->record.x = bag->x;
+  bag->record.y = bag->y;
+  bag->record.theta = bag->theta;
+  if (LogWrite(bag->log, bag->record) != 0)
+    return -1;
+  bag->record.type = LOG_LASER;
+  bag->record.count = bag->count;
+  for (i = 0; i < bag->count; i++) {
+    n = (int) floor((bag->angle + i*bag->step - reading->start) / reading->step + 0.5);
+    if ((n >= 0) && (n < reading->count))
+      bag->record.range[i] = reading->range[n];
+    else
+      bag->record.range[i] = MAX_SENSE_RANGE / MAP_SCALE;
+  }
+  bag->scans++;
+  return LogWrite(bag->log, bag->record);
+}
+
+
+//
+// Replay
+//
+// The replay thread. Writes the readings in time order, reading each chunk once nothing pending is
+// earlier than its start, and stops at the first reading past the end of the window.
+//
+static void *Replay(void *arg)
+{
+  TBag *bag = (TBag *) arg;
+  TBagReading *reading;
+  char *records;
+  size_t size;
+  int i, c = 0;
+
+  for (;;) {
+    while ((c < bag->chunkCount) && ((bag->heapCount == 0) || (bag->chunks[c].start <= bag->heap[0]->time))) {
+      records = TakeChunk(bag, c, &size);
+      if (records == NULL)
+	fprintf(stderr, "Skipping a damaged chunk of the bag at byte %llu\n", (unsigned long long) bag->chunks[c].pos);
+      else {
+	ReadChunkRecords(bag, records, records + size);
+	free(records);
+      }
+      c++;
+    }
+    if (bag->heapCount == 0)
+      break;
+    reading = Pop(bag);
+    if ((reading->time >= bag->end) || (WriteReading(bag, reading) != 0)) {
+      free(reading);
+      break;
+    }
+    free(reading);
+  }
+
+  fprintf(stderr, "Bag replay ended after %u scans.\n", bag->scans);
+  // A log that never had a scan still gets its header, so it reads as an empty log
+  if (bag->log == NULL)
+    bag->log = LogWriteTo(bag->pipe, DPB, 0, -M_PI/2, M_PI/180.0, bag->position ? 0 : DPB_HEADING_ONLY);
+  LogFinish(bag->log);
+
+  pthread_mutex_lock(&bag->lock);
+  bag->stop = 1;
+  pthread_cond_broadcast(&bag->changed);
+  pthread_mutex_unlock(&bag->lock);
+  for (i = 0; i < bag->threads; i++)
+    pthread_join(bag->thread[i], NULL);
+  for (i = 0; i < BAG_SLOTS; i++)
+    free(bag->slot[i].data);
+  while (bag->heapCount > 0)
+    free(Pop(bag));
+  free(bag->heap);
+  free(bag->chunks);
+  free(bag->kinds);
+  close(bag->fd);
+  pthread_mutex_destroy(&bag->lock);
+  pthread_cond_destroy(&bag->changed);
+  free(bag);
+  return NULL;
+}
+
+
+//
+// Listed
+//
+// Returns TRUE if a topic is in a comma separated list.
+//
+static int Listed(const char *topics, const char *topic, uint32_t length)
+{
+  const char *comma;
+
+  while (*topics != '\0') {
+    comma = strchr(topics, ',');
+    if (comma == NULL)
+      comma = topics + strlen(topics);
+    if (((size_t) (comma - topics) == length) && (!strncmp(topics, topic, length)))
+      return TRUE;
+    topics = (*comma == ',') ? comma + 1 : comma;
+  }
+  return FALSE;
+}
+
+
+//
+// KindOf
+//
+// What a message type is used for.
+//
+static int KindOf(const char *type, uint32_t length)
+{
+  if ((length == 21) && (!strncmp(type, "sensor_msgs/LaserScan", 21)))
+    return BAG_SCAN;
+  if ((length == 17) && (!strncmp(type, "nav_msgs/Odometry", 17)))
+    return BAG_ODOMETRY;
+  if ((length == 15) && (!strncmp(type, "sensor_msgs/Imu", 15)))
+    return BAG_IMU;
+  return BAG_UNUSED;
+}
+
+
+//
+// CompareChunks
+//
+// Orders chunks by start time, for qsort.
+//
+static int CompareChunks(const void *a, const void *b)
+{
+  uint64_t first = ((const TBagChunk *) a)->start, second = ((const TBagChunk *) b)->start;
+
+  return (first < second) ? -1 : ((first > second) ? 1 : 0);
+}
+
+
+//
+// ReadIndex
+//
+// Reads the connections and chunks from the index at the end of the bag, and picks the topics and
+// the chunks to use. Returns -1 if the bag cannot be replayed.
+//
+static int ReadIndex(TBag *bag, const char *name, const char *topics, double start, double end, int part, int parts)
+{
+  const char *header, *data, *p, *indexEnd, *topic, *type;
+  char *index, *bagHeader;
+  uint32_t headerLength, dataLength, length, connection, chunkCount, topicLength = 0, typeLength = 0;
+  uint32_t entry[2], e;
+  uint64_t indexPos, first = UINT64_MAX, last = 0;
+  struct stat status;
+  const char *chosen[BAG_IMU+1];
+  uint32_t chosenLength[BAG_IMU+1];
+  TBagChunk chunk;
+  int i, kind, wanted, result = -1;
+
+  bagHeader = ReadBlock(bag->fd, strlen(BAG_MAGIC), &length);
+  if ((bagHeader == NULL) || (Op(bagHeader, length) != BAG_HEADER) ||
+      (FieldValue(bagHeader, length, "index_pos", &indexPos, 8) != 0) ||
+      (FieldValue(bagHeader, length, "conn_count", &bag->connections, 4) != 0) ||
+      (FieldValue(bagHeader, length, "chunk_count", &chunkCount, 4) != 0)) {
+    fprintf(stderr, "%s is not a ROS bag (version 2.0)\n", name);
+    free(bagHeader);
+    return -1;
+  }
+  free(bagHeader);
+  if ((indexPos == 0) || (fstat(bag->fd, &status) != 0) || ((uint64_t) status.st_size < indexPos) ||
+      (status.st_size - indexPos > BAG_MAX_RECORD)) {
+    fprintf(stderr, "%s has no index (was it recorded to the end?); rosbag reindex can add one\n", name);
+    return -1;
+  }
+
+  // The index is small (a few records for each connection and chunk), so it is read whole
+  index = (char *) malloc(status.st_size - indexPos + 1);
+  bag->kinds = (int *) calloc(bag->connections + 1, sizeof(int));
+  bag->chunks = (TBagChunk *) calloc(chunkCount + 1, sizeof(TBagChunk));
+  if ((index == NULL) || (bag->kinds == NULL) || (bag->chunks == NULL) ||
+      (pread(bag->fd, index, status.st_size - indexPos, indexPos) != (ssize_t) (status.st_size - indexPos))) {
+    fprintf(stderr, "Unable to read the index of %s\n", name);
+    free(index);
+    return -1;
+  }
+  indexEnd = index + (status.st_size - indexPos);
+
+  // Pick the topics: those listed, or the first scan topic and the first odometry topic (the first
+  // IMU topic if there is no odometry)
+  memset(chosen, 0, sizeof(chosen));
+  for (p = index; NextRecord(p, indexEnd, header, headerLength, data, dataLength); ) {
+    topic = Field(header, headerLength, "topic", &topicLength);
+    type = Field(data, dataLength, "type", &typeLength);
+    if ((Op(header, headerLength) != BAG_CONNECTION) || (topic == NULL) || (type == NULL))
+      continue;
+    kind = KindOf(type, typeLength);
+    if ((kind == BAG_UNUSED) || (chosen[kind] != NULL))
+      continue;
+    if ((*topics == '\0') || (Listed(topics, topic, topicLength))) {
+      chosen[kind] = topic;
+      chosenLength[kind] = topicLength;
+    }
+  }
+  if ((chosen[BAG_ODOMETRY] != NULL) && (*topics == '\0'))
+    chosen[BAG_IMU] = NULL;
+  bag->position = (chosen[BAG_ODOMETRY] != NULL);
+  if (chosen[BAG_SCAN] == NULL) {
+    fprintf(stderr, "%s has no sensor_msgs/LaserScan topic to replay\n", name);
+    free(index);
+    return -1;
+  }
+  fprintf(stderr, "Replaying scans from %.*s", (int) chosenLength[BAG_SCAN], chosen[BAG_SCAN]);
+  for (kind = BAG_ODOMETRY; kind <= BAG_IMU; kind++)
+    if (chosen[kind] != NULL) {
+      fprintf(stderr, ", %s from %.*s", (kind == BAG_ODOMETRY) ? "odometry" : "heading", (int) chosenLength[kind], chosen[kind]);
+      bag->pose = TRUE;
+    }
+  fprintf(stderr, "\n");
+
+  // Every connection on a chosen topic is used (a topic can have several publishers)
+  for (p = index; NextRecord(p, indexEnd, header, headerLength, data, dataLength); ) {
+    topic = Field(header, headerLength, "topic", &topicLength);
+    type = Field(data, dataLength, "type", &typeLength);
+    if ((Op(header, headerLength) != BAG_CONNECTION) || (topic == NULL) || (type == NULL) ||
+	(FieldValue(header, headerLength, "conn", &connection, 4) != 0) || (connection >= bag->connections))
+      continue;
+    kind = KindOf(type, typeLength);
+    if ((kind != BAG_UNUSED) && (chosen[kind] != NULL) && (topicLength == chosenLength[kind]) &&
+	(!strncmp(topic, chosen[kind], topicLength)))
+      bag->kinds[connection] = kind;
+  }
+
+  // The chunks with messages on those connections
+  for (p = index; NextRecord(p, indexEnd, header, headerLength, data, dataLength); ) {
+    if ((Op(header, headerLength) != BAG_CHUNK_INFO) ||
+	(FieldValue(header, headerLength, "chunk_pos", &chunk.pos, 8) != 0) ||
+	(FieldTime(header, headerLength, "start_time", &chunk.start) != 0) ||
+	(FieldTime(header, headerLength, "end_time", &chunk.end) != 0))
+      continue;
+    if (chunk.start < first)
+      first = chunk.start;
+    if (chunk.end > last)
+      last = chunk.end;
+    wanted = FALSE;
+    for (e = 0; e + sizeof(entry) <= dataLength; e += sizeof(entry)) {
+      memcpy(entry, data + e, sizeof(entry));
+      if ((entry[0] < bag->connections) && (bag->kinds[entry[0]] != BAG_UNUSED) && (entry[1] > 0))
+	wanted = TRUE;
+    }
+    if ((wanted) && (bag->chunkCount < (int) chunkCount))
+      bag->chunks[bag->chunkCount++] = chunk;
+  }
+  free(index);
+
+  // The window, as bag times
+  if (parts > 0) {
+    start = (last - first) * 1e-9 * part / parts;
+    end = (part == parts - 1) ? -1 : (last - first) * 1e-9 * (part + 1) / parts;
+  }
+  bag->start = first + (uint64_t) (((start < 0) ? 0 : start) * 1e9);
+  bag->end = (end < 0) ? UINT64_MAX : first + (uint64_t) (end * 1e9);
+
+  // In order of start time, leaving out the chunks that end before the window, all but the last
+  // of them: its pose goes with the first scans in the window.
+  qsort(bag->chunks, bag->chunkCount, sizeof(TBagChunk), CompareChunks);
+  for (i = 0; (i + 1 < bag->chunkCount) && (bag->chunks[i+1].end < bag->start); i++)
+    ;
+  memmove(bag->chunks, bag->chunks + i, (bag->chunkCount - i) * sizeof(TBagChunk));
+  bag->chunkCount -= i;
+  if (bag->chunkCount > 0)
+    result = 0;
+  else
+    fprintf(stderr, "%s has no messages on those topics\n", name);
+  return result;
+}
+
+
+//
+// BagOpen
+//
+FILE *BagOpen(const char *name, const char *topics, double start, double end, int part, int parts)
+{
+  TBag *bag;
+  pthread_t thread;
+  char magic[sizeof(BAG_MAGIC)];
+  int fds[2], i, result;
+  long processors;
+
+  if ((!IsBag(name)) || ((parts > 0) && ((part < 0) || (part >= parts))))
+    return NULL;
+  bag = (TBag *) calloc(1, sizeof(TBag));
+  if (bag == NULL)
+    return NULL;
+  bag->fd = open(name, O_RDONLY);
+  if (bag->fd < 0) {
+    free(bag);
+    return NULL;
+  }
+  if ((pread(bag->fd, magic, strlen(BAG_MAGIC), 0) != (ssize_t) strlen(BAG_MAGIC)) ||
+      (memcmp(magic, BAG_MAGIC, strlen(BAG_MAGIC)) != 0)) {
+    fprintf(stderr, "%s is not a ROS bag (version 2.0)\n", name);
+    result = -1;
+  }
+  else
+    result = ReadIndex(bag, name, (topics == NULL) ? "" : topics, start, end, part, parts);
+  if (result != 0) {
+    close(bag->fd);
+    free(bag->kinds);
+    free(bag->chunks);
+    free(bag);
+    return NULL;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  if (pipe(fds) != 0) {
+    close(bag->fd);
+    free(bag->kinds);
+    free(bag->chunks);
+    free(bag);
+    return NULL;
+  }
+  bag->pipe = fdopen(fds[1], "w");
+  pthread_mutex_init(&bag->lock, NULL);
+  pthread_cond_init(&bag->changed, NULL);
+
+  processors = sysconf(_SC_NPROCESSORS_ONLN);
+  bag->threads = (processors < BAG_THREADS) ? ((processors < 1) ? 1 : processors) : BAG_THREADS;
+  if (bag->threads > bag->chunkCount)
+    bag->threads = bag->chunkCount;
+  for (i = 0; i < bag->threads; i++)
+    if (pthread_create(&bag->thread[i], NULL, Decompress, bag) != 0)
+      break;
+  bag->threads = i;
+
+  if ((bag->pipe == NULL) || (bag->threads == 0) || (pthread_create(&thread, NULL, Replay, bag) != 0)) {
+    pthread_mutex_lock(&bag->lock);
+    bag->stop = 1;
+    pthread_cond_broadcast(&bag->changed);
+    pthread_mutex_unlock(&bag->lock);
+    for (i = 0; i < bag->threads; i++)
+      pthread_join(bag->thread[i], NULL);
+    for (i = 0; i < BAG_SLOTS; i++)
+      free(bag->slot[i].data);
+    if (bag->pipe != NULL)
+      fclose(bag->pipe);
+    else
+      close(fds[1]);
+    close(fds[0]);
+    close(bag->fd);
+    free(bag->kinds);
+    free(bag->chunks);
+    free(bag);
+    return NULL;
+  }
+  pthread_detach(thread);
+  return fdopen(fds[0], "r");
+}
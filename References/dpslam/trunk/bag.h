@@ -0,0 +1,49 @@
+//
+// bag.h
+//
+// Playback of ROS bags (format 2.0) without ROS. PLAYBACK can name a .bag file; BagOpen replays
+// the laser scans in it, with the robot's pose from an odometry or IMU topic, as a .dpb log through
+// a pipe, so ReadLog reads it like any other log.
+//
+// A bag is a sequence of records, each a header of "name=value" fields followed by its data. The
+// messages are kept in chunks, compressed with bz2 or lz4 or not at all, and an index at the end of
+// the file lists the connections (a topic and its message type) and, for each chunk, where it is,
+// the times of its first and last messages and the connections it has messages on. The index lets
+// us read only the chunks in the window that have messages on the topics we want. A few threads
+// decompress the next chunks while the current one is converted, and the messages of chunks whose
+// times overlap are merged, so everything comes out in time order. Only a handful of chunks are in
+// memory at once, however large the bag.
+//
+// Scans (sensor_msgs/LaserScan) keep the laser's own readings, and the log's header says where they
+// look. The pose comes from nav_msgs/Odometry or, if there is none, the heading alone comes from
+// sensor_msgs/Imu. Each scan goes out with the latest pose before it.
+//
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define BAG_MAGIC "#ROSBAG V2.0\n"
+
+// Record types (the "op" field)
+#define BAG_MESSAGE 0x02
+#define BAG_HEADER 0x03
+#define BAG_INDEX 0x04
+#define BAG_CHUNK 0x05
+#define BAG_CHUNK_INFO 0x06
+#define BAG_CONNECTION 0x07
+
+// The most threads decompressing chunks, and how many chunks each can have ready ahead of the
+// one being converted
+#define BAG_THREADS 4
+#define BAG_AHEAD 2
+
+// Anything larger in a record is taken to be damage, not data
+#define BAG_MAX_RECORD (1 << 30)
+
+// Returns TRUE if a PLAYBACK name refers to a ROS bag.
+int IsBag(const char *name);
+// Replays the scans of a bag between start and end seconds after its first message (end < 0 for
+// the rest of it), or the part'th of parts equal slices of it if parts > 0, as JournalOpen does.
+// topics is a comma separated list of the topics to use (a scan topic, and an odometry or IMU
+// topic), or "" for the first of each kind. Returns the read end of the .dpb log it produces.
+FILE *BagOpen(const char *name, const char *topics, double start, double end, int part, int parts);
@@ -12,3 +12,6 @@
 //
 
 char *PLAYBACK, *RECORDING;
+double PLAYBACK_START = 0, PLAYBACK_END = -1;
+int PLAYBACK_PART = 0, PLAYBACK_PARTS = 0;
+const char *PLAYBACK_TOPICS = "";
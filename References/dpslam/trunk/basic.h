@@ -42,3 +42,11 @@
 // When recording a log file, the file name of the log is stored in *RECORDING
 // When playing back a log file, the name is stored in *PLAYBACK
 extern char *PLAYBACK, *RECORDING;
+// When playing back a handheld journal (.pfj), only the scans between PLAYBACK_START and
+// PLAYBACK_END seconds into the session are used (PLAYBACK_END < 0 for the rest of it). If
+// PLAYBACK_PARTS is set, the window is instead slice PLAYBACK_PART of that many equal slices.
+extern double PLAYBACK_START, PLAYBACK_END;
+extern int PLAYBACK_PART, PLAYBACK_PARTS;
+// The same goes for a ROS bag, which plays back the topics in PLAYBACK_TOPICS (comma separated),
+// or the first laser scan and odometry topics if it is empty.
+extern const char *PLAYBACK_TOPICS;
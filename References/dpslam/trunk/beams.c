@@ -0,0 +1,224 @@
+//
+// beams.c
+//
+// The laser's readings, and the policies that choose which of them to score. See beams.h.
+//
+
+#include <string.h>
+
+#include "laser.h"
+#include "beams.h"
+
+// 180 readings one degree apart, unless the log says otherwise
+int SENSE_NUMBER = 180;
+int SCORE_BEAMS = 0;
+int SCORE_POLICY = SCORE_UNIFORM;
+
+static const char *policyName[] = {"uniform", "information", "range"};
+
+// A reading the information policy could choose: the direction of the surface it hit (SCORE_BINS
+// if it has none), and how squarely it hit it, from 0 (glancing) to 1.
+struct TCandidate_struct {
+  int beam, bin;
+  double squareness;
+};
+typedef struct TCandidate_struct TCandidate;
+
+
+//
+// ScorePolicy
+//
+int ScorePolicy(const char *name)
+{
+  int i;
+
+  for (i = 0; i < (int) (sizeof(policyName)/sizeof(policyName[0])); i++)
+    if (!strcmp(name, policyName[i]))
+      return i;
+  return -1;
+}
+
+
+//
+// ScorePolicyName
+//
+const char *ScorePolicyName(int policy)
+{
+  if ((policy < 0) || (policy >= (int) (sizeof(policyName)/sizeof(policyName[0]))))
+    return "unknown";
+  return policyName[policy];
+}
+
+
+//
+// Fill
+//
+// Chooses more readings, evenly spaced in angle, until wanted of them are chosen. Returns how many are.
+//
+static int Fill(char chosen[], int have, int wanted)
+{
+  int i, k;
+
+  for (k = 0; (k < wanted) && (have < wanted); k++) {
+    i = (2*k + 1)*SENSE_NUMBER/(2*wanted);
+    if (!chosen[i]) {
+      chosen[i] = 1;
+      have++;
+    }
+  }
+  for (i = 0; (i < SENSE_NUMBER) && (have < wanted); i++)
+    if (!chosen[i]) {
+      chosen[i] = 1;
+      have++;
+    }
+  return have;
+}
+
+
+//
+// CompareCandidates
+//
+// By direction, then the squarest first.
+//
+static int CompareCandidates(const void *a, const void *b)
+{
+  const TCandidate *first = (const TCandidate *) a;
+  const TCandidate *second = (const TCandidate *) b;
+
+  if (first->bin != second->bin)
+    return first->bin - second->bin;
+  if (first->squareness != second->squareness)
+    return (first->squareness > second->squareness) ? -1 : 1;
+  return first->beam - second->beam;
+}
+
+
+//
+// Information
+//
+// Normal space sampling. The direction of the surface at each endpoint comes from the endpoints on
+// either side of it. Readings are taken a direction at a time, round and round, the squarest of each
+// direction first, so every direction the scan sees a surface in is scored. Returns how many are chosen.
+//
+static int Information(TSense sense, char chosen[], int wanted)
+{
+  TCandidate candidate[SENSE_MAX];
+  int next[SCORE_BINS+1], end[SCORE_BINS+1];
+  double x[3], y[3], dx, dy, length, normal;
+  int i, j, bin, count = 0, have = 0, taken;
+
+  for (i = 0; i < SENSE_NUMBER; i++) {
+    if (sense[i].distance >= MAX_SENSE_RANGE)
+      continue;
+    candidate[count].beam = i;
+    candidate[count].bin = SCORE_BINS;
+    candidate[count].squareness = 0.0;
+    if ((i > 0) && (i < SENSE_NUMBER-1) && (sense[i-1].distance < MAX_SENSE_RANGE) && (sense[i+1].distance < MAX_SENSE_RANGE)) {
+      for (j = 0; j < 3; j++) {
+	x[j] = cos(sense[i-1+j].theta) * sense[i-1+j].distance;
+	y[j] = sin(sense[i-1+j].theta) * sense[i-1+j].distance;
+      }
+      dx = x[2] - x[0];
+      dy = y[2] - y[0];
+      length = sqrt(SQUARE(dx) + SQUARE(dy));
+      if ((length > 0.0) && (sqrt(SQUARE(x[1] - x[0]) + SQUARE(y[1] - y[0])) < SCORE_GAP) &&
+	  (sqrt(SQUARE(x[2] - x[1]) + SQUARE(y[2] - y[1])) < SCORE_GAP)) {
+	// The surface's normal, which way round does not matter
+	normal = fmod(atan2(dy, dx) + M_PI/2, M_PI);
+	if (normal < 0)
+	  normal = normal + M_PI;
+	bin = (int) (normal * SCORE_BINS / M_PI);
+	candidate[count].bin = MIN(bin, SCORE_BINS-1);
+	candidate[count].squareness = fabs(cos(sense[i].theta)*dy - sin(sense[i].theta)*dx) / length;
+      }
+    }
+    count++;
+  }
+  qsort(candidate, count, sizeof(TCandidate), CompareCandidates);
+
+  // Count the candidates in each direction, then turn the counts into where each direction's start and end
+  for (bin = 0; bin <= SCORE_BINS; bin++)
+    end[bin] = 0;
+  for (i = 0; i < count; i++)
+    end[candidate[i].bin]++;
+  for (bin = 0, i = 0; bin <= SCORE_BINS; bin++) {
+    next[bin] = i;
+    i = i + end[bin];
+    end[bin] = i;
+  }
+
+  do {
+    taken = 0;
+    for (bin = 0; (bin <= SCORE_BINS) && (have < wanted); bin++)
+      if (next[bin] < end[bin]) {
+	chosen[candidate[next[bin]].beam] = 1;
+	next[bin]++;
+	have++;
+	taken = 1;
+      }
+  } while ((taken) && (have < wanted));
+  return have;
+}
+
+
+//
+// Range
+//
+// Each reading that hits something covers a width of surface in proportion to its distance. The
+// chosen readings are the ones at wanted even steps along the total. Returns how many are chosen.
+//
+static int Range(TSense sense, char chosen[], int wanted)
+{
+  double total = 0.0, along = 0.0;
+  int i, k = 0, have = 0;
+
+  for (i = 0; i < SENSE_NUMBER; i++)
+    if (sense[i].distance < MAX_SENSE_RANGE)
+      total = total + sense[i].distance;
+
+  for (i = 0; (i < SENSE_NUMBER) && (k < wanted) && (total > 0.0); i++) {
+    if (sense[i].distance >= MAX_SENSE_RANGE)
+      continue;
+    along = along + sense[i].distance;
+    while ((k < wanted) && ((k + 0.5)*total/wanted <= along)) {
+      if (!chosen[i]) {
+	chosen[i] = 1;
+	have++;
+      }
+      k++;
+    }
+  }
+  return have;
+}
+
+
+//
+// ScoreSubset
+//
+// Whatever the policy, a scan that does not give it enough readings to choose from is made up with
+// readings evenly spaced in angle.
+//
+int ScoreSubset(TSense sense, int beam[])
+{
+  char chosen[SENSE_MAX];
+  int i, have = 0;
+
+  if ((SCORE_BEAMS <= 0) || (SCORE_BEAMS >= SENSE_NUMBER)) {
+    for (i = 0; i < SENSE_NUMBER; i++)
+      beam[i] = i;
+    return SENSE_NUMBER;
+  }
+
+  memset(chosen, 0, SENSE_NUMBER);
+  if (SCORE_POLICY == SCORE_INFORMATION)
+    have = Information(sense, chosen, SCORE_BEAMS);
+  else if (SCORE_POLICY == SCORE_RANGE)
+    have = Range(sense, chosen, SCORE_BEAMS);
+  Fill(chosen, have, SCORE_BEAMS);
+
+  have = 0;
+  for (i = 0; i < SENSE_NUMBER; i++)
+    if (chosen[i])
+      beam[have++] = i;
+  return have;
+}
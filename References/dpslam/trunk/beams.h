@@ -0,0 +1,48 @@
+//
+// beams.h
+//
+// The laser's readings, and which of them are used to score samples. How many readings a scan has
+// (SENSE_NUMBER) and where they look are set when SLAM starts, from the header of the log being
+// played back (see InitLowSlam), so a log from a laser with 741 readings a third of a degree apart
+// plays back as it is, without recompiling.
+//
+// Every reading scored costs a line trace for every sample, so with a dense laser most of the time
+// goes to scoring. Scores can be taken over a subset of SCORE_BEAMS readings instead, chosen from
+// each scan by SCORE_POLICY; the map is always updated with all of them. The score of the subset is
+// scaled up to stand in for the score of the whole scan, so that the thresholds samples are culled
+// by (THRESH in low.c) keep their meaning; otherwise a sample scored on fewer readings looks no
+// worse than the best, far more of them survive each pass, and it ends up slower. The policies are:
+//
+//   uniform       readings evenly spaced in angle
+//   information   readings spread over the directions the surfaces they hit are facing, taking
+//                 the ones that hit a surface most squarely first (normal space sampling), so
+//                 that a long wall does not crowd out the few readings that fix the robot along it
+//   range         readings spread evenly over the length of surface the scan traces out, rather
+//                 than over angle, which puts fewer on clutter near the robot and more on distant
+//                 walls; readings at maximum range are only used to make up the numbers
+//
+// With SCORE_BEAMS 0 (or as many as there are readings) every reading is scored, in order, which
+// is what DP-SLAM has always done.
+//
+// Include after ThisRobot.h.
+//
+
+#define SCORE_UNIFORM 0
+#define SCORE_INFORMATION 1
+#define SCORE_RANGE 2
+
+// The number of directions surfaces are sorted into by the information policy
+#define SCORE_BINS 12
+// Neighbouring endpoints further apart than this (in grid squares) are not taken to be on the same
+// surface, so give no direction for it
+#define SCORE_GAP (0.25 * MAP_SCALE)
+
+// The number of readings scored in each scan (0 for all of them), and how they are chosen
+extern int SCORE_BEAMS, SCORE_POLICY;
+
+// Returns the policy with the given name, or -1 if there is none.
+int ScorePolicy(const char *name);
+const char *ScorePolicyName(int policy);
+// Chooses the readings of a scan to score, by SCORE_POLICY. Fills beam with their indices, in
+// increasing order, and returns how many there are.
+int ScoreSubset(TSense sense, int beam[]);
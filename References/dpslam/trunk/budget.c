@@ -0,0 +1,193 @@
+//
+// budget.c
+//
+// Keeps DP-SLAM inside a memory budget. See budget.h.
+//
+// Allocations are measured with malloc_usable_size, so what is counted is what malloc actually
+// handed out, without adding a header of our own to each of the (many, small) map entries.
+//
+
+#include <malloc.h>
+#include <string.h>
+
+#include "map.h"
+
+#ifndef MEMORY_BUDGET_MB
+#define MEMORY_BUDGET_MB 0
+#endif
+
+long MemoryBudget = 0;
+long MemoryUsed = 0;
+long MemoryPeak = 0;
+
+
+//
+// BudgetExhausted
+//
+// An allocation did not fit. Rather than carrying on with part of a map, or letting the machine
+// start swapping, say what happened and stop.
+//
+static void BudgetExhausted(size_t size)
+{
+  fprintf(stderr, "Memory budget exhausted: %lu more bytes requested with %.1f MB of %.1f MB in use.\n",
+	  (unsigned long) size, MemoryUsed/1048576.0, MemoryBudget/1048576.0);
+  fprintf(stderr, "Use a larger budget (-m), or fewer particles.\n");
+  BudgetReport(stderr);
+  exit(-1);
+}
+
+
+//
+// BudgetCharge
+//
+// Checks a new allocation of the given size against the budget.
+//
+static inline void BudgetCharge(size_t size)
+{
+  if ((MemoryBudget > 0) && (MemoryUsed + (long) size > MemoryBudget))
+    BudgetExhausted(size);
+}
+
+
+//
+// BudgetTrack
+//
+// Adds a successful allocation to the running totals.
+//
+static inline void *BudgetTrack(void *ptr, size_t size)
+{
+  if (ptr == NULL) {
+    fprintf(stderr, "Out of memory allocating %lu bytes.\n", (unsigned long) size);
+    BudgetReport(stderr);
+    exit(-1);
+  }
+  MemoryUsed = MemoryUsed + malloc_usable_size(ptr);
+  if (MemoryUsed > MemoryPeak)
+    MemoryPeak = MemoryUsed;
+  return ptr;
+}
+
+
+//
+// BudgetConfigure
+//
+// Sizes the global maps from the budget. The grids take a fixed share of it; the low level map
+// keeps the same proportion to the high level map that the full size maps have (flagMap is shared
+// by both, and so has to be as large as the larger of them). Neither map grows past its full size.
+//
+int BudgetConfigure(long megabytes)
+{
+  double ratio, cell, side, entry;
+
+  if (megabytes < 0)
+    megabytes = MEMORY_BUDGET_MB;
+  MemoryBudget = megabytes * 1048576;
+  if (MemoryBudget == 0)
+    return 0;
+
+  // Bytes per high level grid square: highMap, flagMap and the printing image at the high level,
+  // plus the share of the low level's lowMap and image that goes with it.
+  ratio = (double) DEFAULT_MAP_WIDTH / DEFAULT_H_MAP_WIDTH;
+  cell = sizeof(PMapStarter) + sizeof(int) + sizeof(unsigned char) +
+    ratio*ratio*(sizeof(PMapStarter) + sizeof(unsigned char));
+  side = sqrt(MemoryBudget * BUDGET_GRID_SHARE / cell);
+
+  HMapWidth = MIN((int) side, DEFAULT_H_MAP_WIDTH);
+  HMapHeight = MIN((int) side, DEFAULT_H_MAP_HEIGHT);
+  MapWidth = MIN((int) (side*ratio), DEFAULT_MAP_WIDTH);
+  MapHeight = MIN((int) (side*ratio), DEFAULT_MAP_HEIGHT);
+
+  // Each entry of the observation cache is a row of observationArray plus its obsX/obsY. The cache
+  // is filled each iteration with the squares in the laser's reach, however small the map, so it
+  // always has its full size and a budget that cannot hold it is refused.
+  entry = sizeof(short int) * (TOP_ID_NUMBER + 2);
+
+  if (MapWidth < BUDGET_MIN_MAP) {
+    fprintf(stderr, "A memory budget of %ld MB leaves room for only a %d square map.\n", megabytes, MapWidth);
+    return -1;
+  }
+  if (AREA * entry > MemoryBudget * BUDGET_CACHE_SHARE) {
+    fprintf(stderr, "A memory budget of %ld MB is too small for the observation cache; it needs at least %ld MB.\n",
+	    megabytes, (long) ceil(AREA * entry / BUDGET_CACHE_SHARE / 1048576));
+    return -1;
+  }
+
+  fprintf(stderr, "Memory budget %ld MB: low map %dx%d, high map %dx%d (%.1f x %.1f m), observation cache %d\n",
+	  megabytes, MapWidth, MapHeight, HMapWidth, HMapHeight, HMapWidth/(double) MAP_SCALE,
+	  HMapHeight/(double) MAP_SCALE, AREA);
+  return 0;
+}
+
+
+void *BudgetMalloc(size_t size)
+{
+  BudgetCharge(size);
+  return BudgetTrack(malloc(size), size);
+}
+
+
+void *BudgetCalloc(size_t count, size_t size)
+{
+  BudgetCharge(count*size);
+  return BudgetTrack(calloc(count, size), count*size);
+}
+
+
+void BudgetFree(void *ptr)
+{
+  if (ptr == NULL)
+    return;
+  MemoryUsed = MemoryUsed - malloc_usable_size(ptr);
+  free(ptr);
+}
+
+
+//
+// BudgetGrid
+//
+// calloc gets a block this large straight from the kernel as untouched zero pages, so a grid
+// costs physical memory only where the map has actually been written. The whole grid is still
+// charged to the budget, since the robot may yet travel to any part of it.
+//
+void **BudgetGrid(int width, int height, size_t size)
+{
+  void **grid;
+  char *cells;
+  int x;
+
+  grid = (void **) BudgetCalloc(1, width*sizeof(void *) + (size_t) width*height*size);
+  cells = (char *) (grid + width);
+  for (x = 0; x < width; x++)
+    grid[x] = cells + (size_t) x*height*size;
+  return grid;
+}
+
+
+//
+// BudgetReport
+//
+// The peak that was charged to the budget, and the peak resident size of the whole process as
+// the kernel saw it (which includes the code, the stack and the statically sized arrays).
+//
+void BudgetReport(FILE *out)
+{
+  FILE *status;
+  char line[128];
+  long resident = -1;
+
+  status = fopen("/proc/self/status", "r");
+  if (status != NULL) {
+    while (fgets(line, sizeof(line), status) != NULL)
+      if (strncmp(line, "VmHWM:", 6) == 0)
+	resident = atol(line+6);
+    fclose(status);
+  }
+
+  if (MemoryBudget > 0)
+    fprintf(out, "Memory: peak %.1f MB of the %.1f MB budget", MemoryPeak/1048576.0, MemoryBudget/1048576.0);
+  else
+    fprintf(out, "Memory: peak %.1f MB", MemoryPeak/1048576.0);
+  if (resident >= 0)
+    fprintf(out, ", peak resident %.1f MB", resident/1024.0);
+  fprintf(out, "\n");
+}
@@ -0,0 +1,46 @@
+//
+// budget.h
+//
+// Memory budget for running DP-SLAM on a small machine, such as the Pre-Fire Mapping handheld.
+// Every allocation the maps and the ancestry tree make goes through BudgetMalloc and BudgetFree,
+// which keep track of how much is in use and the peak. When a budget is set, BudgetConfigure also
+// sizes the global maps to fit in it, and an allocation that would go over the budget stops the
+// program with a report instead of letting it grow without bound.
+//
+// The budget comes from MEMORY_BUDGET_MB (set by "make PROFILE=embedded") or the -m option.
+// With no budget, the maps keep their full size and nothing is limited, but the peak is still
+// reported.
+//
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Share of the budget given to the map grids (lowMap, highMap, flagMap and the images used for
+// printing maps), and most that can go to the observation cache. The rest is left for the map
+// entries and the ancestry tree, which grow as the map is built. The cache does not shrink with
+// the budget: it holds the squares in the laser's reach, not the map, and has no way to do with
+// fewer. Its share is enough for the full cache at the embedded profile's budget.
+#define BUDGET_GRID_SHARE 0.35
+#define BUDGET_CACHE_SHARE 0.25
+
+// Below this many grid squares on a side, a map is too small to be worth running.
+#define BUDGET_MIN_MAP 200
+
+// The budget in bytes. 0 means unlimited.
+extern long MemoryBudget;
+// Bytes currently allocated through the budget, and the most that ever was.
+extern long MemoryUsed, MemoryPeak;
+
+// Sets the budget (in MB, 0 for none, -1 for MEMORY_BUDGET_MB) and sizes the maps to fit.
+// Returns -1 if the budget is too small to hold even the smallest maps, or the observation cache
+// in its share.
+int BudgetConfigure(long megabytes);
+void *BudgetMalloc(size_t size);
+void *BudgetCalloc(size_t count, size_t size);
+void BudgetFree(void *ptr);
+// A width x height grid of elements of the given size, zero filled, as an array of row pointers
+// into one block, so grid[x][y] works as it did for the static arrays. Only the parts of the
+// block that are written ever take physical memory.
+void **BudgetGrid(int width, int height, size_t size);
+// Prints the peak use, against the budget, and the peak resident size of the process.
+void BudgetReport(FILE *out);
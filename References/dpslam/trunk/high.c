@@ -21,6 +21,8 @@
 
 #include "high.h"
 #include "mt-rand.h"
+#include "beams.h"
+#include "resample.h"
 
 // Threshold for culling particles.  x means that particles with prob. e^x worse
 // then the best in the current round are culled
@@ -53,39 +55,46 @@ TParticle h_savedParticle[H_PARTICLE_NUMBER];
 int h_cur_saved_particles_used;
 
 int h_curGeneration;
-unsigned char h_map[H_MAP_WIDTH][H_MAP_HEIGHT];
+// Only exists while a map is being printed
+unsigned char **h_map;
 
 
 
-double LogScorePosition(double x, double y, double theta, int parent, TSense sense)
+// Scores only the readings listed in beam, scaled up to stand in for the whole scan (see beams.h)
+double LogScorePosition(double x, double y, double theta, int parent, TSense sense, int beam[], int beams)
 {
-  int i;
+  int i, k;
   double a, total;
 
   total = 0.0;
-  for (i=0; i < SENSE_NUMBER; i++) {
+  for (k=0; k < beams; k++) {
+    i = beam[k];
     a = HighLineTrace(x, y, (sense[i].theta + theta), sense[i].distance, parent);
     total = total + log(MAX(MAX_TRACE_ERROR, a));
   }
-  return total;
+  return total * ((double) SENSE_NUMBER / beams);
 }
 
 
 
 void HighLocalize(TPath *path, TSenseLog *obs)
 {
-  int i, j, k;
+  int i, j, k, step;
   int best, keepers, worst;
   int newchildren[H_SAMPLE_NUMBER];
+  int beam[SENSE_MAX], beams;
   double moveAngle, threshold;
-  double ftemp, total;
+  double total;
+  double weight[H_SAMPLE_NUMBER];
   TSample sample[H_SAMPLE_NUMBER];
   TPath *holdPath;
   TSenseLog *holdObs;
+  TScan *scan;
 
   holdPath = path;
   holdObs = obs;
-  obs = obs->next;
+  // The first scan is where the path starts; each step of the path ends at the next one.
+  step = 1;
  
  // Make particles
   j = 0;
@@ -113,6 +122,8 @@ void HighLocalize(TPath *path, TSenseLog *obs)
     keepers = 0;
     best = 0;
     worst = 0;
+    scan = obs->scan[step];
+    beams = ScoreSubset(scan->sense, beam);
     for (i=0; i < H_SAMPLE_NUMBER; i++) {
       if (sample[i].probability > threshold) {
 	keepers++;
@@ -127,7 +138,7 @@ void HighLocalize(TPath *path, TSenseLog *obs)
 	// Score this step of the obs
 	sample[i].probability = sample[i].probability + 
 	                        LogScorePosition(sample[i].x, sample[i].y, sample[i].theta, 
-						 h_particle[ sample[i].parent ].ancestryNode->ID, obs->sense);
+						 h_particle[ sample[i].parent ].ancestryNode->ID, scan->sense, beam, beams);
 	if (sample[i].probability > sample[best].probability)
 	  best = i;
       }
@@ -142,7 +153,7 @@ void HighLocalize(TPath *path, TSenseLog *obs)
 
     // Advance the path & observation
     path = path->next;
-    obs = obs->next;
+    step++;
   }
 
   fprintf(stderr, "High level- Best of %d ", keepers);
@@ -162,23 +173,17 @@ void HighLocalize(TPath *path, TSenseLog *obs)
   for (i=0; i < H_SAMPLE_NUMBER; i++)
     sample[i].probability = sample[i].probability/total;
 
-  // Count how many children each particle will get in next generation
-  for (i = 0; i < H_SAMPLE_NUMBER; i++) 
+  // Count how many children each particle will get in next generation (see resample.h)
+  for (i = 0; i < H_SAMPLE_NUMBER; i++) {
     newchildren[i] = 0;
+    weight[i] = sample[i].probability;
+  }
 
-  i = j = 0;  // i = no. of survivors, j = no. of new samples
-  while ((j < H_SAMPLE_NUMBER) && (i < H_PARTICLE_NUMBER)) {
-    k = 0;
-    ftemp = MTrandDec();
-    while (ftemp > sample[k].probability) {
-      ftemp = ftemp - sample[k].probability;
-      k++;
-    }
-    if (newchildren[k] == 0)
+  j = Resample(weight, H_SAMPLE_NUMBER, H_SAMPLE_NUMBER, H_PARTICLE_NUMBER, newchildren);  // j = no. of new samples
+  i = 0;  // i = no. of survivors
+  for (k = 0; k < H_SAMPLE_NUMBER; k++)
+    if (newchildren[k] > 0)
       i++;
-    newchildren[k]++;
-    j++;
-  }
 
   fprintf(stderr, "(%d kept ", i);
 
@@ -217,21 +222,9 @@ void HighLocalize(TPath *path, TSenseLog *obs)
     for (i=0; i < h_cur_saved_particles_used; i++)
       h_savedParticle[i].probability = h_savedParticle[i].probability/total;
 
-    total = 0.0;
     for (i = 0; i < h_cur_saved_particles_used; i++) 
-      total = total + h_savedParticle[i].probability;
-
-    while (j < H_SAMPLE_NUMBER) {
-      k = 0;
-      ftemp = MTrandDec()*total;
-      while (ftemp > (h_savedParticle[k].probability)) {
-	ftemp = ftemp - h_savedParticle[k].probability;
-	k++;
-      }
-      h_children[k]++;
-
-      j++;
-    }
+      weight[i] = h_savedParticle[i].probability;
+    Resample(weight, h_cur_saved_particles_used, H_SAMPLE_NUMBER - j, h_cur_saved_particles_used, h_children);
   }
 }
 
@@ -239,16 +232,17 @@ void HighLocalize(TPath *path, TSenseLog *obs)
 
 void HighAddToWorldModel(TPath *sourcePath, TSenseLog *sourceObs, int maxID)
 {
-  int i, ID;
+  int i, ID, step;
   double moveAngle;
   TPath *path;
-  TSenseLog *obs;
+  TScan *obs;
 
   path = sourcePath;
-  obs = sourceObs->next;
+  step = 1;
 
   while (path != NULL) {
     HighInitializeFlags();
+    obs = sourceObs->scan[step];
     for (ID=0; ID < maxID; ID++) {
       // Move the particle one step
       moveAngle = h_particle[ID].theta + (path->T/2.0);
@@ -266,11 +260,12 @@ void HighAddToWorldModel(TPath *sourcePath, TSenseLog *sourceObs, int maxID)
     }
 
     path = path->next;
-    obs = obs->next;
+    step++;
   }
 
   HighInitializeFlags();
-  if (obs != NULL) 
+  if (step < sourceObs->count) {
+    obs = sourceObs->scan[step];
     for (ID=0; ID < maxID; ID++) {
       for (i=0; i < SENSE_NUMBER; i++) {
 	// normalize readings relative to the pose of current assumed position
@@ -278,6 +273,7 @@ void HighAddToWorldModel(TPath *sourcePath, TSenseLog *sourceObs, int maxID)
 		     h_particle[ID].ancestryNode, (obs->sense[i].distance < MAX_SENSE_RANGE));
       }
     }
+  }
 }
 
 
@@ -311,7 +307,7 @@ void HighUpdateAncestry(TPath *path, TSenseLog *obs)
       for (j=0; j < temp->total; j++)
 	HighDeleteObservation(temp->mapEntries[j].x, temp->mapEntries[j].y, temp->mapEntries[j].node);
 
-      free(temp->mapEntries);
+      BudgetFree(temp->mapEntries);
       temp->mapEntries = NULL;
 
       // Recover the ID. 
@@ -349,7 +345,7 @@ void HighUpdateAncestry(TPath *path, TSenseLog *obs)
       // Check to make sure that the parent's array is large enough to accomadate all of the entries of the child as well.
       if (temp->size < (temp->total + h_particleID[i].total)) {
 	temp->size = (int)(ceil((temp->size + h_particleID[i].size)*1.75));
-	workArray = (TEntryList *)malloc(sizeof(TEntryList)*temp->size);
+	workArray = (TEntryList *)BudgetMalloc(sizeof(TEntryList)*temp->size);
 	if (workArray == NULL) fprintf(stderr, "Malloc failed for workArray\n");
 
 
@@ -359,7 +355,7 @@ void HighUpdateAncestry(TPath *path, TSenseLog *obs)
 	  workArray[j].node = temp->mapEntries[j].node;
 	}
 	// Note that temp->total hasn't changed- that will grow as the child's entries are added in
-	free(temp->mapEntries);
+	BudgetFree(temp->mapEntries);
 	temp->mapEntries = workArray;
       }
 
@@ -398,7 +394,7 @@ void HighUpdateAncestry(TPath *path, TSenseLog *obs)
       }
 
       // We're done with it- remove the array of updates from the child.
-      free(entry);
+      BudgetFree(entry);
       h_particleID[i].mapEntries = NULL;
 
       // Inherit the number of children
@@ -521,9 +517,7 @@ void HighPrintMap(char *name, TAncestor *parent)
   width = H_MAP_WIDTH;
   height = H_MAP_HEIGHT;
 
-  for(x=0; x < width; x++)
-    for(y=0; y < height; y++)
-      h_map[x][y] = 0;
+  h_map = (unsigned char **) BudgetGrid(width, height, sizeof(unsigned char));
 
   lastx = 0;
   lasty = 0;
@@ -570,6 +564,8 @@ void HighPrintMap(char *name, TAncestor *parent)
     }
       
   fclose(printFile);
+  BudgetFree(h_map);
+  h_map = NULL;
   sprintf(sysCall, "convert %s.ppm %s.png", name, name);
   system(sysCall);
   sprintf(sysCall, "chmod 666 %s.ppm", name);
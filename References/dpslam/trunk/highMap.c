@@ -35,7 +35,7 @@
 #define H_PRIOR (-1.0/(MAP_SCALE*8.0))
 
 
-PMapStarter highMap[H_MAP_WIDTH][H_MAP_HEIGHT];
+PMapStarter **highMap;
 // The nodes of the ancestry tree are stored here. Since each particle has a unique ID, we can quickly access the particles via their ID
 // in this array. See the structure TAncestor for more details.
 TAncestor h_particleID[H_ID_NUMBER];
@@ -66,10 +66,16 @@ void HighInitializeWorldMap()
 {
   int x, y;
 
+  if (highMap == NULL)
+    highMap = (PMapStarter **) BudgetGrid(H_MAP_WIDTH, H_MAP_HEIGHT, sizeof(PMapStarter));
+  AllocateObservationCache();
+
   for (y=0; y < H_MAP_HEIGHT; y++)
     for (x=0; x < H_MAP_WIDTH; x++) {
-      highMap[x][y] = NULL;
-      flagMap[x][y] = 0;
+      if (highMap[x][y] != NULL)
+	highMap[x][y] = NULL;
+      if (flagMap[x][y] != 0)
+	flagMap[x][y] = 0;
     }
 
   for (x=0; x < AREA; x++) {
@@ -89,8 +95,8 @@ void HighDestroyMap()
   for (y=0; y < H_MAP_HEIGHT; y++)
     for (x=0; x < H_MAP_WIDTH; x++) 
       while (highMap[x][y] != NULL) {
-	free(highMap[x][y]->array);
-	free(highMap[x][y]);
+	BudgetFree(highMap[x][y]->array);
+	BudgetFree(highMap[x][y]);
 	highMap[x][y] = NULL;
       }
 }
@@ -109,7 +115,7 @@ void HighResizeArray(TMapStarter *node, int deadID)
 
   // Don't count the dead entries in computing the new size
   node->size = (int)(ceil((node->total - node->dead)*1.75));
-  temp = (TMapNode *) malloc(sizeof(TMapNode)*node->size);
+  temp = (TMapNode *) BudgetMalloc(sizeof(TMapNode)*node->size);
   if (temp == NULL) fprintf(stderr, "Malloc failed in expansion of arrays\n");
 
   for (i=0; i < H_ID_NUMBER; i++)
@@ -213,7 +219,7 @@ void HighResizeArray(TMapStarter *node, int deadID)
   node->total = j;
   // After completing this process, we have removed all dead entries.
   node->dead = 0;
-  free(node->array);
+  BudgetFree(node->array);
   node->array = temp;
 }
 
@@ -396,12 +402,12 @@ void HighUpdateGridSquare(int x, int y, double distance, int hit, int parentID)
     obsY[observationID] = y;
     observationID++;
 
-    highMap[x][y] = (TMapStarter *) malloc(sizeof(TMapStarter));
+    highMap[x][y] = (TMapStarter *) BudgetMalloc(sizeof(TMapStarter));
     if (highMap[x][y] == NULL) fprintf(stderr, "Malloc failed in creation of Map Starter at %d %d\n", x, y);
     highMap[x][y]->dead = 0;
     highMap[x][y]->total = 0;
     highMap[x][y]->size = 1;
-    highMap[x][y]->array = (TMapNode *) malloc(sizeof(TMapNode));
+    highMap[x][y]->array = (TMapNode *) BudgetMalloc(sizeof(TMapNode));
     if (highMap[x][y]->array == NULL) fprintf(stderr, "Malloc failed in making initial map array for %d %d\n", x, y);
 
     // Initialize the slot
@@ -436,12 +442,12 @@ void HighUpdateGridSquare(int x, int y, double distance, int hit, int parentID)
     // First check to see if the size of that array is big enough to hold another entry
     if (h_particleID[parentID].size == 0) {
       h_particleID[parentID].size = 1;
-      h_particleID[parentID].mapEntries = (TEntryList *) malloc(sizeof(TEntryList));
+      h_particleID[parentID].mapEntries = (TEntryList *) BudgetMalloc(sizeof(TEntryList));
       if (h_particleID[parentID].mapEntries == NULL) fprintf(stderr, "Malloc failed in creation of entry list array\n");
     }
     else if (h_particleID[parentID].size <= h_particleID[parentID].total) {
       h_particleID[parentID].size = (int)(ceil(h_particleID[parentID].total*1.75));
-      tempEntry = (TEntryList *) malloc(sizeof(TEntryList)*h_particleID[parentID].size);
+      tempEntry = (TEntryList *) BudgetMalloc(sizeof(TEntryList)*h_particleID[parentID].size);
       if (tempEntry == NULL) fprintf(stderr, "Malloc failed in expansion of entry list array\n");
 
       for (i=0; i < h_particleID[parentID].total; i++) {
@@ -450,7 +456,7 @@ void HighUpdateGridSquare(int x, int y, double distance, int hit, int parentID)
 	tempEntry[i].node = h_particleID[parentID].mapEntries[i].node;
       }
 
-      free(h_particleID[parentID].mapEntries);
+      BudgetFree(h_particleID[parentID].mapEntries);
       h_particleID[parentID].mapEntries = tempEntry;
     }
 
@@ -491,8 +497,8 @@ void HighDeleteObservation(short int x, short int y, short int node) {
     return;
 
   if (highMap[x][y]->total - highMap[x][y]->dead == 1) {
-    free(highMap[x][y]->array);
-    free(highMap[x][y]);
+    BudgetFree(highMap[x][y]->array);
+    BudgetFree(highMap[x][y]);
     highMap[x][y] = NULL;
     return;
   }
@@ -502,8 +508,8 @@ void HighDeleteObservation(short int x, short int y, short int node) {
     // Let resizing the array remove this entry
     HighResizeArray(highMap[x][y], highMap[x][y]->array[node].ID);
     if (highMap[x][y]->total == 0) {
-      free(highMap[x][y]->array);
-      free(highMap[x][y]);
+      BudgetFree(highMap[x][y]->array);
+      BudgetFree(highMap[x][y]);
       highMap[x][y] = NULL;
     }
     return;
@@ -603,6 +609,10 @@ void HighAddTrace(double startx, double starty, double MeasuredDist, double thet
   endx = (int) (dx);
   endy = (int) (dy);
 
+  // Traces which would leave the map are not recorded.
+  if (!TRACE_INSIDE(startx, starty, dx, dy, H_MAP_WIDTH, H_MAP_HEIGHT))
+    return;
+
   // Decide which x and y directions the line is travelling.
   if (startx > dx) {
     incX = -1;
@@ -763,6 +773,10 @@ double HighLineTrace(double startx, double starty, double theta, double Measured
   endx = (int) (dx);
   endy = (int) (dy);
 
+  // A trace which would leave the map can't be scored, and counts as a failed trace.
+  if (!TRACE_INSIDE(startx, starty, dx, dy, H_MAP_WIDTH, H_MAP_HEIGHT))
+    return 0;
+
   // Decide which x and y directions the line is travelling.
   if (startx > dx) {
     incX = -1;
@@ -19,7 +19,7 @@
 
 #include "low.h"
 
-extern PMapStarter highMap[H_MAP_WIDTH][H_MAP_HEIGHT];
+extern PMapStarter **highMap;
 
 // The nodes of the ancestry tree are stored here. Since each particle has a unique ID, we can quickly access the particles via their ID
 // in this array. See the structure TAncestor for more details.
@@ -0,0 +1,118 @@
+//
+// logconv.cpp
+//
+// Converts playback logs between formats (see logfile.h).
+//
+//   logconv [-t topics] in out
+//
+// in can be anything slam -p plays back: a .log, .rec or .dpb file, a handheld journal (.pfj), a
+// ROS bag (the topics given with -t, as for slam) or the live stream from the handheld
+// ("tcp:host:port"). out is a .dpb file or a native .log; .rec files cannot be written. The readings of a .rec file are converted to meters and radians the
+// same way ReadLog converts them, so a converted log plays back like the original.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "laser.h"
+#include "stream.h"
+#include "bag.h"
+#include "logfile.h"
+
+
+//
+// Native
+//
+// Converts a record read from a .rec file to the meters and radians of the other formats, as
+// ReadLog does: positions and readings are in cm, angles in degrees, and the position is of the
+// robot's center rather than the laser.
+//
+static void Native(TLogRecord &record)
+{
+  int i, max;
+
+  if (record.type == LOG_ODOMETRY) {
+    record.x = record.x/100.0;
+    record.y = record.y/100.0;
+    record.theta = record.theta*M_PI/180.0;
+    if (record.theta > M_PI)
+      record.theta = record.theta - 2*M_PI;
+    else if (record.theta < -M_PI)
+      record.theta = record.theta + 2*M_PI;
+    record.x = record.x - (cos(record.theta)*TURN_RADIUS/MAP_SCALE);
+    record.y = record.y - (sin(record.theta)*TURN_RADIUS/MAP_SCALE);
+  }
+  else if (record.type == LOG_LASER) {
+    max = (record.count < LOG_MAX_READINGS) ? record.count : LOG_MAX_READINGS;
+    for (i = 0; i < max; i++) {
+      record.range[i] = record.range[i]/100.0;
+      if (record.range[i] > MAX_SENSE_RANGE/MAP_SCALE)
+	record.range[i] = MAX_SENSE_RANGE/MAP_SCALE;
+    }
+  }
+}
+
+
+int main(int argc, char *argv[])
+{
+  static TLogRecord record;
+  TLogFile *in;
+  TLogWriter *out;
+  const char *topics = "";
+  long odometry = 0, lasers = 0;
+
+  if ((argc == 5) && (!strcmp(argv[1], "-t"))) {
+    topics = argv[2];
+    argv += 2;
+    argc -= 2;
+  }
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s [-t topics] in.log|in.rec|in.dpb|in.pfj|in.bag|tcp:host:port out.dpb|out.log\n", argv[0]);
+    return 1;
+  }
+
+  // The same sources InitLowSlam plays back
+  if (IsStream(argv[1]))
+    in = LogAttach(StreamOpen(argv[1]), DPB);
+  else if (IsJournal(argv[1]))
+    in = LogAttach(JournalOpen(argv[1], 0, -1, 0, 0), DPB);
+  else if (IsBag(argv[1]))
+    in = LogAttach(BagOpen(argv[1], topics, 0, -1, 0, 0), DPB);
+  else
+    in = LogOpen(argv[1]);
+  if (in == NULL) {
+    fprintf(stderr, "Unable to open log %s\n", argv[1]);
+    return 1;
+  }
+
+  // Without a .dpb header to go by, the readings are taken to be one degree apart, as InitLowSlam does
+  if (in->beams > 0)
+    out = LogCreate(argv[2], in->beams, in->start, in->step, in->flags);
+  else
+    out = LogCreate(argv[2], 0, -M_PI/2, M_PI/180.0, in->flags);
+  if (out == NULL) {
+    fprintf(stderr, "Unable to create log %s\n", argv[2]);
+    LogClose(in);
+    return 1;
+  }
+
+  while (LogRead(in, record) != LOG_END) {
+    if (in->format == REC)
+      Native(record);
+    if (record.type == LOG_ODOMETRY)
+      odometry++;
+    else if (record.type == LOG_LASER)
+      lasers++;
+    if (LogWrite(out, record) == -1)
+      break;
+  }
+  LogClose(in);
+
+  if (LogFinish(out) == -1) {
+    fprintf(stderr, "Unable to write log %s\n", argv[2]);
+    return 1;
+  }
+  fprintf(stderr, "%ld odometry and %ld laser records written to %s\n", odometry, lasers, argv[2]);
+  return 0;
+}
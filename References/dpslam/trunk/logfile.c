@@ -0,0 +1,712 @@
+//
+// logfile.c
+//
+// Reads and writes the playback logs. See logfile.h.
+//
+// The fields of a line are found the way strtok(line, " ") found them, and each is converted by
+// LogNumber. Almost every number in a log has a handful of digits and a few decimals, and those
+// are converted with one exact integer to double conversion and one multiplication or division
+// by an exact power of ten. Both are correctly rounded, so the result is the correctly rounded
+// value of the text, which is what atof returns. Anything else (long mantissas, large exponents,
+// hex, inf or nan) goes to strtod itself.
+//
+// A .dpb record is read where it lies as well; the numbers are copied out of it with memcpy, since
+// nothing in the file is aligned.
+//
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logfile.h"
+
+// The powers of ten that are exact as doubles
+static const double Pow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+#define POW10_MAX 22
+
+
+//
+// SlowNumber
+//
+// Hands text that the fast path cannot convert exactly to strtod.
+//
+static double SlowNumber(const char *text, const char *end)
+{
+  char buffer[128];
+  char *copy = buffer;
+  size_t length = end - text;
+  double value;
+
+  if (length >= sizeof(buffer))
+    copy = (char *) malloc(length + 1);
+  memcpy(copy, text, length);
+  copy[length] = '\0';
+  value = strtod(copy, NULL);
+  if (copy != buffer)
+    free(copy);
+  return value;
+}
+
+
+//
+// LogNumber
+//
+// Converts text the way atof does, to the same double, reading no further than end.
+//
+double LogNumber(const char *text, const char *end)
+{
+  const char *p = text;
+  unsigned long long mantissa = 0;
+  int significant = 0, digits = 0, exponent = 0, power = 0, negative = 0, powerNegative = 0;
+  double value;
+
+  // Leading white space, then an optional sign
+  while ((p < end) && ((*p == ' ') || ((*p >= '\t') && (*p <= '\r'))))
+    p++;
+  if ((p < end) && ((*p == '+') || (*p == '-')))
+    negative = (*(p++) == '-');
+
+  // The digits, with the decimal point counted into the exponent. Leading zeros do not count
+  // towards the 19 that fit in the mantissa.
+  for (; (p < end) && (*p >= '0') && (*p <= '9'); p++, digits++) {
+    if ((mantissa > 0) || (*p != '0'))
+      significant++;
+    mantissa = mantissa*10 + (*p - '0');
+  }
+  if ((p < end) && (*p == '.'))
+    for (p++; (p < end) && (*p >= '0') && (*p <= '9'); p++, digits++) {
+      if ((mantissa > 0) || (*p != '0'))
+	significant++;
+      mantissa = mantissa*10 + (*p - '0');
+      exponent--;
+    }
+
+  // No digits at all is 0, unless it is inf or nan
+  if (digits == 0) {
+    if ((p < end) && ((*p == 'i') || (*p == 'I') || (*p == 'n') || (*p == 'N')))
+      return SlowNumber(text, end);
+    return 0.0;
+  }
+
+  // An exponent only counts if it has digits
+  if ((p < end) && ((*p == 'e') || (*p == 'E'))) {
+    const char *q = p + 1;
+    if ((q < end) && ((*q == '+') || (*q == '-')))
+      powerNegative = (*(q++) == '-');
+    if ((q < end) && (*q >= '0') && (*q <= '9')) {
+      for (; (q < end) && (*q >= '0') && (*q <= '9'); q++)
+	if (power < 10000)
+	  power = power*10 + (*q - '0');
+      exponent += powerNegative ? -power : power;
+      p = q;
+    }
+  }
+
+  // Hex, too many digits, or a power of ten that is not exact
+  if (((p < end) && ((*p == 'x') || (*p == 'X'))) || (significant > 19) || (mantissa > (1ULL << 53)) ||
+      (exponent < -POW10_MAX) || (exponent > POW10_MAX))
+    return SlowNumber(text, end);
+
+  value = (double) mantissa;
+  if (exponent < 0)
+    value = value / Pow10[-exponent];
+  else
+    value = value * Pow10[exponent];
+  return negative ? -value : value;
+}
+
+
+//
+// Field
+//
+// The next field of a line, as strtok(NULL, " ") would have found it, converted by LogNumber.
+// A field missing from the end of the line is 0.
+//
+static double Field(const char *&p, const char *end)
+{
+  const char *start;
+
+  while ((p < end) && (*p == ' '))
+    p++;
+  start = p;
+  while ((p < end) && (*p != ' '))
+    p++;
+  return LogNumber(start, p);
+}
+
+
+//
+// Skip
+//
+// Steps over fields we do not care about.
+//
+static void Skip(const char *&p, const char *end, int fields)
+{
+  for (; fields > 0; fields--) {
+    while ((p < end) && (*p == ' '))
+      p++;
+    while ((p < end) && (*p != ' '))
+      p++;
+  }
+}
+
+
+//
+// FormatOf
+//
+// The format of a log, from its name: ".rec" files are REC, ".dpb" files DPB, everything else LOG.
+//
+static int FormatOf(const char *name)
+{
+  size_t length = strlen(name);
+
+  if ((length >= 3) && (!strncmp(name + length - 3, "rec", 3)))
+    return REC;
+  if ((length >= 3) && (!strncmp(name + length - 3, "dpb", 3)))
+    return DPB;
+  return LOG;
+}
+
+
+//
+// Release
+//
+// Hands back the pages of a mapped log we have finished with.
+//
+static void Release(TLogFile *log)
+{
+  size_t upto;
+
+  if (log->pos - log->released >= LOG_RELEASE) {
+    upto = log->pos & ~((size_t) sysconf(_SC_PAGESIZE) - 1);
+    madvise((void *) (log->data + log->released), upto - log->released, MADV_DONTNEED);
+    log->released = upto;
+  }
+}
+
+
+//
+// NextLine
+//
+// Finds the next line of the log, including its newline. Returns 0 at the end of the log.
+//
+static int NextLine(TLogFile *log, const char *&line, const char *&end)
+{
+  const char *newline;
+  ssize_t length;
+
+  if (log->file != NULL) {
+    length = getline(&log->line, &log->lineSize, log->file);
+    if (length <= 0)
+      return 0;
+    line = log->line;
+    end = line + length;
+    return 1;
+  }
+
+  if (log->pos >= log->size)
+    return 0;
+  line = log->data + log->pos;
+  newline = (const char *) memchr(line, '\n', log->size - log->pos);
+  end = (newline != NULL) ? newline + 1 : log->data + log->size;
+  log->pos = end - log->data;
+  Release(log);
+  return 1;
+}
+
+
+//
+// Take
+//
+// The next length bytes of a binary log. Returns 0 if the log ends first.
+//
+static int Take(TLogFile *log, size_t length, const char *&data)
+{
+  char *line;
+
+  if (log->file != NULL) {
+    if (length > log->lineSize) {
+      line = (char *) realloc(log->line, length);
+      if (line == NULL)
+	return 0;
+      log->line = line;
+      log->lineSize = length;
+    }
+    if ((length > 0) && (fread(log->line, 1, length, log->file) != length))
+      return 0;
+    data = log->line;
+    return 1;
+  }
+
+  if (log->size - log->pos < length)
+    return 0;
+  data = log->data + log->pos;
+  log->pos += length;
+  Release(log);
+  return 1;
+}
+
+
+//
+// ReadReadings
+//
+// Reads the readings of a laser line into the record.
+//
+static void ReadReadings(const char *&p, const char *end, TLogRecord &record)
+{
+  int i, max;
+
+  max = record.count;
+  if (max > LOG_MAX_READINGS)
+    max = LOG_MAX_READINGS;
+  for (i = 0; i < max; i++)
+    record.range[i] = Field(p, end);
+}
+
+
+//
+// ReadHeader
+//
+// Reads the header of a binary log. Returns -1 if it is not one we can read.
+//
+static int ReadHeader(TLogFile *log)
+{
+  struct dpb_header header;
+  const char *data;
+
+  if (!Take(log, sizeof(header), data))
+    return -1;
+  memcpy(&header, data, sizeof(header));
+  if ((memcmp(header.magic, DPB_MAGIC, 4)) || (header.version > DPB_VERSION) ||
+      (header.headersize < sizeof(header)))
+    return -1;
+  // Anything a later version adds to the header
+  if (!Take(log, header.headersize - sizeof(header), data))
+    return -1;
+
+  log->beams = header.beams;
+  log->start = header.start;
+  log->step = header.step;
+  log->flags = header.flags;
+  return 0;
+}
+
+
+//
+// BinaryOdometry
+//
+static void BinaryOdometry(const char *data, TLogRecord &record)
+{
+  double pose[3];
+
+  memcpy(pose, data, sizeof(pose));
+  record.x = pose[0];
+  record.y = pose[1];
+  record.theta = pose[2];
+  record.type = LOG_ODOMETRY;
+}
+
+
+//
+// BinaryLaser
+//
+// Reads the readings of a binary laser record. Returns -1 if they don't fit in it.
+//
+static int BinaryLaser(const char *data, size_t length, TLogRecord &record)
+{
+  uint32_t count;
+  float range;
+  int i, max;
+
+  if (length < sizeof(count))
+    return -1;
+  memcpy(&count, data, sizeof(count));
+  if ((length - sizeof(count))/sizeof(float) < count)
+    return -1;
+  data += sizeof(count);
+
+  record.count = count;
+  max = (count < LOG_MAX_READINGS) ? count : LOG_MAX_READINGS;
+  for (i = 0; i < max; i++, data += sizeof(float)) {
+    memcpy(&range, data, sizeof(float));
+    record.range[i] = range;
+  }
+  record.type = LOG_LASER;
+  return 0;
+}
+
+
+//
+// ReadBinary
+//
+// Reads the next record of a .dpb log. A DPB_SCAN is returned as its odometry, and its laser is
+// held back for the next call.
+//
+static int ReadBinary(TLogFile *log, TLogRecord &record)
+{
+  struct dpb_record frame;
+  const char *data;
+
+  record.type = LOG_SKIP;
+  if (log->held != NULL) {
+    BinaryLaser(log->held, log->heldLength, record);
+    log->held = NULL;
+    return record.type;
+  }
+
+  if (!Take(log, sizeof(frame), data))
+    return record.type = LOG_END;
+  memcpy(&frame, data, sizeof(frame));
+  if (!Take(log, frame.length, data)) {
+    fprintf(stderr, "Binary log ends in the middle of a record\n");
+    return record.type = LOG_END;
+  }
+
+  switch (frame.tag) {
+  case DPB_ODOMETRY:
+    if (frame.length >= 3*sizeof(double))
+      BinaryOdometry(data, record);
+    break;
+  case DPB_LASER:
+    BinaryLaser(data, frame.length, record);
+    break;
+  case DPB_SCAN:
+    // Both halves are checked before either is used
+    if ((frame.length >= 3*sizeof(double)) &&
+	(BinaryLaser(data + 3*sizeof(double), frame.length - 3*sizeof(double), record) == 0)) {
+      BinaryOdometry(data, record);
+      log->held = data + 3*sizeof(double);
+      log->heldLength = frame.length - 3*sizeof(double);
+    }
+    break;
+  default:
+    // A record from a later version, which we don't know how to use
+    return record.type;
+  }
+  if (record.type == LOG_SKIP)
+    fprintf(stderr, "Damaged record (tag %d, %u bytes) in binary log\n", frame.tag, frame.length);
+  return record.type;
+}
+
+
+//
+// LogRead
+//
+// Reads the next record. Returns its type, LOG_END at the end of the log.
+//
+int LogRead(TLogFile *log, TLogRecord &record)
+{
+  const char *line, *end, *p;
+
+  if (log->format == DPB)
+    return ReadBinary(log, record);
+
+  if (!NextLine(log, line, end))
+    return record.type = LOG_END;
+
+  p = line;
+  record.type = LOG_SKIP;
+  if (log->format == REC) {
+    if ((end - line >= 3) && (!strncmp(line, "POS", 3))) {
+      // The keyword, and the seconds and microseconds of the reading, which we don't care about
+      Skip(p, end, 3);
+      record.x = Field(p, end);
+      record.y = Field(p, end);
+      record.theta = Field(p, end);
+      // There are still two parameters here, pitch and yaw, but we don't use them.
+      record.type = LOG_ODOMETRY;
+    }
+    // Apparently this is also sometimes recorded as 'LASER_RANGE'
+    // We accept anything that starts with LASER
+    else if ((end - line >= 5) && (!strncmp(line, "LASER", 5))) {
+      Skip(p, end, 3);
+      // We only use the first laser.
+      if ((int) Field(p, end) != 0)
+	return record.type;
+      record.count = (int) Field(p, end);
+      // The Wean Hall data has a consistent "180.0:" here which doesn't seem to mean anything.
+      Skip(p, end, 1);
+      ReadReadings(p, end, record);
+      record.type = LOG_LASER;
+    }
+    else
+      fprintf(stderr, "Uninterpretable Line (.rec) : \n %.*s\n", (int) (end - line), line);
+  }
+
+  // Anything not specified is assumed to our native .log files.
+  else {
+    if ((end - line >= 8) && (!strncmp(line, "Odometry", 8))) {
+      Skip(p, end, 1);
+      record.x = Field(p, end);
+      record.y = Field(p, end);
+      record.theta = Field(p, end);
+      record.type = LOG_ODOMETRY;
+    }
+    else if ((end - line >= 5) && (!strncmp(line, "Laser", 5))) {
+      Skip(p, end, 1);
+      record.count = (int) Field(p, end);
+      ReadReadings(p, end, record);
+      record.type = LOG_LASER;
+    }
+    else
+      fprintf(stderr, "Uninterpretable Line : \n %.*s\n", (int) (end - line), line);
+  }
+  return record.type;
+}
+
+
+//
+// LogAttach
+//
+// Reads a log of the given format from a stream, such as the pipe StreamOpen returns.
+//
+TLogFile *LogAttach(FILE *file, int format)
+{
+  TLogFile *log;
+
+  if (file == NULL)
+    return NULL;
+  log = (TLogFile *) calloc(1, sizeof(TLogFile));
+  if (log == NULL)
+    return NULL;
+  log->format = format;
+  log->file = file;
+  if ((format == DPB) && (ReadHeader(log) == -1)) {
+    fprintf(stderr, "Not a DP-SLAM binary log, or from a later version\n");
+    LogClose(log);
+    return NULL;
+  }
+  return log;
+}
+
+
+//
+// LogOpen
+//
+// Opens a log on disk, mapping it into memory if it is a regular file. The format comes from the
+// name: ".rec" files are REC, ".dpb" files DPB, everything else LOG.
+//
+TLogFile *LogOpen(const char *name)
+{
+  TLogFile *log;
+  struct stat status;
+  int format, fd;
+  void *data;
+
+  format = FormatOf(name);
+  fd = open(name, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  // Anything that cannot be mapped, such as a FIFO or an empty file, is read through stdio
+  data = MAP_FAILED;
+  if ((fstat(fd, &status) == 0) && (S_ISREG(status.st_mode)) && (status.st_size > 0) &&
+      ((unsigned long long) status.st_size <= (size_t) -1))
+    data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED)
+    return LogAttach(fdopen(fd, "r"), format);
+  close(fd);
+
+  log = (TLogFile *) calloc(1, sizeof(TLogFile));
+  if (log == NULL) {
+    munmap(data, status.st_size);
+    return NULL;
+  }
+  madvise(data, status.st_size, MADV_SEQUENTIAL);
+  log->format = format;
+  log->data = (const char *) data;
+  log->size = status.st_size;
+  if ((format == DPB) && (ReadHeader(log) == -1)) {
+    fprintf(stderr, "%s is not a DP-SLAM binary log, or is from a later version\n", name);
+    LogClose(log);
+    return NULL;
+  }
+  return log;
+}
+
+
+//
+// LogClose
+//
+void LogClose(TLogFile *log)
+{
+  if (log == NULL)
+    return;
+  if (log->file != NULL)
+    fclose(log->file);
+  if (log->data != NULL)
+    munmap((void *) log->data, log->size);
+  free(log->line);
+  free(log);
+}
+
+
+//
+// LogWriteTo
+//
+// Writes a log of the given format (LOG or DPB) to a stream, such as a pipe.
+//
+TLogWriter *LogWriteTo(FILE *file, int format, int beams, double start, double step, int flags)
+{
+  struct dpb_header header;
+  TLogWriter *log;
+
+  if (file == NULL)
+    return NULL;
+  log = (TLogWriter *) calloc(1, sizeof(TLogWriter));
+  if (log == NULL) {
+    fclose(file);
+    return NULL;
+  }
+  log->format = format;
+  log->file = file;
+  log->beams = (beams > 0) ? beams : 0;
+
+  if (format == DPB) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DPB_MAGIC, 4);
+    header.version = DPB_VERSION;
+    header.headersize = sizeof(header);
+    header.beams = log->beams;
+    header.flags = flags;
+    header.start = start;
+    header.step = step;
+    fwrite(&header, sizeof(header), 1, file);
+  }
+  return log;
+}
+
+
+//
+// LogCreate
+//
+// Creates a log. The format comes from the name as for LogOpen, but .rec files cannot be written.
+//
+TLogWriter *LogCreate(const char *name, int beams, double start, double step, int flags)
+{
+  int format;
+
+  format = FormatOf(name);
+  if (format == REC) {
+    fprintf(stderr, "Unable to write %s: .rec logs can only be read\n", name);
+    return NULL;
+  }
+  return LogWriteTo(fopen(name, "wb"), format, beams, start, step, flags);
+}
+
+
+//
+// WriteBinary
+//
+// Writes one .dpb record: the held odometry, the laser, or both as a DPB_SCAN.
+//
+static void WriteBinary(TLogWriter *log, TLogRecord *laser)
+{
+  char buffer[sizeof(struct dpb_record) + 3*sizeof(double) + sizeof(uint32_t) + LOG_MAX_READINGS*sizeof(float)];
+  struct dpb_record frame;
+  double pose[3];
+  uint32_t count;
+  float range;
+  char *p = buffer + sizeof(frame);
+  int i;
+
+  frame.tag = (!log->holding) ? DPB_LASER : ((laser == NULL) ? DPB_ODOMETRY : DPB_SCAN);
+  frame.reserved = 0;
+
+  if (log->holding) {
+    pose[0] = log->x;
+    pose[1] = log->y;
+    pose[2] = log->theta;
+    memcpy(p, pose, sizeof(pose));
+    p += sizeof(pose);
+    log->holding = 0;
+  }
+  if (laser != NULL) {
+    count = (laser->count < LOG_MAX_READINGS) ? laser->count : LOG_MAX_READINGS;
+    memcpy(p, &count, sizeof(count));
+    p += sizeof(count);
+    for (i = 0; i < (int) count; i++, p += sizeof(float)) {
+      range = laser->range[i];
+      memcpy(p, &range, sizeof(float));
+    }
+  }
+
+  frame.length = p - buffer - sizeof(frame);
+  memcpy(buffer, &frame, sizeof(frame));
+  fwrite(buffer, p - buffer, 1, log->file);
+}
+
+
+//
+// LogWrite
+//
+// Appends a record (in meters and radians). A native .log gets exactly the lines WriteLog has
+// always printed. Returns -1 if it could not be written.
+//
+int LogWrite(TLogWriter *log, TLogRecord &record)
+{
+  int i, max;
+
+  max = (record.count < LOG_MAX_READINGS) ? record.count : LOG_MAX_READINGS;
+  if ((record.type == LOG_LASER) && (log->beams == 0))
+    log->beams = max;
+
+  if (log->format == DPB) {
+    if (record.type == LOG_ODOMETRY) {
+      // Odometry with no laser after it goes out on its own
+      if (log->holding)
+	WriteBinary(log, NULL);
+      log->x = record.x;
+      log->y = record.y;
+      log->theta = record.theta;
+      log->holding = 1;
+    }
+    else if (record.type == LOG_LASER)
+      WriteBinary(log, &record);
+  }
+
+  else if (record.type == LOG_ODOMETRY)
+    fprintf(log->file, "Odometry %.6f %.6f %.6f \n", record.x, record.y, record.theta);
+  else if (record.type == LOG_LASER) {
+    fprintf(log->file, "Laser %d ", max);
+    for (i = 0; i < max; i++)
+      fprintf(log->file, "%.6f ", record.range[i]);
+    fprintf(log->file, "\n");
+  }
+
+  return ferror(log->file) ? -1 : 0;
+}
+
+
+//
+// LogFinish
+//
+// Finishes and closes a log. Returns -1 if anything could not be written.
+//
+int LogFinish(TLogWriter *log)
+{
+  int result = 0;
+
+  if (log == NULL)
+    return -1;
+  if (log->format == DPB) {
+    if (log->holding)
+      WriteBinary(log, NULL);
+    // A log created without a beam count takes the first laser's
+    if ((fseek(log->file, offsetof(struct dpb_header, beams), SEEK_SET) == 0))
+      fwrite(&log->beams, sizeof(log->beams), 1, log->file);
+  }
+  if (ferror(log->file))
+    result = -1;
+  if (fclose(log->file) != 0)
+    result = -1;
+  free(log);
+  return result;
+}
@@ -0,0 +1,151 @@
+//
+// logfile.h
+//
+// Reader and writer for the playback logs: our native .log files ("Odometry x y theta" and
+// "Laser N d0 d1 ..."), the .rec files of the CARMEN era ("POS ..." and "LASER* ...") and the
+// binary .dpb files.
+//
+// A log on disk is mapped into memory and each line is parsed where it lies, with a decimal
+// parser that gives exactly the double atof would (bit for bit), but without the locale lookups,
+// the copy into a line buffer and the strtok passes. Logs that arrive through a pipe (a live
+// stream or a converted journal) are read a line at a time instead and parsed the same way.
+//
+// Records hold the numbers as the file has them; converting them to the units SLAM uses is
+// left to ReadLog.
+//
+// A .dpb file holds the same records as a native .log, in meters and radians, with no text to
+// parse: odometry as doubles and the readings as floats, which hold a laser's readings to a few
+// micrometers. A mapped .dpb is read straight out of the page cache, so playing the same log back
+// under many different parameters costs next to nothing after the first run. logconv converts
+// logs to and from it. All fields are little-endian:
+//
+//   File header (32 bytes)
+//     magic[4]      "DPB1"
+//     version       uint16
+//     headersize    uint16  (size of this header, for later growth)
+//     beams         uint32  readings in each laser record
+//     flags         uint32  DPB_HEADING_ONLY if the odometry has a heading but no position
+//     start         double  angle of the first reading from the robot's facing, in radians
+//     step          double  angle between readings
+//
+//   Records, back to back
+//     tag           uint16  DPB_ODOMETRY, DPB_LASER or DPB_SCAN
+//     reserved      uint16
+//     length        uint32  payload bytes following
+//     payload       DPB_ODOMETRY: x, y, theta as doubles
+//                   DPB_LASER: count as uint32, then count floats
+//                   DPB_SCAN: an odometry payload followed by a laser payload
+//
+// A reader skips records with a tag it does not know.
+//
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Log formats
+#define LOG 0
+#define REC 1
+#define DPB 2
+
+#define DPB_MAGIC "DPB1"
+#define DPB_VERSION 1
+#define DPB_ODOMETRY 1
+#define DPB_LASER 2
+#define DPB_SCAN 3
+
+// Header flags
+#define DPB_HEADING_ONLY 1  // x and y are always 0, as from the handheld, which has no wheel odometry
+
+struct dpb_header {
+  char magic[4];
+  uint16_t version;
+  uint16_t headersize;
+  uint32_t beams;
+  uint32_t flags;
+  double start;
+  double step;
+} __attribute__((packed));
+
+struct dpb_record {
+  uint16_t tag;
+  uint16_t reserved;
+  uint32_t length;
+} __attribute__((packed));
+
+// Record types
+#define LOG_END 0         // No more records
+#define LOG_ODOMETRY 1
+#define LOG_LASER 2
+#define LOG_SKIP 3        // A line that carries nothing we use (such as another laser's scan)
+
+// The most laser readings a record keeps. Readings past this are ignored.
+#define LOG_MAX_READINGS 1024
+
+// How much of a mapped log is read before the pages already parsed are handed back, so a
+// multi-gigabyte log does not stay resident (and count against the memory budget).
+#define LOG_RELEASE (8*1024*1024)
+
+typedef struct TLogRecord_struct {
+  int type;
+  // Odometry: x, y and theta. Laser: not used.
+  double x, y, theta;
+  // Laser: the number of readings the line announced, and the readings themselves (up to
+  // LOG_MAX_READINGS of them; readings missing from the line are 0).
+  int count;
+  double range[LOG_MAX_READINGS];
+} TLogRecord;
+
+typedef struct TLogFile_struct {
+  int format;
+  // The laser's geometry, from a .dpb header (beams is 0 for the text formats, which don't say).
+  int beams;
+  double start, step;
+  // The .dpb header's flags (0 for the text formats, which have nowhere to keep them).
+  int flags;
+  // A mapped log, and how far into it we have parsed.
+  const char *data;
+  size_t size, pos, released;
+  // A log read through stdio, and the line buffer for it.
+  FILE *file;
+  char *line;
+  size_t lineSize;
+  // The laser half of a DPB_SCAN, returned by the next LogRead.
+  const char *held;
+  size_t heldLength;
+} TLogFile;
+
+typedef struct TLogWriter_struct {
+  int format;
+  FILE *file;
+  // A .dpb writer holds on to odometry until it sees whether a laser record follows, so the two
+  // can be written as one DPB_SCAN record.
+  int holding;
+  double x, y, theta;
+  uint32_t beams;
+} TLogWriter;
+
+// Opens a log on disk. The format comes from the name: ".rec" files are REC, ".dpb" files DPB,
+// everything else LOG. Returns NULL if it cannot be opened.
+TLogFile *LogOpen(const char *name);
+// Reads a log of the given format from a stream, such as the pipe StreamOpen returns.
+TLogFile *LogAttach(FILE *file, int format);
+void LogClose(TLogFile *log);
+
+// Reads the next record. Returns its type, LOG_END at the end of the log.
+int LogRead(TLogFile *log, TLogRecord &record);
+
+// Creates a log. The format comes from the name as for LogOpen, but .rec files cannot be written.
+// beams is the number of readings in each laser record, or 0 to take it from the first one, and
+// start and step are the angles of the readings and flags the header flags (only a .dpb file
+// keeps them). Returns NULL if it cannot be created.
+TLogWriter *LogCreate(const char *name, int beams, double start, double step, int flags);
+// Writes a log of the given format (LOG or DPB) to a stream, such as a pipe.
+TLogWriter *LogWriteTo(FILE *file, int format, int beams, double start, double step, int flags);
+// Appends a record (in meters and radians). Returns -1 if it could not be written.
+int LogWrite(TLogWriter *log, TLogRecord &record);
+// Finishes and closes a log. Returns -1 if anything could not be written.
+int LogFinish(TLogWriter *log);
+
+// Converts text the way atof does, to the same double, reading no further than end.
+double LogNumber(const char *text, const char *end);
@@ -19,9 +19,17 @@
 
 #include "low.h"
 #include "mt-rand.h"
-
+#include "stream.h"
+#include "bag.h"
+#include "logfile.h"
+#include "prefetch.h"
+#include "beams.h"
+#include "workers.h"
+#include "resample.h"
+
+// The scans and the corrected motion of the last segment, to start the next one from.
 struct THold {
-  TSense sense;
+  TScan *scan;
   double C, D, T;
 };
 
@@ -64,11 +72,15 @@ struct THold {
 // A constant used for culling in Localize
 #define WORST_POSSIBLE -10000
 
-// Used for recognizing the format of some data logs.
-#define LOG 0
-#define REC 1
-int FILE_FORMAT;
-FILE *readFile;
+// The data log being played back, and the record last read from it.
+TLogFile *readFile;
+TLogRecord logRecord;
+// The log the robot's readings are recorded to (see WriteLog), NULL when not recording.
+TLogWriter *writeFile;
+// The reader that reads the log ahead of LowSlam (see prefetch.c), and the seconds it spent reading
+// the readings taken since the last iteration, and that LowSlam spent waiting for them.
+TPrefetch *prefetch;
+double readTime, readWait;
 
 //
 // Structures
@@ -107,6 +119,8 @@ TSample newSample[SAMPLE_NUMBER];
  // In order to compute the amount of percieved motion from the odometry, the last odometry readings are recorded 
  // The actual percieved movement is the current odometry readings minus these recorded 'last' readings.
 double lastX, lastY, lastTheta;
+ // TRUE when the odometry has only a heading, so the robot's movement can't be measured from it
+int headingOnly = FALSE;
  // No. of children each particle gets, based on random resampling
 int children[PARTICLE_NUMBER];
 
@@ -121,7 +135,8 @@ int curGeneration;
 TSense sense;
  // This array stores the color values for each grid square when printing out the map. For some reason,
  // moving this out as a global variable greatly increases the stability of the code.
-unsigned char map[MAP_WIDTH][MAP_HEIGHT];
+ // It only exists while a map is being printed.
+unsigned char **map;
 THold hold[LOW_DURATION];
 
 
@@ -192,6 +207,125 @@ inline double QuickScore(TSense sense, int index, int sampleNum)
 
 
 
+// One pass of scoring the samples, as it is shared out among the threads (see workers.h): the scan,
+// the readings to score in this pass and what each counts for, and the threshold a sample has to be
+// within to be scored at all. scored notes which samples were.
+struct TScoring_struct {
+  TSenseSample *sense;
+  int *beam;
+  int beams, pass;
+  double scale, threshold;
+  char scored[SAMPLE_NUMBER];
+};
+typedef struct TScoring_struct TScoring;
+
+
+//
+// QuickPass
+//
+// One sample's part of a pass of QuickScore.
+//
+static void QuickPass(int i, void *arg)
+{
+  TScoring *scoring = (TScoring *) arg;
+  int k;
+
+  scoring->scored[i] = (newSample[i].probability >= scoring->threshold);
+  if (scoring->scored[i]) {
+    for (k = scoring->pass; k < scoring->beams; k += PASSES) 
+      newSample[i].probability = newSample[i].probability + scoring->scale*log(QuickScore(scoring->sense, scoring->beam[k], i)); 
+  }
+  else 
+    newSample[i].probability = WORST_POSSIBLE;
+}
+
+
+//
+// CheckPass
+//
+// One sample's part of a pass of CheckScore.
+//
+static void CheckPass(int i, void *arg)
+{
+  TScoring *scoring = (TScoring *) arg;
+  int k;
+
+  scoring->scored[i] = (newSample[i].probability >= scoring->threshold);
+  if (scoring->scored[i]) {
+    for (k = scoring->pass; k < scoring->beams; k += PASSES) 
+      newSample[i].probability = newSample[i].probability + scoring->scale*log(CheckScore(scoring->sense, scoring->beam[k], i)); 
+  }
+  else 
+    newSample[i].probability = WORST_POSSIBLE;
+}
+
+
+
+//
+// RasterizeParents
+//
+// Has the maps of the parents with at least RASTER_MIN_SAMPLES samples left after the quick cut
+// rasterized (see LowRasterize), the parents with the most samples first, over the box that the
+// full traces of those samples can reach: the box around the scan's reach, turned and moved to
+// each sample's pose. Only the full traces read the rasters; a raster costs about as much as a
+// handful of samples' full traces, so it only pays for a parent with many.
+//
+static void RasterizeParents(TSense sense, int beam[], int beams)
+{
+  double minX = 0, minY = 0, maxX = 0, maxY = 0, reach, c, s, x, y;
+  double boxMinX, boxMinY, boxMaxX, boxMaxY;
+  int parent[PARTICLE_NUMBER], parents = 0, samples[PARTICLE_NUMBER];
+  int i, j, k, corner;
+
+  for (j = 0; j < PARTICLE_NUMBER; j++)
+    samples[j] = 0;
+  for (i = 0; i < SAMPLE_NUMBER; i++)
+    if (newSample[i].probability != WORST_POSSIBLE)
+      samples[newSample[i].parent]++;
+  for (j = 0; j < PARTICLE_NUMBER; j++) {
+    if (samples[j] < RASTER_MIN_SAMPLES)
+      continue;
+    for (i = parents; (i > 0) && (samples[parent[i-1]] < samples[j]); i--)
+      parent[i] = parent[i-1];
+    parent[i] = j;
+    parents++;
+  }
+  if (parents == 0)
+    return;
+
+  // The reach of each trace, from the robot. A full trace goes 20 squares past the reading (see
+  // LowLineTrace).
+  for (k = 0; k < beams; k++) {
+    i = beam[k];
+    reach = MIN(sense[i].distance + 20.0, MAX_SENSE_RANGE);
+    minX = MIN(minX, cos(sense[i].theta) * reach);
+    maxX = MAX(maxX, cos(sense[i].theta) * reach);
+    minY = MIN(minY, sin(sense[i].theta) * reach);
+    maxY = MAX(maxY, sin(sense[i].theta) * reach);
+  }
+
+  boxMinX = boxMinY = MAP_WIDTH + MAP_HEIGHT;
+  boxMaxX = boxMaxY = -1;
+  for (i = 0; i < SAMPLE_NUMBER; i++) {
+    if ((newSample[i].probability == WORST_POSSIBLE) || (samples[newSample[i].parent] < RASTER_MIN_SAMPLES))
+      continue;
+    c = cos(newSample[i].theta);
+    s = sin(newSample[i].theta);
+    for (corner = 0; corner < 4; corner++) {
+      x = (corner & 1) ? maxX : minX;
+      y = (corner & 2) ? maxY : minY;
+      boxMinX = MIN(boxMinX, newSample[i].x + x*c - y*s);
+      boxMaxX = MAX(boxMaxX, newSample[i].x + x*c - y*s);
+      boxMinY = MIN(boxMinY, newSample[i].y + x*s + y*c);
+      boxMaxY = MAX(boxMaxY, newSample[i].y + x*s + y*c);
+    }
+  }
+
+  LowRasterize((int) boxMinX - 2, (int) boxMinY - 2, (int) boxMaxX + 2, (int) boxMaxY + 2, parent, parents);
+}
+
+
+
 //
 // Localize
 //
@@ -200,7 +334,6 @@ inline double QuickScore(TSense sense, int index, int sampleNum)
 //
 void Localize(TSense sense)
 {
-  double ftemp; 
   double threshold;  // threshhold for discarding particles (in log prob.)
   double total; 
   double turn, distance, moveAngle; // The incremental motion reported by the odometer
@@ -209,6 +342,10 @@ void Localize(TSense sense)
   int i, j, k, p, best;  // Incremental counters.
   int keepers = 0; // How many particles finish all rounds
   int newchildren[SAMPLE_NUMBER]; // Used for resampling
+  double weight[SAMPLE_NUMBER]; // and the weights resampled by
+  int beam[SENSE_MAX], beams; // The readings used to score the samples (see beams.h)
+  double scale; // and how much each one's score counts for
+  TScoring scoring; // A pass of scoring, shared out among the threads
   
   // Take the odometry readings from both this time step and the last, in order to figure out
   // the base level of incremental motion. Convert our measurements from meters and degrees 
@@ -287,6 +424,14 @@ void Localize(TSense sense)
     }
   }
 
+  // Only some of the readings may be used for scoring. Which ones depends on the scan, not the sample.
+  beams = ScoreSubset(sense, beam);
+  scale = (double) SENSE_NUMBER / beams;
+  scoring.sense = sense;
+  scoring.beam = beam;
+  scoring.beams = beams;
+  scoring.scale = scale;
+
   // Go through these particles in a number of passes, in order to find the best particles. This is
   // where we cull out obviously bad particles, by performing evaluation in a number of distinct
   // steps. At the end of each pass, we identify the probability of the most likely sample. Any sample
@@ -298,19 +443,17 @@ void Localize(TSense sense)
   // provide a good, quick heuristic for culling off bad samples, but should not be used for final
   // weights. Something which looks good in this scan can very easily turn out to be low probability
   // when the entire laser trace is considered.
+  // The samples of each pass are scored on all of the threads, and the best is found once they are
+  // all done, in order, so that it is the same sample whichever thread scored what.
   threshold = WORST_POSSIBLE-1;  // ensures that we accept anything in 1st round
   for (p = 0; p < PASSES; p++){
+    scoring.pass = p;
+    scoring.threshold = threshold;
+    WorkersRun(QuickPass, &scoring, SAMPLE_NUMBER);
     best = 0;
-    for (i = 0; i < SAMPLE_NUMBER; i++) {
-      if (newSample[i].probability >= threshold) {
-	for (k = p; k < SENSE_NUMBER; k += PASSES) 
-	  newSample[i].probability = newSample[i].probability + log(QuickScore(sense, k, i)); 
-	if (newSample[i].probability > newSample[best].probability) 
-	  best = i;
-      }
-      else 
-	newSample[i].probability = WORST_POSSIBLE;
-    }
+    for (i = 0; i < SAMPLE_NUMBER; i++) 
+      if ((scoring.scored[i]) && (newSample[i].probability > newSample[best].probability))
+	best = i;
     threshold = newSample[best].probability - THRESH;
   }
 
@@ -328,27 +471,29 @@ void Localize(TSense sense)
   // Letting the user know how many samples survived this first cut.
   fprintf(stderr, "Better %d ", keepers);
   threshold = -1;
+  if (LOW_RASTER)
+    RasterizeParents(sense, beam, beams);
 
   // Now reevaluate all of the surviving samples, using the full laser scan to look for possible
   // obstructions, in order to get the most accurate weights. While doing this evaluation, we can
   // still keep our eye out for unlikely samples before we are finished.
   keepers = 0;
   for (p = 0; p < PASSES; p++){
+    scoring.pass = p;
+    scoring.threshold = threshold;
+    WorkersRun(CheckPass, &scoring, SAMPLE_NUMBER);
     best = 0;
     for (i = 0; i < SAMPLE_NUMBER; i++) {
-      if (newSample[i].probability >= threshold) {
+      if (scoring.scored[i]) {
 	if (p == PASSES -1)
 	  keepers++;
-	for (k = p; k < SENSE_NUMBER; k += PASSES) 
-	  newSample[i].probability = newSample[i].probability + log(CheckScore(sense, k, i)); 
 	if (newSample[i].probability > newSample[best].probability) 
 	  best = i;
       }
-      else 
-	newSample[i].probability = WORST_POSSIBLE;
     }
     threshold = newSample[best].probability - THRESH; 
   }
+  LowRasterDone();
 
   // Report how many samples survived the second cut. These numbers help the user have confidence that
   // the threshhold values used for culling are reasonable.
@@ -373,27 +518,18 @@ void Localize(TSense sense)
   for (i=0; i < SAMPLE_NUMBER; i++)
     newSample[i].probability = newSample[i].probability/total;
 
-  total = 0.0;
   // Count how many children each particle will get in next generation
-  // This is done through random resampling.
+  // This is done through random resampling (see resample.h).
   for (i = 0; i < SAMPLE_NUMBER; i++) {
     newchildren[i] = 0;
-    total = total + newSample[i].probability;
+    weight[i] = newSample[i].probability;
   }
 
-  i = j = 0;  // i = no. of survivors, j = no. of new samples
-  while ((j < SAMPLE_NUMBER) && (i < PARTICLE_NUMBER)) {
-    k = 0;
-    ftemp = MTrandDec()*total;
-    while (ftemp > (newSample[k].probability)) {
-      ftemp = ftemp - newSample[k].probability;
-      k++;
-    }    
-    if (newchildren[k] == 0)
+  j = Resample(weight, SAMPLE_NUMBER, SAMPLE_NUMBER, PARTICLE_NUMBER, newchildren);  // j = no. of new samples
+  i = 0;  // i = no. of survivors
+  for (k = 0; k < SAMPLE_NUMBER; k++)
+    if (newchildren[k] > 0)
       i++;
-    newchildren[k]++;
-    j++;
-  }
 
   // Report exactly how many samples are kept as particles, since they were actually
   // resampled.
@@ -444,26 +580,20 @@ void Localize(TSense sense)
     for (i=0; i < cur_saved_particles_used; i++)
       savedParticle[i].probability = savedParticle[i].probability/total;
 
-    total = 0.0;
     for (i = 0; i < cur_saved_particles_used; i++) 
-      total = total + savedParticle[i].probability;
-
-    while (j < SAMPLE_NUMBER) {
-      k = 0;
-      ftemp = MTrandDec()*total;
-      while (ftemp > (savedParticle[k].probability)) {
-	ftemp = ftemp - savedParticle[k].probability;
-	k++;
-      }    
-      children[k]++;
-
-      j++;
-    }
+      weight[i] = savedParticle[i].probability;
+    Resample(weight, cur_saved_particles_used, SAMPLE_NUMBER - j, cur_saved_particles_used, children);
   }
 
   // Some useful information concerning the current generation of particles, and the parameters for the best one.
-  fprintf(stderr, "-- %.3d (%.4f, %.4f, %.4f) : %.4f\n", curGeneration, savedParticle[best].x, savedParticle[best].y, 
+  fprintf(stderr, "-- %.3d (%.4f, %.4f, %.4f) : %.4f", curGeneration, savedParticle[best].x, savedParticle[best].y, 
 	  savedParticle[best].theta, savedParticle[best].probability);
+  // When playing back a log, how long it took to read this iteration's readings, and how much of that we had to wait for.
+  if (prefetch != NULL)
+    fprintf(stderr, " [log %.2f ms, waited %.2f ms]", readTime*1000.0, readWait*1000.0);
+  fprintf(stderr, "\n");
+  readTime = 0.0;
+  readWait = 0.0;
 }
 
 
@@ -486,14 +616,14 @@ void DisposeAncestry(TAncestor particleID[])
       entry = particleID[i].mapEntries;
       for (j=0; j < particleID[i].total; j++)
 	LowDeleteObservation(entry[j].x, entry[j].y, entry[j].node);
-      free(entry);
+      BudgetFree(entry);
       particleID[i].mapEntries = NULL;
       
       tempPath = particleID[i].path;
       while (tempPath != NULL) {
 	trashPath = tempPath;
 	tempPath = tempPath->next;
-	free(trashPath);
+	BudgetFree(trashPath);
       }
       particleID[i].path = NULL;
 
@@ -547,7 +677,7 @@ void UpdateAncestry(TSense sense, TAncestor particleID[])
 	LowDeleteObservation(temp->mapEntries[j].x, temp->mapEntries[j].y, temp->mapEntries[j].node);
 
       // Get rid of the memory being used by this ancestor
-      free(temp->mapEntries);
+      BudgetFree(temp->mapEntries);
       temp->mapEntries = NULL;
 
       // This is used exclusively for the low level in hierarchical SLAM. 
@@ -556,7 +686,7 @@ void UpdateAncestry(TSense sense, TAncestor particleID[])
       while (tempPath != NULL) {
 	trashPath = tempPath;
 	tempPath = tempPath->next;
-	free(trashPath);
+	BudgetFree(trashPath);
       }
       temp->path = NULL;
 
@@ -598,7 +728,7 @@ void UpdateAncestry(TSense sense, TAncestor particleID[])
       // in addition to its own. If not, we need to increase the dynamic array.
       if (parentNode->size < (parentNode->total + particleID[i].total)) {
 	parentNode->size = (int)(ceil((parentNode->size + particleID[i].size)*1.75));
-	workArray = (TEntryList *)malloc(sizeof(TEntryList)*parentNode->size);
+	workArray = (TEntryList *)BudgetMalloc(sizeof(TEntryList)*parentNode->size);
 	if (workArray == NULL) fprintf(stderr, "Malloc failed for workArray\n");
 
 	for (j=0; j < parentNode->total; j++) {
@@ -607,7 +737,7 @@ void UpdateAncestry(TSense sense, TAncestor particleID[])
 	  workArray[j].node = parentNode->mapEntries[j].node;
 	}
 	// Note that parentNode->total hasn't changed- that will grow as the child's entries are added in
-	free(parentNode->mapEntries);
+	BudgetFree(parentNode->mapEntries);
 	parentNode->mapEntries = workArray;
       }
 
@@ -647,7 +777,7 @@ void UpdateAncestry(TSense sense, TAncestor particleID[])
       }
 
       // We're done with it- remove the array of updates from the child.
-      free(particleID[i].mapEntries);
+      BudgetFree(particleID[i].mapEntries);
       particleID[i].mapEntries = NULL;
 
       // Inherit the path
@@ -700,7 +830,7 @@ void UpdateAncestry(TSense sense, TAncestor particleID[])
       l_particle[j].ancestryNode = savedParticle[i].ancestryNode;
 
       // Add a new entry to the path of the ancestor node.
-      trashPath = (TPath *)malloc(sizeof(TPath));
+      trashPath = (TPath *)BudgetMalloc(sizeof(TPath));
       trashPath->C = savedParticle[i].C;
       trashPath->D = savedParticle[i].D;
       trashPath->T = savedParticle[i].T;
@@ -743,7 +873,7 @@ void UpdateAncestry(TSense sense, TAncestor particleID[])
       temp->seen = 0;
 
       // This is where we add a new entry to this node's hypothesized path for the robot
-      trashPath = (TPath *)malloc(sizeof(TPath));
+      trashPath = (TPath *)BudgetMalloc(sizeof(TPath));
       trashPath->C = savedParticle[i].C;
       trashPath->D = savedParticle[i].D;
       trashPath->T = savedParticle[i].T;
@@ -789,102 +919,89 @@ void UpdateAncestry(TSense sense, TAncestor particleID[])
 
 
 
+//
+// WriteLog
+//
+// Prints to file the data that we would normally be getting from sensors, such as the laser and the odometry.
+// This allows us to later play back the exact run, with different parameters.
+// All readings are in meters or radians. The log is in our native text format or, if its name ends in .dpb,
+// the binary one (see logfile.h).
+//
+void WriteLog(TLogWriter *logFile, TSense sense)
+{
+  int i;
+
+  logRecord.type = LOG_ODOMETRY;
+  logRecord.x = odometry.x;
+  logRecord.y = odometry.y;
+  logRecord.theta = odometry.theta;
+  LogWrite(logFile, logRecord);
+
+  logRecord.type = LOG_LASER;
+  logRecord.count = SENSE_NUMBER;
+  for (i = 0; i < SENSE_NUMBER; i++)
+    logRecord.range[i] = sense[i].distance/MAP_SCALE;
+  LogWrite(logFile, logRecord);
+}
+
+
+
 //
 // ReadLog
 //
 // Reads back into the sensor data structures the raw readings that were stored to file by WriteLog (above)
-// Reads a single line from the file, and interprets it by its delineator (either Laser or Odometry). If the line
-// is not delineated for some reason, the function prints out an error message, and advances to the next line.
+// Reads a single record from the log (see logfile.c), and interprets it by its type (either Laser or Odometry).
+// Lines that cannot be interpreted are reported by the reader and skipped.
 // While there is still information in the file, it will return 0. When it reaches the end of the file, it will return 1.
+// Once SLAM has started, this is called only by the prefetch reader's thread.
 //
-int ReadLog(FILE *logFile, TSense &sense, int &continueSlam) {
+int ReadLog(TLogFile *logFile, TSense &sense, TOdo &odometry) {
   int i, max;
-  char line[4096];
 
-  if (fgets(line, 4096, logFile) == NULL) {
-    fprintf(stderr, "End of Log File.\n");
-    continueSlam = 0;
+  switch (LogRead(logFile, logRecord)) {
+  case LOG_END:
     return 1;
-  }
 
-  if (FILE_FORMAT == REC) {
-    if (!strncmp(line, "POS", 3)) {
-      strtok(line, " ");   // This is to remove the keyword
-      strtok(NULL, " ");   // Second item is the time of the reading, in seconds. We don't care.
-      strtok(NULL, " ");   // Third item is the usecs of the time. We still don't care.
-      // Read x and y coordinates, and convert them from cm to m. 
-      odometry.x = atof(strtok(NULL, " "))/100.0;
-      odometry.y = atof(strtok(NULL, " "))/100.0;
-      // Read the facing angle of the robot, and convert from deg to rad
-      odometry.theta = atof(strtok(NULL, " "))*M_PI/180.0;
-
-      if (odometry.theta > M_PI) 
-	odometry.theta = odometry.theta - 2*M_PI;
-      else if (odometry.theta < -M_PI) 
-	odometry.theta = odometry.theta + 2*M_PI;
+  case LOG_ODOMETRY:
+    if (logFile->format == REC) {
+      // Convert x and y coordinates from cm to m, and the facing angle of the robot from deg to rad
+      odometry.x = logRecord.x/100.0;
+      odometry.y = logRecord.y/100.0;
+      odometry.theta = logRecord.theta*M_PI/180.0;
+    }
+    else {
+      odometry.x = logRecord.x;
+      odometry.y = logRecord.y;
+      odometry.theta = logRecord.theta;
+    }
+
+    if (odometry.theta > M_PI) 
+      odometry.theta = odometry.theta - 2*M_PI;
+    else if (odometry.theta < -M_PI) 
+      odometry.theta = odometry.theta + 2*M_PI;
 
+    if (logFile->format == REC) {
       odometry.x = odometry.x - (cos(odometry.theta)*TURN_RADIUS/MAP_SCALE);
       odometry.y = odometry.y - (sin(odometry.theta)*TURN_RADIUS/MAP_SCALE);
-      // There are still two parameters here, pitch and yaw, as far as i can tell, but we don't use them. 
-      // I don't think we have any maps to use that even let those two change.
     }
-    // Apparently this is also sometimes recorded as 'LASER_RANGE'
-    // We accept anything that starts with LASER
-    else if (!strncmp(line, "LASER", 5)) {
-      strtok(line, " ");   // This is to remove the keyword
-      strtok(NULL, " ");   // Second item is the time of the reading, in seconds. We don't care.
-      strtok(NULL, " ");   // Third item is the usecs of the time. We still don't care.
-      i = (int) (atof(strtok(NULL, " ")));   // This item is the laser ID.
-      // We only use the first laser. This can be changed in hard code, but it is rare that
-      // we will try to use anything with multiple lasers. It's just in case.
-      if (i != 0)
-	return 0;
-
-      // Here we are reading in the total number of laser readings that will follow. This is usually 180 with
-      // SICK lasers.
-      max = (int) (atof(strtok(NULL, " ")));
-      if (max > SENSE_NUMBER)
-	max = SENSE_NUMBER;
-      // In theory, i don't think that this next item is supposed to be here, but in the Wean Hall data,
-      // i noticed this consistent term of "180.0:" which doesn't seem to mean anything pertinent. I hope.
-      strtok(NULL, " ");
-      
-      // Now read in the whole list of laser readings. Remember that they are in cm, so translating them to
-      // MAP_SCALE takes an extra 1/100
-      for (i = 0; i < max; i++) {
-	sense[i].distance = atof(strtok(NULL, " "))*MAP_SCALE/100.0;
+    break;
+
+  case LOG_LASER:
+    // The total number of laser readings. This is usually 180 with SICK lasers.
+    max = logRecord.count;
+    if (max > SENSE_NUMBER)
+      max = SENSE_NUMBER;
+    for (i = 0; i < max; i++) {
+      // Readings in a .rec file are in cm, so translating them to MAP_SCALE takes an extra 1/100
+      if (logFile->format == REC) {
+	sense[i].distance = logRecord.range[i]*MAP_SCALE/100.0;
 	if (sense[i].distance > MAX_SENSE_RANGE)
 	  sense[i].distance = MAX_SENSE_RANGE;
       }
+      else
+	sense[i].distance = logRecord.range[i]*MAP_SCALE;
     }
-    else 
-      fprintf(stderr, "Uninterpretable Line (.rec) : \n %s\n", line);
-  }
-
-  // Anything not specified is assumed to our native .log files.
-  else {
-    if (!strncmp(line, "Odometry", 8)) {
-      strtok(line, " ");
-      odometry.x = atof(strtok(NULL, " "));
-      odometry.y = atof(strtok(NULL, " "));
-      odometry.theta = atof(strtok(NULL, " "));
-
-      if (odometry.theta > M_PI) 
-	odometry.theta = odometry.theta - 2*M_PI;
-      else if (odometry.theta < -M_PI) 
-	odometry.theta = odometry.theta + 2*M_PI;
-    }
-    else if (!strncmp(line, "Laser", 5)) {
-      strtok(line, " ");
-      max = (int) (atof(strtok(NULL, " ")));
-      if (max > SENSE_NUMBER)
-	max = SENSE_NUMBER;
-      for (i = 0; i < max; i++) {
-	sense[i].distance = atof(strtok(NULL, " "))*MAP_SCALE;
-      }
-    }
-    else 
-      fprintf(stderr, "Uninterpretable Line : \n %s\n", line);
+    break;
   }
 
   return 0;
@@ -914,9 +1031,8 @@ void PrintMap(char *name, TAncestor *parent, int particles, double overlayX, dou
   width = MAP_WIDTH;
   height = MAP_HEIGHT;
 
-  for(x=0; x < width; x++)
-    for(y=0; y<height; y++)
-      map[x][y] = 0;
+  // Already cleared
+  map = (unsigned char **) BudgetGrid(width, height, sizeof(unsigned char));
 
   lastx = 0;
   lasty = 0;
@@ -1004,6 +1120,8 @@ void PrintMap(char *name, TAncestor *parent, int particles, double overlayX, dou
       
   // We're finished making the ppm file, and now convert it to png, for compressed storage and easy viewing.
   fclose(printFile);
+  BudgetFree(map);
+  map = NULL;
   sprintf(sysCall, "convert %s.ppm %s.png", name, name);
   system(sysCall);
   sprintf(sysCall, "chmod 666 %s.ppm", name);
@@ -1020,40 +1138,101 @@ void PrintMap(char *name, TAncestor *parent, int particles, double overlayX, dou
 //
 void InitLowSlam()
 {
-  int i, j;
-  char name[32];
+  int i;
 
   // Set up the variables to open the correct data log, and identify its format.
-  if (PLAYBACK != "") {
-    readFile = fopen(PLAYBACK, "r");
-    strcpy(name, &PLAYBACK[strlen(PLAYBACK)-3]);
-    if (strncmp(name, "rec", 3) == 0) 
-      FILE_FORMAT = REC;
-    else
-      FILE_FORMAT = LOG;
+  // A "tcp:host:port" log is the live stream from the handheld, which arrives in our binary format.
+  if ((PLAYBACK[0] != '\0') && (IsStream(PLAYBACK))) {
+    readFile = LogAttach(StreamOpen(PLAYBACK), DPB);
+    if (readFile == NULL) {
+      fprintf(stderr, "Unable to open stream %s\n", PLAYBACK);
+      exit(-1);
+    }
+  }
+  // A handheld journal (.pfj) is converted to our binary format as well, but only for the
+  // requested window of the session.
+  else if ((PLAYBACK[0] != '\0') && (IsJournal(PLAYBACK))) {
+    readFile = LogAttach(JournalOpen(PLAYBACK, PLAYBACK_START, PLAYBACK_END, PLAYBACK_PART, PLAYBACK_PARTS), DPB);
+    if (readFile == NULL) {
+      fprintf(stderr, "Unable to open journal %s\n", PLAYBACK);
+      exit(-1);
+    }
+  }
+  // So is a ROS bag, again for the requested window only.
+  else if ((PLAYBACK[0] != '\0') && (IsBag(PLAYBACK))) {
+    readFile = LogAttach(BagOpen(PLAYBACK, PLAYBACK_TOPICS, PLAYBACK_START, PLAYBACK_END, PLAYBACK_PART, PLAYBACK_PARTS), DPB);
+    if (readFile == NULL) {
+      fprintf(stderr, "Unable to open bag %s\n", PLAYBACK);
+      exit(-1);
+    }
+  }
+  // A log on disk is mapped into memory and parsed in place; its name says if it is a .rec file.
+  else if (PLAYBACK[0] != '\0') {
+    readFile = LogOpen(PLAYBACK);
+    if (readFile == NULL) {
+      fprintf(stderr, "Unable to open log %s\n", PLAYBACK);
+      exit(-1);
+    }
   }
 
-  // All angle values will remain static
-  for (i = 0; i < SENSE_NUMBER; i++) 
-    sense[i].theta = (i*M_PI/180.0) - M_PI/2;
+  if (PLAYBACK[0] != '\0')
+    headingOnly = ((readFile->flags & DPB_HEADING_ONLY) != 0);
+
+  // All angle values will remain static. A binary log says how many readings there are and where they
+  // look; otherwise there are SENSE_NUMBER of them, one degree apart.
+  if ((PLAYBACK[0] != '\0') && (readFile->beams > 0)) {
+    if (readFile->beams > SENSE_MAX)
+      fprintf(stderr, "%s has %d readings in a scan, but only the first %d are used\n", PLAYBACK, readFile->beams, SENSE_MAX);
+    SENSE_NUMBER = MIN(readFile->beams, SENSE_MAX);
+    for (i = 0; i < SENSE_NUMBER; i++)
+      sense[i].theta = readFile->start + i*readFile->step;
+  }
+  else
+    for (i = 0; i < SENSE_NUMBER; i++) 
+      sense[i].theta = (i*M_PI/180.0) - M_PI/2;
+  fprintf(stderr, "Scans of %d readings from %.1f to %.1f degrees, ", SENSE_NUMBER, sense[0].theta*180.0/M_PI,
+	  sense[SENSE_NUMBER-1].theta*180.0/M_PI);
+  if ((SCORE_BEAMS > 0) && (SCORE_BEAMS < SENSE_NUMBER))
+    fprintf(stderr, "scoring %d of them (%s)\n", SCORE_BEAMS, ScorePolicyName(SCORE_POLICY));
+  else
+    fprintf(stderr, "scoring all of them\n");
+  fprintf(stderr, "Threads scoring samples: %d\n", WorkersStart());
 
   curGeneration = 0;
   if (PLAYBACK == "") {
+    // Anything the robot senses can be recorded, to play back later
+    if (RECORDING[0] != '\0') {
+      writeFile = LogCreate(RECORDING, SENSE_NUMBER, sense[0].theta, sense[1].theta - sense[0].theta, 0);
+      if (writeFile == NULL) {
+	fprintf(stderr, "Unable to create log %s\n", RECORDING);
+	exit(-1);
+      }
+    }
+
     // Grab our initial reading of the odometer and laser
     GetSensation(sense);
     GetOdometry(odometry);
+    if (writeFile != NULL)
+      WriteLog(writeFile, sense);
   }
   else {
     // Read through the file the specified number of iterations, in order to get to a 
     // later portion of the sensor log.
     for (i=0; i < START_ITERATION; i++) {
-      ReadLog(readFile, sense, j);
-      ReadLog(readFile, sense, j);
+      ReadLog(readFile, sense, odometry);
+      ReadLog(readFile, sense, odometry);
     }
 
     // Read in the first data before starting SLAM.
-    ReadLog(readFile, sense, i);
-    ReadLog(readFile, sense, i);
+    ReadLog(readFile, sense, odometry);
+    ReadLog(readFile, sense, odometry);
+
+    // The rest of the log is read ahead of SLAM by another thread
+    prefetch = PrefetchStart(readFile, ReadLog, sense, odometry);
+    if (prefetch == NULL) {
+      fprintf(stderr, "Unable to start reading %s\n", PLAYBACK);
+      exit(-1);
+    }
   }
 }
 
@@ -1065,8 +1244,17 @@ void InitLowSlam()
 //
 void CloseLowSlam()
 {
-  if (PLAYBACK != "")
-    fclose(readFile);
+  if (PLAYBACK[0] != '\0') {
+    fprintf(stderr, "Playback: %ld readings, %.2f s reading the log, %.2f s of it waited for\n", prefetch->readings,
+	    prefetch->readTime, prefetch->waitTime);
+    PrefetchStop(prefetch);
+    prefetch = NULL;
+    LogClose(readFile);
+  }
+  if ((writeFile != NULL) && (LogFinish(writeFile) == -1))
+    fprintf(stderr, "Unable to finish writing log %s\n", RECORDING);
+  writeFile = NULL;
+  WorkersStop();
 }
 
 
@@ -1078,12 +1266,12 @@ void CloseLowSlam()
 //
 void LowSlam(int &continueSlam, TPath **path, TSenseLog **obs)
 {
-  double moveAngle;
+  double moveAngle, read, wait;
   int counter;
   int i, j, overflow = 0;
   char name[32];
   TPath *tempPath;
-  TSenseLog *tempObs;
+  TScan *scan;
   TAncestor *lineage;
 
   // Initialize the worldMap
@@ -1145,10 +1333,7 @@ void LowSlam(int &continueSlam, TPath **path, TSenseLog **obs)
   // Add the first thing that you see to the worldMap at the center. This gives us something to localize off of.
   if (curGeneration == 0) {
     AddToWorldModel(sense, 0);
-    for (i=0; i < SENSE_NUMBER; i++) {
-      hold[0].sense[i].distance = sense[i].distance;
-      hold[0].sense[i].theta = sense[i].theta;
-    }
+    hold[0].scan = ScanNew(sense);
     curGeneration++;
   }
   // If you are using hierarchical SLAM, we use a small portion of the previous map to get us started.
@@ -1157,7 +1342,7 @@ void LowSlam(int &continueSlam, TPath **path, TSenseLog **obs)
   else {
     LowInitializeFlags();
     // Add our first observation to our map of the world. This will serve as the basis for future localizations
-    AddToWorldModel(hold[(int)(LOW_DURATION*.5)].sense, 0);
+    AddToWorldModel(hold[(int)(LOW_DURATION*.5)].scan->sense, 0);
     for (i=(int)(LOW_DURATION*.5)+1; i < LOW_DURATION; i++) {
       LowInitializeFlags();
       // Move the particles one step
@@ -1168,22 +1353,17 @@ void LowSlam(int &continueSlam, TPath **path, TSenseLog **obs)
 	(hold[i].D * sin(moveAngle)) + (hold[i].C * sin(moveAngle + M_PI/2));
       l_particle[0].theta = l_particle[0].theta + hold[i].T;
       
-      AddToWorldModel(hold[i].sense, 0);
+      AddToWorldModel(hold[i].scan->sense, 0);
     }
 
-    for (i=0; i < SENSE_NUMBER; i++) {
-      hold[0].sense[i].distance = hold[LOW_DURATION-1].sense[i].distance;
-      hold[0].sense[i].theta = hold[LOW_DURATION-1].sense[i].theta;
-    }
+    scan = ScanShare(hold[LOW_DURATION-1].scan);
+    ScanRelease(hold[0].scan);
+    hold[0].scan = scan;
   }
 
   // Get our observation log started.
-  (*obs) = (TSenseLog *)malloc(sizeof(TSenseLog));
-  for (i=0; i < SENSE_NUMBER; i++) {
-    (*obs)->sense[i].distance = hold[0].sense[i].distance;
-    (*obs)->sense[i].theta = hold[0].sense[i].theta;
-  }
-  (*obs)->next = NULL;
+  (*obs) = SenseLogNew();
+  SenseLogAppend(*obs, hold[0].scan);
 
   continueSlam = 1;
   counter = 0;
@@ -1201,25 +1381,36 @@ void LowSlam(int &continueSlam, TPath **path, TSenseLog **obs)
 	//overflow = 2;
     }
     else {
-      // Collect information from the data log. If either reading returns 1, we've run out of log data, and
+      // Collect information from the data log, which the prefetch reader has ready for us. At the end of the log,
       // we need to stop now.
-      if ((ReadLog(readFile, sense, continueSlam) == 1) || (ReadLog(readFile, sense, continueSlam) == 1))
+      if (PrefetchTake(prefetch, sense, odometry, read, wait) == 1) {
+	fprintf(stderr, "End of Log File.\n");
+	continueSlam = 0;
 	overflow = 0;
+      }
       else 
 	overflow = 1;
+      readTime += read;
+      readWait += wait;
     }
 
     // We don't necessarily want to use every last reading that comes in. This allows us to make certain that the 
     // robot has moved at least a minimal amount (in terms of meters and radians) before we try to localize and update.
-    if ((sqrt(SQUARE(odometry.x - lastX) + SQUARE(odometry.y - lastY)) < 0.05) && (fabs(odometry.theta - lastTheta) < 0.03))
+    // A log with no position in its odometry (such as the handheld's) can't tell us how far it has moved, so all of
+    // its readings are used.
+    if ((!headingOnly) &&
+	(sqrt(SQUARE(odometry.x - lastX) + SQUARE(odometry.y - lastY)) < 0.05) && (fabs(odometry.theta - lastTheta) < 0.03))
       overflow = 0;
 
     if (overflow > 0) {
       overflow--;
 
       // Record and preprocess the current laser reading
-      if (PLAYBACK == "")
+      if (PLAYBACK == "") {
 	GetSensation(sense);
+	if (writeFile != NULL)
+	  WriteLog(writeFile, sense);
+      }
 
       // Wipe the slate clean 
       LowInitializeFlags();
@@ -1230,23 +1421,12 @@ void LowSlam(int &continueSlam, TPath **path, TSenseLog **obs)
       // Add these maintained particles to the FamilyTree, so that ancestry can be determined, and then prune dead lineages
       UpdateAncestry(sense, l_particleID);
 
-      // Update the observation log (used only by hierarchical SLAM)
-      tempObs = (*obs);
-      while (tempObs->next != NULL)
-	tempObs = tempObs->next;
-      tempObs->next = (TSenseLog *)malloc(sizeof(TSenseLog));
-      if (tempObs->next == NULL) fprintf(stderr, "Malloc failed in making a new observation!\n");
-      for (i=0; i < SENSE_NUMBER; i++) {
-	tempObs->next->sense[i].distance = sense[i].distance;
-	tempObs->next->sense[i].theta = sense[i].theta;
-      }
-      tempObs->next->next = NULL;
-
-      // Holding Pen for observations.
-      for (i=0; i < SENSE_NUMBER; i++) {
-	hold[counter].sense[i].distance = sense[i].distance;
-	hold[counter].sense[i].theta = sense[i].theta;
-      }
+      // The scan is kept once, and shared by the observation log (used only by hierarchical SLAM)
+      // and the holding pen for observations.
+      scan = ScanNew(sense);
+      SenseLogAppend(*obs, scan);
+      ScanRelease(hold[counter].scan);
+      hold[counter].scan = scan;
 
       curGeneration++;
       counter++;
@@ -26,8 +26,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #include "lowMap.h"
+#include "workers.h"
 
 // Unobserved grid squares are treated of having a prior of one stopped scan per 
 // 8 meters of laser scan. 
@@ -38,7 +40,7 @@
 
 // The global map for the low level, which contains all observations that any particle 
 // has made to any specific grid square.
-PMapStarter lowMap[MAP_WIDTH][MAP_HEIGHT];
+PMapStarter **lowMap;
 
 // The nodes of the ancestry tree are stored here. Since each particle has a unique ID, 
 // we can quickly access the particles via their ID in this array. See the structure 
@@ -51,6 +53,10 @@ TParticle l_particle[PARTICLE_NUMBER];
 int l_cur_particles_used;
 int FLAG;
 
+// Held while an entry of the observation cache is built, since samples are scored on several
+// threads at once (see workers.h).
+static pthread_mutex_t observationLock = PTHREAD_MUTEX_INITIALIZER;
+
 
 //
 // This process should be called at the start of each iteration of the slam process.
@@ -83,13 +89,22 @@ void LowInitializeWorldMap()
 {
   int x, y;
 
+  // The grids are allocated the first time through, already cleared.
+  if (lowMap == NULL)
+    lowMap = (PMapStarter **) BudgetGrid(MAP_WIDTH, MAP_HEIGHT, sizeof(PMapStarter));
+  AllocateObservationCache();
+
+  // Squares are only written when they need clearing, so that the parts of the grids which the
+  // robot never reaches are never brought into memory.
   for (y=0; y < MAP_HEIGHT; y++)
     for (x=0; x < MAP_WIDTH; x++) {
       // The map is a set of pointers. Null represents that it is unobserved.
-      lowMap[x][y] = NULL;
+      if (lowMap[x][y] != NULL)
+	lowMap[x][y] = NULL;
       // flagMap is set to all zeros, indicating that location does not have an
       // entry in the observationArray
-      flagMap[x][y] = 0;
+      if (flagMap[x][y] != 0)
+	flagMap[x][y] = 0;
     }
 
   // There are no entries in the observationArray yet, so obsX/obsY are set to 0
@@ -119,8 +134,8 @@ void LowDestroyMap()
   for (y=0; y < MAP_HEIGHT; y++)
     for (x=0; x < MAP_WIDTH; x++) {
       while (lowMap[x][y] != NULL) {
-	free(lowMap[x][y]->array);
-	free(lowMap[x][y]);
+	BudgetFree(lowMap[x][y]->array);
+	BudgetFree(lowMap[x][y]);
 	lowMap[x][y] = NULL;
       }
     }
@@ -150,7 +165,7 @@ void LowResizeArray(TMapStarter *node, int deadID)
   // Create a new array of the appropriate size.
   // Don't count the dead entries in computing the new size
   node->size = (int)(ceil((node->total - node->dead)*1.75));
-  temp = (TMapNode *) malloc(sizeof(TMapNode)*node->size);
+  temp = (TMapNode *) BudgetMalloc(sizeof(TMapNode)*node->size);
   if (temp == NULL) fprintf(stderr, "Malloc failed in expansion of arrays.  %d\n", node->size);
 
   // Initialize our hash table.
@@ -257,7 +272,7 @@ void LowResizeArray(TMapStarter *node, int deadID)
   node->total = j;
   // After completing this process, we have removed all dead entries.
   node->dead = 0;
-  free(node->array);
+  BudgetFree(node->array);
   node->array = temp;
 }
 
@@ -345,7 +360,11 @@ static void AddToWorkingArray(int i, TMapStarter *node, short int workingArray[]
 // effectively expands the local map by one grid square, and allows any future accesses to
 // this grid square to be completed in constant time. This function itself can take O(P) time.
 //
-inline void LowBuildObservation(int x, int y, char usage)
+// Scoring threads may find the square unbuilt at the same time, so it is built under a lock by
+// whichever gets there first, and flagMap only points at the entry once it is complete. Returns
+// the new value of flagMap[x][y].
+//
+inline int LowBuildObservation(int x, int y, char usage)
 {
   TAncestor *lineage;
   PAncestor stack[PARTICLE_NUMBER];
@@ -353,17 +372,23 @@ inline void LowBuildObservation(int x, int y, char usage)
   int i, here, topStack;
   char flag;
 
+  pthread_mutex_lock(&observationLock);
+  here = flagMap[x][y];
+  if (here != 0) {
+    pthread_mutex_unlock(&observationLock);
+    return here;
+  }
+
   // The size of the observationArray is not large enough- we throw out an error
   // message and stop the program
   if (observationID >= AREA) 
     fprintf(stderr, "aRoll over!\n");
 
   // Grab a slot in the observationArray
-  flagMap[x][y] = observationID;
+  here = observationID;
   obsX[observationID] = x;
   obsY[observationID] = y;
   observationID++;
-  here = flagMap[x][y];
 
   // Initialize the slot and the ancestor particles
   for (i=0; i < ID_NUMBER; i++) {
@@ -429,10 +454,13 @@ inline void LowBuildObservation(int x, int y, char usage)
   // observation array- a glance at the flagMap can indicate that the desity is 0, regardless of
   // which particle is making the access.
   if ((usage) && (flag)) 
-    flagMap[x][y] = -2;
+    here = -2;
   else
     for (i=0; i < ID_NUMBER; i++) 
       observationArray[here][i] = workingArray[i];
+  __atomic_store_n(&flagMap[x][y], here, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&observationLock);
+  return here;
 }
 
 
@@ -465,7 +493,7 @@ void LowUpdateGridSquare(int x, int y, double distance, int hit, int parentID)
     // new entry into the map at this location, that we can then build on.
     // The first step is to create a starter structure, to keep track of the dynamic array
     // of observations.
-    lowMap[x][y] = (TMapStarter *) malloc(sizeof(TMapStarter));
+    lowMap[x][y] = (TMapStarter *) BudgetMalloc(sizeof(TMapStarter));
     if (lowMap[x][y] == NULL) fprintf(stderr, "Malloc failed in creation of Map Starter at %d %d\n", x, y);
     // No dead or obsolete entries yet.
     lowMap[x][y]->dead = 0;
@@ -474,7 +502,7 @@ void LowUpdateGridSquare(int x, int y, double distance, int hit, int parentID)
     // We will only have room for one observation in this grid square so far. Later, this can grow.
     lowMap[x][y]->size = 1;
     // The actual dynamic array is created here, of exactly the size for one entry.
-    lowMap[x][y]->array = (TMapNode *) malloc(sizeof(TMapNode));
+    lowMap[x][y]->array = (TMapNode *) BudgetMalloc(sizeof(TMapNode));
     if (lowMap[x][y]->array == NULL) fprintf(stderr, "Malloc failed in making initial map array for %d %d\n", x, y);
 
     // Initialize the slot
@@ -504,8 +532,8 @@ void LowUpdateGridSquare(int x, int y, double distance, int hit, int parentID)
     if (lowMap[x][y]->size <= lowMap[x][y]->total) {
       LowResizeArray(lowMap[x][y], -71);
       if (lowMap[x][y]->total == 0) {
-	free(lowMap[x][y]->array);
-	free(lowMap[x][y]);
+	BudgetFree(lowMap[x][y]->array);
+	BudgetFree(lowMap[x][y]);
 	lowMap[x][y] = NULL;
       }
     }
@@ -519,19 +547,19 @@ void LowUpdateGridSquare(int x, int y, double distance, int hit, int parentID)
     // First check to see if the size of that array is big enough to hold another entry
     if (l_particleID[parentID].size == 0) {
       l_particleID[parentID].size = 1;
-      l_particleID[parentID].mapEntries = (TEntryList *) malloc(sizeof(TEntryList));
+      l_particleID[parentID].mapEntries = (TEntryList *) BudgetMalloc(sizeof(TEntryList));
       if (l_particleID[parentID].mapEntries == NULL) fprintf(stderr, "Malloc failed in creation of entry list array\n");
     }
     else if (l_particleID[parentID].size <= l_particleID[parentID].total) {
       l_particleID[parentID].size = (int)(ceil(l_particleID[parentID].total*1.25));
-      tempEntry = (TEntryList *) malloc(sizeof(TEntryList)*l_particleID[parentID].size);
+      tempEntry = (TEntryList *) BudgetMalloc(sizeof(TEntryList)*l_particleID[parentID].size);
       if (tempEntry == NULL) fprintf(stderr, "Malloc failed in expansion of entry list array\n");
       for (i=0; i < l_particleID[parentID].total; i++) {
 	tempEntry[i].x = l_particleID[parentID].mapEntries[i].x;
 	tempEntry[i].y = l_particleID[parentID].mapEntries[i].y;
 	tempEntry[i].node = l_particleID[parentID].mapEntries[i].node;
       }
-      free(l_particleID[parentID].mapEntries);
+      BudgetFree(l_particleID[parentID].mapEntries);
       l_particleID[parentID].mapEntries = tempEntry;
     }
 
@@ -593,8 +621,8 @@ void LowDeleteObservation(short int x, short int y, short int node) {
   // revert the whole entry in the map to NULL, indicating that no current particle
   // has observed this location. 
   if (lowMap[x][y]->total - lowMap[x][y]->dead == 1) {
-    free(lowMap[x][y]->array);
-    free(lowMap[x][y]);
+    BudgetFree(lowMap[x][y]->array);
+    BudgetFree(lowMap[x][y]);
     lowMap[x][y] = NULL;
     return;
   }
@@ -605,8 +633,8 @@ void LowDeleteObservation(short int x, short int y, short int node) {
     // now, as indicated by the second argument).
     LowResizeArray(lowMap[x][y], lowMap[x][y]->array[node].ID);
     if (lowMap[x][y]->total == 0) {
-      free(lowMap[x][y]->array);
-      free(lowMap[x][y]);
+      BudgetFree(lowMap[x][y]->array);
+      BudgetFree(lowMap[x][y]);
       lowMap[x][y] = NULL;
     }
     return;
@@ -644,6 +672,8 @@ void LowDeleteObservation(short int x, short int y, short int node) {
 //
 inline double LowComputeProbability(int x, int y, double distance, int parentID) 
 {
+  int here;
+
   // If there are no entries at this location in the map, we know that the observation
   // for any particle is UNKNOWN. Use the density of our prior for unknown grid squares
   if (lowMap[x][y] == NULL) 
@@ -653,23 +683,24 @@ inline double LowComputeProbability(int x, int y, double distance, int parentID)
   // how to get constant time access. If that value is set to 0, we know that this location
   // has yet to be accessed this iteration, and we have build the observation array entry 
   // for this square
-  if (flagMap[x][y] == 0) 
-    LowBuildObservation(x, y, 1);
+  here = __atomic_load_n(&flagMap[x][y], __ATOMIC_ACQUIRE);
+  if (here == 0) 
+    here = LowBuildObservation(x, y, 1);
 
   // If the flagMap is set to the constant -2, all particles agree that this location is
   // empty. We can avoid significant pointer redirection and memory accesses, and just
   // acknowledge that an empty square has probability 0 of stopping a scan.
-  if (flagMap[x][y] == -2)
+  if (here == -2)
     return 0;
 
   // If the observationArray does not have an entry for this particle (as indicated by
   // the index of -1) then this location is considered UNKNOWN for this particle, and
   // we can use our prior value for density.
-  if (observationArray[flagMap[x][y]][parentID] == -1)
+  if (observationArray[here][parentID] == -1)
     return (1.0 - exp(L_PRIOR * distance));
   // This value of -2 is a constant used to indicate that the square is empty, and
   // it is not necessary to access the lowMap, and risk a cache miss.
-  if (observationArray[flagMap[x][y]][parentID] == -2)
+  if (observationArray[here][parentID] == -2)
     return 0;
   // If there is an entry in the observationArray, then we use that entry as an index
   // into the global map at the relevent location, and retrieve the information 
@@ -679,10 +710,162 @@ inline double LowComputeProbability(int x, int y, double distance, int parentID)
   // Note that if no laser scan have been observed to stop in this square, density is
   // zero, and no matter what the distance currently being observed to pass through the 
   // square, there is no chance that it will stop the scan. 
-  if (lowMap[x][y]->array[ observationArray[flagMap[x][y]][parentID] ].hits == 0)
+  if (lowMap[x][y]->array[ observationArray[here][parentID] ].hits == 0)
+    return 0;
+  return (1.0 - exp(-(lowMap[x][y]->array[ observationArray[here][parentID] ].hits/
+		      lowMap[x][y]->array[ observationArray[here][parentID] ].distance) * distance));
+}
+
+
+
+//
+// Dense rasters of the parents' maps. Many samples share a parent, and LowComputeProbability
+// goes through lowMap, flagMap, observationArray and the square's array for every square of
+// every trace of every one of them. With LOW_RASTER, Localize has each parent's map laid out
+// once an iteration as a grid of densities (hits/distance) over the box the scan can reach
+// (LowRasterize), and traces for that parent read the density straight from the grid. The
+// densities are the same floats LowComputeProbability divides out, so the scores are unchanged.
+//
+// Building an entry of the observation cache costs far more than looking it up, so the rasters
+// do not build any: a square not yet in the cache is left as RASTER_LOOKUP, and looked up (and
+// built) by LowComputeProbability if a trace gets to it, as it would have been anyway.
+//
+
+int LOW_RASTER = 0;
+
+// The box the rasters cover, its size, and each parent's grid (by ancestry ID), or NULL if it
+// has none this iteration. The grids are kept in one block, which is kept from one iteration
+// to the next, and grown when it is too small.
+static int rasterX, rasterY, rasterWidth, rasterHeight;
+static float *rasterGrid[ID_NUMBER];
+static float *rasterBlock = NULL;
+static long rasterCells = 0;
+// The parents being rasterized, by ancestry ID
+static int rasterID[PARTICLE_NUMBER], rasters;
+
+
+//
+// RasterColumn
+//
+// Rasterizes one column of the box for all of the parents. The squares are looked up the same
+// way LowComputeProbability does it.
+//
+static void RasterColumn(int column, void *arg)
+{
+  int x, y, i, here, entry;
+  long cell;
+  TMapNode *node;
+
+  x = rasterX + column;
+  for (y = rasterY; y < rasterY + rasterHeight; y++) {
+    cell = (long) column*rasterHeight + (y - rasterY);
+    if (lowMap[x][y] == NULL) {
+      for (i = 0; i < rasters; i++)
+	rasterGrid[rasterID[i]][cell] = RASTER_UNKNOWN;
+      continue;
+    }
+
+    here = __atomic_load_n(&flagMap[x][y], __ATOMIC_ACQUIRE);
+    for (i = 0; i < rasters; i++) {
+      if (here == 0)
+	rasterGrid[rasterID[i]][cell] = RASTER_LOOKUP;
+      else if (here == -2)
+	rasterGrid[rasterID[i]][cell] = 0;
+      else {
+	entry = observationArray[here][rasterID[i]];
+	if (entry == -1)
+	  rasterGrid[rasterID[i]][cell] = RASTER_UNKNOWN;
+	else if (entry == -2)
+	  rasterGrid[rasterID[i]][cell] = 0;
+	else {
+	  node = &lowMap[x][y]->array[entry];
+	  rasterGrid[rasterID[i]][cell] = (node->hits == 0) ? 0 : node->hits/node->distance;
+	}
+      }
+    }
+  }
+}
+
+
+//
+// LowRasterize
+//
+// Rasterizes the maps of the given particles over the box from (minX, minY) to (maxX, maxY), as
+// many of them as fit in RASTER_MAX_MB, in the order given. The columns are shared out among the
+// scoring threads.
+//
+void LowRasterize(int minX, int minY, int maxX, int maxY, int particle[], int particles)
+{
+  long cells, fit;
+  int i, ID;
+
+  LowRasterDone();
+  minX = MAX(minX, 1);
+  minY = MAX(minY, 1);
+  maxX = MIN(maxX, MAP_WIDTH-2);
+  maxY = MIN(maxY, MAP_HEIGHT-2);
+  if ((maxX < minX) || (maxY < minY) || (particles == 0))
+    return;
+  rasterX = minX;
+  rasterY = minY;
+  rasterWidth = maxX - minX + 1;
+  rasterHeight = maxY - minY + 1;
+
+  cells = (long) rasterWidth*rasterHeight;
+  fit = MIN((long) particles, (RASTER_MAX_MB*1048576L) / (cells*(long) sizeof(float)));
+  if (fit == 0)
+    return;
+  if (fit*cells > rasterCells) {
+    BudgetFree(rasterBlock);
+    rasterBlock = (float *) BudgetMalloc(fit*cells*sizeof(float));
+    rasterCells = fit*cells;
+  }
+
+  for (i = 0; i < fit; i++) {
+    ID = l_particle[particle[i]].ancestryNode->ID;
+    if (rasterGrid[ID] != NULL)
+      continue;
+    rasterGrid[ID] = rasterBlock + rasters*cells;
+    rasterID[rasters++] = ID;
+  }
+  WorkersRun(RasterColumn, NULL, rasterWidth);
+}
+
+
+//
+// LowRasterDone
+//
+// The rasters are only good until the map changes, at the end of the iteration.
+//
+void LowRasterDone()
+{
+  int i;
+
+  for (i = 0; i < rasters; i++)
+    rasterGrid[rasterID[i]] = NULL;
+  rasters = 0;
+}
+
+
+//
+// LowTraceProbability
+//
+// LowComputeProbability, for a trace with a raster of its parent's map (grid) or without (NULL).
+//
+static inline double LowTraceProbability(float *grid, int x, int y, double distance, int parentID)
+{
+  float density;
+
+  if (grid == NULL)
+    return LowComputeProbability(x, y, distance, parentID);
+  density = grid[(long) (x - rasterX)*rasterHeight + (y - rasterY)];
+  if (density == RASTER_LOOKUP)
+    return LowComputeProbability(x, y, distance, parentID);
+  if (density == RASTER_UNKNOWN)
+    return (1.0 - exp(L_PRIOR * distance));
+  if (density == 0)
     return 0;
-  return (1.0 - exp(-(lowMap[x][y]->array[ observationArray[flagMap[x][y]][parentID] ].hits/
-		      lowMap[x][y]->array[ observationArray[flagMap[x][y]][parentID] ].distance) * distance));
+  return (1.0 - exp(-density * distance));
 }
 
 
@@ -751,6 +934,10 @@ void LowAddTrace(double startx, double starty, double MeasuredDist, double theta
   endx = (int) (dx);
   endy = (int) (dy);
 
+  // Traces which would leave the map are not recorded.
+  if (!TRACE_INSIDE(startx, starty, dx, dy, MAP_WIDTH, MAP_HEIGHT))
+    return;
+
   // Decide which x and y directions the line is travelling.
   // inc tells us which way to increment x and y. edge indicates whether we are computing
   // distance from the near or far edge.
@@ -900,6 +1087,7 @@ double LowLineTrace(double startx, double starty, double theta, double MeasuredD
   double xblock, yblock;
   double xMotion, yMotion;
   double standardDist;
+  float *grid;            // The raster of the parent's map, if there is one
 
   // eval is the total probability for this line trace. Since this is a summation, eval starts at 0
   eval = 0.0;
@@ -929,6 +1117,15 @@ double LowLineTrace(double startx, double starty, double theta, double MeasuredD
   endx = (int) (dx);
   endy = (int) (dy);
 
+  // A trace which would leave the map can't be scored, and counts as a failed trace.
+  if (!TRACE_INSIDE(startx, starty, dx, dy, MAP_WIDTH, MAP_HEIGHT))
+    return 0;
+
+  // With a raster of the parent's map that the whole trace is inside, the squares are read from that.
+  grid = rasterGrid[parentID];
+  if ((grid != NULL) && (!TRACE_INSIDE(startx - rasterX, starty - rasterY, dx - rasterX, dy - rasterY, rasterWidth, rasterHeight)))
+    grid = NULL;
+
   // Decide which x and y directions the line is travelling.
   if (startx > dx) {
     incX = -1;
@@ -1009,7 +1206,7 @@ double LowLineTrace(double startx, double starty, double theta, double MeasuredD
 
       // Compute the probability of the laser stopping in the square, given the particle's unique map.
       // Keep in mind that the probability of even getting this far in the trace is likely less than 1.
-      prob = totalProb * LowComputeProbability(x, y, distance, parentID);
+      prob = totalProb * LowTraceProbability(grid, x, y, distance, parentID);
       if (prob > 0) {
 	// If the scan had actually been stopped by an object in the map at this square,
 	// how much error would there be in the laser? Determine which axis will be crossed 
@@ -1039,7 +1236,7 @@ double LowLineTrace(double startx, double starty, double theta, double MeasuredD
 	distance = -overflow*cosecant;
 	overflow = overflow + 1.0;
 
-	prob = totalProb * LowComputeProbability(x, y, distance, parentID);
+	prob = totalProb * LowTraceProbability(grid, x, y, distance, parentID);
 	if (prob > 0) {
 	  // There is no question about which axis will be the next crossed, since we just crossed the y-axis, 
 	  // and x motion is dominant
@@ -1085,7 +1282,7 @@ double LowLineTrace(double startx, double starty, double theta, double MeasuredD
       else 
 	distance = standardDist;
 
-      prob = totalProb * LowComputeProbability(x, y, distance, parentID);
+      prob = totalProb * LowTraceProbability(grid, x, y, distance, parentID);
       if (prob > 0) {
 	if (overflow < 0.0) 
 	  error = fabs(xMotion);
@@ -1103,7 +1300,7 @@ double LowLineTrace(double startx, double starty, double theta, double MeasuredD
 	distance = -overflow*secant;
 	overflow = overflow + 1.0;
 
-	prob = totalProb * LowComputeProbability(x, y, distance, parentID);
+	prob = totalProb * LowTraceProbability(grid, x, y, distance, parentID);
 	if (prob > 0) {
 	  error = fabs(yMotion);
 	  if (error < 20.0) 
@@ -23,8 +23,8 @@
 #include "map.h"
 
 // The global map used by the low level slam process. These are pointers to MapStarter in order
-// to save memory on te large amount of unobserved grid squares.
-extern PMapStarter lowMap[MAP_WIDTH][MAP_HEIGHT];
+// to save memory on te large amount of unobserved grid squares. Allocated by LowInitializeWorldMap.
+extern PMapStarter **lowMap;
 // The nodes of the ancestry tree are stored here. Since each particle has a unique ID, we can 
 // quickly access the particles via their ID in this array. See the structure TAncestor in map.h 
 // for more details.
@@ -45,3 +45,17 @@ double LowComputeProb(int x, int y, double distance, int ID);
 
 void LowAddTrace(double startx, double starty, double MeasuredDist, double theta, int parentID, int addEnd);
 double LowLineTrace(double startx, double starty, double theta, double MeasuredDist, int parentID, float culling);
+
+// Dense rasters of the parents' maps, for scoring (see LowRasterize in lowMap.c). Set with -g.
+// A raster holds each square's density, RASTER_UNKNOWN for a square the parent has not observed,
+// or RASTER_LOOKUP for one to look up in the map, and the rasters of an iteration take at most
+// RASTER_MAX_MB.
+extern int LOW_RASTER;
+#define RASTER_UNKNOWN -1.0f
+#define RASTER_LOOKUP -2.0f
+#define RASTER_MAX_MB 32
+// The fewest samples a parent needs to have its map rasterized (see RasterizeParents in low.c)
+#define RASTER_MIN_SAMPLES 8
+
+void LowRasterize(int minX, int minY, int maxX, int maxY, int particle[], int particles);
+void LowRasterDone();
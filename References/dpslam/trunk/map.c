@@ -15,8 +15,27 @@
 
 #include "map.h"
 
-int flagMap[H_MAP_WIDTH][H_MAP_HEIGHT];
-short int obsX[AREA], obsY[AREA];
+int MapWidth = DEFAULT_MAP_WIDTH, MapHeight = DEFAULT_MAP_HEIGHT;
+int HMapWidth = DEFAULT_H_MAP_WIDTH, HMapHeight = DEFAULT_H_MAP_HEIGHT;
 
-short int observationArray[AREA][TOP_ID_NUMBER];
+int **flagMap;
+short int *obsX, *obsY;
+
+short int (*observationArray)[TOP_ID_NUMBER];
 int observationID;
+
+
+//
+// The observation cache is shared by both levels, and flagMap covers the larger (high level) map.
+// It is sized by then, since BudgetConfigure runs before SLAM starts. Calling this again does nothing.
+//
+void AllocateObservationCache()
+{
+  if (flagMap != NULL)
+    return;
+
+  flagMap = (int **) BudgetGrid(H_MAP_WIDTH, H_MAP_HEIGHT, sizeof(int));
+  obsX = (short int *) BudgetCalloc(AREA, sizeof(short int));
+  obsY = (short int *) BudgetCalloc(AREA, sizeof(short int));
+  observationArray = (short int (*)[TOP_ID_NUMBER]) BudgetCalloc(AREA, sizeof(short int)*TOP_ID_NUMBER);
+}
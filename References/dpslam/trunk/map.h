@@ -18,7 +18,11 @@
 // about particle numbers and the information each one needs to maintain.
 //
 
+#include <stddef.h>
+
 #include "laser.h"
+#include "budget.h"
+#include "scans.h"
 
 #define UNKNOWN -2
 
@@ -31,12 +35,18 @@
 // When not using hierarchical, these are the only values that matter.
 // See low.h for how to turn on and off hierarchical slam
 
-// We need to know, for various purposes, how big our map is allowed to be
-#define MAP_WIDTH  1700
-#define MAP_HEIGHT 1700
+// We need to know, for various purposes, how big our map is allowed to be.
+// These are the full sizes; with a memory budget (see budget.h) the map is made smaller to fit.
+#define DEFAULT_MAP_WIDTH  1700
+#define DEFAULT_MAP_HEIGHT 1700
+#define MAP_WIDTH  MapWidth
+#define MAP_HEIGHT MapHeight
 
 // This is the number of particles that we are keeping at the low level
+// (the embedded build profile in the Makefile sets fewer)
+#ifndef PARTICLE_NUMBER
 #define PARTICLE_NUMBER 50
+#endif
 // This is the number of samples that we will generate each iteration. Notice that we
 // generate more samples than we will keep as actual particles. This is because so many 
 // are "bad" samples, and clearly won't be resampled, thus we don't need to allocate nearly
@@ -55,11 +65,15 @@
 // hierarchical slam is not being used.
 
 // We need to know, for various purposes, how big our map is allowed to be
-#define H_MAP_WIDTH  3000
-#define H_MAP_HEIGHT 3000
+#define DEFAULT_H_MAP_WIDTH  3000
+#define DEFAULT_H_MAP_HEIGHT 3000
+#define H_MAP_WIDTH  HMapWidth
+#define H_MAP_HEIGHT HMapHeight
 
 // This is the number of particles that we are keeping at the high level
+#ifndef H_PARTICLE_NUMBER
 #define H_PARTICLE_NUMBER 50
+#endif
 // This is the number that we will generate
 #define H_SAMPLE_NUMBER (H_PARTICLE_NUMBER*10)
 // Number of unique particle ID numbers. Each particle (and ancestry particle) gets its own ID. 
@@ -79,8 +93,17 @@
 // A bounding box on the semicircle of possible observations.
 // This is useful for creating the observation cache (basically a set of local maps) which
 // allows us to run in linear time. This number will grow with increased laser ranges.
+// A memory budget never makes the cache smaller, so it must leave room for all of it.
 #define AREA (int) (3.1415 * 55.0 *MAP_SCALE*MAP_SCALE)
 
+// The map sizes in use. They start at the full sizes above, and BudgetConfigure may shrink them.
+extern int MapWidth, MapHeight, HMapWidth, HMapHeight;
+
+// A line trace only visits squares between its two endpoints, so it stays inside a map (with a
+// square to spare on every side) when both of them do.
+#define TRACE_INSIDE(sx, sy, ex, ey, width, height) \
+  ((MIN(sx, ex) >= 1) && (MIN(sy, ey) >= 1) && (MAX(sx, ex) < (width)-1) && (MAX(sy, ey) < (height)-1))
+
 
 // Used for passing the corrected odometric path from the low level to high level for
 // further evaluation. Only used for hierarchical slam.
@@ -94,13 +117,7 @@ struct TPath_struct {
 };
 typedef struct TPath_struct TPath;
 
-// Like TPath, this is also used to pass sets of observations from the low level to the
-// high level. Only used for hierarchical slam.
-struct TSenseLog_struct {
-  TSense sense;
-  struct TSenseLog_struct *next;
-};
-typedef struct TSenseLog_struct TSenseLog;
+// The observations that go with a path, TSenseLog, are in scans.h.
 
 
 // The maps are each made up of dynamic arrays of MapNodes. 
@@ -203,8 +220,9 @@ typedef struct TParticle_struct TParticle;
 // the "expanded" set of information for that grid square (where map accesses are constant time into an array).
 // obsX/obsY do the opposite, and tell, for each entry of the observation cache, where in the map they 
 // correspond to. This is most useful for cleaning up the observation cache and flagMap after each iteration.
-extern int flagMap[H_MAP_WIDTH][H_MAP_HEIGHT];
-extern short int obsX[AREA], obsY[AREA];
+// All of these are allocated by AllocateObservationCache the first time a map is initialized.
+extern int **flagMap;
+extern short int *obsX, *obsY;
 
 // This is where the actual observation cache is stored. For a given position in the global map, (x,y), 
 // consult i=flagMap[x][y] to get the proper index into the observationArray. Now, observationArray[i][j] 
@@ -212,7 +230,9 @@ extern short int obsX[AREA], obsY[AREA];
 // info from the global map, this just gives a reference index into the appropriate grid square, so if 
 // k=observationArray[i][j], then the actual information for particle j at (x,y) is map[x][y]->array[k], 
 // which then contains fields such as hits, distance, etc.
-extern short int observationArray[AREA][TOP_ID_NUMBER];
+extern short int (*observationArray)[TOP_ID_NUMBER];
 
 // The number of entries of observationArray currently being used.
 extern int observationID;
+
+void AllocateObservationCache();
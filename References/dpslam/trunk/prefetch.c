@@ -0,0 +1,156 @@
+//
+// prefetch.c
+//
+// Reads a playback log ahead of SLAM. See prefetch.h.
+//
+
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+
+#include "ThisRobot.h"
+#include "logfile.h"
+#include "prefetch.h"
+
+
+//
+// Now
+//
+static double Now()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec/1e9;
+}
+
+
+//
+// Wait
+//
+// sem_wait, through any signals.
+//
+static void Wait(sem_t *semaphore)
+{
+  while ((sem_wait(semaphore) == -1) && (errno == EINTR))
+    ;
+}
+
+
+//
+// Reader
+//
+// The reader thread. Fills the ring until the log ends or it is told to stop.
+//
+static void *Reader(void *arg)
+{
+  TPrefetch *prefetch = (TPrefetch *) arg;
+  TReading *slot;
+  double start;
+  int i, end = 0;
+
+  while (!end) {
+    Wait(&prefetch->empty);
+    if (prefetch->stop)
+      break;
+
+    // Each reading is an odometry record and a laser record, read the way LowSlam used to read
+    // them. If the first ends the log, the second is not read.
+    start = Now();
+    end = ((prefetch->read(prefetch->log, prefetch->sense, prefetch->odometry) == 1) ||
+	   (prefetch->read(prefetch->log, prefetch->sense, prefetch->odometry) == 1));
+
+    slot = &prefetch->ring[prefetch->head];
+    slot->seconds = Now() - start;
+    slot->end = end;
+    slot->odometry = prefetch->odometry;
+    for (i = 0; i < SENSE_NUMBER; i++)
+      slot->distance[i] = prefetch->sense[i].distance;
+    prefetch->head = (prefetch->head + 1) % PREFETCH_DEPTH;
+    sem_post(&prefetch->filled);
+  }
+  return NULL;
+}
+
+
+//
+// PrefetchStart
+//
+// Starts a reader on a log, carrying on from the readings already read from it.
+//
+TPrefetch *PrefetchStart(TLogFile *log, TReadFunction read, TSense &sense, TOdo &odometry)
+{
+  TPrefetch *prefetch;
+
+  prefetch = (TPrefetch *) calloc(1, sizeof(TPrefetch));
+  if (prefetch == NULL)
+    return NULL;
+  prefetch->log = log;
+  prefetch->read = read;
+  memcpy(prefetch->sense, sense, sizeof(TSense));
+  prefetch->odometry = odometry;
+  sem_init(&prefetch->filled, 0, 0);
+  sem_init(&prefetch->empty, 0, PREFETCH_DEPTH);
+
+  if (pthread_create(&prefetch->thread, NULL, Reader, prefetch) != 0) {
+    sem_destroy(&prefetch->filled);
+    sem_destroy(&prefetch->empty);
+    free(prefetch);
+    return NULL;
+  }
+  return prefetch;
+}
+
+
+//
+// PrefetchTake
+//
+// Takes the next reading into sense and odometry, waiting for the reader if it has none ready.
+// Returns 1 at the end of the log, and keeps returning 1 after that.
+//
+int PrefetchTake(TPrefetch *prefetch, TSense &sense, TOdo &odometry, double &read, double &wait)
+{
+  TReading *slot;
+  double start;
+  int i;
+
+  start = Now();
+  Wait(&prefetch->filled);
+  wait = Now() - start;
+  prefetch->waitTime += wait;
+
+  slot = &prefetch->ring[prefetch->tail];
+  read = slot->seconds;
+  if (slot->end) {
+    // Leave the end in the ring for the next call
+    sem_post(&prefetch->filled);
+    return 1;
+  }
+  odometry = slot->odometry;
+  for (i = 0; i < SENSE_NUMBER; i++)
+    sense[i].distance = slot->distance[i];
+  prefetch->tail = (prefetch->tail + 1) % PREFETCH_DEPTH;
+  prefetch->readings++;
+  prefetch->readTime += read;
+  sem_post(&prefetch->empty);
+  return 0;
+}
+
+
+//
+// PrefetchStop
+//
+// Stops the reader, whether or not it has reached the end of the log. A reader waiting on a live
+// stream stops once its next reading arrives.
+//
+void PrefetchStop(TPrefetch *prefetch)
+{
+  if (prefetch == NULL)
+    return;
+  prefetch->stop = 1;
+  sem_post(&prefetch->empty);
+  pthread_join(prefetch->thread, NULL);
+  sem_destroy(&prefetch->filled);
+  sem_destroy(&prefetch->empty);
+  free(prefetch);
+}
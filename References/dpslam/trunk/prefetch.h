@@ -0,0 +1,61 @@
+//
+// prefetch.h
+//
+// Reads a playback log ahead of SLAM. A reader thread reads the log (parsing it, or waiting on the
+// disk, a stream or a journal) and leaves each odometry and laser reading, ready to use, in a
+// small ring. LowSlam takes them from the ring, so between localizations it only waits for the
+// log if the reader has fallen behind. The end of the log comes through the ring as well, after
+// the last reading.
+//
+// The ring has one reader and one taker. The reader only writes slots the taker has given back,
+// and the taker only reads slots the reader has filled, so no slot is ever shared; two semaphores
+// count the filled and empty slots, and block a side only when the ring is full or empty.
+//
+// Include after ThisRobot.h and logfile.h.
+//
+
+#include <pthread.h>
+#include <semaphore.h>
+
+// The number of readings the reader can get ahead of SLAM
+#define PREFETCH_DEPTH 32
+
+// Reads the next odometry and laser reading from a log into sense and odometry (see ReadLog).
+// Returns 1 at the end of the log.
+typedef int (*TReadFunction)(TLogFile *log, TSense &sense, TOdo &odometry);
+
+typedef struct TReading_struct {
+  // Set on the slot after the last reading; nothing else in it is used.
+  int end;
+  TOdo odometry;
+  double distance[SENSE_MAX];
+  // The seconds the reader spent reading it
+  double seconds;
+} TReading;
+
+typedef struct TPrefetch_struct {
+  TLogFile *log;
+  TReadFunction read;
+  TReading ring[PREFETCH_DEPTH];
+  // The next slot the reader fills, and the next one SLAM takes
+  int head, tail;
+  sem_t filled, empty;
+  int stop;
+  pthread_t thread;
+  // The reader's own copy of the latest readings, since a record may update only one of them
+  TSense sense;
+  TOdo odometry;
+  // Readings taken so far, the seconds the reader spent reading them (which SLAM used to spend
+  // itself), and the seconds SLAM spent waiting for the reader.
+  long readings;
+  double readTime, waitTime;
+} TPrefetch;
+
+// Starts a reader on a log, carrying on from the readings already read from it.
+TPrefetch *PrefetchStart(TLogFile *log, TReadFunction read, TSense &sense, TOdo &odometry);
+// Takes the next reading into sense and odometry, waiting for the reader if it has none ready.
+// Returns 1 at the end of the log. read is set to the seconds the reader spent reading it, and
+// wait to the seconds spent waiting for it.
+int PrefetchTake(TPrefetch *prefetch, TSense &sense, TOdo &odometry, double &read, double &wait);
+// Stops the reader, whether or not it has reached the end of the log. The log is left open.
+void PrefetchStop(TPrefetch *prefetch);
@@ -0,0 +1,234 @@
+//
+// resample.c
+//
+// Giving samples their children. See resample.h.
+//
+
+#include <string.h>
+
+#include "basic.h"
+#include "mt-rand.h"
+#include "resample.h"
+
+int RESAMPLE_SCHEME = RESAMPLE_MULTINOMIAL;
+
+static const char *schemeName[] = { "multinomial", "systematic", "stratified" };
+
+// Room for the running sum of the weights, or the weights of the samples given children, and
+// which samples those are. Grown to the most samples resampled so far.
+static double *value = NULL;
+static int *fresh = NULL;
+static int room = 0;
+
+
+//
+// ResampleScheme
+//
+int ResampleScheme(const char *name)
+{
+  int i;
+
+  for (i = 0; i < (int) (sizeof(schemeName)/sizeof(schemeName[0])); i++)
+    if (!strcmp(name, schemeName[i]))
+      return i;
+  return -1;
+}
+
+
+//
+// ResampleSchemeName
+//
+const char *ResampleSchemeName(int scheme)
+{
+  if ((scheme < 0) || (scheme >= (int) (sizeof(schemeName)/sizeof(schemeName[0]))))
+    return "unknown";
+  return schemeName[scheme];
+}
+
+
+//
+// Room
+//
+// Makes sure there is room for count samples.
+//
+static void Room(int count)
+{
+  if (count <= room)
+    return;
+  room = count;
+  value = (double *) realloc(value, room*sizeof(double));
+  fresh = (int *) realloc(fresh, room*sizeof(int));
+}
+
+
+//
+// Multinomial
+//
+// Independent draws, one at a time until there are draws of them or limit samples that had no
+// children have been given some. Each is found by a binary search of the running sum of the
+// weights, for the first sample whose share of it the draw falls in.
+//
+static int Multinomial(const double weight[], int count, int draws, int limit, int children[])
+{
+  int i, k, low, high, last, given, added;
+  double total, x;
+
+  total = 0.0;
+  last = 0;
+  for (i = 0; i < count; i++) {
+    total = total + weight[i];
+    value[i] = total;
+    if (weight[i] > 0.0)
+      last = i;
+  }
+
+  given = added = 0;
+  while ((given < draws) && (added < limit)) {
+    x = MTrandDec()*total;
+    low = 0;
+    high = count;
+    while (low < high) {
+      k = (low + high)/2;
+      if (x < value[k])
+	high = k;
+      else
+	low = k+1;
+    }
+    // Rounding can leave a draw just past the end of the sum
+    k = MIN(low, last);
+    if (children[k] == 0)
+      added++;
+    children[k]++;
+    given++;
+  }
+  return given;
+}
+
+
+//
+// Comb
+//
+// Systematic and stratified resampling. Their draws are in increasing order, one in each of draws
+// equal parts of the total weight, so they are all given out in one pass along the running sum.
+// Returns how many samples that had no children were given some, having listed them in fresh.
+//
+static int Comb(int scheme, const double weight[], int count, int draws, int children[])
+{
+  int i, k, last, added;
+  double total, sum, step, offset, x;
+
+  total = 0.0;
+  last = 0;
+  for (i = 0; i < count; i++) {
+    total = total + weight[i];
+    if (weight[i] > 0.0)
+      last = i;
+  }
+  step = total/draws;
+  offset = MTrandDec();
+
+  k = added = 0;
+  sum = 0.0;
+  x = offset*step;
+  for (i = 0; (i < count) && (k < draws); i++) {
+    sum = sum + weight[i];
+    while ((k < draws) && (x < sum)) {
+      if (children[i] == 0)
+	fresh[added++] = i;
+      children[i]++;
+      k++;
+      x = (k + ((scheme == RESAMPLE_STRATIFIED) ? MTrandDec() : offset))*step;
+    }
+  }
+  // Rounding can leave the last draws just past the end of the sum
+  if (k < draws) {
+    if (children[last] == 0)
+      fresh[added++] = last;
+    children[last] += draws - k;
+  }
+  return added;
+}
+
+
+//
+// Heaviest
+//
+// Returns the k-th heaviest (from 0) of the n weights in value, which are reordered.
+//
+static double Heaviest(int n, int k)
+{
+  int low, high, i, j;
+  double pivot, swap;
+
+  low = 0;
+  high = n-1;
+  while (low < high) {
+    pivot = value[(low + high)/2];
+    i = low;
+    j = high;
+    while (i <= j) {
+      while (value[i] > pivot)
+	i++;
+      while (value[j] < pivot)
+	j--;
+      if (i <= j) {
+	swap = value[i];
+	value[i] = value[j];
+	value[j] = swap;
+	i++;
+	j--;
+      }
+    }
+    if (k <= j)
+      high = j;
+    else if (k >= i)
+      low = i;
+    else
+      break;
+  }
+  return value[k];
+}
+
+
+int ResampleBy(int scheme, const double weight[], int count, int draws, int limit, int children[])
+{
+  int i, k, first, added, kept, given;
+  double least;
+
+  if ((count <= 0) || (draws <= 0) || (limit <= 0))
+    return 0;
+  Room(count);
+  if (scheme == RESAMPLE_MULTINOMIAL)
+    return Multinomial(weight, count, draws, limit, children);
+
+  added = Comb(scheme, weight, count, draws, children);
+  given = draws;
+  if (added <= limit)
+    return given;
+
+  // Too many samples were given children. Keep the heaviest limit of them, and take back the
+  // children of the rest. Those that weigh the same as the lightest one kept are taken in turn
+  // from a random place, so that ties do not always go to the first samples.
+  for (i = 0; i < added; i++)
+    value[i] = weight[fresh[i]];
+  least = Heaviest(added, limit-1);
+  kept = 0;
+  for (i = 0; i < added; i++)
+    if (weight[fresh[i]] > least)
+      kept++;
+  first = (int) (MTrandDec()*added);
+  for (i = 0; i < added; i++) {
+    k = fresh[(first + i) % added];
+    if ((weight[k] < least) || ((weight[k] == least) && (kept++ >= limit))) {
+      given = given - children[k];
+      children[k] = 0;
+    }
+  }
+  return given;
+}
+
+
+int Resample(const double weight[], int count, int draws, int limit, int children[])
+{
+  return ResampleBy(RESAMPLE_SCHEME, weight, count, draws, limit, children);
+}
@@ -0,0 +1,45 @@
+//
+// resample.h
+//
+// Resampling: how many children each sample gets in the next generation, by its weight. Both
+// levels resample the same way (Localize in low.c, HighLocalize in high.c), with a limit on how
+// many distinct samples can have children, since each one that does takes up a particle. The
+// schemes are:
+//
+//   multinomial   every child is an independent draw, which is what DP-SLAM has always done
+//                 ("roulette wheel"). Stops drawing once limit samples have children.
+//   systematic    one random offset, and the children evenly spaced from it over the weights, so
+//                 a sample with weight w gets within one of draws*w children
+//   stratified    the weights are split into draws equal strata, with one independent draw in
+//                 each; in between the other two
+//
+// Systematic and stratified resampling give each sample close to its share of the children, where
+// multinomial leaves it to chance, so fewer good samples are lost to bad luck and fewer copies are
+// made of poor ones (resamplebench measures how much). Their draws come in increasing order, so
+// all of them are found in one pass over the running sum of the weights. Multinomial draws are
+// each found by a binary search of the running sum, which gives the same children the old linear
+// walk did, with the same random numbers.
+//
+// When more than limit samples get children from systematic or stratified resampling, only the
+// heaviest limit of them keep theirs, and the rest of the children are left for the caller to
+// give out among the ones kept, as it does when multinomial resampling stops early.
+//
+// Everything here is used by the SLAM thread only.
+//
+
+#define RESAMPLE_MULTINOMIAL 0
+#define RESAMPLE_SYSTEMATIC 1
+#define RESAMPLE_STRATIFIED 2
+
+// How samples are resampled. Set with -d.
+extern int RESAMPLE_SCHEME;
+
+// Returns the scheme with the given name, or -1 if there is none.
+int ResampleScheme(const char *name);
+const char *ResampleSchemeName(int scheme);
+// Adds up to draws children to children[], among the count weights (which need not add up to 1),
+// by RESAMPLE_SCHEME, so that no more than limit samples that had none are given any. Returns how
+// many children were given.
+int Resample(const double weight[], int count, int draws, int limit, int children[]);
+// The same, by a given scheme.
+int ResampleBy(int scheme, const double weight[], int count, int draws, int limit, int children[]);
@@ -0,0 +1,279 @@
+//
+// resamplebench.cpp
+//
+// Compares the resampling schemes (resample.c) on weights like those Localize resamples, and times
+// them against the old roulette wheel, which walked the samples from the first for every draw.
+//
+//   resamplebench [samples [particles [trials]]]
+//
+// Each generation gives out as many children as there are samples (SAMPLE_NUMBER by default), with
+// at most particles of the samples having any, and then the rest among those kept, as Localize
+// does. For each scheme it reports, averaged over the trials:
+//
+//   variance   the squared difference between each sample's children and its share of them
+//              (samples times its weight), summed and divided by samples. The noise resampling
+//              adds to the filter; 1 - the sum of the squared weights for multinomial resampling
+//              when the limit is not reached.
+//   kept       how many samples had children
+//   lost       how many samples that were due at least one child got none
+//   us         microseconds per generation
+//
+// on three sets of weights: flat (every sample the same), culled (a sixteenth of them left, the rest
+// culled, as after Localize's passes) and wide (all of them left, spread out enough that more than
+// particles of them are due children, so the limit matters). It also checks that multinomial
+// resampling gives the same children the old walk did, with the same random numbers.
+//
+
+#include <sys/time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "mt-rand.h"
+#include "resample.h"
+
+// The default numbers of samples and particles, as in map.h
+#define BENCH_SAMPLES 500
+#define BENCH_PARTICLES 50
+#define BENCH_TRIALS 20000
+// The spread of the log weights that survive culling, as THRESH in low.c
+#define BENCH_SPREAD 13.0
+
+
+//
+// Now
+//
+static double Now()
+{
+  struct timeval time;
+
+  gettimeofday(&time, NULL);
+  return time.tv_sec + time.tv_usec/1e6;
+}
+
+
+//
+// OldGeneration
+//
+// Resampling as Localize did it before resample.c, the roulette wheel walked from the first sample
+// for every draw. Returns how many samples have children.
+//
+static int OldGeneration(const double weight[], int samples, int particles, int children[])
+{
+  double *kept = new double[samples];
+  int *which = new int[samples];
+  double total, ftemp;
+  int i, j, k, n;
+
+  total = 0.0;
+  for (i = 0; i < samples; i++) {
+    children[i] = 0;
+    total = total + weight[i];
+  }
+  i = j = 0;
+  while ((j < samples) && (i < particles)) {
+    k = 0;
+    ftemp = MTrandDec()*total;
+    while (ftemp > weight[k]) {
+      ftemp = ftemp - weight[k];
+      k++;
+    }
+    if (children[k] == 0)
+      i++;
+    children[k]++;
+    j++;
+  }
+
+  // The rest go to those kept, renormalized
+  n = 0;
+  for (k = 0; k < samples; k++)
+    if (children[k] > 0) {
+      which[n] = k;
+      kept[n++] = weight[k];
+    }
+  total = 0.0;
+  for (k = 0; k < n; k++)
+    total = total + kept[k];
+  for (k = 0; k < n; k++)
+    kept[k] = kept[k]/total;
+  total = 0.0;
+  for (k = 0; k < n; k++)
+    total = total + kept[k];
+  for (; j < samples; j++) {
+    k = 0;
+    ftemp = MTrandDec()*total;
+    while (ftemp > kept[k]) {
+      ftemp = ftemp - kept[k];
+      k++;
+    }
+    children[which[k]]++;
+  }
+
+  delete [] kept;
+  delete [] which;
+  return i;
+}
+
+
+//
+// Generation
+//
+// The same, by a given scheme of resample.c.
+//
+static int Generation(int scheme, const double weight[], int samples, int particles, int children[])
+{
+  double *kept = new double[samples];
+  int *which = new int[samples];
+  int *extra = new int[samples]; // the children of those kept
+  double total;
+  int j, k, n;
+
+  for (k = 0; k < samples; k++)
+    children[k] = 0;
+  j = ResampleBy(scheme, weight, samples, samples, particles, children);
+
+  n = 0;
+  for (k = 0; k < samples; k++)
+    if (children[k] > 0) {
+      which[n] = k;
+      kept[n] = weight[k];
+      extra[n++] = children[k];
+    }
+  if (j < samples) {
+    total = 0.0;
+    for (k = 0; k < n; k++)
+      total = total + kept[k];
+    for (k = 0; k < n; k++)
+      kept[k] = kept[k]/total;
+    ResampleBy(scheme, kept, n, samples - j, n, extra);
+    for (k = 0; k < n; k++)
+      children[which[k]] = extra[k];
+  }
+
+  delete [] kept;
+  delete [] which;
+  delete [] extra;
+  return n;
+}
+
+
+//
+// Weights
+//
+// Fills in one of the sets of weights, normalized.
+//
+static void Weights(const char *set, double weight[], int samples, int particles)
+{
+  double total = 0.0;
+  int i;
+
+  srand(1);
+  for (i = 0; i < samples; i++) {
+    if (!strcmp(set, "flat"))
+      weight[i] = 1.0;
+    else if (!strcmp(set, "culled"))
+      weight[i] = (rand() % 16 == 0) ? exp(-BENCH_SPREAD*(rand() % 1000)/1000.0) : 0.0;
+    else
+      weight[i] = exp(-log((double) samples/particles)*(rand() % 1000)/1000.0);
+    total = total + weight[i];
+  }
+  for (i = 0; i < samples; i++)
+    weight[i] = weight[i]/total;
+}
+
+
+//
+// Bench
+//
+// Runs one scheme (or the old walk, for -1) on one set of weights, and prints what it did.
+//
+static void Bench(int scheme, const double weight[], int samples, int particles, int trials)
+{
+  int *children = new int[samples];
+  double variance = 0.0, kept = 0.0, lost = 0.0, start, time;
+  int t, i;
+
+  seedMT(1);
+  start = Now();
+  for (t = 0; t < trials; t++) {
+    if (scheme == -1)
+      OldGeneration(weight, samples, particles, children);
+    else
+      Generation(scheme, weight, samples, particles, children);
+    for (i = 0; i < samples; i++) {
+      variance = variance + (children[i] - samples*weight[i])*(children[i] - samples*weight[i]);
+      if (children[i] > 0)
+	kept++;
+      else if (samples*weight[i] >= 1.0)
+	lost++;
+    }
+  }
+  time = Now() - start;
+
+  printf("  %-12s %9.4f %7.1f %7.2f %9.2f\n", (scheme == -1) ? "old walk" : ResampleSchemeName(scheme),
+	 variance/samples/trials, kept/trials, lost/trials, time*1e6/trials);
+  delete [] children;
+}
+
+
+//
+// Same
+//
+// Checks that multinomial resampling gives the same children as the old walk. Returns 0 if so.
+//
+static int Same(const double weight[], int samples, int particles, int trials)
+{
+  int *oldChildren = new int[samples], *children = new int[samples];
+  int t, i, differ = 0;
+
+  for (t = 0; (t < trials) && (!differ); t++) {
+    seedMT(t+1);
+    OldGeneration(weight, samples, particles, oldChildren);
+    seedMT(t+1);
+    Generation(RESAMPLE_MULTINOMIAL, weight, samples, particles, children);
+    for (i = 0; i < samples; i++)
+      if (children[i] != oldChildren[i])
+	differ = 1;
+  }
+  delete [] oldChildren;
+  delete [] children;
+  return differ;
+}
+
+
+int main(int argc, char *argv[])
+{
+  const char *set[] = { "flat", "culled", "wide" };
+  int samples = BENCH_SAMPLES, particles = BENCH_PARTICLES, trials = BENCH_TRIALS;
+  int s, scheme, result = 0;
+  double *weight;
+
+  if (argc > 1)
+    samples = atoi(argv[1]);
+  if (argc > 2)
+    particles = atoi(argv[2]);
+  if (argc > 3)
+    trials = atoi(argv[3]);
+  if ((argc > 4) || (samples <= 0) || (particles <= 0) || (trials <= 0)) {
+    fprintf(stderr, "Usage: %s [samples [particles [trials]]]\n", argv[0]);
+    return 1;
+  }
+
+  weight = new double[samples];
+  printf("%d samples, at most %d kept, %d trials\n", samples, particles, trials);
+  for (s = 0; s < (int) (sizeof(set)/sizeof(set[0])); s++) {
+    Weights(set[s], weight, samples, particles);
+    printf("%s:\n", set[s]);
+    printf("  %-12s %9s %7s %7s %9s\n", "", "variance", "kept", "lost", "us");
+    Bench(-1, weight, samples, particles, trials);
+    for (scheme = RESAMPLE_MULTINOMIAL; scheme <= RESAMPLE_STRATIFIED; scheme++)
+      Bench(scheme, weight, samples, particles, trials);
+    if (Same(weight, samples, particles, (trials < 1000) ? trials : 1000) != 0) {
+      printf("  MISMATCH: multinomial did not give the children the old walk did\n");
+      result = 1;
+    }
+  }
+  delete [] weight;
+  return result;
+}
@@ -0,0 +1,115 @@
+//
+// scans.c
+//
+// The pool of scans shared by the low and high levels. See scans.h.
+//
+// The pool's blocks are charged to the memory budget like everything else, and kept for the rest
+// of the run.
+//
+
+#include <string.h>
+
+#include "map.h"
+
+// The scans in the pool, not in use
+static TScan *freeScans = NULL;
+
+
+//
+// ScanGrow
+//
+// Adds a block of SCAN_BLOCK scans to the pool.
+//
+static void ScanGrow()
+{
+  char *block;
+  TScan *scan;
+  int i;
+
+  block = (char *) BudgetMalloc(SCAN_BLOCK * SCAN_SIZE);
+  for (i = 0; i < SCAN_BLOCK; i++) {
+    scan = (TScan *) (block + i*SCAN_SIZE);
+    scan->references = 0;
+    scan->next = freeScans;
+    freeScans = scan;
+  }
+}
+
+
+TScan *ScanNew(TSense sense)
+{
+  TScan *scan;
+
+  if (freeScans == NULL)
+    ScanGrow();
+  scan = freeScans;
+  freeScans = scan->next;
+  scan->references = 1;
+  scan->next = NULL;
+  memcpy(scan->sense, sense, SENSE_NUMBER*sizeof(TSenseSample));
+  return scan;
+}
+
+
+TScan *ScanShare(TScan *scan)
+{
+  scan->references++;
+  return scan;
+}
+
+
+void ScanRelease(TScan *scan)
+{
+  if (scan == NULL)
+    return;
+  scan->references--;
+  if (scan->references == 0) {
+    scan->next = freeScans;
+    freeScans = scan;
+  }
+}
+
+
+TSenseLog *SenseLogNew()
+{
+  TSenseLog *log;
+
+  log = (TSenseLog *) BudgetMalloc(sizeof(TSenseLog));
+  log->count = 0;
+  log->size = 0;
+  log->scan = NULL;
+  return log;
+}
+
+
+//
+// SenseLogAppend
+//
+// The log starts with room for 64 scans, more than a segment of LOW_DURATION steps needs, and
+// doubles when it is full, so it stays a few allocations a segment however long they are.
+//
+void SenseLogAppend(TSenseLog *log, TScan *scan)
+{
+  TScan **grown;
+
+  if (log->count == log->size) {
+    log->size = (log->size == 0) ? 64 : 2*log->size;
+    grown = (TScan **) BudgetMalloc(log->size * sizeof(TScan *));
+    if (log->count > 0)
+      memcpy(grown, log->scan, log->count * sizeof(TScan *));
+    BudgetFree(log->scan);
+    log->scan = grown;
+  }
+  log->scan[log->count++] = ScanShare(scan);
+}
+
+
+void SenseLogFree(TSenseLog *log)
+{
+  int i;
+
+  for (i = 0; i < log->count; i++)
+    ScanRelease(log->scan[i]);
+  BudgetFree(log->scan);
+  BudgetFree(log);
+}
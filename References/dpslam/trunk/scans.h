@@ -0,0 +1,53 @@
+//
+// scans.h
+//
+// The scans SLAM localizes against. Each one is written once, into a TScan from a pool, when the
+// low level takes it up, and is then shared rather than copied: the low level's holding pen
+// (hold[] in low.c), which replays the end of one segment at the start of the next, and the
+// observation log handed to the high level each hold a reference. A scan goes back to the pool
+// when the last reference is let go, and an observation log lets go of all of its scans at once
+// when the segment is done with. Readings SLAM skips (the robot has not moved far enough) never
+// come into the pool at all.
+//
+// Only a couple of segments' worth of scans are ever in use, so once the pool has grown to that
+// its slots are reused from then on, and the low level makes no allocations for its scans. Scans
+// are only allocated room for the SENSE_NUMBER readings they actually have (see beams.h).
+//
+// Everything here is used by the SLAM thread only.
+//
+
+// The number of scans the pool grows by when it runs out
+#define SCAN_BLOCK 32
+
+// A scan. Like TSense, sense has room for the most readings a scan can have, so it comes last, and
+// a scan is only allocated SCAN_SIZE.
+struct TScan_struct {
+  // The references to the scan, or, while it is in the pool, the next free scan
+  int references;
+  struct TScan_struct *next;
+  TSense sense;
+};
+typedef struct TScan_struct TScan;
+#define SCAN_SIZE ((offsetof(TScan, sense) + SENSE_NUMBER*sizeof(TSenseSample) + 7) & ~(size_t) 7)
+
+// The scans of one segment of the low level, in order, passed up to the high level along with the
+// path (see TPath). The first scan is where the segment starts, before the first step of the path.
+struct TSenseLog_struct {
+  int count, size;
+  TScan **scan;
+};
+typedef struct TSenseLog_struct TSenseLog;
+
+// A scan from the pool holding a copy of sense, with one reference.
+TScan *ScanNew(TSense sense);
+// Adds a reference to a scan, and returns it.
+TScan *ScanShare(TScan *scan);
+// Lets go of a reference to a scan (which can be NULL).
+void ScanRelease(TScan *scan);
+
+// An empty observation log.
+TSenseLog *SenseLogNew();
+// Adds a reference to a scan to the end of a log.
+void SenseLogAppend(TSenseLog *log, TScan *scan);
+// Lets go of all of the scans in a log, and the log itself.
+void SenseLogFree(TSenseLog *log);
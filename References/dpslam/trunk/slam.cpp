@@ -29,6 +29,9 @@
 
 #include "high.h"
 #include "mt-rand.h"
+#include "beams.h"
+#include "workers.h"
+#include "resample.h"
 
 // The initial seed used for the random number generated can be set here.
 #define SEED 1
@@ -92,26 +95,6 @@ int InitializeRobot(int argc, char *argv[]) {
 }
 
 
-//
-// WriteLog
-//
-// Prints to file the data that we would normally be getting from sensors, such as the laser and the odometry.
-// This allows us to later play back the exact run, with different parameters.
-// All readings are in meters or radians.
-//
-void WriteLog(FILE *logFile, TSense sense) 
-{ 
-  int i;
-
-  fprintf(logFile, "Odometry %.6f %.6f %.6f \n", odometry.x, odometry.y, odometry.theta);
-  fprintf(logFile, "Laser %d ", SENSE_NUMBER);
-  for (i = 0; i < SENSE_NUMBER; i++)
-    fprintf(logFile, "%.6f ", sense[i].distance/MAP_SCALE);
-  fprintf(logFile, "\n");
-}
- 
-
-
 //
 // This calls the procedures in the other files which do all the real work. 
 // If you wanted to not use hierarchical SLAM, you could remove all references here to High*, and make
@@ -120,7 +103,7 @@ void WriteLog(FILE *logFile, TSense sense)
 void *Slam(void *a)
 {
   TPath *path, *trashPath;
-  TSenseLog *obs, *trashObs;
+  TSenseLog *obs;
 
   InitHighSlam();
   InitLowSlam();
@@ -133,16 +116,13 @@ void *Slam(void *a)
     while (path != NULL) {
       trashPath = path;
       path = path->next;
-      free(trashPath);
-    }
-    while (obs != NULL) {
-      trashObs = obs;
-      obs = obs->next;
-      free(trashObs);
+      BudgetFree(trashPath);
     }
+    SenseLogFree(obs);
   }
 
   CloseLowSlam();
+  BudgetReport(stderr);
   return NULL;
 }
 
@@ -161,6 +141,7 @@ int main (int argc, char *argv[])
   //int y;
   //double maxDist, tempDist, tempAngle;
   int WANDER, EXPLORE, DIRECT_COMMAND;
+  long budget = -1;
   pthread_t slam_thread;
     
   RECORDING = "";
@@ -178,8 +159,61 @@ int main (int argc, char *argv[])
     }
     else if (!strncmp(argv[x], "-P", 2))
       PLAYBACK = "current.log";
+    else if ((!strncmp(argv[x], "-s", 2)) && (x+1 < argc)) {
+      x++;
+      PLAYBACK_START = atof(argv[x]);
+    }
+    else if ((!strncmp(argv[x], "-e", 2)) && (x+1 < argc)) {
+      x++;
+      PLAYBACK_END = atof(argv[x]);
+    }
+    else if ((!strncmp(argv[x], "-j", 2)) && (x+1 < argc)) {
+      x++;
+      if ((sscanf(argv[x], "%d/%d", &PLAYBACK_PART, &PLAYBACK_PARTS) != 2) ||
+	  (PLAYBACK_PART < 1) || (PLAYBACK_PART > PLAYBACK_PARTS)) {
+	fprintf(stderr, "-j takes the part to process, as in 2/4\n");
+	return -1;
+      }
+      PLAYBACK_PART--;
+    }
+    else if ((!strncmp(argv[x], "-t", 2)) && (x+1 < argc)) {
+      x++;
+      PLAYBACK_TOPICS = argv[x];
+    }
+    else if ((!strncmp(argv[x], "-b", 2)) && (x+1 < argc)) {
+      x++;
+      SCORE_BEAMS = atoi(argv[x]);
+      if (strchr(argv[x], '/') != NULL)
+	SCORE_POLICY = ScorePolicy(strchr(argv[x], '/') + 1);
+      if ((SCORE_BEAMS < 0) || (SCORE_POLICY == -1)) {
+	fprintf(stderr, "-b takes the number of readings to score, and how to choose them (uniform, information or range), as in 60/range\n");
+	return -1;
+      }
+    }
+    else if (!strncmp(argv[x], "-g", 2))
+      LOW_RASTER = 1;
+    else if ((!strncmp(argv[x], "-d", 2)) && (x+1 < argc)) {
+      x++;
+      RESAMPLE_SCHEME = ResampleScheme(argv[x]);
+      if (RESAMPLE_SCHEME == -1) {
+	fprintf(stderr, "-d takes how to resample: multinomial, systematic or stratified\n");
+	return -1;
+      }
+    }
+    else if ((!strncmp(argv[x], "-w", 2)) && (x+1 < argc)) {
+      x++;
+      WORKER_THREADS = atoi(argv[x]);
+    }
+    else if ((!strncmp(argv[x], "-m", 2)) && (x+1 < argc)) {
+      x++;
+      budget = atol(argv[x]);
+    }
   }
 
+  // Size the maps before anything is allocated
+  if (BudgetConfigure(budget) == -1)
+    return -1;
+
   fprintf(stderr, "********** Localization Example *************\n");
   if (PLAYBACK == "")
     if (InitializeRobot(argc, argv) == -1)
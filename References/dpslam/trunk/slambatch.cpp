@@ -0,0 +1,566 @@
+//
+// slambatch.cpp
+//
+// Maps many capture sessions at once. slambatch watches an upload directory for sessions (anything
+// slam -p plays back: .log, .rec, .dpb, .pfj or .bag files), queues each one once it has finished
+// arriving, and maps it by running slam on it in a folder of its own, several at a time.
+//
+//   slambatch [-j jobs] [-m MB] [-o maps] [-once] [-slam path] uploads [-- slam options]
+//
+// slam keeps all of its state in globals, so each session is mapped by a process of its own, which
+// also keeps a session that crashes or runs out of memory from taking the others with it. A session
+// floor2.pfj is mapped in maps/floor2_pfj, where slam writes its maps, and its output goes to
+// slam.log there. When it finishes, a status file records how it went, and a session with a status
+// file is not mapped again, so slambatch can be stopped and restarted at any time; a session that
+// was still being mapped is started over.
+//
+// A file counts as having arrived once its size and modification time have not changed for one
+// look at the directory (BATCH_POLL seconds). Journals are best uploaded with their session index
+// (.idx) first.
+//
+// Sessions scale better than threads, so as many sessions are run at a time as there are cores,
+// or as memory allows at MB each if that is fewer, and the cores are shared out among them for
+// scoring samples (slam -w; see workers.h). With -m, each session is also held to that budget
+// (see budget.h); without it, MB is taken to be BATCH_JOB_MB and the sessions are not limited.
+// -j sets the number at a time outright. Progress
+// is reported every BATCH_REPORT seconds. -once stops once every session in the directory has
+// been mapped, instead of watching for more. Anything after "--" is passed on to slam, such as
+// -b 60/range.
+//
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN(A,B) ((A) >= (B) ? (B) : (A))
+#define MAX(A,B) ((A) >= (B) ? (A) : (B))
+
+// Seconds between looks at the upload directory, and between progress reports
+#define BATCH_POLL 2
+#define BATCH_REPORT 10
+// The memory a session is taken to need when it has no budget, in MB. loop5.log peaks at about
+// 250 MB; a long session builds more map.
+#define BATCH_JOB_MB 512
+// The most sessions mapped at once
+#define BATCH_MAX_JOBS 64
+// The most options passed on to slam
+#define BATCH_MAX_OPTIONS 32
+
+// What has become of a session
+#define SESSION_ARRIVING 0   // Still being uploaded, as far as we know
+#define SESSION_QUEUED 1
+#define SESSION_RUNNING 2
+#define SESSION_DONE 3
+#define SESSION_FAILED 4
+#define SESSION_MAPPED 5     // Mapped before slambatch started
+
+struct TSession_struct {
+  char name[NAME_MAX+1];
+  // The size and modification time at the last look
+  off_t size;
+  time_t modified;
+  int state;
+  // The order it was queued in
+  long queued;
+  // The slam process mapping it, its output, and the end of the output not yet read as a line
+  pid_t pid;
+  int output;
+  FILE *log;
+  char line[256];
+  size_t lineLength;
+  // Scans mapped so far, and when the mapping started and ended
+  long scans;
+  double started, finished;
+};
+typedef struct TSession_struct TSession;
+
+TSession *session;
+int sessions, sessionSize;
+long queuedCount;
+volatile sig_atomic_t stopping;
+
+
+//
+// Now
+//
+static double Now()
+{
+  struct timeval time;
+
+  gettimeofday(&time, NULL);
+  return time.tv_sec + time.tv_usec/1e6;
+}
+
+
+//
+// Stop
+//
+static void Stop(int signal)
+{
+  stopping = 1;
+}
+
+
+//
+// IsSession
+//
+// Returns TRUE if a file name is something slam plays back.
+//
+static int IsSession(const char *name)
+{
+  static const char *extension[] = {".log", ".rec", ".dpb", ".pfj", ".bag"};
+  size_t length = strlen(name);
+  int i;
+
+  for (i = 0; i < (int) (sizeof(extension)/sizeof(extension[0])); i++)
+    if ((length > 4) && (strcmp(name + length - 4, extension[i]) == 0))
+      return 1;
+  return 0;
+}
+
+
+//
+// Folder
+//
+// The folder a session is mapped in: floor2.pfj is mapped in maps/floor2_pfj.
+//
+static void Folder(const char *maps, const char *name, char *folder, size_t size)
+{
+  char *dot;
+
+  snprintf(folder, size, "%s/%s", maps, name);
+  dot = strrchr(folder, '.');
+  if (dot != NULL)
+    *dot = '_';
+}
+
+
+//
+// AvailableMB
+//
+// The memory that can be given to sessions without pushing anything else out.
+//
+static long AvailableMB()
+{
+  FILE *meminfo;
+  char line[256];
+  long kb = -1;
+
+  meminfo = fopen("/proc/meminfo", "r");
+  if (meminfo != NULL) {
+    while (fgets(line, sizeof(line), meminfo) != NULL)
+      if (sscanf(line, "MemAvailable: %ld kB", &kb) == 1)
+	break;
+    fclose(meminfo);
+  }
+  if (kb < 0)
+    kb = sysconf(_SC_PHYS_PAGES) * (sysconf(_SC_PAGESIZE) / 1024);
+  return kb / 1024;
+}
+
+
+//
+// Look
+//
+// Looks at the upload directory. New sessions are noted, and any whose size and time have not
+// changed since the last look are queued, unless they have been mapped already.
+//
+static void Look(const char *uploads, const char *maps)
+{
+  DIR *directory;
+  struct dirent *entry;
+  struct stat status;
+  char path[PATH_MAX];
+  TSession *s;
+  int i;
+
+  directory = opendir(uploads);
+  if (directory == NULL) {
+    fprintf(stderr, "Unable to read %s\n", uploads);
+    return;
+  }
+  while ((entry = readdir(directory)) != NULL) {
+    if (!IsSession(entry->d_name))
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", uploads, entry->d_name);
+    if ((stat(path, &status) != 0) || (!S_ISREG(status.st_mode)))
+      continue;
+
+    for (i = 0; i < sessions; i++)
+      if (strcmp(session[i].name, entry->d_name) == 0)
+	break;
+    if (i == sessions) {
+      if (sessions == sessionSize) {
+	s = (TSession *) realloc(session, (sessionSize + 64) * sizeof(TSession));
+	if (s == NULL)
+	  break;
+	session = s;
+	sessionSize = sessionSize + 64;
+      }
+      s = &session[sessions++];
+      memset(s, 0, sizeof(TSession));
+      strcpy(s->name, entry->d_name);
+      s->size = status.st_size;
+      s->modified = status.st_mtime;
+      s->output = -1;
+      s->state = SESSION_ARRIVING;
+      Folder(maps, s->name, path, sizeof(path));
+      strncat(path, "/status", sizeof(path) - strlen(path) - 1);
+      if (access(path, F_OK) == 0)
+	s->state = SESSION_MAPPED;
+      continue;
+    }
+
+    s = &session[i];
+    if (s->state != SESSION_ARRIVING)
+      continue;
+    if ((s->size == status.st_size) && (s->modified == status.st_mtime)) {
+      s->state = SESSION_QUEUED;
+      s->queued = queuedCount++;
+    }
+    s->size = status.st_size;
+    s->modified = status.st_mtime;
+  }
+  closedir(directory);
+}
+
+
+//
+// Start
+//
+// Starts slam on a session, in its own folder. Returns -1 if it could not be started.
+//
+static int Start(TSession *s, const char *uploads, const char *maps, const char *slam, long budget,
+		 int threads, int options, char *option[])
+{
+  char folder[PATH_MAX], path[PATH_MAX+16], input[PATH_MAX], megabytes[32], workers[32];
+  char *argv[BATCH_MAX_OPTIONS + 8];
+  int fds[2], argc = 0, i, null;
+
+  Folder(maps, s->name, folder, sizeof(folder));
+  snprintf(path, sizeof(path), "%s/%s", uploads, s->name);
+  if ((mkdir(folder, 0777) != 0) && (errno != EEXIST))
+    return -1;
+  if (realpath(path, input) == NULL)
+    return -1;
+  snprintf(path, sizeof(path), "%s/slam.log", folder);
+  s->log = fopen(path, "w");
+  if (s->log == NULL)
+    return -1;
+  if (pipe(fds) != 0) {
+    fclose(s->log);
+    return -1;
+  }
+
+  argv[argc++] = (char *) slam;
+  argv[argc++] = (char *) "-p";
+  argv[argc++] = input;
+  if (budget > 0) {
+    snprintf(megabytes, sizeof(megabytes), "%ld", budget);
+    argv[argc++] = (char *) "-m";
+    argv[argc++] = megabytes;
+  }
+  snprintf(workers, sizeof(workers), "%d", threads);
+  argv[argc++] = (char *) "-w";
+  argv[argc++] = workers;
+  for (i = 0; i < options; i++)
+    argv[argc++] = option[i];
+  argv[argc] = NULL;
+
+  s->pid = fork();
+  if (s->pid == 0) {
+    // slam writes its maps where it runs, and everything it has to say goes to slam.log
+    null = open("/dev/null", O_RDONLY);
+    dup2(null, 0);
+    dup2(fds[1], 1);
+    dup2(fds[1], 2);
+    close(fds[0]);
+    close(fds[1]);
+    close(null);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    if (chdir(folder) == 0)
+      execv(slam, argv);
+    _exit(127);
+  }
+  close(fds[1]);
+  if (s->pid < 0) {
+    close(fds[0]);
+    fclose(s->log);
+    return -1;
+  }
+  s->output = fds[0];
+  s->lineLength = 0;
+  s->scans = 0;
+  s->started = Now();
+  s->state = SESSION_RUNNING;
+  return 0;
+}
+
+
+//
+// Read
+//
+// Copies what slam has written to slam.log, and counts the scans it has mapped (each localization
+// prints a line starting "-- " with the iteration and the best pose). Returns 0 at the end of the
+// output.
+//
+static int Read(TSession *s)
+{
+  char buffer[4096];
+  ssize_t got;
+  int i;
+
+  got = read(s->output, buffer, sizeof(buffer));
+  if ((got < 0) && ((errno == EINTR) || (errno == EAGAIN)))
+    return 1;
+  if (got <= 0)
+    return 0;
+  fwrite(buffer, 1, got, s->log);
+
+  for (i = 0; i < got; i++) {
+    if (buffer[i] == '\n') {
+      s->line[s->lineLength] = '\0';
+      if (strstr(s->line, "-- ") != NULL)
+	s->scans++;
+      s->lineLength = 0;
+    }
+    else if (s->lineLength < sizeof(s->line) - 1)
+      s->line[s->lineLength++] = buffer[i];
+  }
+  return 1;
+}
+
+
+//
+// Finish
+//
+// Collects a finished slam and records how it went in the session's status file.
+//
+static void Finish(TSession *s, const char *maps)
+{
+  char path[PATH_MAX];
+  FILE *file;
+  int status;
+
+  while ((waitpid(s->pid, &status, 0) == -1) && (errno == EINTR))
+    ;
+  close(s->output);
+  s->output = -1;
+  fclose(s->log);
+  s->log = NULL;
+  s->finished = Now();
+  s->state = ((WIFEXITED(status)) && (WEXITSTATUS(status) == 0)) ? SESSION_DONE : SESSION_FAILED;
+
+  if (WIFEXITED(status))
+    fprintf(stderr, "%s: %s, %ld scans in %.0f s (exit %d)\n", s->name, (s->state == SESSION_DONE) ? "mapped" : "failed",
+	    s->scans, s->finished - s->started, WEXITSTATUS(status));
+  else
+    fprintf(stderr, "%s: failed, %ld scans in %.0f s (signal %d)\n", s->name, s->scans, s->finished - s->started,
+	    WTERMSIG(status));
+
+  Folder(maps, s->name, path, sizeof(path));
+  strncat(path, "/status", sizeof(path) - strlen(path) - 1);
+  file = fopen(path, "w");
+  if (file == NULL)
+    return;
+  fprintf(file, "%s\n", (s->state == SESSION_DONE) ? "mapped" : "failed");
+  if (WIFEXITED(status))
+    fprintf(file, "exit %d\n", WEXITSTATUS(status));
+  else
+    fprintf(file, "signal %d\n", WTERMSIG(status));
+  fprintf(file, "scans %ld\nseconds %.1f\n", s->scans, s->finished - s->started);
+  fclose(file);
+}
+
+
+//
+// Report
+//
+// Prints what is running and waiting, and the scans mapped since the last report.
+//
+static void Report(double elapsed, double interval, long *lastScans)
+{
+  int count[SESSION_MAPPED+1], i;
+  long scans = 0;
+
+  memset(count, 0, sizeof(count));
+  for (i = 0; i < sessions; i++) {
+    count[session[i].state]++;
+    if (session[i].state != SESSION_MAPPED)
+      scans = scans + session[i].scans;
+  }
+  fprintf(stderr, "[%.0f s] %d mapping, %d queued, %d arriving, %d mapped, %d failed; %ld scans, %.1f a second",
+	  elapsed, count[SESSION_RUNNING], count[SESSION_QUEUED], count[SESSION_ARRIVING], count[SESSION_DONE],
+	  count[SESSION_FAILED], scans, (interval > 0) ? (scans - *lastScans) / interval : 0.0);
+  if (elapsed > 0)
+    fprintf(stderr, ", %.1f sessions an hour", (count[SESSION_DONE] + count[SESSION_FAILED]) * 3600.0 / elapsed);
+  fprintf(stderr, "\n");
+  for (i = 0; i < sessions; i++)
+    if (session[i].state == SESSION_RUNNING)
+      fprintf(stderr, "    %s: %ld scans, %.0f s\n", session[i].name, session[i].scans, Now() - session[i].started);
+  *lastScans = scans;
+}
+
+
+int main(int argc, char *argv[])
+{
+  struct pollfd fds[BATCH_MAX_JOBS];
+  TSession *ready[BATCH_MAX_JOBS];
+  char slam[PATH_MAX+8], self[PATH_MAX], *slash;
+  const char *uploads = NULL, *maps = "maps", *slamPath = NULL;
+  char **option = NULL;
+  int jobs = 0, threads, once = 0, options = 0, running, waiting, timeout, i, n;
+  long budget = 0, perJob, cores, lastScans = 0;
+  double begin, nextLook, nextReport, lastReport;
+  TSession *next;
+
+  for (i = 1; i < argc; i++) {
+    if ((!strcmp(argv[i], "-j")) && (i+1 < argc))
+      jobs = atoi(argv[++i]);
+    else if ((!strcmp(argv[i], "-m")) && (i+1 < argc))
+      budget = atol(argv[++i]);
+    else if ((!strcmp(argv[i], "-o")) && (i+1 < argc))
+      maps = argv[++i];
+    else if ((!strcmp(argv[i], "-slam")) && (i+1 < argc))
+      slamPath = argv[++i];
+    else if (!strcmp(argv[i], "-once"))
+      once = 1;
+    else if (!strcmp(argv[i], "--")) {
+      option = argv + i + 1;
+      options = argc - i - 1;
+      break;
+    }
+    else if ((argv[i][0] != '-') && (uploads == NULL))
+      uploads = argv[i];
+    else
+      uploads = NULL, i = argc;
+  }
+  if ((uploads == NULL) || (jobs < 0) || (budget < 0) || (options > BATCH_MAX_OPTIONS)) {
+    fprintf(stderr, "Usage: %s [-j jobs] [-m MB] [-o maps] [-once] [-slam path] uploads [-- slam options]\n", argv[0]);
+    return 1;
+  }
+
+  // slam is taken to be next to slambatch, unless we are told otherwise
+  if (slamPath == NULL) {
+    n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    self[(n > 0) ? n : 0] = '\0';
+    slash = strrchr(self, '/');
+    if (slash != NULL)
+      *slash = '\0';
+    snprintf(slam, sizeof(slam), "%s/slam", (slash != NULL) ? self : ".");
+  }
+  else if (realpath(slamPath, slam) == NULL)
+    slam[0] = '\0';
+  if (access(slam, X_OK) != 0) {
+    fprintf(stderr, "Unable to find slam (%s); give its path with -slam\n", slam);
+    return 1;
+  }
+  if ((mkdir(maps, 0777) != 0) && (errno != EEXIST)) {
+    fprintf(stderr, "Unable to create %s\n", maps);
+    return 1;
+  }
+
+  // One session a core, as far as memory goes
+  cores = sysconf(_SC_NPROCESSORS_ONLN);
+  perJob = (budget > 0) ? budget : BATCH_JOB_MB;
+  if (jobs == 0) {
+    jobs = MIN(cores, AvailableMB() / perJob);
+    if (jobs < 1)
+      jobs = 1;
+  }
+  if (jobs > BATCH_MAX_JOBS)
+    jobs = BATCH_MAX_JOBS;
+  threads = MAX(1, cores / jobs);
+  fprintf(stderr, "Mapping sessions from %s into %s, %d at a time on %d threads each (%ld cores, %ld MB available, %ld MB each)\n",
+	  uploads, maps, jobs, threads, cores, AvailableMB(), perJob);
+
+  signal(SIGINT, Stop);
+  signal(SIGTERM, Stop);
+  signal(SIGPIPE, SIG_IGN);
+
+  begin = Now();
+  nextLook = begin;
+  nextReport = begin + BATCH_REPORT;
+  lastReport = begin;
+  while (!stopping) {
+    if (Now() >= nextLook) {
+      Look(uploads, maps);
+      nextLook = Now() + BATCH_POLL;
+    }
+
+    // Start the sessions that have waited longest, while there is room
+    running = 0;
+    for (i = 0; i < sessions; i++)
+      if (session[i].state == SESSION_RUNNING)
+	running++;
+    while (running < jobs) {
+      next = NULL;
+      for (i = 0; i < sessions; i++)
+	if ((session[i].state == SESSION_QUEUED) && ((next == NULL) || (session[i].queued < next->queued)))
+	  next = &session[i];
+      if (next == NULL)
+	break;
+      if (Start(next, uploads, maps, slam, budget, threads, options, option) != 0) {
+	fprintf(stderr, "%s: unable to start slam\n", next->name);
+	next->state = SESSION_FAILED;
+	continue;
+      }
+      fprintf(stderr, "%s: mapping\n", next->name);
+      running++;
+    }
+
+    waiting = 0;
+    for (i = 0; i < sessions; i++)
+      if ((session[i].state == SESSION_ARRIVING) || (session[i].state == SESSION_QUEUED))
+	waiting++;
+    if ((once) && (running == 0) && (waiting == 0))
+      break;
+
+    // Wait for output until the next look or report
+    n = 0;
+    for (i = 0; i < sessions; i++)
+      if (session[i].state == SESSION_RUNNING) {
+	fds[n].fd = session[i].output;
+	fds[n].events = POLLIN;
+	ready[n++] = &session[i];
+      }
+    // Never negative, which would wait forever if looking or starting ran past the next report
+    timeout = MAX(0, (int) (1000 * (MIN(nextLook, nextReport) - Now())) + 1);
+    if (poll(fds, n, timeout) > 0)
+      for (i = 0; i < n; i++)
+	if ((fds[i].revents != 0) && (Read(ready[i]) == 0))
+	  Finish(ready[i], maps);
+
+    if (Now() >= nextReport) {
+      Report(Now() - begin, Now() - lastReport, &lastScans);
+      lastReport = Now();
+      nextReport = lastReport + BATCH_REPORT;
+    }
+  }
+
+  // Sessions still being mapped are stopped, and mapped again next time
+  for (i = 0; i < sessions; i++)
+    if (session[i].state == SESSION_RUNNING) {
+      kill(session[i].pid, SIGTERM);
+      waitpid(session[i].pid, NULL, 0);
+      close(session[i].output);
+      fclose(session[i].log);
+      session[i].state = SESSION_QUEUED;
+      fprintf(stderr, "%s: stopped\n", session[i].name);
+    }
+  Report(Now() - begin, Now() - lastReport, &lastScans);
+  free(session);
+  return 0;
+}
@@ -0,0 +1,597 @@
+//
+// stream.c
+//
+// Client for the Pre-Fire Mapping handheld's live stream. See stream.h.
+//
+// A receiver thread reads records from the handheld and writes them as a .dpb log (see logfile.h)
+// into a pipe, which ReadLog reads like a file. The log's header is written with the first scan,
+// since that is when we learn how many readings the laser has and where they look.
+// The receiver remembers the next record it needs, so after a dropped connection it reconnects,
+// asks the handheld to resume from there, and the log continues without gaps or repeats.
+//
+// A journal is replayed by a thread in the same way, starting from the scan the session index
+// points at rather than from the beginning of the file.
+//
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <math.h>
+
+#include "laser.h"
+#include "logfile.h"
+#include "stream.h"
+
+struct TStream_struct {
+  char host[256];
+  char port[16];
+  // The pipe, until the log is started on it with the first scan
+  FILE *pipe;
+  TLogWriter *log;
+  TLogRecord record;
+  // The geometry of the first scan, which is the log's
+  uint16_t startstep, cluster, count;
+  uint32_t nextSeq;
+  double theta;
+};
+typedef struct TStream_struct TStream;
+
+struct TJournal_struct {
+  TStream stream;
+  int fd;
+  int indexFd;
+  uint16_t indexHeaderSize;
+  uint32_t entries;
+  uint64_t offset;
+  double start, end;
+  int part, parts;
+};
+typedef struct TJournal_struct TJournal;
+
+
+//
+// IsStream
+//
+int IsStream(const char *name)
+{
+  return (strncmp(name, "tcp:", 4) == 0);
+}
+
+
+//
+// ReadFully
+//
+// Reads exactly length bytes from the socket. Returns -1 if the connection closed first.
+//
+static int ReadFully(int fd, void *buffer, size_t length)
+{
+  size_t done = 0;
+  ssize_t got;
+
+  while (done < length) {
+    got = recv(fd, (char *)buffer + done, length - done, 0);
+    if (got <= 0)
+      return -1;
+    done += got;
+  }
+  return 0;
+}
+
+
+//
+// SendMessage
+//
+static int SendMessage(int fd, uint16_t type, const void *payload, uint32_t length)
+{
+  char message[sizeof(struct pfs_header) + sizeof(struct pfs_hello)];
+  struct pfs_header header;
+
+  header.sync = PFS_SYNC;
+  header.type = type;
+  header.reserved = 0;
+  header.length = length;
+  header.seq = 0;
+  memcpy(message, &header, sizeof(header));
+  memcpy(message + sizeof(header), payload, length);
+  if (send(fd, message, sizeof(header) + length, MSG_NOSIGNAL) != (ssize_t)(sizeof(header) + length))
+    return -1;
+  return 0;
+}
+
+
+//
+// Connect
+//
+// Opens a TCP connection to the handheld. Returns the socket, or -1.
+//
+static int Connect(TStream *stream)
+{
+  struct addrinfo hints, *result, *address;
+  int fd = -1;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(stream->host, stream->port, &hints, &result) != 0)
+    return -1;
+  for (address = result; address != NULL; address = address->ai_next) {
+    fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (fd < 0)
+      continue;
+    if (connect(fd, address->ai_addr, address->ai_addrlen) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(result);
+  return fd;
+}
+
+
+//
+// WriteScan
+//
+// Writes one scan as an odometry and a laser record. The handheld has no wheel odometry, so the
+// odometry carries only the IMU heading. The log keeps the laser's own readings, as many as the
+// first scan has and where they look; a later scan that covers different steps is resampled to
+// them, and anything missing is reported as max range.
+//
+static void WriteScan(TStream *stream, struct pfj_scan *scan, uint16_t *range)
+{
+  int i, n;
+
+  if (stream->log == NULL) {
+    stream->startstep = scan->startstep;
+    stream->cluster = scan->cluster;
+    stream->count = scan->count;
+    stream->log = LogWriteTo(stream->pipe, DPB, scan->count, STREAM_ANGLE(scan->startstep),
+			     STREAM_ANGLE(STREAM_FRONT_STEP + scan->cluster), DPB_HEADING_ONLY);
+    stream->pipe = NULL;
+    if (stream->log == NULL)
+      return;
+  }
+
+  stream->record.type = LOG_ODOMETRY;
+  stream->record.x = 0.0;
+  stream->record.y = 0.0;
+  stream->record.theta = stream->theta;
+  LogWrite(stream->log, stream->record);
+
+  stream->record.type = LOG_LASER;
+  stream->record.count = stream->count;
+  for (i = 0; i < stream->count; i++) {
+    n = (int) floor((stream->startstep + i*stream->cluster - scan->startstep) / (double) scan->cluster + 0.5);
+    if ((n < 0) || (n >= scan->count) || (range[n] < 20))
+      stream->record.range[i] = MAX_SENSE_RANGE / MAP_SCALE;
+    else
+      stream->record.range[i] = range[n] / 1000.0;
+  }
+  LogWrite(stream->log, stream->record);
+  fflush(stream->log->file);
+}
+
+
+//
+// EndLog
+//
+// Finishes the log. One that never had a scan still gets its header, so it reads as an empty log.
+//
+static void EndLog(TStream *stream)
+{
+  if (stream->log == NULL)
+    stream->log = LogWriteTo(stream->pipe, DPB, 0, -M_PI/2, M_PI/180.0, DPB_HEADING_ONLY);
+  stream->pipe = NULL;
+  LogFinish(stream->log);
+  stream->log = NULL;
+}
+
+
+//
+// SetHeading
+//
+// The IMU's yaw is clockwise in degrees, SLAM wants counterclockwise radians in (-pi, pi]
+//
+static void SetHeading(TStream *stream, float yaw)
+{
+  stream->theta = -yaw * M_PI / 180.0;
+  while (stream->theta > M_PI)
+    stream->theta -= 2*M_PI;
+  while (stream->theta <= -M_PI)
+    stream->theta += 2*M_PI;
+}
+
+
+//
+// HandleRecord
+//
+static void HandleRecord(TStream *stream, char *payload, uint32_t length)
+{
+  struct pfj_record record;
+  struct pfj_scan scan;
+  struct pfj_imu imu;
+  uint16_t range[1024];
+
+  if (length < sizeof(record))
+    return;
+  memcpy(&record, payload, sizeof(record));
+  payload += sizeof(record);
+  length -= sizeof(record);
+
+  if ((record.type == PFJ_SCAN) && (length >= sizeof(scan))) {
+    memcpy(&scan, payload, sizeof(scan));
+    if ((scan.count > 1024) || (scan.cluster == 0) || (length < sizeof(scan) + scan.count*2))
+      return;
+    memcpy(range, payload + sizeof(scan), scan.count*2);
+    WriteScan(stream, &scan, range);
+  }
+  else if ((record.type == PFJ_IMU) && (length >= sizeof(imu))) {
+    memcpy(&imu, payload, sizeof(imu));
+    SetHeading(stream, imu.angle[0]);
+  }
+}
+
+
+//
+// Receive
+//
+// The receiver thread. Keeps (re)connecting until the handheld says the stream has ended.
+//
+static void *Receive(void *arg)
+{
+  TStream *stream = (TStream *) arg;
+  struct pfs_header header;
+  struct pfs_hello hello;
+  struct pfs_credit credit;
+  static char payload[65536];
+  uint32_t used;
+  int fd, ended = 0;
+
+  while (!ended) {
+    fd = Connect(stream);
+    if (fd < 0) {
+      sleep(STREAM_RETRY);
+      continue;
+    }
+    hello.resume = stream->nextSeq;
+    hello.credits = STREAM_WINDOW;
+    if (SendMessage(fd, PFS_HELLO, &hello, sizeof(hello)) != 0) {
+      close(fd);
+      continue;
+    }
+    fprintf(stderr, "Connected to %s:%s, resuming at record %u\n", stream->host, stream->port, stream->nextSeq);
+
+    used = 0;
+    while (ReadFully(fd, &header, sizeof(header)) == 0) {
+      if ((header.sync != PFS_SYNC) || (header.length > sizeof(payload)) ||
+	  (ReadFully(fd, payload, header.length) != 0))
+	break;
+      if (header.type == PFS_END) {
+	ended = 1;
+	break;
+      }
+      if ((header.type != PFS_RECORD) || (header.seq != stream->nextSeq))
+	continue;
+      HandleRecord(stream, payload, header.length);
+      stream->nextSeq++;
+      // Only grant more once the records have been handed to SLAM (the pipe write above blocks)
+      used++;
+      if (used >= STREAM_WINDOW/2) {
+	credit.credits = used;
+	if (SendMessage(fd, PFS_CREDIT, &credit, sizeof(credit)) != 0)
+	  break;
+	used = 0;
+      }
+    }
+    close(fd);
+    if (!ended) {
+      fprintf(stderr, "Lost the handheld at record %u, reconnecting.\n", stream->nextSeq);
+      sleep(STREAM_RETRY);
+    }
+  }
+
+  fprintf(stderr, "Handheld stream ended after %u records.\n", stream->nextSeq);
+  EndLog(stream);
+  return NULL;
+}
+
+
+//
+// StreamOpen
+//
+FILE *StreamOpen(const char *name)
+{
+  TStream *stream;
+  pthread_t thread;
+  const char *colon;
+  int fds[2];
+
+  colon = strrchr(name, ':');
+  if ((!IsStream(name)) || (colon == name + 3) || (colon - name - 4 >= 256))
+    return NULL;
+  stream = (TStream *) calloc(1, sizeof(TStream));
+  if (stream == NULL)
+    return NULL;
+  strncpy(stream->host, name + 4, colon - name - 4);
+  strncpy(stream->port, colon + 1, sizeof(stream->port) - 1);
+
+  // SLAM may stop reading before the stream ends; that must not kill the program
+  signal(SIGPIPE, SIG_IGN);
+  if (pipe(fds) != 0) {
+    free(stream);
+    return NULL;
+  }
+  stream->pipe = fdopen(fds[1], "w");
+  if (pthread_create(&thread, NULL, Receive, stream) != 0) {
+    fclose(stream->pipe);
+    close(fds[0]);
+    free(stream);
+    return NULL;
+  }
+  pthread_detach(thread);
+  return fdopen(fds[0], "r");
+}
+
+
+//
+// IsJournal
+//
+int IsJournal(const char *name)
+{
+  size_t length = strlen(name);
+
+  return ((length > 4) && (strcmp(name + length - 4, ".pfj") == 0));
+}
+
+
+//
+// ReadEntry
+//
+// Reads entry n of the session index. Returns -1 if there is no such entry.
+//
+static int ReadEntry(TJournal *journal, uint32_t n, struct pfx_entry *entry)
+{
+  if (n >= journal->entries)
+    return -1;
+  if (pread(journal->indexFd, entry, sizeof(*entry), journal->indexHeaderSize + (off_t)n * sizeof(*entry)) != sizeof(*entry))
+    return -1;
+  return 0;
+}
+
+
+//
+// OpenIndex
+//
+// Opens the .idx next to the journal, if there is one written for this session.
+//
+static void OpenIndex(TJournal *journal, const char *name, uint64_t created)
+{
+  char indexName[1024];
+  struct pfx_header header;
+  off_t size;
+
+  snprintf(indexName, sizeof(indexName), "%.*s.idx", (int) strlen(name) - 4, name);
+  journal->indexFd = open(indexName, O_RDONLY);
+  if (journal->indexFd < 0)
+    return;
+  size = lseek(journal->indexFd, 0, SEEK_END);
+  if ((pread(journal->indexFd, &header, sizeof(header), 0) != sizeof(header)) ||
+      (memcmp(header.magic, PFX_MAGIC, 4) != 0) || (header.created != created) ||
+      (header.headersize < sizeof(header)) || (size < header.headersize)) {
+    close(journal->indexFd);
+    journal->indexFd = -1;
+    return;
+  }
+  journal->indexHeaderSize = header.headersize;
+  journal->entries = (size - header.headersize) / sizeof(struct pfx_entry);
+}
+
+
+//
+// ReadRecord
+//
+// Reads the record at the journal's current offset, skipping forward to the next sync word over
+// damaged data. Returns the total record length (header included), or 0 at the end of the journal.
+//
+static uint32_t ReadRecord(TJournal *journal, char *buffer, size_t size)
+{
+  struct pfj_record record;
+
+  while (pread(journal->fd, &record, sizeof(record), journal->offset) == sizeof(record)) {
+    if ((record.sync == PFJ_SYNC) && (sizeof(record) + record.length <= size) &&
+	(pread(journal->fd, buffer, sizeof(record) + record.length, journal->offset) == (ssize_t)(sizeof(record) + record.length)))
+      return sizeof(record) + record.length;
+    if (record.sync == PFJ_SYNC)
+      return 0;
+    journal->offset++;
+  }
+  return 0;
+}
+
+
+//
+// FindStart
+//
+// Positions the journal at the first scan at or after the start of the window and works out the end
+// of the window, both as handheld clock times. With an index this is a binary search; without one
+// the journal is read from the beginning, keeping track of the heading as it goes. Returns -1 if the
+// journal has no scans.
+//
+static int FindStart(TJournal *journal, uint64_t *endTime)
+{
+  struct pfx_entry entry, last;
+  struct pfj_record record;
+  struct pfj_imu imu;
+  static char buffer[65536];
+  uint64_t first = 0, finish = 0, startTime;
+  uint64_t scanOffset = 0;
+  uint32_t low, high, middle, length;
+  float yaw = 0;
+  int found = 0;
+
+  if ((journal->indexFd >= 0) && (ReadEntry(journal, 0, &entry) == 0) &&
+      (ReadEntry(journal, journal->entries - 1, &last) == 0)) {
+    first = entry.timestamp;
+    finish = last.timestamp;
+  }
+  else {
+    // No index: one pass to find the extent of the session
+    if (journal->indexFd >= 0)
+      close(journal->indexFd);
+    journal->indexFd = -1;
+    fprintf(stderr, "No session index for this journal, reading it from the start.\n");
+    scanOffset = journal->offset;
+    while ((length = ReadRecord(journal, buffer, sizeof(buffer))) > 0) {
+      memcpy(&record, buffer, sizeof(record));
+      if (record.type == PFJ_SCAN) {
+	if (!found)
+	  first = record.timestamp;
+	finish = record.timestamp;
+	found = 1;
+      }
+      journal->offset += length;
+    }
+    journal->offset = scanOffset;
+    if (!found)
+      return -1;
+  }
+
+  if (journal->parts > 0) {
+    journal->start = (finish - first) * 1e-9 * journal->part / journal->parts;
+    journal->end = (finish - first) * 1e-9 * (journal->part + 1) / journal->parts;
+    // The last part must not lose the final scan to rounding
+    if (journal->part == journal->parts - 1)
+      journal->end = -1;
+  }
+  startTime = first + (uint64_t) (journal->start * 1e9);
+  *endTime = (journal->end < 0) ? UINT64_MAX : first + (uint64_t) (journal->end * 1e9);
+
+  if (journal->indexFd >= 0) {
+    low = 0;
+    high = journal->entries;
+    while (low < high) {
+      middle = low + (high - low)/2;
+      if ((ReadEntry(journal, middle, &entry) != 0) || (entry.timestamp >= startTime))
+	high = middle;
+      else
+	low = middle + 1;
+    }
+    if (ReadEntry(journal, low, &entry) != 0)
+      return -1;
+    journal->offset = entry.offset;
+    SetHeading(&journal->stream, entry.attitude[0]);
+    fprintf(stderr, "Starting at scan %u (index entry %u of %u)\n", entry.scan, low, journal->entries);
+    return 0;
+  }
+
+  // Without an index, walk forward to the first scan in the window
+  while ((length = ReadRecord(journal, buffer, sizeof(buffer))) > 0) {
+    memcpy(&record, buffer, sizeof(record));
+    if ((record.type == PFJ_IMU) && (record.length >= sizeof(imu))) {
+      memcpy(&imu, buffer + sizeof(record), sizeof(imu));
+      yaw = imu.angle[0];
+    }
+    else if ((record.type == PFJ_SCAN) && (record.timestamp >= startTime)) {
+      SetHeading(&journal->stream, yaw);
+      return 0;
+    }
+    journal->offset += length;
+  }
+  return -1;
+}
+
+
+//
+// Replay
+//
+// The journal thread. Converts every record from the start of the window up to the first scan past
+// its end, then closes the log. Windows include their start and exclude their end, so the parts of
+// a split session share no scans.
+//
+static void *Replay(void *arg)
+{
+  TJournal *journal = (TJournal *) arg;
+  struct pfj_record record;
+  static char buffer[65536];
+  uint64_t endTime;
+  uint32_t length, scans = 0;
+
+  if (FindStart(journal, &endTime) == 0) {
+    while ((length = ReadRecord(journal, buffer, sizeof(buffer))) > 0) {
+      memcpy(&record, buffer, sizeof(record));
+      if (record.type == PFJ_SCAN) {
+	if (record.timestamp >= endTime)
+	  break;
+	scans++;
+      }
+      HandleRecord(&journal->stream, buffer, length);
+      journal->offset += length;
+    }
+  }
+
+  fprintf(stderr, "Journal replay ended after %u scans.\n", scans);
+  EndLog(&journal->stream);
+  close(journal->fd);
+  if (journal->indexFd >= 0)
+    close(journal->indexFd);
+  free(journal);
+  return NULL;
+}
+
+
+//
+// JournalOpen
+//
+FILE *JournalOpen(const char *name, double start, double end, int part, int parts)
+{
+  TJournal *journal;
+  struct pfj_header header;
+  pthread_t thread;
+  int fds[2];
+
+  if ((!IsJournal(name)) || ((parts > 0) && ((part < 0) || (part >= parts))))
+    return NULL;
+  journal = (TJournal *) calloc(1, sizeof(TJournal));
+  if (journal == NULL)
+    return NULL;
+  journal->indexFd = -1;
+  journal->start = (start < 0) ? 0 : start;
+  journal->end = end;
+  journal->part = part;
+  journal->parts = parts;
+  journal->fd = open(name, O_RDONLY);
+  if ((journal->fd < 0) || (pread(journal->fd, &header, sizeof(header), 0) != sizeof(header)) ||
+      (memcmp(header.magic, PFJ_MAGIC, 4) != 0) || (header.headersize < sizeof(header))) {
+    if (journal->fd >= 0)
+      close(journal->fd);
+    free(journal);
+    return NULL;
+  }
+  journal->offset = header.headersize;
+  OpenIndex(journal, name, header.created);
+
+  signal(SIGPIPE, SIG_IGN);
+  if (pipe(fds) != 0) {
+    close(journal->fd);
+    if (journal->indexFd >= 0)
+      close(journal->indexFd);
+    free(journal);
+    return NULL;
+  }
+  journal->stream.pipe = fdopen(fds[1], "w");
+  if (pthread_create(&thread, NULL, Replay, journal) != 0) {
+    fclose(journal->stream.pipe);
+    close(fds[0]);
+    close(journal->fd);
+    if (journal->indexFd >= 0)
+      close(journal->indexFd);
+    free(journal);
+    return NULL;
+  }
+  pthread_detach(thread);
+  return fdopen(fds[0], "r");
+}
@@ -0,0 +1,129 @@
+//
+// stream.h
+//
+// Live input from the Pre-Fire Mapping handheld. Instead of a log file, PLAYBACK can name the
+// handheld as "tcp:host:port". StreamOpen connects to it and returns a FILE that reads exactly like
+// a .dpb log file, so ReadLog and the rest of the SLAM code do not need to know the difference. The
+// log has the laser's own readings (741 of them, a third of a degree apart, for the handheld's
+// URG-04LX).
+//
+// The handheld has no wheel odometry, so the log's odometry has the IMU heading and no position,
+// and its header says so (DPB_HEADING_ONLY). LowSlam normally skips readings taken before the robot
+// has moved a few centimeters or turned a little, which would leave only the turns; for such a log
+// it uses every reading instead.
+//
+// PLAYBACK can also name a journal (.pfj) copied off the handheld. JournalOpen replays it the same
+// way, but can start and stop at any time in the session: the session index (.idx) next to the
+// journal finds the first scan of the window with a binary search, so a corridor in the middle of a
+// long session is ready in milliseconds, and one session can be split between several processes.
+//
+// The message layout below must match CodeBase/RemoteCode/stream.h and storage.h on the handheld.
+//
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define PFS_SYNC 0x7E534650
+#define PFS_HELLO 1
+#define PFS_CREDIT 2
+#define PFS_RECORD 3
+#define PFS_IDLE 4
+#define PFS_END 5
+
+#define PFJ_MAGIC "PFJ1"
+#define PFJ_SYNC 0x7E4A4650
+#define PFJ_SCAN 1
+#define PFJ_IMU 2
+#define PFX_MAGIC "PFX1"
+
+// The number of records the handheld may send before we hand out more credit. When SLAM falls
+// behind, the pipe to ReadLog fills, we stop granting credit and the handheld stops sending; 
+// what it could not send is replayed later from its flash journal.
+#define STREAM_WINDOW 64
+// Seconds to wait before trying to reconnect to the handheld
+#define STREAM_RETRY 1
+
+// URG-04LX geometry: the step that looks straight ahead, and the steps in a full turn. Steps count
+// counterclockwise, so STREAM_ANGLE is the angle a step looks at, from the robot's facing.
+#define STREAM_FRONT_STEP 384
+#define STREAM_STEPS_PER_REV 1024
+#define STREAM_ANGLE(step) (((step) - STREAM_FRONT_STEP) * 2*M_PI / STREAM_STEPS_PER_REV)
+
+struct pfs_header {
+  uint32_t sync;
+  uint16_t type;
+  uint16_t reserved;
+  uint32_t length;
+  uint32_t seq;
+} __attribute__((packed));
+
+struct pfs_hello {
+  uint32_t resume;
+  uint32_t credits;
+} __attribute__((packed));
+
+struct pfs_credit {
+  uint32_t credits;
+} __attribute__((packed));
+
+struct pfj_header {
+  char magic[4];
+  uint16_t version;
+  uint16_t headersize;
+  uint64_t created;
+} __attribute__((packed));
+
+struct pfj_record {
+  uint32_t sync;
+  uint16_t type;
+  uint16_t reserved;
+  uint32_t length;
+  uint32_t seq;
+  uint64_t timestamp;
+} __attribute__((packed));
+
+struct pfj_scan {
+  uint32_t sensor_time;
+  uint16_t startstep;
+  uint16_t endstep;
+  uint16_t cluster;
+  uint16_t count;
+} __attribute__((packed));
+
+struct pfj_imu {
+  uint16_t channels;
+  uint16_t reserved;
+  float angle[3];
+  float rate[3];
+  float mag[3];
+  float gyro[3];
+  float accel[3];
+} __attribute__((packed));
+
+struct pfx_header {
+  char magic[4];
+  uint16_t version;
+  uint16_t headersize;
+  uint64_t created;
+} __attribute__((packed));
+
+struct pfx_entry {
+  uint64_t timestamp;
+  uint64_t offset;
+  uint32_t record;
+  uint32_t scan;
+  float attitude[3];
+} __attribute__((packed));
+
+// Returns TRUE if a PLAYBACK name refers to a live stream rather than a file.
+int IsStream(const char *name);
+// Connects to "tcp:host:port" in the background and returns the read end of the log it produces.
+// The log ends (EOF) when the handheld reports that capture has stopped.
+FILE *StreamOpen(const char *name);
+
+// Returns TRUE if a PLAYBACK name refers to a handheld journal (.pfj).
+int IsJournal(const char *name);
+// Replays the scans of a journal between start and end seconds into the session (end < 0 for the
+// rest of it) and returns the read end of the log it produces. If parts > 0, the window is instead
+// the part'th (from 0) of parts equal slices of the session.
+FILE *JournalOpen(const char *name, double start, double end, int part, int parts);
@@ -0,0 +1,132 @@
+//
+// workers.c
+//
+// Threads to score samples on. See workers.h.
+//
+// The workers sleep on a condition until WorkersRun gives them a job, which is told apart from the
+// last one by its number. Each thread takes WORKERS_CHUNK items at a time until there are none
+// left, and the last one to finish wakes WorkersRun.
+//
+
+#include <unistd.h>
+
+#include "ThisRobot.h"
+#include "workers.h"
+
+int WORKER_THREADS = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t started = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t finished = PTHREAD_COND_INITIALIZER;
+static pthread_t worker[WORKERS_MAX];
+static int workers = 0, stop = 0;
+
+// The job: what to call, on what, and how far through the items it has got
+static void (*job)(int item, void *arg);
+static void *jobArg;
+static int jobNumber = 0, jobCount, jobNext, jobBusy;
+
+
+//
+// Work
+//
+// Takes items from the job until there are none left. Called with the lock held, and returns with it held.
+//
+static void Work()
+{
+  int first, last, i;
+
+  while (jobNext < jobCount) {
+    first = jobNext;
+    last = MIN(first + WORKERS_CHUNK, jobCount);
+    jobNext = last;
+    pthread_mutex_unlock(&lock);
+    for (i = first; i < last; i++)
+      job(i, jobArg);
+    pthread_mutex_lock(&lock);
+  }
+}
+
+
+//
+// Worker
+//
+// A worker thread. Joins in each job as it comes.
+//
+static void *Worker(void *arg)
+{
+  int done = 0;
+
+  pthread_mutex_lock(&lock);
+  for (;;) {
+    while ((!stop) && (jobNumber == done))
+      pthread_cond_wait(&started, &lock);
+    if (stop)
+      break;
+    done = jobNumber;
+    jobBusy++;
+    Work();
+    jobBusy--;
+    if ((jobBusy == 0) && (jobNext >= jobCount))
+      pthread_cond_signal(&finished);
+  }
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+
+int WorkersStart()
+{
+  int threads = WORKER_THREADS;
+
+  if (threads <= 0)
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  threads = MAX(1, MIN(threads, WORKERS_MAX));
+
+  stop = 0;
+  for (workers = 0; workers < threads-1; workers++)
+    if (pthread_create(&worker[workers], NULL, Worker, NULL) != 0)
+      break;
+  return workers + 1;
+}
+
+
+void WorkersRun(void (*work)(int item, void *arg), void *arg, int count)
+{
+  int i;
+
+  // With no workers, there is no need to take the lock
+  if (workers == 0) {
+    for (i = 0; i < count; i++)
+      work(i, arg);
+    return;
+  }
+
+  pthread_mutex_lock(&lock);
+  job = work;
+  jobArg = arg;
+  jobCount = count;
+  jobNext = 0;
+  jobNumber++;
+  pthread_cond_broadcast(&started);
+  jobBusy++;
+  Work();
+  jobBusy--;
+  while (jobBusy > 0)
+    pthread_cond_wait(&finished, &lock);
+  pthread_mutex_unlock(&lock);
+}
+
+
+void WorkersStop()
+{
+  int i;
+
+  pthread_mutex_lock(&lock);
+  stop = 1;
+  pthread_cond_broadcast(&started);
+  pthread_mutex_unlock(&lock);
+  for (i = 0; i < workers; i++)
+    pthread_join(worker[i], NULL);
+  workers = 0;
+}
@@ -0,0 +1,33 @@
+//
+// workers.h
+//
+// Threads to score samples on. Nearly all of the time in a run goes to Localize (low.c) scoring
+// each sample against the scan, and each sample's score depends only on its own pose, its
+// parent's map and the scan, so the samples of each pass are shared out among the SLAM thread and
+// the workers. WorkersRun hands them out a few at a time, so a thread that gets cheap samples
+// (ones already culled) takes more of them, and only returns once every one is done; that is the
+// barrier at the end of each pass, before the best sample is found and the rest culled.
+//
+// Since every sample is scored by exactly the same arithmetic whichever thread scores it, and the
+// best is found afterwards in order by the SLAM thread, the results are the same for any number of
+// threads. The observation cache, which the scoring fills in as it goes, is built one square at a
+// time under a lock (see LowBuildObservation), and what goes in it does not depend on the order.
+//
+// Include after ThisRobot.h.
+//
+
+#include <pthread.h>
+
+// The most threads, and how many items a thread takes at a time
+#define WORKERS_MAX 64
+#define WORKERS_CHUNK 4
+
+// The number of threads to score on, the SLAM thread included, or 0 for one per core. Set with -w.
+extern int WORKER_THREADS;
+
+// Starts the workers. Returns the number of threads scoring, the SLAM thread included.
+int WorkersStart();
+// Calls work(item, arg) for every item from 0 to count-1, spread over the threads, and returns
+// when all of them are done. Each call must only write what belongs to its own item.
+void WorkersRun(void (*work)(int item, void *arg), void *arg, int count);
+void WorkersStop();